@@ -0,0 +1,111 @@
+/* Reads a console log containing "trace:" lines, as written by
+ *  PackosTraceDump(), and writes the events as a Chrome trace
+ *  (load it in chrome://tracing or Perfetto).  Each context is a
+ *  thread, named by the low 32 bits of its address; it is shown as
+ *  running from the yield that switched to it until the one that
+ *  switched away.
+ *
+ * Usage: trace-decode [cpu-MHz] <console.log >trace.json
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  unsigned int quads[4];
+} Addr;
+
+static int parseAddr(const char* str, Addr* addr)
+{
+  return (sscanf(str,"%x:%x:%x:%x",
+                 addr->quads,addr->quads+1,addr->quads+2,addr->quads+3)
+          ==4)
+    ? 0
+    : -1;
+}
+
+static void printAddr(const Addr* addr)
+{
+  printf("\"%x:%x:%x:%x\"",
+         addr->quads[0],addr->quads[1],addr->quads[2],addr->quads[3]);
+}
+
+int main(int argc, char* argv[])
+{
+  char line[512];
+  double mhz=1000.0;
+  unsigned long long firstTsc=0;
+  int haveFirst=0;
+
+  if (argc>2)
+    {
+      fprintf(stderr,"usage: %s [cpu-MHz] <console.log >trace.json\n",
+              argv[0]);
+      return 1;
+    }
+
+  if (argc==2)
+    {
+      mhz=atof(argv[1]);
+      if (mhz<=0)
+        {
+          fprintf(stderr,"%s: bad MHz: %s\n",argv[0],argv[1]);
+          return 1;
+        }
+    }
+
+  printf("{\"traceEvents\":[\n");
+  while (fgets(line,sizeof(line),stdin))
+    {
+      unsigned int seq,tscHi,tscLo,depth;
+      char event[16],contextStr[40],srcStr[40],destStr[40];
+      const char* start=strstr(line,"trace: ");
+      unsigned long long tsc;
+      Addr context,src,dest;
+      double ts;
+
+      if (!start) continue;
+      if (sscanf(start,"trace: %u %15s %x %x %u %39s %39s %39s",
+                 &seq,event,&tscHi,&tscLo,&depth,
+                 contextStr,srcStr,destStr)
+          !=8)
+        continue;
+      if ((parseAddr(contextStr,&context)<0)
+          || (parseAddr(srcStr,&src)<0)
+          || (parseAddr(destStr,&dest)<0)
+          )
+        continue;
+
+      tsc=(((unsigned long long)tscHi)<<32)|tscLo;
+      if (!haveFirst)
+        {
+          firstTsc=tsc;
+          haveFirst=1;
+        }
+      ts=((double)(tsc-firstTsc))/mhz;
+
+      if (!strcmp(event,"yield"))
+        {
+          printf(" {\"name\":\"run\",\"ph\":\"E\",\"pid\":0,\"tid\":%u,\"ts\":%.3f},\n",
+                 src.quads[3],ts);
+          printf(" {\"name\":\"run\",\"ph\":\"B\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}",
+                 dest.quads[3],ts);
+        }
+      else
+        {
+          printf(" {\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,"
+                 "\"args\":{\"seq\":%u,\"queueDepth\":%u,\"src\":",
+                 event,context.quads[3],ts,seq,depth);
+          printAddr(&src);
+          printf(",\"dest\":");
+          printAddr(&dest);
+          printf("}}");
+        }
+
+      printf(",\n");
+    }
+
+  printf(" {\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":0}\n");
+  printf("]}\n");
+  return 0;
+}
@@ -1,27 +1,166 @@
 #include <packos/checksums.h>
 #include <packos/arch.h>
 
-static uint32_t sumRange(void* base,
-                         uint32_t count,
-                         bool swab)
+/* Sums are taken a 32-bit word at a time into 64 bits, in the CPU's
+ *  own byte order, and only folded and swapped at the end; the
+ *  ones'-complement sum doesn't care about byte order (RFC 1071),
+ *  so long as it's consistent.
+ */
+static uint16_t fold(uint64_t sum)
 {
-  uint16_t* p=(uint16_t*)base;
-  uint32_t res=0;
-  int numWords=count/2;
-  while (numWords>0)
+  uint32_t res;
+
+  sum=(sum&0xffffffff)+(sum>>32);
+  sum=(sum&0xffffffff)+(sum>>32);
+  res=(uint32_t)sum;
+  res=(res&0xffff)+(res>>16);
+  res=(res&0xffff)+(res>>16);
+  return (uint16_t)res;
+}
+
+/* The trailing bytes: fewer than 4 of them. */
+static uint64_t sumTail(const byte* p,
+                        uint32_t count)
+{
+  uint64_t res=0;
+
+  if (count>=2)
     {
-      uint16_t x=p[--numWords];
-      if (swab) x=ntohs(x);
+      res+=*((const uint16_t*)p);
+      p+=2;
+      count-=2;
+    }
+
+  if (count)
+    {
+      uint16_t x=0;
+      *((byte*)(&x))=*p;
       res+=x;
     }
-  if (count&1)
+
+  return res;
+}
+
+uint16_t PackosChecksumPartial(const void* base,
+                               uint32_t count)
+{
+  const uint32_t* p=(const uint32_t*)base;
+  uint64_t sum=0;
+
+  while (count>=32)
+    {
+      sum+=p[0];
+      sum+=p[1];
+      sum+=p[2];
+      sum+=p[3];
+      sum+=p[4];
+      sum+=p[5];
+      sum+=p[6];
+      sum+=p[7];
+      p+=8;
+      count-=32;
+    }
+
+  while (count>=4)
     {
-      uint16_t x=(((byte*)base)[count-1]);
-      res+=(x<<8);
+      sum+=*(p++);
+      count-=4;
     }
+
+  sum+=sumTail((const byte*)p,count);
+  return ntohs(fold(sum));
+}
+
+uint16_t PackosChecksumCopy(void* dest,
+                            const void* src,
+                            uint32_t count)
+{
+  const uint32_t* p=(const uint32_t*)src;
+  uint32_t* q=(uint32_t*)dest;
+  uint64_t sum=0;
+
+  while (count>=32)
+    {
+      uint32_t a=p[0],b=p[1],c=p[2],d=p[3];
+      uint32_t e=p[4],f=p[5],g=p[6],h=p[7];
+      q[0]=a; q[1]=b; q[2]=c; q[3]=d;
+      q[4]=e; q[5]=f; q[6]=g; q[7]=h;
+      sum+=a;
+      sum+=b;
+      sum+=c;
+      sum+=d;
+      sum+=e;
+      sum+=f;
+      sum+=g;
+      sum+=h;
+      p+=8;
+      q+=8;
+      count-=32;
+    }
+
+  while (count>=4)
+    {
+      uint32_t a=*(p++);
+      *(q++)=a;
+      sum+=a;
+      count-=4;
+    }
+
+  {
+    const byte* pb=(const byte*)p;
+    byte* qb=(byte*)q;
+    uint32_t i;
+    for (i=0; i<count; i++)
+      qb[i]=pb[i];
+    sum+=sumTail(pb,count);
+  }
+
+  return ntohs(fold(sum));
+}
+
+uint16_t PackosChecksumAdd(uint16_t a, uint16_t b)
+{
+  return fold(((uint32_t)a)+b);
+}
+
+uint16_t PackosChecksumSwap(uint16_t sum)
+{
+  return (uint16_t)((sum<<8)|(sum>>8));
+}
+
+uint16_t PackosChecksumUpdate16(uint16_t checksum,
+                                uint16_t oldValue,
+                                uint16_t newValue)
+{
+  /* HC' = ~(~HC + ~m + m') */
+  uint32_t sum=((uint16_t)~checksum);
+  sum+=((uint16_t)~oldValue);
+  sum+=newValue;
+  return (uint16_t)~fold(sum);
+}
+
+/* The pseudo-header: both addresses, the upper-layer length and the
+ *  protocol.
+ */
+static uint32_t pseudoHeader(PackosPacket* packet,
+                             uint32_t len,
+                             byte protocol)
+{
+  uint32_t res=PackosChecksumPartial(&(packet->ipv6.src),32);
+  res+=len>>16;
+  res+=len&0xffff;
+  res+=protocol;
   return res;
 }
 
+/* The length of the upper-layer packet starting at header. */
+static int upperLayerLen(PackosPacket* packet,
+                         void* header)
+{
+  return (packet->ipv6.payloadLength
+          -(((byte*)header)-(packet->ipv6.dataAndHeaders)));
+}
+
 int UdpChecksum(PackosPacket* packet,
                 IpHeader* udp,
                 PackosError* error)
@@ -40,32 +179,26 @@ int UdpChecksum(PackosPacket* packet,
       return -1;
     }
 
-  res=sumRange(&(packet->ipv6.src),32,true);
-  res+=udp->u.udp->length;
-  res+=ipHeaderTypeUDP;
+  res=pseudoHeader(packet,udp->u.udp->length,ipHeaderTypeUDP);
 
   res+=udp->u.udp->sourcePort;
   res+=udp->u.udp->destPort;
   res+=udp->u.udp->length;
 
-  res+=sumRange(((byte*)(udp->u.udp))+sizeof(IpHeaderUDP),
-                udp->u.udp->length-sizeof(IpHeaderUDP),
-                true);
-  while (res>>16)
-    res=(res&0xffff)+(res>>16);
+  res+=PackosChecksumPartial(((byte*)(udp->u.udp))+sizeof(IpHeaderUDP),
+                             udp->u.udp->length-sizeof(IpHeaderUDP));
 
   *error=packosErrorNone;
-  return (~res)&0xffff;
+  return (~fold(res))&0xffff;
 }
 
-uint16_t IcmpChecksum(PackosPacket* packet,
-                      IpHeader* icmp,
-                      PackosError* error)
+uint16_t IcmpChecksumWithData(PackosPacket* packet,
+                              IpHeader* icmp,
+                              uint16_t dataSum,
+                              PackosError* error)
 {
   uint32_t sum;
-  uint32_t len=packet->ipv6.payloadLength;
-
-  *error=packosErrorNone;
+  int len;
 
   if (!(packet && icmp && (icmp->kind==ipHeaderTypeICMP)))
     {
@@ -73,9 +206,14 @@ uint16_t IcmpChecksum(PackosPacket* packet,
       return -1;
     }
 
-  sum=sumRange(&(packet->ipv6.src),32,true);
-  sum+=len;
-  sum+=58;
+  len=upperLayerLen(packet,icmp->u.icmp);
+  if (len<8)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  sum=pseudoHeader(packet,len,ipHeaderTypeICMP);
   sum+=((uint32_t)(icmp->u.icmp->type)<<8);
   sum+=icmp->u.icmp->code;
 
@@ -101,20 +239,44 @@ uint16_t IcmpChecksum(PackosPacket* packet,
       break;
     }
 
-  sum+=sumRange(((byte*)icmp->u.icmp)+8,len-8,true);
-
-  while (sum>>16)
-    sum=(sum&0xffff)+(sum>>16);
+  sum+=dataSum;
 
   *error=packosErrorNone;
-  return (~sum)&0xffff;
+  return (~fold(sum))&0xffff;
 }
 
-int TcpChecksum(PackosPacket* packet,
-                IpHeader* tcp,
-                PackosError* error)
+uint16_t IcmpChecksum(PackosPacket* packet,
+                      IpHeader* icmp,
+                      PackosError* error)
+{
+  int len;
+
+  if (!(packet && icmp && (icmp->kind==ipHeaderTypeICMP)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  len=upperLayerLen(packet,icmp->u.icmp);
+  if (len<8)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  return IcmpChecksumWithData(packet,icmp,
+                              PackosChecksumPartial(((byte*)icmp->u.icmp)+8,
+                                                    len-8),
+                              error);
+}
+
+int TcpChecksumWithData(PackosPacket* packet,
+                        IpHeader* tcp,
+                        uint16_t dataSum,
+                        PackosError* error)
 {
   uint32_t res;
+  int len,headerLen;
 
   if (!(packet && tcp && (tcp->kind==ipHeaderTypeTCP)))
     {
@@ -122,9 +284,15 @@ int TcpChecksum(PackosPacket* packet,
       return -1;
     }
 
-  res=sumRange(&(packet->ipv6.src),32,true);
-  res+=packet->ipv6.payloadLength;
-  res+=ipHeaderTypeTCP;
+  len=upperLayerLen(packet,tcp->u.tcp);
+  headerLen=((tcp->u.tcp->dataOffsetAndFlags)>>12)*4;
+  if ((headerLen<(int)sizeof(IpHeaderTCP)) || (len<headerLen))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  res=pseudoHeader(packet,len,ipHeaderTypeTCP);
 
   res+=tcp->u.tcp->sourcePort;
   res+=tcp->u.tcp->destPort;
@@ -134,17 +302,41 @@ int TcpChecksum(PackosPacket* packet,
   res+=(tcp->u.tcp->ackNumber&0xffff);
   res+=tcp->u.tcp->dataOffsetAndFlags;
   res+=tcp->u.tcp->window;
-  res+=tcp->u.tcp->checksum;
   res+=tcp->u.tcp->urgent;
 
-  res+=sumRange(((byte*)(tcp->u.tcp))+sizeof(IpHeaderTCP),
-                packet->ipv6.payloadLength-sizeof(IpHeaderTCP),
-                true);
-  res-=tcp->u.tcp->checksum;
+  /* Options */
+  res+=PackosChecksumPartial(((byte*)(tcp->u.tcp))+sizeof(IpHeaderTCP),
+                             headerLen-sizeof(IpHeaderTCP));
 
-  while (res>>16)
-    res=(res&0xffff)+(res>>16);
+  res+=dataSum;
 
   *error=packosErrorNone;
-  return (~res)&0xffff;
+  return (~fold(res))&0xffff;
+}
+
+int TcpChecksum(PackosPacket* packet,
+                IpHeader* tcp,
+                PackosError* error)
+{
+  int len,headerLen;
+
+  if (!(packet && tcp && (tcp->kind==ipHeaderTypeTCP)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  len=upperLayerLen(packet,tcp->u.tcp);
+  headerLen=((tcp->u.tcp->dataOffsetAndFlags)>>12)*4;
+  if ((headerLen<(int)sizeof(IpHeaderTCP)) || (len<headerLen))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  return TcpChecksumWithData(packet,tcp,
+                             PackosChecksumPartial(((byte*)(tcp->u.tcp))
+                                                   +headerLen,
+                                                   len-headerLen),
+                             error);
 }
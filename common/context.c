@@ -115,10 +115,24 @@ static void wrapper(void)
 PackosContext PackosContextNew(PackosContextFunc func,
                                const char* name,
                                PackosError* error)
+{
+  return PackosContextNewWithQueueLen(func,name,PACKOS_PACKET_QUEUE_LEN,error);
+}
+
+PackosContext PackosContextNewWithQueueLen(PackosContextFunc func,
+                                           const char* name,
+                                           unsigned int queueLen,
+                                           PackosError* error)
 {
   extern PackosContext currentContext;
   if (!error) return 0;
 
+  if (!(queueLen && (queueLen<=PACKOS_PACKET_QUEUE_MAXLEN)))
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
   bool resIsScheduler=(!currentContext);
 
   PackosContext res=poolAlloc(error);
@@ -331,16 +345,46 @@ PackosContext PackosContextNew(PackosContextFunc func,
   res->os.config->state=&(res->os.config->stateConst);
   res->os.config->state->ifaceRegistry=0;
   res->os.queue.offset=res->os.queue.numPackets=0;
+  res->os.queue.packets=res->os.queue.inlinePackets;
+  res->os.queue.size=res->os.queue.capacity=PACKOS_PACKET_QUEUE_LEN;
+  res->os.queue.lowWater=PACKOS_PACKET_QUEUE_LEN/2;
+  res->os.queue.physical=0;
+  res->os.queue.firstWaiter=0;
+  res->os.waitingOn=res->os.nextWaiter=0;
+  res->os.nextWoken=0;
+  res->os.isWoken=false;
+  res->os.priority=0;
+  {
+    int i;
+    for (i=0; i<PACKOS_CONTEXT_QUEUE_MAX_LINKS; i++)
+      res->os.queueLinks[i].queue=0;
+  }
+  res->os.packetCache.numPackets=0;
+  res->os.packetCache.stats.hits=res->os.packetCache.stats.misses=0;
+  res->os.packetCache.stats.refills=res->os.packetCache.stats.drains=0;
 
   {
     uint16_t cpl;
     asm("movw %%cs, %0": "=m"(cpl));
     cpl&=3;
 
+    if ((queueLen!=PACKOS_PACKET_QUEUE_LEN)
+        && (PackosKernelContextSetQueueLen(res,queueLen,error)<0)
+        )
+      {
+        PackosError tmp;
+        PackosMemoryLogicalRangeFree(res->os.configLogical,res,&tmp);
+        PackosMemoryPhysicalRangeFree(res->os.configPhysical,&tmp);
+        poolFree(res,&tmp);
+        return 0;
+      }
+
     if (PackosPacketRegisterContext(res,error)<0)
       {
         PackosError tmp;
         if (false) kprintf("PackosContextNew(): PackosPacketRegisterContext(): %s\n",PackosErrorToString(*error));
+        if (res->os.queue.physical)
+          PackosMemoryPhysicalRangeFree(res->os.queue.physical,&tmp);
         PackosMemoryLogicalRangeFree(res->os.configLogical,res,&tmp);
         PackosMemoryPhysicalRangeFree(res->os.configPhysical,&tmp);
         poolFree(res,&tmp);
@@ -397,6 +441,20 @@ PackosAddress PackosContextGetAddr(PackosContext context,
   return context->os.config->addresses.self;
 }
 
+int PackosContextSetQueueLen(PackosContext context,
+                             unsigned int queueLen,
+                             PackosError* error)
+{
+  if (!error) return -2;
+  if (!PackosKernelContextMayActFor(context))
+    {
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
+    }
+
+  return PackosKernelContextSetQueueLen(context,queueLen,error);
+}
+
 int PackosContextSetMetadata(PackosContext context,
                              void* metadata,
                              PackosError* error)
@@ -205,7 +205,7 @@ bool PackosAddrIsZero(PackosAddress a)
 
 bool PackosAddrIsMcast(PackosAddress a)
 {
-  return (a.octs[0]==255);
+  return (a.bytes[0]==0xff);
 }
 
 PackosAddress PackosPacketGetKernelAddr(PackosError* error)
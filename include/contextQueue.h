@@ -3,6 +3,10 @@
 
 #include <packos/context.h>
 
+/* Queues are intrusive: a context can be in at most
+ *  PACKOS_CONTEXT_QUEUE_MAX_LINKS of them at once, and at most once in
+ *  each.  All operations but ForEach and Find are O(1).
+ */
 typedef struct PackosContextQueue* PackosContextQueue;
 
 typedef int (*PackosContextOp)(PackosContext context,
@@ -38,5 +42,8 @@ int PackosContextQueueLen(PackosContextQueue queue,
                           PackosError* error);
 bool PackosContextQueueEmpty(PackosContextQueue queue,
                              PackosError* error);
+bool PackosContextQueueContains(PackosContextQueue queue,
+                                PackosContext context,
+                                PackosError* error);
 
 #endif /*_PACKOS_CONTEXTQUEUE_H_*/
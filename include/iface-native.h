@@ -11,5 +11,12 @@ int IpIfaceNativeSetNextYieldTo(IpIface iface,
 int IpIfaceNativeSetYieldToRecipient(IpIface iface,
                                      bool yieldToRecipient,
                                      PackosError* error);
+/* If set, sends to a context whose queue is full block until it
+ *  drains, instead of failing.  Off by default; never set it in the
+ *  scheduler.
+ */
+int IpIfaceNativeSetWaitWhenFull(IpIface iface,
+                                 bool waitWhenFull,
+                                 PackosError* error);
 
 #endif /*_IFACE_NATIVE_H_*/
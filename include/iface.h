@@ -12,6 +12,13 @@ typedef PackosPacket* (*IpIfaceReceiveMethod)
      (IpIface iface, PackosError* error);
 typedef int (*IpIfaceCloseMethod)
      (IpIface iface, PackosError* error);
+typedef int (*IpIfaceMcastMethod)
+     (IpIface iface, PackosAddress group, PackosError* error);
+/* Sends packet and waits for the first packet back from where it
+ *  went, which is then the next one receive hands out.
+ */
+typedef int (*IpIfaceCallMethod)
+     (IpIface iface, PackosPacket* packet, PackosError* error);
 
 typedef struct TcpIfaceContext* TcpIfaceContext;
 
@@ -19,6 +26,9 @@ struct IpIface {
   IpIfaceSendMethod send;
   IpIfaceReceiveMethod receive;
   IpIfaceCloseMethod close;
+  IpIfaceMcastMethod mcastJoin; /* NULL if the iface can't multicast */
+  IpIfaceMcastMethod mcastLeave;
+  IpIfaceCallMethod call; /* NULL if the iface can't; send is used */
   void* context;
 
   PackosAddress addr;
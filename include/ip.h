@@ -91,6 +91,40 @@ byte* IpHeaderGetNextPos(IpHeader* header,
                          PackosError* error);
 int IpHeaderTypeOrder(IpHeaderType type, PackosError* error);
 
+/* What IpPacketGetInfo() found in a packet's header chain: where each
+ *  header starts, relative to ipv6.dataAndHeaders, the upper-layer
+ *  protocol, and where the data starts; also which byte order the
+ *  packet is in.  Kept in the packet page's tailroom, so it travels
+ *  with the packet.  It's filled in when a packet is received, kept up
+ *  to date by IpHeaderAppend(), and otherwise parsed the first time
+ *  it's asked for.
+ */
+#define IP_PACKET_MAX_HEADERS 8
+
+typedef struct {
+  uint16_t offset;
+  IpHeader header; /* header.u is only good until the packet is copied */
+} IpPacketHeaderSlot;
+
+typedef struct {
+  byte valid;
+  byte firstKind; /* ipv6.nextHeader, when parsed */
+  byte protocol;
+  byte numHeaders;
+  byte networkOrder;
+  byte unknown; /* the chain runs into a header type we don't know */
+  uint16_t dataOffset;
+  IpPacketHeaderSlot headers[IP_PACKET_MAX_HEADERS];
+} IpPacketInfo;
+
+IpPacketInfo* IpPacketGetInfo(PackosPacket* packet,
+                              PackosError* error);
+
+/* The i'th header in the chain, or 0 with packosErrorDoesNotExist. */
+IpHeader* IpPacketGetHeader(PackosPacket* packet,
+                            unsigned int i,
+                            PackosError* error);
+
 typedef struct IpHeaderIterator* IpHeaderIterator;
 
 IpHeaderIterator IpHeaderIteratorNew(PackosPacket* packet,
@@ -151,15 +185,52 @@ PackosPacket* IpReceiveOn(IpIface iface,
                           PackosError* error);
 
 int IpSend(PackosPacket* packet, PackosError* error);
+
+/* As IpSendOn() and IpSend(), but where the interface can, waits for
+ *  the first packet back from where this one went, so that the next
+ *  receive on the interface returns it without going through the
+ *  scheduler.  For request/reply exchanges with a local server.
+ */
+int IpCallOn(IpIface iface, PackosPacket* packet, PackosError* error);
+int IpCall(PackosPacket* packet, PackosError* error);
 PackosPacket* IpReceive(byte protocolExpected, /* 0 is wildcard */
                         IpHeaderRouting0** routingHeader,
                         IpIface* ifaceReceivedOn,
                         bool stopWhenReceiveOtherPacket,
                         PackosError* error);
 
+/* Received packets are left in network order until something needs
+ *  to look inside them: IpReceiveOn() and IpReceive() hand them back in
+ *  host order, but filters see them as they came, so that a packet
+ *  that's only forwarded is never converted.  Both conversions do
+ *  nothing if the packet's already in the order asked for.
+ */
 int IpPacketFromNetworkOrder(PackosPacket* packet,
                              PackosError* error);
 int IpPacketToNetworkOrder(PackosPacket* packet,
                            PackosError* error);
+bool IpPacketIsNetworkOrder(PackosPacket* packet,
+                            PackosError* error);
+
+/* Notes that packet has just come in, in network order, and parses its
+ *  headers without converting them.
+ */
+int IpPacketMarkNetworkOrder(PackosPacket* packet,
+                             PackosError* error);
+
+/* These work in either byte order. */
+uint16_t IpPacketGetPayloadLength(PackosPacket* packet,
+                                  PackosError* error);
+int IpPacketSetPayloadLength(PackosPacket* packet,
+                             uint16_t payloadLength,
+                             PackosError* error);
+
+/* The ports of a UDP or TCP packet; fails with packosErrorWrongProtocol
+ *  for anything else.  Either pointer may be NULL.
+ */
+int IpPacketGetPorts(PackosPacket* packet,
+                     uint16_t* sourcePort,
+                     uint16_t* destPort,
+                     PackosError* error);
 
 #endif /*_IP_H_*/
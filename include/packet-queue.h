@@ -3,9 +3,33 @@
 
 #include <packos/packet.h>
 
+/* Packets are filed by protocol as they're enqueued, so that taking
+ *  the oldest one of a given protocol doesn't mean looking at all the
+ *  others.  The sequence numbers keep the order across the rings.
+ */
+typedef enum {
+  packosPacketQueueClassUDP=0,
+  packosPacketQueueClassTCP,
+  packosPacketQueueClassICMP,
+  packosPacketQueueClassOther,
+  packosPacketQueueNumClasses
+} PackosPacketQueueClass;
+
+typedef struct {
+  PackosPacket* packet;
+  uint32_t seq;
+  int protocol;
+} PackosPacketQueueEntry;
+
+typedef struct {
+  PackosPacketQueueEntry* entries;
+  uint16_t start,count;
+} PackosPacketQueueRing;
+
 typedef struct PackosPacketQueue {
-  PackosPacket** packets;
-  uint16_t capacity,start,count;
+  PackosPacketQueueRing rings[packosPacketQueueNumClasses];
+  uint16_t capacity,count;
+  uint32_t nextSeq;
 }* PackosPacketQueue;
 
 PackosPacketQueue PackosPacketQueueNew(int capacity,
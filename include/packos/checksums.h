@@ -4,6 +4,33 @@
 #include <packos/packet.h>
 #include <ip.h>
 
+/* Partial sums: the ones'-complement sum of a run of bytes, taken as
+ *  big-endian 16-bit words, folded to 16 bits but not complemented.
+ *  Sums of consecutive runs can be added with PackosChecksumAdd(), so
+ *  long as each run but the last is of even length; a run that starts
+ *  at an odd offset needs PackosChecksumSwap() first.
+ */
+uint16_t PackosChecksumPartial(const void* base,
+                               uint32_t count);
+
+/* Copies count bytes from src to dest, returning the partial sum of
+ *  them.
+ */
+uint16_t PackosChecksumCopy(void* dest,
+                            const void* src,
+                            uint32_t count);
+
+uint16_t PackosChecksumAdd(uint16_t a, uint16_t b);
+uint16_t PackosChecksumSwap(uint16_t sum);
+
+/* Incremental update (RFC 1624): given the checksum of a header,
+ *  returns its checksum once the 16-bit word oldValue in it has been
+ *  replaced by newValue.
+ */
+uint16_t PackosChecksumUpdate16(uint16_t checksum,
+                                uint16_t oldValue,
+                                uint16_t newValue);
+
 int UdpChecksum(PackosPacket* packet,
                 IpHeader* udp,
                 PackosError* error);
@@ -14,4 +41,17 @@ int TcpChecksum(PackosPacket* packet,
                 IpHeader* tcp,
                 PackosError* error);
 
+/* As IcmpChecksum() and TcpChecksum(), for callers who already have
+ *  the partial sum of the data: everything after the ICMP header, or
+ *  after the TCP header and its options.
+ */
+uint16_t IcmpChecksumWithData(PackosPacket* packet,
+                              IpHeader* icmp,
+                              uint16_t dataSum,
+                              PackosError* error);
+int TcpChecksumWithData(PackosPacket* packet,
+                        IpHeader* tcp,
+                        uint16_t dataSum,
+                        PackosError* error);
+
 #endif /*_PACKOS_CHECKSUMS_H_*/
@@ -0,0 +1,19 @@
+#ifndef _PACKOS_CLOCK_H_
+#define _PACKOS_CLOCK_H_
+
+#include <packos/types.h>
+#include <packos/errors.h>
+
+/* Microseconds since the clock was started. */
+uint64_t PackosClockNow(PackosError* error);
+
+/* Asks for a clock interrupt packet once PackosClockNow() reaches when;
+ *  0 cancels.  There is one alarm, owned by whoever is registered for
+ *  the clock interrupt; setting it replaces the last one.  It comes on
+ *  top of the periodic packets, if the kernel still sends those (see
+ *  PACKOS_KERNEL_TICKLESS).
+ */
+int PackosClockSetAlarm(uint64_t when,
+                        PackosError* error);
+
+#endif /*_PACKOS_CLOCK_H_*/
@@ -10,6 +10,21 @@ typedef void (*PackosContextFunc)(void);
 PackosContext PackosContextNew(PackosContextFunc func,
                                const char* name,
                                PackosError* error);
+/* As PackosContextNew(), but the context's receive queue holds up to
+ *  queueLen packets (at most PACKOS_PACKET_QUEUE_MAXLEN) rather than
+ *  PACKOS_PACKET_QUEUE_LEN.
+ */
+PackosContext PackosContextNewWithQueueLen(PackosContextFunc func,
+                                           const char* name,
+                                           unsigned int queueLen,
+                                           PackosError* error);
+/* Resizes context's receive queue; senders waiting in
+ *  PackosPacketSendWait() are woken once it drains to half of queueLen.
+ *  Only the context itself or the scheduler may resize it.
+ */
+int PackosContextSetQueueLen(PackosContext context,
+                             unsigned int queueLen,
+                             PackosError* error);
 PackosContext PackosGetCurrentContext(PackosError* error);
 const char* PackosContextGetName(PackosContext context,
                                  PackosError* error);
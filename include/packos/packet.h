@@ -6,6 +6,13 @@
 
 #define PACKOS_MTU 1500
 
+/* The last PACKOS_PACKET_TAILROOM bytes of each packet page belong to
+ *  the IP library, which caches what it has parsed of the packet there.
+ *  PackosPacketAlloc() clears them, and leaves them out of the size it
+ *  reports.
+ */
+#define PACKOS_PACKET_TAILROOM 128
+
 typedef union {
   byte bytes[16];
   uint16_t words[8];
@@ -70,6 +77,17 @@ PackosPacket* PackosPacketAlloc(SizeType* sizeOut,
 void PackosPacketFree(PackosPacket* packet,
                       PackosError* error);
 
+typedef struct {
+  uint32_t hits,misses,refills,drains;
+} PackosPacketCacheStats;
+
+/* Each context keeps a few free packet pages of its own, refilled from
+ *  and drained to the kernel's pool PACKOS_PACKET_CACHE_BATCH pages at
+ *  a time.  Reports how well the calling context's cache is doing.
+ */
+int PackosPacketCacheGetStats(PackosPacketCacheStats* stats,
+                              PackosError* error);
+
 /* Send a packet.  If yieldToRecipient is set, and the recipient is
  *  blocking in PackosPacketReceive(), then the caller will yield the
  *  CPU to the recipient.
@@ -78,6 +96,30 @@ int PackosPacketSend(PackosPacket* packet,
                      bool yieldToRecipient,
                      PackosError* error);
 
+/* As PackosPacketSend(), but if the recipient's queue is full, blocks
+ *  until it has drained below its low-water mark and tries again,
+ *  rather than failing with packosErrorPacketQueueFull.  Not for use
+ *  by the scheduler, nor for multicast.
+ */
+int PackosPacketSendWait(PackosPacket* packet,
+                         bool yieldToRecipient,
+                         PackosError* error);
+
+/* Send several packets in one trip through the kernel.  Runs of
+ *  consecutive packets with the same destination cost one address
+ *  lookup and wake the recipient once.  If yieldToRecipient is set,
+ *  the caller yields to the last recipient it woke.
+ *
+ * Returns the number of packets sent.  Sending stops at the first
+ *  packet that cannot be delivered; that packet and the ones after it
+ *  still belong to the caller, and *error says why.  Returns <0 if
+ *  not even the first packet could be sent.
+ */
+int PackosPacketSendBatch(PackosPacket** packets,
+                          unsigned int numPackets,
+                          bool yieldToRecipient,
+                          PackosError* error);
+
 /* Receive a packet.  If blocking is true, blocks until a packet is
  *  received, then returns it.  The resulting packet is guaranteed to
  *  be a page, as if it had been returned by PackosPacketAlloc(); when
@@ -86,6 +128,14 @@ int PackosPacketSend(PackosPacket* packet,
  */
 PackosPacket* PackosPacketReceive(PackosError* error);
 
+/* Receive up to maxPackets packets, blocking until at least one is
+ *  available.  Returns the number stored in packets[], or <0 on error.
+ *  Each packet must be freed or reused, as for PackosPacketReceive().
+ */
+int PackosPacketReceiveBatch(PackosPacket** packets,
+                             unsigned int maxPackets,
+                             PackosError* error);
+
 /* For use by the scheduler only.  The scheduler calls this to
  *  say "let so-and-so run until you have a message for me".  If
  *  context is, or becomes, blocked, will return with the error
@@ -95,9 +145,55 @@ PackosPacket* PackosPacketReceive(PackosError* error);
 PackosPacket* PackosPacketReceiveOrYieldTo(PackosContext context,
                                            PackosError* error);
 
+/* Sends request to its packos.dest and blocks until a packet comes
+ *  back from the context that has that address, which it returns.  If
+ *  the server can run, control passes straight to it, skipping the
+ *  scheduler; a server that replies with yieldToRecipient set hands it
+ *  straight back.  Other packets that arrive meanwhile are left queued.
+ *  Fails with packosErrorContextFinished if the server exits first; the
+ *  request has been delivered by then, so it's no longer the caller's.
+ */
+PackosPacket* PackosPacketCall(PackosPacket* request,
+                               PackosError* error);
+
 int PackosPacketRegisterContext(PackosContext context,
                                 PackosError* error);
 int PackosPacketUnregisterContext(PackosContext context,
                                   PackosError* error);
 
+/* A context receives packets sent to its own address, plus any others
+ *  added here.  Fails with packosErrorAddrInUse if some context already
+ *  has addr.  Only context itself, or the scheduler, may add or remove
+ *  its addresses; anyone else gets packosErrorKernelPermissionDenied.
+ */
+int PackosPacketAddAddress(PackosContext context,
+                           PackosAddress addr,
+                           PackosError* error);
+int PackosPacketRemoveAddress(PackosContext context,
+                              PackosAddress addr,
+                              PackosError* error);
+
+/* Multicast group membership.  A packet sent to a group is delivered
+ *  to every member but the sender, as the *same* page: members must
+ *  treat it as read-only, or call PackosPacketUnshare() first.  As
+ *  with addresses, only context itself or the scheduler may change its
+ *  memberships.
+ */
+int PackosPacketMcastJoin(PackosContext context,
+                          PackosAddress group,
+                          PackosError* error);
+int PackosPacketMcastLeave(PackosContext context,
+                           PackosAddress group,
+                           PackosError* error);
+
+bool PackosPacketIsShared(PackosPacket* packet,
+                          PackosError* error);
+
+/* Copy-on-write for multicast deliveries.  If packet is shared with
+ *  other contexts, returns a private copy and drops the caller's
+ *  reference to the original; otherwise returns packet itself.
+ */
+PackosPacket* PackosPacketUnshare(PackosPacket* packet,
+                                  PackosError* error);
+
 #endif /*_PACKOS_PACKETS_H_*/
@@ -0,0 +1,18 @@
+#ifndef _PACKOS_KERNEL_CLOCKP_H_
+#define _PACKOS_KERNEL_CLOCKP_H_
+
+#include <packos/clock.h>
+
+/* If defined, the clock interrupt packet is sent only when an alarm
+ *  goes off; otherwise it is also sent every PACKOS_CLOCK_PERIOD_USEC,
+ *  as the old tick was.
+ */
+#define PACKOS_KERNEL_TICKLESS
+
+#define PACKOS_CLOCK_PERIOD_USEC 100000
+
+/* Both called with interrupts blocked. */
+void PackosKernelClockInit(void);
+void PackosKernelClockInterrupt(void);
+
+#endif /*_PACKOS_KERNEL_CLOCKP_H_*/
@@ -37,6 +37,15 @@ typedef struct {
   } segmentIds;
 } ContextPageTable;
 
+/* Free packet pages kept by one context, in front of the kernel's
+ *  packet pool.  See PackosPacketAlloc().
+ */
+typedef struct {
+  PackosPacket* packets[PACKOS_PACKET_CACHE_LEN];
+  unsigned int numPackets;
+  PackosPacketCacheStats stats;
+} PackosPacketCache;
+
 typedef struct {
   unsigned int oldTSS:16;
   unsigned int zero0:16;
@@ -79,6 +88,17 @@ typedef struct {
   unsigned int ioMapOffset:16; /* Relative to base of TSS. */
 } PackosContext386TSS;
 
+/* How many PackosContextQueues a context can be in at once. */
+#define PACKOS_CONTEXT_QUEUE_MAX_LINKS 4
+
+/* One membership in a PackosContextQueue; queue is 0 if the link is
+ *  free.
+ */
+typedef struct {
+  struct PackosContextQueue* queue;
+  PackosContext next,prev;
+} PackosContextQueueLink;
+
 struct PackosContext {
   PackosContext386TSS tss;
 
@@ -90,11 +110,35 @@ struct PackosContext {
 
     ContextPageTable pageTable;
 
+    /* packets is a ring of size slots; it points at inlinePackets
+     *  unless the queue has been grown past PACKOS_PACKET_QUEUE_LEN.
+     *  Senders blocked on a full queue are chained through their
+     *  nextWaiter fields, and woken once the queue drains to lowWater.
+     */
     struct {
-      PackosPacket* packets[PACKOS_PACKET_QUEUE_LEN];
+      PackosPacket** packets;
       unsigned int offset,numPackets;
+      unsigned int size,capacity,lowWater;
+      PackosMemoryPhysicalRange physical;
+      PackosPacket* inlinePackets[PACKOS_PACKET_QUEUE_LEN];
+      PackosContext firstWaiter;
     } queue;
 
+    PackosContext waitingOn,nextWaiter;
+
+    /* Contexts unblocked since the scheduler last looked, in order. */
+    PackosContext nextWoken;
+    bool isWoken;
+
+    /* Set by the scheduler; the kernel only compares them. */
+    unsigned int priority;
+
+    PackosPacketCache packetCache;
+
+    /* Change blocking only through PackosKernelContextSetBlocking():
+     *  it's what puts an unblocked context on the woken list, and
+     *  schedulers take runnable contexts from there.
+     */
     bool blocking,finished;
 
     PackosMemoryPhysicalRange configPhysical;
@@ -102,6 +146,8 @@ struct PackosContext {
     PackosContextConfig* config;
 
     void* metadata;
+
+    PackosContextQueueLink queueLinks[PACKOS_CONTEXT_QUEUE_MAX_LINKS];
   } os;
 
   struct {
@@ -133,12 +179,34 @@ void PackosKernelContextYield(void);
 void PackosKernelContextYieldTo(PackosContext to,
                                 PackosError* error);
 PackosContext PackosKernelContextCurrent(PackosError* error);
+/* Whether the current context may act for context: only context itself
+ *  and the scheduler may.
+ */
+bool PackosKernelContextMayActFor(PackosContext context);
 
 int PackosKernelSetTick(PackosError* error);
 
 int PackosKernelSetIdleContext(PackosContext idleContext_,
                                PackosError* error);
 
+/* For the scheduler: takes the oldest context to have gone from
+ *  blocking to not since the last call.  Returns 0, with
+ *  packosErrorNone, if there are none.
+ */
+PackosContext PackosKernelContextTakeWoken(PackosError* error);
+
+/* For the scheduler: a context that wakes one of higher priority
+ *  yields to the scheduler once its send is done, instead of running
+ *  out its slice.  Only the scheduler may set priorities.
+ */
+int PackosKernelContextSetPriority(PackosContext context,
+                                   unsigned int priority,
+                                   PackosError* error);
+/* Yields to the scheduler if the current context has woken one of
+ *  higher priority since the scheduler last took the woken list.
+ */
+void PackosKernelContextPreemptIfPending(void);
+
 /* Returns 0 on success, <0 on failure (say, if the receiving context's
  *  queue is full).
  */
@@ -147,6 +215,38 @@ int PackosKernelContextInsertPacket(PackosContext context,
                                     PackosError* error);
 PackosPacket* PackosKernelContextExtractPacket(PackosContext context,
                                                PackosError* error);
+/* Extracts the oldest queued packet whose packos.src is src, leaving
+ *  the others queued in order.  packosErrorNoPacketAvail if none.
+ */
+PackosPacket* PackosKernelContextExtractPacketFrom(PackosContext context,
+                                                   PackosAddress src,
+                                                   PackosError* error);
+/* Sets the number of packets context's queue may hold, growing its
+ *  storage if need be.  Fails if more than queueLen are queued now.
+ */
+int PackosKernelContextSetQueueLen(PackosContext context,
+                                   unsigned int queueLen,
+                                   PackosError* error);
+
+/* Blocks the current context until recipient's queue is no longer
+ *  full.  The scheduler may not wait; it gets packosErrorPacketQueueFull.
+ */
+int PackosKernelContextWaitForQueueSpace(PackosContext recipient,
+                                         PackosError* error);
+
+/* Takes the current context off the waiter list it joined in
+ *  PackosKernelContextWaitForQueueSpace(), if any.
+ */
+void PackosKernelContextStopWaiting(void);
+
+/* Extracts up to maxPackets packets in one critical section.  Returns
+ *  the number extracted, or <0 on failure (packosErrorNoPacketAvail
+ *  if the queue was empty).
+ */
+int PackosKernelContextExtractPackets(PackosContext context,
+                                      PackosPacket** packets,
+                                      unsigned int maxPackets,
+                                      PackosError* error);
 bool PackosKernelContextHasPacket(PackosContext context,
                                   PackosError* error);
 
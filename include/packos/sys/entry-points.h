@@ -29,7 +29,23 @@ typedef enum {
   packosSysEntryPointIdPacketReceive,
   packosSysEntryPointIdPacketReceiveOrYieldTo,
   packosSysEntryPointIdPacketAlloc,
-  packosSysEntryPointIdPacketFree
+  packosSysEntryPointIdPacketFree,
+  packosSysEntryPointIdPacketSendBatch,
+  packosSysEntryPointIdPacketReceiveBatch,
+  packosSysEntryPointIdPacketAddAddress,
+  packosSysEntryPointIdPacketRemoveAddress,
+  packosSysEntryPointIdPacketMcastJoin,
+  packosSysEntryPointIdPacketMcastLeave,
+  packosSysEntryPointIdPacketUnshare,
+  packosSysEntryPointIdPacketSendWait,
+  packosSysEntryPointIdContextSetQueueLen,
+  packosSysEntryPointIdPacketCall,
+  packosSysEntryPointIdTraceRead,
+  packosSysEntryPointIdTraceDump,
+  packosSysEntryPointIdContextTakeWoken,
+  packosSysEntryPointIdClockNow,
+  packosSysEntryPointIdClockSetAlarm,
+  packosSysEntryPointIdContextSetPriority
 } PackosSysEntryPointId;
 
 typedef union {
@@ -4,6 +4,7 @@
 #include <packos/packet.h>
 
 #define PACKOS_KERNEL_PACKET_MAXADDRS 32
+#define PACKOS_KERNEL_PACKET_MAXGROUPS 32
 #if 0
 #define PACKETS_ARE_PAGES
 #endif
@@ -12,6 +13,12 @@ int PackosKernelPacketRegisterContext(PackosContext context,
                                       PackosError* error);
 int PackosKernelPacketUnregisterContext(PackosContext context,
                                         PackosError* error);
+int PackosKernelPacketAddAddress(PackosContext context,
+                                 PackosAddress addr,
+                                 PackosError* error);
+int PackosKernelPacketRemoveAddress(PackosContext context,
+                                    PackosAddress addr,
+                                    PackosError* error);
 PackosContext PackosKernelPacketFindContextByAddr(PackosAddress addr,
                                                   PackosError* error);
 
@@ -19,6 +26,11 @@ int PackosPacketSendFromKernel(PackosPacket* packet,
                                bool yieldToRecipient,
                                PackosError* error);
 
+int PackosPacketSendBatchFromKernel(PackosPacket** packets,
+                                    unsigned int numPackets,
+                                    bool yieldToRecipient,
+                                    PackosError* error);
+
 int PackosKernelPacketSend(PackosPacket* packet,
                            bool yieldToRecipient,
                            PackosError* error);
@@ -29,4 +41,8 @@ PackosPacket* PackosKernelPacketAlloc(PackosError* error);
 void PackosKernelPacketFree(PackosPacket* packet,
                             PackosError* error);
 
+/* Returns every page in context's packet cache to the pool. */
+int PackosKernelPacketCacheDrain(PackosContext context,
+                                 PackosError* error);
+
 #endif /*_PACKOS_KERNEL_PACKETP_H_*/
@@ -0,0 +1,33 @@
+#ifndef _PACKOS_KERNEL_TRACEP_H_
+#define _PACKOS_KERNEL_TRACEP_H_
+
+#include <packos/trace.h>
+#include <packos/context.h>
+
+#define PACKOS_KERNEL_TRACE
+
+void PackosKernelTrace(PackosTraceEvent event,
+                       PackosContext context,
+                       PackosAddress src,
+                       PackosAddress dest);
+/* packet may be null, for events that aren't about one. */
+void PackosKernelTracePacket(PackosTraceEvent event,
+                             PackosContext context,
+                             const PackosPacket* packet);
+void PackosKernelTraceYield(PackosContext from,
+                            PackosContext to);
+
+#ifdef PACKOS_KERNEL_TRACE
+#define PACKOS_TRACE(event,context,src,dest) \
+  PackosKernelTrace(event,context,src,dest)
+#define PACKOS_TRACE_PACKET(event,context,packet) \
+  PackosKernelTracePacket(event,context,packet)
+#define PACKOS_TRACE_YIELD(from,to) \
+  PackosKernelTraceYield(from,to)
+#else
+#define PACKOS_TRACE(event,context,src,dest)
+#define PACKOS_TRACE_PACKET(event,context,packet)
+#define PACKOS_TRACE_YIELD(from,to)
+#endif
+
+#endif /*_PACKOS_KERNEL_TRACEP_H_*/
@@ -0,0 +1,52 @@
+#ifndef _PACKOS_TRACE_H_
+#define _PACKOS_TRACE_H_
+
+#include <packos/types.h>
+#include <packos/errors.h>
+#include <packos/packet.h>
+
+/* Must be a power of two. */
+#define PACKOS_TRACE_LEN 512
+
+typedef enum {
+  packosTraceEventNone=0,
+  packosTraceEventSend,
+  packosTraceEventReceive,
+  packosTraceEventAlloc,
+  packosTraceEventFree,
+  packosTraceEventBlock,
+  packosTraceEventYield
+} PackosTraceEvent;
+
+/* For a yield, src is the context giving up the CPU and dest the one
+ *  getting it.  queueDepth is that of context's queue, after the event.
+ */
+typedef struct {
+  uint32_t seq;
+  uint16_t event;
+  uint16_t queueDepth;
+  uint64_t tsc;
+  PackosAddress context;
+  PackosAddress src;
+  PackosAddress dest;
+} PackosTraceRecord;
+
+/* Copies out up to maxRecords records, starting at *cursor (0 for the
+ *  oldest still held), and advances *cursor past them.  Records that
+ *  were overwritten before being read are skipped.  Returns the number
+ *  copied.
+ */
+int PackosTraceRead(PackosTraceRecord* records,
+                    unsigned int maxRecords,
+                    uint32_t* cursor,
+                    PackosError* error);
+
+/* Writes the records from *cursor on to the console, one per line, for
+ *  aux/trace-decode to turn into a timeline.  Advances *cursor.
+ */
+int PackosTraceDump(uint32_t* cursor,
+                    PackosError* error);
+
+const char* PackosTraceEventToString(PackosTraceEvent event);
+
+#endif /*_PACKOS_TRACE_H_*/
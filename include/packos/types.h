@@ -35,6 +35,9 @@ typedef int32_t PtrDiffType;
 #define false 0
 
 #define PACKOS_PACKET_QUEUE_LEN 16
+#define PACKOS_PACKET_QUEUE_MAXLEN 1024
+#define PACKOS_PACKET_CACHE_LEN 8
+#define PACKOS_PACKET_CACHE_BATCH (PACKOS_PACKET_CACHE_LEN/2)
 
 typedef struct PackosContext* PackosContext;
 typedef struct PackosMemoryPhysicalRange* PackosMemoryPhysicalRange;
@@ -0,0 +1,39 @@
+#ifndef _ROUTE_TABLE_H_
+#define _ROUTE_TABLE_H_
+
+#include <ip.h>
+
+/* A longest-prefix-match table from IPv6 prefixes to interfaces, kept
+ *  as a path-compressed binary trie: each node holds a whole prefix,
+ *  and branches on the first bit after it.  A lookup visits at most
+ *  one node per distinct prefix length on the way to its answer, and
+ *  there's no limit on the number of routes.
+ */
+typedef struct RouteTable* RouteTable;
+
+RouteTable RouteTableNew(PackosError* error);
+int RouteTableDelete(RouteTable table,
+                     PackosError* error);
+
+/* Replaces the route for the same prefix, if there is one. */
+int RouteTableAdd(RouteTable table,
+                  PackosAddressMask prefix,
+                  IpIface iface,
+                  PackosError* error);
+
+/* packosErrorDoesNotExist if there's no route for exactly that prefix. */
+int RouteTableRemove(RouteTable table,
+                     PackosAddressMask prefix,
+                     PackosError* error);
+
+/* The interface for the longest prefix that covers addr;
+ *  packosErrorNoRouteToHost if none does.
+ */
+IpIface RouteTableLookup(RouteTable table,
+                         PackosAddress addr,
+                         PackosError* error);
+
+uint32_t RouteTableNumRoutes(RouteTable table,
+                             PackosError* error);
+
+#endif /*_ROUTE_TABLE_H_*/
@@ -3,9 +3,37 @@
 
 #include <schedulers/common.h>
 
+/* Maintained by the scheduler; apps need not set it. */
+typedef enum {
+  schedulerBasicStateNew=0,
+  schedulerBasicStateParked,   /* !isRunning */
+  schedulerBasicStateRunnable,
+  schedulerBasicStateBlocked
+} SchedulerBasicState;
+
+#define SCHEDULER_BASIC_NUM_PRIORITIES 4
+
+/* The longest a context runs before the scheduler takes a look; and
+ *  how often, at most, it polls its TCP and control sockets when no
+ *  packet for them has woken it.
+ */
+#define SCHEDULER_BASIC_SLICE_USEC 100000
+/* The slice instead, while some blocked context outranks the running
+ *  one: the longest it then waits for the CPU once woken.
+ */
+#define SCHEDULER_BASIC_PREEMPT_USEC 10000
+#define SCHEDULER_BASIC_POLL_USEC 1000000
+
+/* priority runs from 0 (the default) to SCHEDULER_BASIC_NUM_PRIORITIES-1.
+ *  A runnable context never waits behind one of lower priority; give
+ *  interrupt-driven drivers a high one.
+ */
 typedef struct {
   bool isDaemon,isRunning,isInited;
   PackosContext dependsOn;
+  uint8_t priority;
+  SchedulerBasicState state;
+  uint8_t blockedAt; /* the priority it blocked with; the scheduler's */
 } SchedulerBasicContextMetadata;
 
 void SchedulerBasic(void);
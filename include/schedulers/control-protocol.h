@@ -8,11 +8,13 @@
 
 typedef enum {
   controlRequestCmdInvalid=0,
-  controlRequestCmdReportInited=1
+  controlRequestCmdReportInited=1,
+  controlRequestCmdSetPriority=2   /* arg: the new priority */
 } ControlRequestCmd;
 
+/* arg is command-specific; 0 if the command takes none. */
 typedef struct {
-  uint16_t version,cmd,requestId,reserved;
+  uint16_t version,cmd,requestId,arg;
 } ControlRequest;
 
 typedef struct {
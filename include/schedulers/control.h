@@ -15,4 +15,11 @@ int SchedulerControlClose(SchedulerControl control,
 int SchedulerControlReportInited(SchedulerControl control,
                                  PackosError* error);
 
+/* Sets this context's priority; see SchedulerBasicContextMetadata.
+ *  Takes effect from its next time slot.
+ */
+int SchedulerControlSetPriority(SchedulerControl control,
+                                uint8_t priority,
+                                PackosError* error);
+
 #endif /*_SCHEDULERS_CONTROL_H_*/
@@ -28,6 +28,11 @@ typedef enum {
   tcpFlagUrgent=32
 } TcpFlag;
 
+typedef enum {
+  tcpCongestionControlNewReno=0,
+  tcpCongestionControlCubic
+} TcpCongestionControl;
+
 const char* TcpSocketStateToString(TcpSocketState state,
                                    PackosError* error);
 
@@ -64,6 +69,20 @@ int TcpSocketSend(TcpSocket socket,
                   uint32_t nbytes,
                   PackosError* error);
 
+/* For sending without copying into the socket: TcpSocketSendBuffer()
+ *  gives the space at the end of the outgoing queue, and its size in
+ *  *nbytes; write into it, then TcpSocketSendCommit() what was
+ *  written.  The space lasts until the next send on the socket;
+ *  committing 0 bytes gives it back unused.  packosErrorQueueFull if
+ *  the queue's at its limit.
+ */
+void* TcpSocketSendBuffer(TcpSocket socket,
+                          uint32_t* nbytes,
+                          PackosError* error);
+int TcpSocketSendCommit(TcpSocket socket,
+                        uint32_t nbytes,
+                        PackosError* error);
+
 int TcpSocketReceive(TcpSocket socket,
                      void* buff,
                      uint32_t nbytes,
@@ -72,6 +91,19 @@ int TcpSocketReceive(TcpSocket socket,
 bool TcpSocketReceivePending(TcpSocket socket,
                              PackosError* error);
 
+/* CUBIC unless set otherwise; best set before the connection is. */
+int TcpSocketSetCongestionControl(TcpSocket socket,
+                                  TcpCongestionControl algorithm,
+                                  PackosError* error);
+
+/* The most each of the socket's buffers may grow to, up to 1MB; 64K
+ *  unless set otherwise.  Buffers only take memory for what's in them.
+ */
+int TcpSocketSetBufferLimits(TcpSocket socket,
+                             uint32_t sendLimit,
+                             uint32_t receiveLimit,
+                             PackosError* error);
+
 int TcpPoll(PackosError* error);
 
 #endif /*_TCP_H_*/
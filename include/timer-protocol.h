@@ -8,9 +8,29 @@ typedef enum {
   timerRequestCmdInvalid=0,
   timerRequestCmdOpen=1,
   timerRequestCmdClose=2,
-  timerRequestCmdTick=3
+  timerRequestCmdTick=3,
+  timerRequestCmdBatch=4
 } TimerRequestCmd;
 
+typedef enum {
+  timerBatchOpInvalid=0,
+  timerBatchOpArm=1,   /* rearms the id if it's already armed */
+  timerBatchOpCancel=2
+} TimerBatchOp;
+
+/* deadline is absolute, in microseconds on the kernel clock (see
+ *  PackosClockNow()); period is how far apart the ticks after the
+ *  first come, or 0 for a one-shot timer.
+ */
+typedef struct {
+  uint32_t id;
+  uint16_t op,reserved;
+  uint64_t deadline;
+  uint32_t period;
+} TimerBatchEntry;
+
+#define TIMER_BATCH_MAX_ENTRIES 32
+
 typedef struct {
   uint32_t id;
   uint16_t version,cmd,requestId,reserved;
@@ -19,9 +39,28 @@ typedef struct {
       uint32_t sec,usec;
       bool repeat;
     } open;
+    struct {
+      uint32_t numEntries;
+      uint16_t tickPort;
+    } batch;
   } args;
 } TimerRequest;
 
+/* A batch request's numEntries entries follow it.  Its timers tick to
+ *  tickPort, or to the port the request came from if that's 0; the
+ *  reply always goes to the port the request came from.
+ */
+#define TimerRequestBatchEntries(request) \
+  ((TimerBatchEntry*)(((TimerRequest*)(request))+1))
+
+/* A tick reply covers every timer of one socket that expired on the
+ *  same tick: id is the first of them, and all numIds ids follow the
+ *  reply, in TimerReplyTickIds().
+ *
+ * A batch request always gets a reply, with the same requestId, whose
+ *  numEntries errors (as ints; packosErrorNone for success) follow it
+ *  in TimerReplyBatchErrors(), in the order of the entries.
+ */
 typedef struct {
   uint32_t id;
   uint16_t cmd,requestId;
@@ -29,7 +68,18 @@ typedef struct {
     struct {
       uint32_t errorAsInt;
     } open,close;
+    struct {
+      uint32_t numIds;
+    } tick;
+    struct {
+      uint32_t numEntries;
+    } batch;
   } u;
 } TimerReply;
 
+#define TIMER_REPLY_MAX_TICK_IDS 64
+
+#define TimerReplyTickIds(reply) ((uint32_t*)(((TimerReply*)(reply))+1))
+#define TimerReplyBatchErrors(reply) ((uint32_t*)(((TimerReply*)(reply))+1))
+
 #endif /*_TIMER_PROTOCOL_H_*/
@@ -15,4 +15,31 @@ Timer TimerNew(UdpSocket socket,
 int TimerClose(Timer timer,
                PackosError* error);
 
+/* Collects arms, rearms and cancels for timers on one socket, and
+ *  sends them to the timer server in one packet.  Deadlines are
+ *  absolute, on PackosClockNow()'s clock; a period of 0 makes a
+ *  one-shot timer.  The ticks arrive on the socket; the batch itself
+ *  goes out from a socket of the batch's own, and TimerBatchSend()
+ *  waits for the server's reply, failing with the error of the first
+ *  entry that failed.  A full batch is sent before another entry is
+ *  added.
+ */
+typedef struct TimerBatch* TimerBatch;
+
+TimerBatch TimerBatchNew(UdpSocket socket,
+                         PackosError* error);
+int TimerBatchClose(TimerBatch batch, /* drops unsent entries */
+                    PackosError* error);
+
+int TimerBatchArm(TimerBatch batch,
+                  uint32_t id,
+                  uint64_t deadline,
+                  uint32_t period,
+                  PackosError* error);
+int TimerBatchCancel(TimerBatch batch,
+                     uint32_t id,
+                     PackosError* error);
+int TimerBatchSend(TimerBatch batch,
+                   PackosError* error);
+
 #endif /*_TIMER_H_*/
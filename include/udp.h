@@ -31,6 +31,15 @@ int UdpSocketSend(UdpSocket socket,
                   PackosPacket* packet,
                   PackosError* error);
 
+/* Sends request and returns the next packet received on socket, for
+ *  request/reply exchanges.  A reply from a local server comes straight
+ *  back, without going through the scheduler (see PackosPacketCall()).
+ *  The request is used up, whether or not this succeeds.
+ */
+PackosPacket* UdpSocketCall(UdpSocket socket,
+                            PackosPacket* request,
+                            PackosError* error);
+
 PackosPacket* UdpSocketReceive(UdpSocket socket,
                                IpHeaderRouting0** routingHeader,
                                bool stopWhenReceiveOtherPacket,
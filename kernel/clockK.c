@@ -0,0 +1,234 @@
+#include <packos/sys/clockP.h>
+#include <packos/sys/interruptsP.h>
+#include <packos/sys/contextP.h>
+#include <packos/sys/blockP.h>
+#include <packos/arch.h>
+
+#include "kprintfK.h"
+
+/* The PIT's counter 0 runs one-shot (mode 0): it counts down from
+ *  whatever was last loaded, interrupts at zero, and carries on down
+ *  from 0xffff.  Each interrupt loads the time to the next deadline,
+ *  or the longest count if that's further off, so that the time is
+ *  kept.  Counts and microseconds are converted in 16.16 fixed point,
+ *  so as to stay in 32 bits.
+ */
+#define PIT_CMD 0x43
+#define PIT_COUNTER0 0x40
+
+#define PIT_CMD_COUNTER0_ONE_SHOT 0x30
+#define PIT_CMD_READ_BACK_COUNTER0 0xc2
+#define PIT_STATUS_OUT 0x80
+#define PIT_STATUS_NULL_COUNT 0x40
+
+#define PIT_USEC_PER_COUNT_16 54925  /* (1000000/1193182)<<16 */
+#define PIT_COUNTS_PER_USEC_16 78196 /* (1193182/1000000)<<16 */
+
+#define PIT_MAX_COUNTS 0xffff
+#define PIT_MAX_USEC 54900
+/* A shorter count could run out before we've returned from the
+ *  interrupt that loaded it.
+ */
+#define PIT_MIN_COUNTS 16
+
+extern void sendTickPacket(void);
+
+static struct {
+  uint64_t usec;     /* when the current count was loaded */
+  uint32_t fraction; /* of a microsecond, in 65536ths */
+  uint16_t counts;   /* the current count */
+  uint64_t alarm;    /* 0 if none */
+#ifndef PACKOS_KERNEL_TICKLESS
+  uint64_t nextTick;
+#endif
+} pit;
+
+static inline void outb(uint16_t port, byte v)
+{
+  asm volatile ("outb %0, %1" : : "a"(v), "Nd"(port) );
+}
+
+static inline byte inb(uint16_t port)
+{
+  byte res;
+  asm volatile ("inb %1, %0" : "=a"(res) : "Nd"(port) );
+  return res;
+}
+
+/* Counts since the current count was loaded, including any since it
+ *  ran out, if its interrupt is still pending.
+ */
+static uint32_t elapsedCounts(void)
+{
+  byte status;
+  uint16_t left;
+
+  outb(PIT_CMD,PIT_CMD_READ_BACK_COUNTER0);
+  status=inb(PIT_COUNTER0);
+  left=inb(PIT_COUNTER0);
+  left|=((uint16_t)(inb(PIT_COUNTER0)))<<8;
+
+  if (status&PIT_STATUS_NULL_COUNT)
+    return 0;
+  if (status&PIT_STATUS_OUT)
+    return pit.counts+((0x10000-left)&0xffff);
+  return pit.counts-left;
+}
+
+static void addCounts(uint64_t* usec,
+                      uint32_t* fraction,
+                      uint32_t counts)
+{
+  while (counts)
+    {
+      uint32_t n=(counts>PIT_MAX_COUNTS) ? PIT_MAX_COUNTS : counts;
+      (*fraction)+=n*PIT_USEC_PER_COUNT_16;
+      (*usec)+=(*fraction)>>16;
+      (*fraction)&=0xffff;
+      counts-=n;
+    }
+}
+
+static uint64_t nextDeadline(void)
+{
+  uint64_t res=pit.alarm;
+#ifndef PACKOS_KERNEL_TICKLESS
+  if ((!res) || (pit.nextTick<res))
+    res=pit.nextTick;
+#endif
+  return res;
+}
+
+/* Folds the elapsed counts into pit.usec; the counter must be loaded
+ *  again before the time is next read.
+ */
+static void catchUp(void)
+{
+  addCounts(&(pit.usec),&(pit.fraction),elapsedCounts());
+}
+
+/* Loads the count to the next deadline. */
+static void load(void)
+{
+  uint64_t deadline;
+  uint32_t usec,counts;
+
+  deadline=nextDeadline();
+  if ((!deadline) || (deadline-pit.usec>=PIT_MAX_USEC))
+    usec=PIT_MAX_USEC;
+  else if (deadline<=pit.usec)
+    usec=0;
+  else
+    usec=(uint32_t)(deadline-pit.usec);
+
+  counts=(usec*PIT_COUNTS_PER_USEC_16)>>16;
+  if (counts<PIT_MIN_COUNTS)
+    counts=PIT_MIN_COUNTS;
+
+  pit.counts=counts;
+  outb(PIT_CMD,PIT_CMD_COUNTER0_ONE_SHOT);
+  outb(PIT_COUNTER0,counts&0xff);
+  outb(PIT_COUNTER0,counts>>8);
+}
+
+void PackosKernelClockInit(void)
+{
+  pit.usec=0;
+  pit.fraction=0;
+  pit.alarm=0;
+#ifndef PACKOS_KERNEL_TICKLESS
+  pit.nextTick=PACKOS_CLOCK_PERIOD_USEC;
+#endif
+
+  pit.counts=PIT_MAX_COUNTS;
+  outb(PIT_CMD,PIT_CMD_COUNTER0_ONE_SHOT);
+  outb(PIT_COUNTER0,PIT_MAX_COUNTS&0xff);
+  outb(PIT_COUNTER0,PIT_MAX_COUNTS>>8);
+}
+
+void PackosKernelClockInterrupt(void)
+{
+  bool send=false;
+
+  catchUp();
+
+  if (pit.alarm && (pit.alarm<=pit.usec))
+    {
+      pit.alarm=0;
+      send=true;
+    }
+
+#ifndef PACKOS_KERNEL_TICKLESS
+  if (pit.nextTick<=pit.usec)
+    {
+      while (pit.nextTick<=pit.usec)
+        pit.nextTick+=PACKOS_CLOCK_PERIOD_USEC;
+      send=true;
+    }
+#endif
+
+  load();
+
+  /* Last, since it may switch to the recipient. */
+  if (send)
+    sendTickPacket();
+}
+
+uint64_t PackosClockNow(PackosError* error)
+{
+  PackosInterruptState state;
+  uint64_t res;
+  uint32_t fraction;
+
+  if (!error) return 0;
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return 0;
+
+  res=pit.usec;
+  fraction=pit.fraction;
+  addCounts(&res,&fraction,elapsedCounts());
+
+  PackosKernelContextRestore(state,0);
+  return res;
+}
+
+int PackosClockSetAlarm(uint64_t when,
+                        PackosError* error)
+{
+  PackosInterruptState state;
+  PackosAddress owner;
+  uint16_t udpPort;
+
+  if (!error) return -2;
+
+  owner=PackosInterruptFor(PACKOS_INTERRUPT_KERNEL_ID_CLOCK,&udpPort,error);
+  if ((!udpPort) || !(PackosAddrEq(owner,PackosMyAddress(error))))
+    {
+      *error=packosErrorAccessDenied;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  pit.alarm=when;
+
+  /* A later alarm can wait for the current count to run out; an
+   *  earlier one can't.
+   */
+  if (when)
+    {
+      uint64_t countEnds=pit.usec;
+      uint32_t fraction=pit.fraction;
+      addCounts(&countEnds,&fraction,pit.counts);
+      if (when<countEnds)
+        {
+          catchUp();
+          load();
+        }
+    }
+
+  PackosKernelContextRestore(state,0);
+  return 0;
+}
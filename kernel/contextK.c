@@ -10,6 +10,7 @@
 #include <packos/sys/packetP.h>
 #include <packos/sys/interruptsP.h>
 #include <packos/sys/contextP.h>
+#include <packos/sys/traceP.h>
 #include <packos/sys/blockP.h>
 #include <packos/sys/asm.h>
 
@@ -21,6 +22,16 @@ static PackosContext scheduler=0;
 static PackosContext idleContext=0;
 PackosContext currentContext=0;
 
+static struct {
+  PackosContext first,last;
+} wokenContexts={0,0};
+
+/* Set when a context wakes one the scheduler ranks above it. */
+static bool preemptPending=false;
+
+static void wakeQueueWaiters(PackosContext context);
+static void stopWaiting(PackosContext context);
+
 #define PRINT_ESP(msg)\
   {const uint32_t* esp; asm("movl %%esp, %0": "=r"(esp));\
     kprintf("%s: %p: %x %x %x %x %x %x\n",msg,esp,\
@@ -277,6 +288,11 @@ PackosContext PackosKernelContextCurrent(PackosError* error)
     }
 }
 
+bool PackosKernelContextMayActFor(PackosContext context)
+{
+  return (context==currentContext) || (currentContext==scheduler);
+}
+
 void PackosKernelContextYield(void)
 {
   PackosError error;
@@ -317,9 +333,83 @@ void PackosKernelContextSetBlocking(PackosContext context,
     }
 
   *error=packosErrorNone;
+  if (blocking && !(context->os.blocking))
+    PACKOS_TRACE_PACKET(packosTraceEventBlock,context,0);
+
+  if ((!blocking) && context->os.blocking && !(context->os.isWoken))
+    {
+      PackosError tmp;
+      PackosInterruptState state=PackosKernelContextBlock(&tmp);
+      context->os.isWoken=true;
+      context->os.nextWoken=0;
+      if (currentContext && (currentContext!=scheduler)
+          && (context->os.priority>currentContext->os.priority)
+          )
+        preemptPending=true;
+      if (wokenContexts.last)
+        wokenContexts.last->os.nextWoken=context;
+      else
+        wokenContexts.first=context;
+      wokenContexts.last=context;
+      PackosKernelContextRestore(state,0);
+    }
+
   context->os.blocking=blocking;
 }
 
+PackosContext PackosKernelContextTakeWoken(PackosError* error)
+{
+  PackosContext res;
+  PackosInterruptState state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return 0;
+
+  preemptPending=false;
+  res=wokenContexts.first;
+  if (res)
+    {
+      wokenContexts.first=res->os.nextWoken;
+      if (!(wokenContexts.first))
+        wokenContexts.last=0;
+      res->os.nextWoken=0;
+      res->os.isWoken=false;
+    }
+
+  PackosKernelContextRestore(state,0);
+  *error=packosErrorNone;
+  return res;
+}
+
+int PackosKernelContextSetPriority(PackosContext context,
+                                   unsigned int priority,
+                                   PackosError* error)
+{
+  if (!error) return -2;
+  if (!context)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (currentContext!=scheduler)
+    {
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
+    }
+
+  context->os.priority=priority;
+  *error=packosErrorNone;
+  return 0;
+}
+
+void PackosKernelContextPreemptIfPending(void)
+{
+  if (!preemptPending) return;
+
+  preemptPending=false;
+  if (currentContext!=scheduler)
+    PackosKernelContextYield();
+}
+
 bool PackosKernelContextFinished(PackosContext context,
                                  PackosError* error)
 {
@@ -367,6 +457,21 @@ void PackosKernelContextExit(void)
   currentContext->os.finished=true;
   currentContext->os.blocking=false;
   PackosPacketUnregisterContext(currentContext,&tmp);
+  PackosKernelPacketCacheDrain(currentContext,&tmp);
+  {
+    PackosInterruptState state=PackosKernelContextBlock(&tmp);
+    stopWaiting(currentContext);
+    wakeQueueWaiters(currentContext);
+    if (currentContext->os.queue.physical)
+      {
+        PackosMemoryPhysicalRangeFree(currentContext->os.queue.physical,&tmp);
+        currentContext->os.queue.physical=0;
+        currentContext->os.queue.packets=currentContext->os.queue.inlinePackets;
+        currentContext->os.queue.size=PACKOS_PACKET_QUEUE_LEN;
+        currentContext->os.queue.offset=currentContext->os.queue.numPackets=0;
+      }
+    PackosKernelContextRestore(state,0);
+  }
   PackosKernelContextYield();
 }
 
@@ -485,6 +590,7 @@ void PackosKernelContextYieldTo(PackosContext to,
   PRINT_ESP("before swapContext()");
 #endif
 
+  PACKOS_TRACE_YIELD(from,to);
   swapContext(from,to);
 
 #ifdef DEBUG
@@ -502,6 +608,166 @@ void PackosKernelContextYieldTo(PackosContext to,
   }
 }
 
+/* Must be called with interrupts blocked. */
+static void wakeQueueWaiters(PackosContext context)
+{
+  PackosContext cur;
+  PackosContext next;
+
+  for (cur=context->os.queue.firstWaiter; cur; cur=next)
+    {
+      PackosError tmp;
+      next=cur->os.nextWaiter;
+      cur->os.nextWaiter=0;
+      cur->os.waitingOn=0;
+      PackosKernelContextSetBlocking(cur,false,&tmp);
+    }
+
+  context->os.queue.firstWaiter=0;
+}
+
+/* Must be called with interrupts blocked. */
+static void stopWaiting(PackosContext context)
+{
+  PackosContext* link;
+
+  if (!(context->os.waitingOn)) return;
+
+  for (link=&(context->os.waitingOn->os.queue.firstWaiter);
+       *link;
+       link=&((*link)->os.nextWaiter))
+    if ((*link)==context)
+      {
+        *link=context->os.nextWaiter;
+        break;
+      }
+
+  context->os.nextWaiter=0;
+  context->os.waitingOn=0;
+}
+
+int PackosKernelContextSetQueueLen(PackosContext context,
+                                   unsigned int queueLen,
+                                   PackosError* error)
+{
+  PackosInterruptState state;
+
+  if (!error) return -2;
+  if (!(context && queueLen && (queueLen<=PACKOS_PACKET_QUEUE_MAXLEN)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  if (queueLen<context->os.queue.numPackets)
+    {
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorPacketQueueFull;
+      return -1;
+    }
+
+  if (queueLen>context->os.queue.size)
+    {
+      PackosPacket** packets;
+      unsigned int i;
+      PackosMemoryPhysicalRange physical
+        =PackosMemoryPhysicalRangeAlloc(packosMemoryPhysicalTypeRAM,
+                                        queueLen*sizeof(PackosPacket*),
+                                        PACKOS_PAGE_SIZE,
+                                        error);
+      if (!physical)
+        {
+          PackosKernelContextRestore(state,0);
+          return -1;
+        }
+
+      packets=(PackosPacket**)(PackosMemoryPhysicalRangeGetAddr(physical,
+                                                                error));
+      for (i=0; i<context->os.queue.numPackets; i++)
+        packets[i]
+          =context->os.queue.packets[(context->os.queue.offset+i)
+                                     %context->os.queue.size];
+
+      if (context->os.queue.physical)
+        {
+          PackosError tmp;
+          PackosMemoryPhysicalRangeFree(context->os.queue.physical,&tmp);
+        }
+
+      context->os.queue.physical=physical;
+      context->os.queue.packets=packets;
+      context->os.queue.offset=0;
+      context->os.queue.size
+        =PackosMemoryPhysicalRangeGetLen(physical,error)/sizeof(PackosPacket*);
+    }
+
+  context->os.queue.capacity=queueLen;
+  context->os.queue.lowWater=queueLen/2;
+  if (context->os.queue.numPackets<=context->os.queue.lowWater)
+    wakeQueueWaiters(context);
+
+  PackosKernelContextRestore(state,0);
+  *error=packosErrorNone;
+  return 0;
+}
+
+int PackosKernelContextWaitForQueueSpace(PackosContext recipient,
+                                         PackosError* error)
+{
+  PackosInterruptState state;
+
+  if (!recipient)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  if (recipient->os.queue.numPackets<recipient->os.queue.capacity)
+    {
+      PackosKernelContextRestore(state,0);
+      return 0;
+    }
+
+  if ((currentContext==scheduler)
+      || (currentContext==recipient)
+      || recipient->os.finished
+      )
+    {
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorPacketQueueFull;
+      return -1;
+    }
+
+  if (currentContext->os.waitingOn!=recipient)
+    {
+      stopWaiting(currentContext);
+      currentContext->os.waitingOn=recipient;
+      currentContext->os.nextWaiter=recipient->os.queue.firstWaiter;
+      recipient->os.queue.firstWaiter=currentContext;
+    }
+
+  PackosKernelContextSetBlocking(currentContext,true,error);
+  PackosKernelContextYield();
+
+  PackosKernelContextRestore(state,0);
+  *error=packosErrorNone;
+  return 0;
+}
+
+void PackosKernelContextStopWaiting(void)
+{
+  PackosError tmp;
+  PackosInterruptState state=PackosKernelContextBlock(&tmp);
+  stopWaiting(currentContext);
+  PackosKernelContextRestore(state,0);
+}
+
 int PackosKernelContextInsertPacket(PackosContext context,
                                     PackosPacket* packet,
                                     PackosError* error)
@@ -516,7 +782,7 @@ int PackosKernelContextInsertPacket(PackosContext context,
   state=PackosKernelContextBlock(error);
   if ((*error)!=packosErrorNone) return -1;
 
-  if (context->os.queue.numPackets>=PACKOS_PACKET_QUEUE_LEN)
+  if (context->os.queue.numPackets>=context->os.queue.capacity)
     {
       PackosKernelContextRestore(state,0);
       *error=packosErrorPacketQueueFull;
@@ -525,7 +791,7 @@ int PackosKernelContextInsertPacket(PackosContext context,
 
   {
     unsigned int i=context->os.queue.offset+context->os.queue.numPackets;
-    i%=PACKOS_PACKET_QUEUE_LEN;
+    i%=context->os.queue.size;
     context->os.queue.numPackets++;
     context->os.queue.packets[i]=packet;
   }
@@ -557,14 +823,103 @@ PackosPacket* PackosKernelContextExtractPacket(PackosContext context,
 
   {
     PackosPacket* res=context->os.queue.packets[context->os.queue.offset++];
-    context->os.queue.offset%=PACKOS_PACKET_QUEUE_LEN;
+    context->os.queue.offset%=context->os.queue.size;
     context->os.queue.numPackets--;
+    PACKOS_TRACE_PACKET(packosTraceEventReceive,context,res);
+    if (context->os.queue.numPackets<=context->os.queue.lowWater)
+      wakeQueueWaiters(context);
     PackosKernelContextRestore(state,0);
     *error=packosErrorNone;
     return res;
   }
 }
 
+PackosPacket* PackosKernelContextExtractPacketFrom(PackosContext context,
+                                                   PackosAddress src,
+                                                   PackosError* error)
+{
+  PackosInterruptState state;
+  unsigned int i;
+
+  if (!context)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return 0;
+
+  for (i=0; i<context->os.queue.numPackets; i++)
+    {
+      unsigned int size=context->os.queue.size;
+      unsigned int at=(context->os.queue.offset+i)%size;
+      PackosPacket* res=context->os.queue.packets[at];
+      if (!(PackosAddrEq(res->packos.src,src)))
+        continue;
+
+      /* Close the gap, so the rest stay in arrival order. */
+      for (; i+1<context->os.queue.numPackets; i++)
+        {
+          unsigned int next=(at+1)%size;
+          context->os.queue.packets[at]=context->os.queue.packets[next];
+          at=next;
+        }
+
+      context->os.queue.numPackets--;
+      PACKOS_TRACE_PACKET(packosTraceEventReceive,context,res);
+      if (context->os.queue.numPackets<=context->os.queue.lowWater)
+        wakeQueueWaiters(context);
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorNone;
+      return res;
+    }
+
+  PackosKernelContextRestore(state,0);
+  *error=packosErrorNoPacketAvail;
+  return 0;
+}
+
+int PackosKernelContextExtractPackets(PackosContext context,
+                                      PackosPacket** packets,
+                                      unsigned int maxPackets,
+                                      PackosError* error)
+{
+  PackosInterruptState state;
+  unsigned int n;
+
+  if (!(context && packets && maxPackets))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  if (!(context->os.queue.numPackets))
+    {
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorNoPacketAvail;
+      return -1;
+    }
+
+  for (n=0; (n<maxPackets) && (context->os.queue.numPackets>0); n++)
+    {
+      packets[n]=context->os.queue.packets[context->os.queue.offset++];
+      context->os.queue.offset%=context->os.queue.size;
+      context->os.queue.numPackets--;
+      PACKOS_TRACE_PACKET(packosTraceEventReceive,context,packets[n]);
+    }
+
+  if (context->os.queue.numPackets<=context->os.queue.lowWater)
+    wakeQueueWaiters(context);
+
+  PackosKernelContextRestore(state,0);
+  *error=packosErrorNone;
+  return n;
+}
+
 bool PackosKernelContextHasPacket(PackosContext context,
                                   PackosError* error)
 {
@@ -116,7 +116,7 @@ void sendTickPacket(void)
   PackosError error;
   PackosInterruptId id=PACKOS_INTERRUPT_KERNEL_ID_CLOCK;
 
-  packet=PackosPacketAlloc(0,&error);
+  packet=PackosKernelPacketAlloc(&error);
   if (!packet)
     {
       kprintf("sendTickPacket(): PackosKernelPacketAlloc(): %s\n",
@@ -170,7 +170,7 @@ void sendTickPacket(void)
     {
       kprintf("sendTickPacket(): PackosPacketSendFromKernel: %s\n",
               PackosErrorToString(error));
-      PackosPacketFree(packet,&error);
+      PackosKernelPacketFree(packet,&error);
       asm("cli; hlt");
     }
 }
@@ -183,7 +183,7 @@ void PackosKernelIRQHandler(PackosInterruptId id)
 
   kprintf("PackosKernelIRQHandler(%d)\n",(int)id);
 
-  packet=PackosPacketAlloc(0,&error);
+  packet=PackosKernelPacketAlloc(&error);
   if (!packet)
     {
       kprintf("sendTickPacket(): PackosKernelPacketAlloc(): %s\n",
@@ -237,7 +237,7 @@ void PackosKernelIRQHandler(PackosInterruptId id)
     {
       kprintf("sendTickPacket(): PackosPacketSendFromKernel: %s\n",
               PackosErrorToString(error));
-      PackosPacketFree(packet,&error);
+      PackosKernelPacketFree(packet,&error);
       asm("cli; hlt");
     }
 }
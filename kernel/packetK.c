@@ -3,118 +3,469 @@
 #include <packos/sys/blockP.h>
 #include <packos/sys/packetP.h>
 #include <packos/sys/memoryP.h>
+#include <packos/sys/traceP.h>
 #include "kprintfK.h"
 
+#define DEBUG
+
+/* Maps addresses to the contexts that receive packets sent to them.
+ *  Open addressing with linear probing, keyed on the whole address;
+ *  deleted slots are left as tombstones until the table is rebuilt.
+ *  The size must be a power of two.
+ */
+#define ADDR_TABLE_SIZE (PACKOS_KERNEL_PACKET_MAXADDRS*32)
+#define ADDR_TABLE_MAX_LOAD ((ADDR_TABLE_SIZE/4)*3)
+
+typedef enum {
+  addrSlotEmpty=0,
+  addrSlotUsed,
+  addrSlotDeleted
+} AddrSlotState;
+
+/* Multicast group addresses have a group instead of a context. */
+typedef struct {
+  bool inUse;
+  unsigned int numMembers;
+  PackosContext members[PACKOS_KERNEL_PACKET_MAXADDRS];
+} McastGroup;
+
 typedef struct {
   PackosAddress addr;
   PackosContext context;
-} Pair;
+  McastGroup* group;
+  AddrSlotState state;
+} AddrSlot;
 
-#define DEBUG
+static McastGroup mcastGroups[PACKOS_KERNEL_PACKET_MAXGROUPS];
 
-#define NUM_PAIRS PACKOS_KERNEL_PACKET_MAXADDRS*10
-static Pair pairs[NUM_PAIRS];
-static bool pairsInited=false;
+static int packetAddRef(PackosPacket* packet,
+                        PackosError* error);
+static bool dropSharedRef(PackosPacket* packet,
+                          PackosError* error);
 
-static void initPairs(void)
+static struct {
+  AddrSlot slots[ADDR_TABLE_SIZE];
+  unsigned int numUsed,numDeleted;
+} addrTable;
+
+static uint32_t hashAddr(PackosAddress addr)
 {
-  int i;
+  uint32_t h=addr.quads[0];
+  h=(h*0x9e3779b1U)^addr.quads[1];
+  h=(h*0x9e3779b1U)^addr.quads[2];
+  h=(h*0x9e3779b1U)^addr.quads[3];
+  h^=(h>>16);
+  return h;
+}
+
+/* Returns the slot holding addr, or NULL.  If insertAt is not NULL,
+ *  it is set to the slot where addr should go if it isn't there.
+ */
+static AddrSlot* seekAddr(PackosAddress addr,
+                          AddrSlot** insertAt)
+{
+  uint32_t i=hashAddr(addr)&(ADDR_TABLE_SIZE-1);
+  unsigned int probes;
+  AddrSlot* firstDeleted=0;
+
+  for (probes=0; probes<ADDR_TABLE_SIZE; probes++)
+    {
+      AddrSlot* slot=&(addrTable.slots[i]);
+      switch (slot->state)
+        {
+        case addrSlotEmpty:
+          if (insertAt)
+            *insertAt=(firstDeleted ? firstDeleted : slot);
+          return 0;
 
-  if (pairsInited) return;
+        case addrSlotDeleted:
+          if (!firstDeleted)
+            firstDeleted=slot;
+          break;
+
+        case addrSlotUsed:
+          if (PackosAddrEq(slot->addr,addr))
+            return slot;
+          break;
+        }
 
-  for (i=0; i<NUM_PAIRS; i++)
-    pairs[i].context=0;
+      i=(i+1)&(ADDR_TABLE_SIZE-1);
+    }
+
+  if (insertAt)
+    *insertAt=firstDeleted;
+  return 0;
+}
 
-  pairsInited=true;
+/* Reinserts every live entry, to clear out tombstones.  Must be called
+ *  with interrupts blocked.
+ */
+static void rebuildAddrTable(void)
+{
+  static AddrSlot old[ADDR_TABLE_SIZE];
+  unsigned int i;
+
+  for (i=0; i<ADDR_TABLE_SIZE; i++)
+    {
+      old[i]=addrTable.slots[i];
+      addrTable.slots[i].state=addrSlotEmpty;
+    }
+  addrTable.numDeleted=0;
+
+  for (i=0; i<ADDR_TABLE_SIZE; i++)
+    if (old[i].state==addrSlotUsed)
+      {
+        AddrSlot* slot=0;
+        seekAddr(old[i].addr,&slot);
+        *slot=old[i];
+      }
 }
 
 PackosAddress PackosAddressGenerate(PackosError* error)
 {
+  /* The generation goes up each time the ID counter wraps, so an
+   *  address is not handed out twice unless 2^64 have gone by.
+   */
   static uint32_t nextId=1;
+  static uint32_t generation=0;
   PackosAddress res;
-  res.octs[0]=res.octs[1]=0;
-  res.bytes[0]=0x7e;
-  res.bytes[1]=0x8e;
-  res.quads[3]=htonl(nextId++);
-  nextId%=NUM_PAIRS;
+
+  do
+    {
+      res.octs[0]=res.octs[1]=0;
+      res.bytes[0]=0x7e;
+      res.bytes[1]=0x8e;
+      res.quads[2]=htonl(generation);
+      res.quads[3]=htonl(nextId++);
+      if (!nextId)
+        {
+          generation++;
+          nextId=1;
+        }
+    }
+  while (seekAddr(res,0));
+
   *error=packosErrorNone;
   return res;
 }
 
-int PackosPacketRegisterContext(PackosContext context,
-                                PackosError* error)
+int PackosKernelPacketAddAddress(PackosContext context,
+                                 PackosAddress addr,
+                                 PackosError* error)
 {
-  int i=ntohl(context->os.config->addresses.self.quads[3]);
-  initPairs();
+  AddrSlot* slot=0;
+  PackosInterruptState state;
 
-  if ((i<0) || (i>=NUM_PAIRS))
+  if (!error) return -2;
+  if (!(context && !(PackosAddrIsMcast(addr))))
     {
-      *error=packosErrorAddrUnregistered;
+      *error=packosErrorInvalidArg;
       return -1;
     }
 
-  if (pairs[i].context)
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  if (seekAddr(addr,&slot))
     {
+      PackosKernelContextRestore(state,0);
       *error=packosErrorAddrInUse;
       return -1;
     }
 
-  pairs[i].context=context;
-  pairs[i].addr=context->os.config->addresses.self;
+  if (addrTable.numUsed>=ADDR_TABLE_MAX_LOAD)
+    {
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorAddrRegistryFull;
+      return -1;
+    }
+
+  if ((!slot)
+      || ((addrTable.numUsed+addrTable.numDeleted)>=ADDR_TABLE_MAX_LOAD)
+      )
+    {
+      rebuildAddrTable();
+      seekAddr(addr,&slot);
+    }
+
+  if (slot->state==addrSlotDeleted)
+    addrTable.numDeleted--;
+  slot->addr=addr;
+  slot->context=context;
+  slot->group=0;
+  slot->state=addrSlotUsed;
+  addrTable.numUsed++;
+
+  PackosKernelContextRestore(state,0);
   return 0;
 }
 
-int PackosPacketUnregisterContext(PackosContext context,
-                                  PackosError* error)
+int PackosKernelPacketRemoveAddress(PackosContext context,
+                                    PackosAddress addr,
+                                    PackosError* error)
 {
-  int i=ntohl(context->os.config->addresses.self.quads[3]);
-  initPairs();
+  AddrSlot* slot;
+  PackosInterruptState state;
 
-  if ((i<0) || (i>=NUM_PAIRS))
+  if (!error) return -2;
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  slot=seekAddr(addr,0);
+  if (!(slot && (slot->context==context)))
     {
+      PackosKernelContextRestore(state,0);
       *error=packosErrorAddrUnregistered;
       return -1;
     }
 
-  if ((pairs[i].context==context)
-      && (PackosAddrEq(pairs[i].addr,context->os.config->addresses.self))
-      )
+  slot->state=addrSlotDeleted;
+  slot->context=0;
+  addrTable.numUsed--;
+  addrTable.numDeleted++;
+
+  PackosKernelContextRestore(state,0);
+  return 0;
+}
+
+int PackosPacketAddAddress(PackosContext context,
+                           PackosAddress addr,
+                           PackosError* error)
+{
+  if (!error) return -2;
+  if (!PackosKernelContextMayActFor(context))
     {
-      pairs[i].context=0;
-      return 0;
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
     }
 
-  *error=packosErrorAddrUnregistered;
-  return -1;
+  return PackosKernelPacketAddAddress(context,addr,error);
 }
 
-PackosContext PackosKernelPacketFindContextByAddr(PackosAddress addr,
-                                               PackosError* error)
+int PackosPacketRemoveAddress(PackosContext context,
+                              PackosAddress addr,
+                              PackosError* error)
+{
+  if (!error) return -2;
+  if (!PackosKernelContextMayActFor(context))
+    {
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
+    }
+
+  return PackosKernelPacketRemoveAddress(context,addr,error);
+}
+
+/* Must be called with interrupts blocked.  Returns true if context was
+ *  a member.  Frees the group, and its address, when the last member
+ *  leaves.
+ */
+static bool leaveGroup(AddrSlot* slot,
+                       PackosContext context)
+{
+  McastGroup* group=slot->group;
+  unsigned int i;
+
+  for (i=0; i<group->numMembers; i++)
+    if (group->members[i]==context)
+      break;
+
+  if (i==group->numMembers)
+    return false;
+
+  group->members[i]=group->members[--(group->numMembers)];
+  if (!(group->numMembers))
+    {
+      group->inUse=false;
+      slot->group=0;
+      slot->state=addrSlotDeleted;
+      addrTable.numUsed--;
+      addrTable.numDeleted++;
+    }
+
+  return true;
+}
+
+int PackosPacketMcastJoin(PackosContext context,
+                          PackosAddress group,
+                          PackosError* error)
 {
-  int i=ntohl(addr.quads[3]);
+  AddrSlot* slot=0;
+  PackosInterruptState state;
+  McastGroup* g;
+  unsigned int i;
+
+  if (!error) return -2;
+  if (!(context && PackosAddrIsMcast(group)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+  if (!PackosKernelContextMayActFor(context))
+    {
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
 
-  if ((i<0) || (i>=NUM_PAIRS))
+  if (!seekAddr(group,&slot))
     {
+      for (i=0; i<PACKOS_KERNEL_PACKET_MAXGROUPS; i++)
+        if (!(mcastGroups[i].inUse))
+          break;
+
+      if ((i==PACKOS_KERNEL_PACKET_MAXGROUPS)
+          || (addrTable.numUsed>=ADDR_TABLE_MAX_LOAD)
+          )
+        {
+          PackosKernelContextRestore(state,0);
+          *error=packosErrorAddrRegistryFull;
+          return -1;
+        }
+
+      if ((!slot)
+          || ((addrTable.numUsed+addrTable.numDeleted)>=ADDR_TABLE_MAX_LOAD)
+          )
+        {
+          rebuildAddrTable();
+          seekAddr(group,&slot);
+        }
+
+      g=&(mcastGroups[i]);
+      g->inUse=true;
+      g->numMembers=0;
+
+      if (slot->state==addrSlotDeleted)
+        addrTable.numDeleted--;
+      slot->addr=group;
+      slot->context=0;
+      slot->group=g;
+      slot->state=addrSlotUsed;
+      addrTable.numUsed++;
+    }
+  else
+    {
+      slot=seekAddr(group,0);
+      g=slot->group;
+    }
+
+  for (i=0; i<g->numMembers; i++)
+    if (g->members[i]==context)
+      {
+        PackosKernelContextRestore(state,0);
+        return 0;
+      }
+
+  if (g->numMembers>=PACKOS_KERNEL_PACKET_MAXADDRS)
+    {
+      PackosKernelContextRestore(state,0);
+      *error=packosErrorAddrRegistryFull;
+      return -1;
+    }
+
+  g->members[g->numMembers++]=context;
+
+  PackosKernelContextRestore(state,0);
+  return 0;
+}
+
+int PackosPacketMcastLeave(PackosContext context,
+                           PackosAddress group,
+                           PackosError* error)
+{
+  AddrSlot* slot;
+  PackosInterruptState state;
+
+  if (!error) return -2;
+  if (!(context && PackosAddrIsMcast(group)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+  if (!PackosKernelContextMayActFor(context))
+    {
+      *error=packosErrorKernelPermissionDenied;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  slot=seekAddr(group,0);
+  if (!(slot && slot->group && leaveGroup(slot,context)))
+    {
+      PackosKernelContextRestore(state,0);
       *error=packosErrorAddrUnregistered;
-      return 0;
+      return -1;
     }
 
-  initPairs();
+  PackosKernelContextRestore(state,0);
+  return 0;
+}
 
-  if (!(pairs[i].context))
+int PackosPacketRegisterContext(PackosContext context,
+                                PackosError* error)
+{
+  return PackosKernelPacketAddAddress(context,
+                                      context->os.config->addresses.self,
+                                      error);
+}
+
+/* Drops every address context had, not just its own. */
+int PackosPacketUnregisterContext(PackosContext context,
+                                  PackosError* error)
+{
+  unsigned int i;
+  bool found=false;
+  PackosInterruptState state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  for (i=0; i<ADDR_TABLE_SIZE; i++)
+    {
+      AddrSlot* slot=&(addrTable.slots[i]);
+      if (slot->state!=addrSlotUsed) continue;
+
+      if (slot->group)
+        leaveGroup(slot,context);
+      else
+        {
+          if (slot->context==context)
+            {
+              slot->state=addrSlotDeleted;
+              slot->context=0;
+              addrTable.numUsed--;
+              addrTable.numDeleted++;
+              found=true;
+            }
+        }
+    }
+
+  PackosKernelContextRestore(state,0);
+
+  if (!found)
     {
       *error=packosErrorAddrUnregistered;
-      return 0;
+      return -1;
     }
 
-  if (!(PackosAddrEq(pairs[i].addr,addr)))
+  return 0;
+}
+
+PackosContext PackosKernelPacketFindContextByAddr(PackosAddress addr,
+                                               PackosError* error)
+{
+  AddrSlot* slot=seekAddr(addr,0);
+  if (!(slot && slot->context))
     {
       *error=packosErrorAddrUnregistered;
       return 0;
     }
 
   *error=packosErrorNone;
-  return pairs[i].context;
+  return slot->context;
 }
 
 int PackosPacketSend(PackosPacket* packet,
@@ -129,26 +480,17 @@ int PackosPacketSend(PackosPacket* packet,
 
   packet->packos.src=PackosContextGetAddr(PackosKernelContextCurrent(error),
                                           error);
-  return PackosPacketSendFromKernel(packet,yieldToRecipient,error);
+  if (PackosPacketSendFromKernel(packet,yieldToRecipient,error)<0)
+    return -1;
+
+  PackosKernelContextPreemptIfPending();
+  return 0;
 }
 
-int PackosPacketSendFromKernel(PackosPacket* packet,
-                               bool yieldToRecipient,
-                               PackosError* error)
+static PackosContext findRecipient(PackosAddress dest,
+                                   PackosError* error)
 {
-  PackosContext recipient;
-  PackosInterruptState state;
-
-  if (!packet)
-    {
-      *error=packosErrorInvalidArg;
-      return -1;
-    }
-
-  state=PackosKernelContextBlock(error);
-  if ((*error)!=packosErrorNone) return -1;
-
-  recipient=PackosKernelPacketFindContextByAddr(packet->packos.dest,error);
+  PackosContext recipient=PackosKernelPacketFindContextByAddr(dest,error);
   if (!recipient)
     {
 #ifdef DEBUG
@@ -156,121 +498,501 @@ int PackosPacketSendFromKernel(PackosPacket* packet,
       const char* addrStr=buff;
       {
 	PackosError tmp;
-	if (PackosAddrToString(packet->packos.dest,buff,sizeof(buff),&tmp)<0)
+	if (PackosAddrToString(dest,buff,sizeof(buff),&tmp)<0)
 	  addrStr=PackosErrorToString(tmp);
       }
       kprintf("PackosPacketSendFromKernel(): PackosKernelPacketFindContextByAddr(%s): %s\n",
  	      addrStr,
 	      PackosErrorToString(*error));
 #endif
-      PackosKernelContextRestore(state,0);
       if ((*error)==packosErrorAddrUnregistered)
         *error=packosErrorAddressUnreachable;
-      return -1;
+      return 0;
     }
 
+  return recipient;
+}
+
+/* Must be called with interrupts blocked. */
+static int deliver(PackosPacket* packet,
+                   PackosContext recipient,
+                   PackosError* error)
+{
 #ifdef PACKETS_ARE_PAGES
   {
     PackosPageEntry entry=PackosEntryOfPage(packet,error);
     if (!entry)
-      {
-        PackosKernelContextRestore(state,0);
-        return -1;
-      }
+      return -1;
 
     if (PackosPageEntryTransfer(entry,PackosKernelContextCurrent(error),
                                 recipient,error)<0)
-      {
-        PackosKernelContextRestore(state,0);
-        return -1;
-      }
+      return -1;
   }
 #endif
 
   if (PackosKernelContextInsertPacket(recipient,packet,error)<0)
     {
-      /*kprintf("PackosPacketSendFromKernel(): PackosKernelContextInsertPacket(): %s\n",
-        PackosErrorToString(*error));*/
+      /*kprintf("PackosPacketSendFromKernel(): PackosKernelContextInsertPacket(): %s\n",
+        PackosErrorToString(*error));*/
+      return -1;
+    }
+
+  PACKOS_TRACE_PACKET(packosTraceEventSend,recipient,packet);
+  return 0;
+}
+
+/* Must be called with interrupts blocked.  Every member of dest's
+ *  group except the sender gets the same page; it is freed when the
+ *  last of them frees it.  Members whose queues are full miss out.
+ *  Sets *firstWoken to the first blocked member woken, if any.
+ *  Returns the number of members that got the packet, which then
+ *  belongs to them; or <0 if none did, with the error a unicast send
+ *  to the last one tried would have given.
+ */
+static int deliverMcast(PackosPacket* packet,
+                        PackosContext* firstWoken,
+                        PackosError* error)
+{
+  AddrSlot* slot=seekAddr(packet->packos.dest,0);
+  McastGroup* group;
+  unsigned int i,numDelivered=0;
+  PackosError lastError=packosErrorAddressUnreachable;
+
+  if (!(slot && slot->group))
+    {
+      *error=packosErrorAddressUnreachable;
+      return -1;
+    }
+
+  group=slot->group;
+  for (i=0; i<group->numMembers; i++)
+    {
+      PackosContext member=group->members[i];
+      PackosError tmp;
+
+      if (PackosAddrEq(member->os.config->addresses.self,packet->packos.src))
+        continue;
+
+      /* If the page can't be shared any further, those who have it
+       *  keep it.
+       */
+      if (numDelivered && (packetAddRef(packet,&tmp)<0))
+        break;
+
+      if (PackosKernelContextInsertPacket(member,packet,&tmp)<0)
+        {
+          lastError=tmp;
+          if (numDelivered)
+            dropSharedRef(packet,&tmp);
+          continue;
+        }
+
+      PACKOS_TRACE_PACKET(packosTraceEventSend,member,packet);
+      numDelivered++;
+      if (PackosKernelContextBlocking(member,&tmp))
+        {
+          PackosKernelContextSetBlocking(member,false,&tmp);
+          if (firstWoken && !(*firstWoken))
+            *firstWoken=member;
+        }
+    }
+
+  if (!numDelivered)
+    {
+      *error=lastError;
+      return -1;
+    }
+
+  *error=packosErrorNone;
+  return numDelivered;
+}
+
+int PackosPacketSendFromKernel(PackosPacket* packet,
+                               bool yieldToRecipient,
+                               PackosError* error)
+{
+  PackosContext recipient;
+  PackosInterruptState state;
+
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  if (PackosAddrIsMcast(packet->packos.dest))
+    {
+      PackosContext woken=0;
+      if (deliverMcast(packet,&woken,error)<0)
+        {
+          PackosKernelContextRestore(state,0);
+          return -1;
+        }
+
+      if (yieldToRecipient && woken)
+        PackosKernelContextYieldTo(woken,error);
+
+      PackosKernelContextRestore(state,0);
+      return 0;
+    }
+
+  recipient=findRecipient(packet->packos.dest,error);
+  if (!recipient)
+    {
+      PackosKernelContextRestore(state,0);
+      return -1;
+    }
+
+  if (deliver(packet,recipient,error)<0)
+    {
+      PackosKernelContextRestore(state,0);
+      return -1;
+    }
+
+  if (PackosKernelContextBlocking(recipient,error))
+    {
+      PackosKernelContextSetBlocking(recipient,false,error);
+      if (yieldToRecipient)
+        PackosKernelContextYieldTo(recipient,error);
+    }
+
+  PackosKernelContextRestore(state,0);
+  return 0;
+}
+
+int PackosPacketSendWait(PackosPacket* packet,
+                         bool yieldToRecipient,
+                         PackosError* error)
+{
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  while (PackosPacketSend(packet,yieldToRecipient,error)<0)
+    {
+      PackosContext recipient;
+
+      if (((*error)!=packosErrorPacketQueueFull)
+          || PackosAddrIsMcast(packet->packos.dest)
+          )
+        {
+          PackosKernelContextStopWaiting();
+          return -1;
+        }
+
+      recipient=PackosKernelPacketFindContextByAddr(packet->packos.dest,
+                                                    error);
+      if (!recipient)
+        {
+          PackosKernelContextStopWaiting();
+          *error=packosErrorAddressUnreachable;
+          return -1;
+        }
+
+      if (PackosKernelContextWaitForQueueSpace(recipient,error)<0)
+        {
+          PackosKernelContextStopWaiting();
+          return -1;
+        }
+    }
+
+  PackosKernelContextStopWaiting();
+  return 0;
+}
+
+int PackosPacketSendBatch(PackosPacket** packets,
+                          unsigned int numPackets,
+                          bool yieldToRecipient,
+                          PackosError* error)
+{
+  unsigned int i;
+  PackosAddress src;
+
+  if (!(packets && numPackets))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  src=PackosContextGetAddr(PackosKernelContextCurrent(error),error);
+  for (i=0; i<numPackets; i++)
+    {
+      if (!(packets[i]))
+        {
+          *error=packosErrorInvalidArg;
+          return -1;
+        }
+      packets[i]->packos.src=src;
+    }
+
+  {
+    int res=PackosPacketSendBatchFromKernel(packets,numPackets,
+                                            yieldToRecipient,error);
+    if (res>0)
+      PackosKernelContextPreemptIfPending();
+    return res;
+  }
+}
+
+int PackosPacketSendBatchFromKernel(PackosPacket** packets,
+                                    unsigned int numPackets,
+                                    bool yieldToRecipient,
+                                    PackosError* error)
+{
+  PackosContext recipient=0;
+  PackosContext lastWoken=0;
+  PackosInterruptState state;
+  unsigned int i;
+
+  if (!(packets && numPackets))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  for (i=0; i<numPackets; i++)
+    {
+      /* Consecutive packets to the same destination share one lookup,
+       *  and the recipient is woken once, when its run ends.
+       */
+      if ((!recipient)
+          || (!(PackosAddrEq(packets[i]->packos.dest,
+                             packets[i-1]->packos.dest)))
+          )
+        {
+          if (recipient && PackosKernelContextBlocking(recipient,error))
+            {
+              PackosKernelContextSetBlocking(recipient,false,error);
+              lastWoken=recipient;
+            }
+          recipient=0;
+
+          if (PackosAddrIsMcast(packets[i]->packos.dest))
+            {
+              PackosContext woken=0;
+              if (deliverMcast(packets[i],&woken,error)<0)
+                break;
+              if (woken)
+                lastWoken=woken;
+              continue;
+            }
+
+          recipient=findRecipient(packets[i]->packos.dest,error);
+          if (!recipient)
+            break;
+        }
+
+      if (deliver(packets[i],recipient,error)<0)
+        break;
+    }
+
+  /* *error still says why the loop stopped, if it did. */
+  {
+    PackosError tmp;
+    if (recipient && (i>0) && PackosKernelContextBlocking(recipient,&tmp))
+      {
+        PackosKernelContextSetBlocking(recipient,false,&tmp);
+        lastWoken=recipient;
+      }
+  }
+
+  if (i==0)
+    {
+      PackosKernelContextRestore(state,0);
+      return -1;
+    }
+
+  if (i==numPackets)
+    *error=packosErrorNone;
+
+  if (yieldToRecipient && lastWoken)
+    {
+      PackosError tmp;
+      PackosKernelContextYieldTo(lastWoken,&tmp);
+    }
+
+  PackosKernelContextRestore(state,0);
+  return i;
+}
+
+PackosPacket* PackosPacketReceive(PackosError* error)
+{
+  return PackosPacketReceiveOrYieldTo(0,error);
+}
+
+int PackosPacketReceiveBatch(PackosPacket** packets,
+                             unsigned int maxPackets,
+                             PackosError* error)
+{
+  PackosContext current;
+  int res;
+
+  PackosInterruptState state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  current=PackosKernelContextCurrent(error);
+  res=PackosKernelContextExtractPackets(current,packets,maxPackets,error);
+  while ((res<0) && ((*error)==packosErrorNoPacketAvail))
+    {
+      PackosKernelContextSetBlocking(current,true,error);
+      PackosKernelContextYield();
+      res=PackosKernelContextExtractPackets(current,packets,maxPackets,error);
+    }
+
+  PackosKernelContextRestore(state,0);
+  return res;
+}
+
+PackosPacket* PackosPacketReceiveOrYieldTo(PackosContext context,
+                                           PackosError* error)
+{
+  PackosContext current;
+  PackosPacket* res;
+
+  PackosInterruptState state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return 0;
+
+  current=PackosKernelContextCurrent(error);
+  res=PackosKernelContextExtractPacket(current,error);
+  while (!res)
+    {
+      if (context && PackosKernelContextFinished(context,error))
+        {
+          PackosKernelContextRestore(state,0);
+          *error=packosErrorContextFinished;
+          return 0;
+        }
+
+      if (context && PackosKernelContextBlocking(context,error))
+        {
+          PackosError tmp;
+          kprintf("<%s>: PackosKernelPacketReceiveOrYieldTo(): context %s is blocked\n",
+                  PackosContextGetOwnName(&tmp),
+                  PackosContextGetName(context,&tmp));
+          PackosKernelContextRestore(state,0);
+          *error=packosErrorYieldedToBlocked;
+          return 0;
+        }
+
+      PackosKernelContextSetBlocking(current,true,error);
+      if (context)
+        PackosKernelContextYieldTo(context,error);
+      else
+        PackosKernelContextYield();
+
+      res=PackosKernelContextExtractPacket(current,error);
+      if (!res)
+        {
+          if (context && ((*error)==packosErrorNoPacketAvail))
+            *error=packosErrorContextYieldedBack;
+          break;
+        }
+    }
+
+  PackosKernelContextRestore(state,0);
+  return res;
+}
+
+PackosPacket* PackosPacketCall(PackosPacket* request,
+                               PackosError* error)
+{
+  PackosContext current,server;
+  PackosAddress serverAddr;
+  PackosPacket* res;
+  PackosInterruptState state;
+
+  if (!request)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  if (PackosAddrIsMcast(request->packos.dest))
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return 0;
+
+  current=PackosKernelContextCurrent(error);
+  request->packos.src=PackosContextGetAddr(current,error);
+
+  server=findRecipient(request->packos.dest,error);
+  if (!server)
+    {
+      PackosKernelContextRestore(state,0);
+      return 0;
+    }
+
+  /* The request may have gone to one of the server's extra addresses,
+   *  but its reply comes from its own.
+   */
+  serverAddr=PackosContextGetAddr(server,error);
+
+  if (server==current)
+    {
       PackosKernelContextRestore(state,0);
-      return -1;
+      *error=packosErrorInvalidArg;
+      return 0;
     }
 
-  if (PackosKernelContextBlocking(recipient,error))
+  if (deliver(request,server,error)<0)
     {
-      PackosKernelContextSetBlocking(recipient,false,error);
-      if (yieldToRecipient)
-        PackosKernelContextYieldTo(recipient,error);
+      PackosKernelContextRestore(state,0);
+      return 0;
     }
 
-  PackosKernelContextRestore(state,0);
-  return 0;
-}
-
-PackosPacket* PackosPacketReceive(PackosError* error)
-{
-  return PackosPacketReceiveOrYieldTo(0,error);
-}
-
-PackosPacket* PackosPacketReceiveOrYieldTo(PackosContext context,
-                                           PackosError* error)
-{
-  PackosContext current;
-  PackosPacket* res;
-
-  PackosInterruptState state=PackosKernelContextBlock(error);
-  if ((*error)!=packosErrorNone) return 0;
+  if (PackosKernelContextBlocking(server,error))
+    PackosKernelContextSetBlocking(server,false,error);
 
-  current=PackosKernelContextCurrent(error);
-  res=PackosKernelContextExtractPacket(current,error);
+  /* Whatever else arrives meanwhile stays queued for
+   *  PackosPacketReceive().  While the server can run, run it
+   *  directly instead of going through the scheduler.
+   */
+  res=PackosKernelContextExtractPacketFrom(current,serverAddr,error);
   while (!res)
     {
-      if (context && PackosKernelContextFinished(context,error))
+      if (PackosKernelContextFinished(server,error))
         {
           PackosKernelContextRestore(state,0);
           *error=packosErrorContextFinished;
           return 0;
         }
 
-      if (context && PackosKernelContextBlocking(context,error))
-        {
-          PackosError tmp;
-          kprintf("<%s>: PackosKernelPacketReceiveOrYieldTo(): context %s is blocked\n",
-                  PackosContextGetOwnName(&tmp),
-                  PackosContextGetName(context,&tmp));
-          PackosKernelContextRestore(state,0);
-          *error=packosErrorYieldedToBlocked;
-          return 0;
-        }
-
       PackosKernelContextSetBlocking(current,true,error);
-      if (context)
-        PackosKernelContextYieldTo(context,error);
-      else
+      if (PackosKernelContextBlocking(server,error))
         PackosKernelContextYield();
+      else
+        PackosKernelContextYieldTo(server,error);
 
-      res=PackosKernelContextExtractPacket(current,error);
-      if (!res)
-        {
-          if (context && ((*error)==packosErrorNoPacketAvail))
-            *error=packosErrorContextYieldedBack;
-          break;
-        }
+      res=PackosKernelContextExtractPacketFrom(current,serverAddr,error);
     }
 
   PackosKernelContextRestore(state,0);
   return res;
 }
 
+/* Pages are reachable from every context through the pool's global
+ *  logical range, so handing one out needs no per-page mapping.  A
+ *  page sitting in some context's cache is still inUse as far as the
+ *  pool is concerned; cached marks it as free within that cache.
+ */
 typedef struct {
-  bool inUse;
-  union {
-    struct {
-      uint16_t next,prev;
-    } avail;
-    struct {
-      PackosMemoryLogicalRange logical;
-    } inUse;
-  } u;
+  bool inUse,cached;
+  uint16_t refs;
+  struct {
+    uint16_t next,prev;
+  } avail;
 } PacketInPoolMetadata;
 
 #define POOL_SIZE 256
@@ -280,6 +1002,7 @@ struct {
   struct {
     PackosMemoryPhysicalRange physical;
     PackosMemoryLogicalRange logical;
+    byte* base;
   } packets;
   struct {
     uint16_t first,last;
@@ -313,26 +1036,31 @@ static int initPool(PackosError* error)
     }
 
   packetPool.packets.logical
-    =PackosMemoryLogicalRangeNew(packetPool.packets.physical,
-                                 0,packosMemoryFlagGlobal,
-                                 0,0,0,
-                                 error);
+    =PackosMemoryLogicalRangeNewK(packetPool.packets.physical,
+                                  packosMemoryFlagGlobal,
+                                  0,0,0,
+                                  error);
   if (!(packetPool.packets.logical))
     {
-      kprintf("packetK:initPool(): PackosMemoryLogicalRangeNew(): %s\n",
+      kprintf("packetK:initPool(): PackosMemoryLogicalRangeNewK(): %s\n",
               PackosErrorToString(*error));
       kprintf("Cannot initialize the packet pool; must halt.\n");
       asm("hlt");
     }
 
+  packetPool.packets.base
+    =(byte*)(PackosMemoryLogicalRangeGetAddr(packetPool.packets.logical,
+                                             error));
+
   for (i=0; i<POOL_SIZE; i++)
     {
       packetPool.metadata[i].inUse=false;
-      packetPool.metadata[i].u.avail.next=i+1;
-      packetPool.metadata[i].u.avail.prev=i-1;
+      packetPool.metadata[i].cached=false;
+      packetPool.metadata[i].avail.next=i+1;
+      packetPool.metadata[i].avail.prev=i-1;
     }
-  packetPool.metadata[0].u.avail.prev=0xffffU;
-  packetPool.metadata[POOL_SIZE-1].u.avail.next=0xffffU;
+  packetPool.metadata[0].avail.prev=0xffffU;
+  packetPool.metadata[POOL_SIZE-1].avail.next=0xffffU;
 
   packetPool.avail.first=0;
   packetPool.avail.last=POOL_SIZE-1;
@@ -346,13 +1074,10 @@ static int initPool(PackosError* error)
 static int packetToIndex(PackosPacket* packet,
                          PackosError* error)
 {
-  byte* base
-    =(PackosPacket*)
-    (PackosMemoryLogicalRangeGetAddr(packetPool.packets.logical,
-                                     error)
-     );
-  int res=(((byte*)packet)-base)/PACKOS_PAGE_SIZE;
-  if ((res<0) || (res>=POOL_SIZE))
+  int res=(((byte*)packet)-packetPool.packets.base)/PACKOS_PAGE_SIZE;
+  if ((((byte*)packet)<packetPool.packets.base)
+      || (res>=POOL_SIZE)
+      )
     {
       *error=packosErrorPacketNotInPool;
       return -1;
@@ -361,77 +1086,292 @@ static int packetToIndex(PackosPacket* packet,
   return res;
 }
 
-PackosPacket* PackosPacketAlloc(SizeType* sizeOut,
-                                PackosError* error)
+static PackosPacket* indexToPacket(int i)
 {
-  extern PackosContext currentContext;
+  return (PackosPacket*)(packetPool.packets.base+i*PACKOS_PAGE_SIZE);
+}
 
-  PackosPacket* res;
+/* Takes up to numPackets pages off the avail list, in one critical
+ *  section.  Returns the number taken, or <0 if the pool is empty.
+ */
+static int poolTake(PackosPacket** packets,
+                    unsigned int numPackets,
+                    PackosError* error)
+{
+  unsigned int n;
+  PackosInterruptState state;
+
+  if (initPool(error)<0) return -1;
+
+  state=PackosKernelContextBlock(error);
+  if ((*error)!=packosErrorNone) return -1;
+
+  for (n=0; (n<numPackets) && (packetPool.avail.first!=0xffffU); n++)
+    {
+      int i=packetPool.avail.first;
+
+      packetPool.avail.first=packetPool.metadata[i].avail.next;
+      if (packetPool.avail.first==0xffffU)
+        packetPool.avail.last=0xffffU;
+      else
+        packetPool.metadata[packetPool.avail.first].avail.prev=0xffffU;
+
+      packetPool.metadata[i].inUse=true;
+      packetPool.metadata[i].cached=false;
+      packetPool.metadata[i].refs=1;
+      packets[n]=indexToPacket(i);
+    }
+
+  PackosKernelContextRestore(state,0);
+
+  if (!n)
+    {
+      *error=packosErrorOutOfMemory;
+      return -1;
+    }
+
+  *error=packosErrorNone;
+  return n;
+}
+
+/* Returns numPackets pages to the avail list, in one critical section.
+ *  The caller has already checked that they are in the pool.
+ */
+static void poolGive(PackosPacket** packets,
+                     unsigned int numPackets,
+                     PackosError* error)
+{
+  unsigned int n;
   PackosInterruptState state=PackosKernelContextBlock(error);
-  if ((*error)!=packosErrorNone) return 0;
+  if ((*error)!=packosErrorNone) return;
+
+  for (n=0; n<numPackets; n++)
+    {
+      int i=(((byte*)(packets[n]))-packetPool.packets.base)/PACKOS_PAGE_SIZE;
+
+      packetPool.metadata[i].inUse=false;
+      packetPool.metadata[i].cached=false;
+      packetPool.metadata[i].avail.next=packetPool.avail.first;
+      packetPool.metadata[i].avail.prev=0xffffU;
+      packetPool.avail.first=i;
+      if (packetPool.metadata[i].avail.next==0xffffU)
+        packetPool.avail.last=i;
+      else
+        packetPool.metadata[packetPool.metadata[i].avail.next].avail.prev=i;
+    }
+
+  PackosKernelContextRestore(state,0);
+}
 
-  if (initPool(error)<0) return 0;
+static void initPacket(PackosPacket* packet)
+{
+  packet->ipv6.versionAndTrafficClassAndFlowLabel=0x60000000;
+  packet->ipv6.payloadLength=0;
+  packet->ipv6.nextHeader=59;
+  packet->ipv6.hopLimit=255;
 
   {
-    uint16_t next;
-    int i=packetPool.avail.first;
-    if (i==0xffffU)
-      {
-        *error=packosErrorOutOfMemory;
-        PackosKernelContextRestore(state,0);
-        return 0;
-      }
+    uint32_t* tail=(uint32_t*)(((byte*)packet)
+                               +PACKOS_PAGE_SIZE-PACKOS_PACKET_TAILROOM);
+    int n;
+    for (n=0; n<PACKOS_PACKET_TAILROOM/sizeof(uint32_t); n++)
+      tail[n]=0;
+  }
+}
 
-    next=packetPool.metadata[i].u.avail.next;
+/* Checks that packet came from the pool and is still allocated.
+ *  Returns its index, or <0.
+ */
+static int checkAllocated(PackosPacket* packet,
+                          const char* func,
+                          PackosError* error)
+{
+  int i=packetToIndex(packet,error);
+  if (i<0)
+    {
+      PackosError tmp;
+      kprintf("%s(): packetToIndex(0x%x): %s\n",
+              func,packet,PackosErrorToString(*error));
+      PackosKernelContextBlock(&tmp);
+      asm("cli; hlt");
+      return -1;
+    }
 
-    packetPool.metadata[i].u.inUse.logical
-      =PackosMemoryLogicalRangeNew(packetPool.packets.physical,
-                                   currentContext,
-                                   packosMemoryFlagWritable,
-                                   0,i*PACKOS_PAGE_SIZE,PACKOS_PAGE_SIZE,
-                                   error);
-    if (!(packetPool.metadata[i].u.inUse.logical))
-      {
-        PackosKernelContextRestore(state,0);
-        return 0;
-      }
+  if ((!(packetPool.metadata[i].inUse))
+      || packetPool.metadata[i].cached
+      )
+    {
+      *error=packosErrorAlreadyFreed;
+      return -1;
+    }
 
-    res
-      =(PackosPacket*)
-      (PackosMemoryLogicalRangeGetAddr(packetPool.metadata[i].u.inUse.logical,
-                                       error
-                                       )
-       )
-      ;
-    if (!res)
-      {
-        PackosError tmp;
-        PackosMemoryLogicalRangeFree(packetPool.metadata[i].u.inUse.logical,
-                                     currentContext,
-                                     &tmp);
-        PackosKernelContextRestore(state,0);
-        return 0;
-      }
+  return i;
+}
 
-    packetPool.avail.first=next;
-    if (packetPool.avail.first==0xffffU)
-      packetPool.avail.last=0xffffU;
-    else
-      packetPool.metadata[packetPool.avail.first].u.avail.prev=0xffffU;
+static int packetAddRef(PackosPacket* packet,
+                        PackosError* error)
+{
+  int i=packetToIndex(packet,error);
+  if (i<0) return -1;
 
-    packetPool.metadata[i].inUse=true;
-  }
+  packetPool.metadata[i].refs++;
+  return 0;
+}
 
-  res->ipv6.versionAndTrafficClassAndFlowLabel=0x60000000;
-  res->ipv6.payloadLength=0;
-  res->ipv6.nextHeader=59;
-  res->ipv6.hopLimit=255;
+/* If other holders share packet, drops this one's reference and
+ *  returns true.  A page with only one holder can't change under
+ *  us, so that case needs no critical section.
+ */
+static bool dropSharedRef(PackosPacket* packet,
+                          PackosError* error)
+{
+  int i=packetToIndex(packet,error);
+  bool res=false;
+  PackosInterruptState state;
 
-  *error=packosErrorNone;
+  if (packetPool.metadata[i].refs<=1)
+    return false;
 
+  state=PackosKernelContextBlock(error);
+  if (packetPool.metadata[i].refs>1)
+    {
+      packetPool.metadata[i].refs--;
+      res=true;
+    }
   PackosKernelContextRestore(state,0);
 
-  if (sizeOut) *sizeOut=PACKOS_PAGE_SIZE;
+  *error=packosErrorNone;
+  return res;
+}
+
+bool PackosPacketIsShared(PackosPacket* packet,
+                          PackosError* error)
+{
+  int i=packetToIndex(packet,error);
+  if (i<0) return false;
+
+  *error=packosErrorNone;
+  return (packetPool.metadata[i].refs>1);
+}
+
+PackosPacket* PackosPacketUnshare(PackosPacket* packet,
+                                  PackosError* error)
+{
+  PackosPacket* res;
+
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  if (!(PackosPacketIsShared(packet,error)))
+    {
+      if ((*error)!=packosErrorNone) return 0;
+      return packet;
+    }
+
+  res=PackosPacketAlloc(0,error);
+  if (!res) return 0;
+
+  {
+    uint32_t* to=(uint32_t*)res;
+    const uint32_t* from=(const uint32_t*)packet;
+    unsigned int n;
+    for (n=0; n<PACKOS_PAGE_SIZE/sizeof(uint32_t); n++)
+      to[n]=from[n];
+  }
+
+  PackosPacketFree(packet,error);
+  if ((*error)!=packosErrorNone)
+    {
+      PackosError tmp;
+      PackosPacketFree(res,&tmp);
+      return 0;
+    }
+
+  return res;
+}
+
+/* Bypasses the per-context caches.  For use from interrupt handlers,
+ *  which run on behalf of whatever context they interrupted.
+ */
+PackosPacket* PackosKernelPacketAlloc(PackosError* error)
+{
+  PackosPacket* res;
+
+  if (poolTake(&res,1,error)<0) return 0;
+
+  initPacket(res);
+  PACKOS_TRACE_PACKET(packosTraceEventAlloc,0,0);
+  return res;
+}
+
+void PackosKernelPacketFree(PackosPacket* packet,
+                            PackosError* error)
+{
+  if (!error) return;
+
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return;
+    }
+
+  if (checkAllocated(packet,"PackosKernelPacketFree",error)<0)
+    return;
+
+  PACKOS_TRACE_PACKET(packosTraceEventFree,0,packet);
+
+  if (dropSharedRef(packet,error))
+    return;
+
+  poolGive(&packet,1,error);
+}
+
+/* The common case is served from the current context's cache without
+ *  blocking interrupts.  Only interrupt handlers could preempt us, and
+ *  they never touch a context's cache.
+ */
+PackosPacket* PackosPacketAlloc(SizeType* sizeOut,
+                                PackosError* error)
+{
+  extern PackosContext currentContext;
+
+  PackosPacket* res;
+
+  if (!currentContext)
+    {
+      res=PackosKernelPacketAlloc(error);
+      if (!res) return 0;
+    }
+  else
+    {
+      PackosPacketCache* cache=&(currentContext->os.packetCache);
+
+      if (cache->numPackets)
+        cache->stats.hits++;
+      else
+        {
+          int n;
+
+          cache->stats.misses++;
+          n=poolTake(cache->packets,PACKOS_PACKET_CACHE_BATCH,error);
+          if (n<0) return 0;
+
+          cache->numPackets=n;
+          cache->stats.refills++;
+        }
+
+      res=cache->packets[--(cache->numPackets)];
+      packetPool.metadata[packetToIndex(res,error)].cached=false;
+      initPacket(res);
+      PACKOS_TRACE_PACKET(packosTraceEventAlloc,currentContext,0);
+    }
+
+  *error=packosErrorNone;
+
+  if (sizeOut) *sizeOut=PACKOS_PAGE_SIZE-PACKOS_PACKET_TAILROOM;
 
   return res;
 }
@@ -439,8 +1379,10 @@ PackosPacket* PackosPacketAlloc(SizeType* sizeOut,
 void PackosPacketFree(PackosPacket* packet,
                       PackosError* error)
 {
+  extern PackosContext currentContext;
+
   int i;
-  PackosInterruptState state;
+  PackosPacketCache* cache;
 
   if (!error) return;
 
@@ -450,39 +1392,78 @@ void PackosPacketFree(PackosPacket* packet,
       return;
     }
 
-  state=PackosKernelContextBlock(error);
-  if ((*error)!=packosErrorNone) return;
-
-  i=packetToIndex(packet,error);
-  if (i<0)
+  if (!currentContext)
     {
-      PackosError tmp;
-      kprintf("PackosPacketFree(): packetToIndex(0x%x): %s\n",
-              packet,PackosErrorToString(*error));
-      PackosKernelContextRestore(state,&tmp);
-      asm("cli; hlt");
+      PackosKernelPacketFree(packet,error);
       return;
     }
 
-  if (!(packetPool.metadata[i].inUse))
+  i=checkAllocated(packet,"PackosPacketFree",error);
+  if (i<0) return;
+
+  PACKOS_TRACE_PACKET(packosTraceEventFree,currentContext,packet);
+
+  if (dropSharedRef(packet,error))
+    return;
+
+  cache=&(currentContext->os.packetCache);
+  if (cache->numPackets>=PACKOS_PACKET_CACHE_LEN)
+    {
+      /* Hand back the oldest half, keeping the pages most likely
+       *  to still be in the data cache.
+       */
+      unsigned int j;
+
+      poolGive(cache->packets,PACKOS_PACKET_CACHE_BATCH,error);
+      for (j=PACKOS_PACKET_CACHE_BATCH; j<cache->numPackets; j++)
+        cache->packets[j-PACKOS_PACKET_CACHE_BATCH]=cache->packets[j];
+      cache->numPackets-=PACKOS_PACKET_CACHE_BATCH;
+      cache->stats.drains++;
+    }
+
+  packetPool.metadata[i].cached=true;
+  cache->packets[cache->numPackets++]=packet;
+
+  *error=packosErrorNone;
+}
+
+int PackosKernelPacketCacheDrain(PackosContext context,
+                                 PackosError* error)
+{
+  PackosPacketCache* cache;
+
+  if (!error) return -2;
+  if (!context)
     {
-      *error=packosErrorAlreadyFreed;
-      return;
+      *error=packosErrorInvalidArg;
+      return -1;
     }
 
-  packetPool.metadata[i].inUse=false;
-  packetPool.metadata[i].u.avail.next=packetPool.avail.first;
-  packetPool.metadata[i].u.avail.prev=0xffffU;
-  packetPool.avail.first=i;
-  if (packetPool.metadata[i].u.avail.next==0xffffU)
-    packetPool.avail.last=i;
-  else
-    packetPool.metadata[packetPool.metadata[i].u.avail.next].u.avail.prev=i;
+  cache=&(context->os.packetCache);
+  if (cache->numPackets)
+    {
+      poolGive(cache->packets,cache->numPackets,error);
+      cache->numPackets=0;
+      cache->stats.drains++;
+    }
 
-  {
-    PackosError tmp;
-    PackosKernelContextRestore(state,&tmp);
-  }
+  *error=packosErrorNone;
+  return 0;
+}
+
+int PackosPacketCacheGetStats(PackosPacketCacheStats* stats,
+                              PackosError* error)
+{
+  extern PackosContext currentContext;
+
+  if (!error) return -2;
+  if (!(stats && currentContext))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
+  *stats=currentContext->os.packetCache.stats;
   *error=packosErrorNone;
+  return 0;
 }
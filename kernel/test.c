@@ -1,6 +1,8 @@
 #include <packos/interrupts.h>
 #include <packos/memory.h>
 #include <packos/sys/contextP.h>
+#include <packos/sys/clockP.h>
+#include <packos/checksums.h>
 #include "kprintfK.h"
 
 #define N (10)
@@ -96,6 +98,170 @@ static void idle(void)
   while (1);
 }
 
+/* A sender that fills a small queue with PackosPacketSendWait() must
+ *  come back off the kernel's woken list once the recipient drains it;
+ *  that's the only way a scheduler finds out it can run again.
+ */
+#define WAIT_QUEUE_LEN 2
+#define WAIT_NUM_PACKETS 6
+
+static PackosAddress waitRecipientAddr;
+static int waitNumSent,waitNumReceived;
+
+static void waitSender(void)
+{
+  PackosError error;
+  int i;
+
+  for (i=0; i<WAIT_NUM_PACKETS; i++)
+    {
+      PackosPacket* packet=PackosPacketAlloc(0,&error);
+      if (!packet)
+        {
+          kprintf("waitSender: PackosPacketAlloc(): %s\n",
+                  PackosErrorToString(error));
+          return;
+        }
+
+      packet->packos.dest=waitRecipientAddr;
+      if (PackosPacketSendWait(packet,false,&error)<0)
+        {
+          kprintf("waitSender: PackosPacketSendWait(): %s\n",
+                  PackosErrorToString(error));
+          PackosPacketFree(packet,&error);
+          return;
+        }
+
+      waitNumSent++;
+    }
+}
+
+static void waitRecipient(void)
+{
+  PackosError error;
+
+  while (waitNumReceived<WAIT_NUM_PACKETS)
+    {
+      PackosPacket* packet=PackosPacketReceive(&error);
+      if (!packet)
+        {
+          kprintf("waitRecipient: PackosPacketReceive(): %s\n",
+                  PackosErrorToString(error));
+          return;
+        }
+
+      waitNumReceived++;
+      PackosPacketFree(packet,&error);
+    }
+}
+
+/* Runs the two as SchedulerBasic would: a context that blocks gets the
+ *  CPU again only once PackosKernelContextTakeWoken() hands it back.
+ */
+static bool testQueueSpaceWakeup(void)
+{
+  PackosError error;
+  PackosContext sender,recipient;
+  bool senderRunnable=true,recipientRunnable=true;
+  int round;
+
+  recipient=PackosContextNewWithQueueLen(waitRecipient,"waitRecipient",
+                                         WAIT_QUEUE_LEN,&error);
+  if (!recipient)
+    {
+      kprintf("PackosContextNewWithQueueLen(): %s\n",
+              PackosErrorToString(error));
+      return false;
+    }
+  waitRecipientAddr=PackosContextGetAddr(recipient,&error);
+
+  sender=PackosContextNew(waitSender,"waitSender",&error);
+  if (!sender)
+    {
+      kprintf("PackosContextNew(waitSender): %s\n",
+              PackosErrorToString(error));
+      return false;
+    }
+
+  while (PackosKernelContextTakeWoken(&error))
+    ;
+
+  for (round=0; round<4*WAIT_NUM_PACKETS; round++)
+    {
+      PackosContext woken;
+
+      if (PackosContextFinished(sender,&error)
+          && PackosContextFinished(recipient,&error))
+        break;
+
+      if (senderRunnable && !PackosContextFinished(sender,&error))
+        {
+          PackosContextYieldTo(sender,&error);
+          senderRunnable=!PackosKernelContextBlocking(sender,&error);
+        }
+
+      if (recipientRunnable && !PackosContextFinished(recipient,&error))
+        {
+          PackosContextYieldTo(recipient,&error);
+          recipientRunnable=!PackosKernelContextBlocking(recipient,&error);
+        }
+
+      while ((woken=PackosKernelContextTakeWoken(&error))!=0)
+        {
+          if (woken==sender)
+            senderRunnable=true;
+          else if (woken==recipient)
+            recipientRunnable=true;
+        }
+    }
+
+  if ((waitNumSent!=WAIT_NUM_PACKETS)
+      || (waitNumReceived!=WAIT_NUM_PACKETS)
+      )
+    {
+      kprintf("queue-space wakeup: FAILED: sent %d, received %d of %d\n",
+              waitNumSent,waitNumReceived,WAIT_NUM_PACKETS);
+      return false;
+    }
+
+  kprintf("queue-space wakeup: ok\n");
+  return true;
+}
+
+/* Rewrites one word of a buffer to each of a few values, and checks
+ *  that PackosChecksumUpdate16() agrees with summing it all again.
+ */
+static bool testChecksumUpdate(void)
+{
+  static const uint16_t newValues[]={0x0000,0x0001,0x8100,0xfffe,0xffff};
+  byte buff[20]={0x60,0x00,0x00,0x00,0x00,0x14,0x3a,0x40,
+                 0x80,0x00,0xf2,0x3c,0x12,0x34,0x00,0x01,
+                 0xde,0xad,0xbe,0xef};
+  unsigned int i;
+
+  for (i=0; i<sizeof(newValues)/sizeof(newValues[0]); i++)
+    {
+      uint16_t before=(uint16_t)~PackosChecksumPartial(buff,sizeof(buff));
+      uint16_t oldValue=(((uint16_t)(buff[8]))<<8)|buff[9];
+      uint16_t updated,recomputed;
+
+      buff[8]=newValues[i]>>8;
+      buff[9]=newValues[i]&0xff;
+      updated=PackosChecksumUpdate16(before,oldValue,newValues[i]);
+      recomputed=(uint16_t)~PackosChecksumPartial(buff,sizeof(buff));
+      if (updated!=recomputed)
+        {
+          kprintf("checksum update: FAILED: %x to %x gave %x, not %x\n",
+                  (unsigned int)oldValue,(unsigned int)(newValues[i]),
+                  (unsigned int)updated,(unsigned int)recomputed);
+          return false;
+        }
+    }
+
+  kprintf("checksum update: ok\n");
+  return true;
+}
+
 static void scheduler(void)
 {
   PackosContext c[N];
@@ -166,6 +332,15 @@ static void scheduler(void)
 
       {
         PackosPacket* packet;
+
+        /* The clock is tickless; ask for the end of the slice. */
+        if (PackosClockSetAlarm(PackosClockNow(&error)
+                                +PACKOS_CLOCK_PERIOD_USEC,
+                                &error)
+            <0)
+          kprintf("PackosClockSetAlarm(): %s\n",
+                  PackosErrorToString(error));
+
         asm("schedulerCallReceive:");
         packet=PackosPacketReceiveOrYieldTo(c[i],&error);
         if (packet)
@@ -193,6 +368,9 @@ static void scheduler(void)
       }
     }
 
+  testQueueSpaceWakeup();
+  testChecksumUpdate();
+
   kprintf("scheduler exiting; numFinished==%d\n",numFinished);
 }
 
@@ -0,0 +1,166 @@
+#include <packos/arch.h>
+#include <packos/sys/traceP.h>
+#include <packos/sys/contextP.h>
+#include "kprintfK.h"
+
+/* Writers claim a slot with one atomic add and never wait; a record's
+ *  seq is stored last, so a reader can tell a slot that is still being
+ *  written, or that has been lapped, from the one it asked for.
+ */
+static struct {
+  PackosTraceRecord records[PACKOS_TRACE_LEN];
+  uint32_t next;
+} traceRing;
+
+static uint64_t readTSC(void)
+{
+  uint32_t lo,hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return (((uint64_t)hi)<<32)|lo;
+}
+
+static const PackosAddress noAddr={{0}};
+
+static PackosAddress addrOf(PackosContext context)
+{
+  if (context)
+    return context->os.config->addresses.self;
+  return noAddr;
+}
+
+void PackosKernelTrace(PackosTraceEvent event,
+                       PackosContext context,
+                       PackosAddress src,
+                       PackosAddress dest)
+{
+  uint32_t seq=__sync_fetch_and_add(&(traceRing.next),1);
+  PackosTraceRecord* record=traceRing.records+(seq%PACKOS_TRACE_LEN);
+
+  record->seq=0;
+  asm volatile("" ::: "memory");
+
+  record->event=event;
+  record->tsc=readTSC();
+  record->src=src;
+  record->dest=dest;
+  record->context=addrOf(context);
+  record->queueDepth=(context ? context->os.queue.numPackets : 0);
+
+  asm volatile("" ::: "memory");
+  record->seq=seq+1;
+}
+
+void PackosKernelTracePacket(PackosTraceEvent event,
+                             PackosContext context,
+                             const PackosPacket* packet)
+{
+  if (packet)
+    PackosKernelTrace(event,context,packet->packos.src,packet->packos.dest);
+  else
+    PackosKernelTrace(event,context,noAddr,noAddr);
+}
+
+void PackosKernelTraceYield(PackosContext from,
+                            PackosContext to)
+{
+  PackosKernelTrace(packosTraceEventYield,from,addrOf(from),addrOf(to));
+}
+
+int PackosTraceRead(PackosTraceRecord* records,
+                    unsigned int maxRecords,
+                    uint32_t* cursor,
+                    PackosError* error)
+{
+  uint32_t next,seq;
+  unsigned int n=0;
+
+  if (!error) return -2;
+  if (!(records && cursor))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  next=traceRing.next;
+  seq=*cursor;
+  if ((next-seq)>PACKOS_TRACE_LEN)
+    seq=next-PACKOS_TRACE_LEN;
+
+  for (; (seq!=next) && (n<maxRecords); seq++)
+    {
+      const PackosTraceRecord* record
+        =traceRing.records+(seq%PACKOS_TRACE_LEN);
+
+      if (record->seq!=seq+1)
+        continue;
+
+      records[n]=*record;
+      asm volatile("" ::: "memory");
+      if (record->seq!=seq+1)
+        continue;
+
+      n++;
+    }
+
+  *cursor=seq;
+  *error=packosErrorNone;
+  return n;
+}
+
+static void dumpAddr(const PackosAddress* addr)
+{
+  kprintf(" %x:%x:%x:%x",
+          ntohl(addr->quads[0]),ntohl(addr->quads[1]),
+          ntohl(addr->quads[2]),ntohl(addr->quads[3]));
+}
+
+int PackosTraceDump(uint32_t* cursor,
+                    PackosError* error)
+{
+  PackosTraceRecord records[16];
+  int n;
+
+  if (!error) return -2;
+  if (!cursor)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  while ((n=PackosTraceRead(records,16,cursor,error))>0)
+    {
+      int i;
+      for (i=0; i<n; i++)
+        {
+          kprintf("trace: %u %s %x %x %u",
+                  records[i].seq-1,
+                  PackosTraceEventToString(records[i].event),
+                  (uint32_t)(records[i].tsc>>32),
+                  (uint32_t)(records[i].tsc),
+                  (unsigned int)(records[i].queueDepth));
+          dumpAddr(&(records[i].context));
+          dumpAddr(&(records[i].src));
+          dumpAddr(&(records[i].dest));
+          kprintf("\n");
+        }
+    }
+
+  if (n<0) return -1;
+  return 0;
+}
+
+const char* PackosTraceEventToString(PackosTraceEvent event)
+{
+  switch (event)
+    {
+    case packosTraceEventNone: return "none";
+    case packosTraceEventSend: return "send";
+    case packosTraceEventReceive: return "receive";
+    case packosTraceEventAlloc: return "alloc";
+    case packosTraceEventFree: return "free";
+    case packosTraceEventBlock: return "block";
+    case packosTraceEventYield: return "yield";
+    }
+
+  return "unknown";
+}
@@ -89,6 +89,14 @@ static IpFilterAction IcmpFilterMethod(IpIface iface,
     header=h->u.icmp;
   }
 
+  if (IpPacketFromNetworkOrder(packet,error)<0)
+    {
+      UtilPrintfStream(errStream,error,
+                       "IcmpFilterMethod(): IpPacketFromNetworkOrder(): %s\n",
+                       PackosErrorToString(*error));
+      return ipFilterActionError;
+    }
+
   switch (header->type)
     {
     case icmpTypeDestinationUnreachable:
@@ -106,6 +114,9 @@ static IpFilterAction IcmpFilterMethod(IpIface iface,
         IpHeader replyHeader;
         IpHeaderICMP replyICMP;
         unsigned int size;
+        const uint16_t requestChecksum=header->checksum;
+        const uint16_t requestTypeAndCode
+          =(((uint16_t)(header->type))<<8)|(header->code);
 
         PackosPacket* reply=PackosPacketAlloc(&size,error);
         if (!reply)
@@ -146,6 +157,7 @@ static IpFilterAction IcmpFilterMethod(IpIface iface,
         {
           int headerLen=IpHeaderGetSize(&replyHeader,error);
           int sizeToCopy,packetDataLen;
+          uint16_t dataSum;
           byte* packetData;
           byte* replyData;
           if (headerLen<0)
@@ -218,7 +230,10 @@ static IpFilterAction IcmpFilterMethod(IpIface iface,
               return ipFilterActionError;
             }
 
-          UtilMemcpy(replyData,packetData,sizeToCopy);
+          if (sizeToCopy<packetDataLen)
+            dataSum=PackosChecksumCopy(replyData,packetData,sizeToCopy);
+          else
+            UtilMemcpy(replyData,packetData,sizeToCopy);
 
           {
             IpHeader* h=IpHeaderSeek(reply,ipHeaderTypeICMP,error);
@@ -228,13 +243,27 @@ static IpFilterAction IcmpFilterMethod(IpIface iface,
                         PackosErrorToString(*error));
                 return ipFilterActionError;
               }
-            h->u.icmp->checksum=IcmpChecksum(reply,h,error);
-            if ((*error)!=packosErrorNone)
+
+            /* An untruncated reply differs from the request only in its
+             *  type and code: swapping the addresses leaves the
+             *  pseudo-header's sum alone.  So the request's checksum
+             *  just needs updating, which also passes any damage to the
+             *  request back to the requester.
+             */
+            if (sizeToCopy<packetDataLen)
               {
-                UtilPrintfStream(errStream,error,"IcmpFilterMethod(): IcmpChecksum(): %s\n",
-                        PackosErrorToString(*error));
-                return ipFilterActionError;
+                h->u.icmp->checksum=IcmpChecksumWithData(reply,h,dataSum,error);
+                if ((*error)!=packosErrorNone)
+                  {
+                    UtilPrintfStream(errStream,error,"IcmpFilterMethod(): IcmpChecksumWithData(): %s\n",
+                            PackosErrorToString(*error));
+                    return ipFilterActionError;
+                  }
               }
+            else
+              h->u.icmp->checksum
+                =PackosChecksumUpdate16(requestChecksum,requestTypeAndCode,
+                                        ((uint16_t)icmpTypeEchoReply)<<8);
           }
 
           if (IpSendOn(iface,reply,error)<0)
@@ -355,6 +384,7 @@ int IcmpSendError(IpIface iface,
   {
     int headerLen=IpHeaderGetSize(&replyHeader,error);
     int sizeToCopy,packetLen;
+    bool wasNetworkOrder;
     byte* replyData;
     if (headerLen<0)
       {
@@ -366,7 +396,7 @@ int IcmpSendError(IpIface iface,
       }
     sizeToCopy=size-72-headerLen;
 
-    packetLen=packet->ipv6.payloadLength+40;
+    packetLen=IpPacketGetPayloadLength(packet,error)+40;
     if (sizeToCopy>packetLen)
       sizeToCopy=packetLen;
 
@@ -391,6 +421,7 @@ int IcmpSendError(IpIface iface,
 	return -1;
       }
 
+    wasNetworkOrder=IpPacketIsNetworkOrder(packet,error);
     if (IpPacketToNetworkOrder(packet,error)<0)
       {
 	UtilPrintfStream(errStream,error,
@@ -401,7 +432,7 @@ int IcmpSendError(IpIface iface,
 
     UtilMemcpy(replyData,&(packet->ipv6),sizeToCopy);
 
-    if (IpPacketFromNetworkOrder(packet,error)<0)
+    if ((!wasNetworkOrder) && (IpPacketFromNetworkOrder(packet,error)<0))
       {
 	UtilPrintfStream(errStream,error,
 		"IcmpFilterMethod(): IpPacketFromNetworkOrder(): %s\n",
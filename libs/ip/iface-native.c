@@ -1,22 +1,52 @@
 #include <util/stream.h>
 #include <util/alloc.h>
 #include <iface.h>
+#include <packos/context.h>
 
 typedef struct {
-  bool yieldToRecipient;
+  bool yieldToRecipient,waitWhenFull;
   PackosContext nextToYieldTo;
+  PackosPacket* reply; /* from call(), for the next receive() */
 } IpIfaceNativeContext;
 
 static int send(IpIface iface, PackosPacket* packet, PackosError* error)
 {
   IpIfaceNativeContext* context=(IpIfaceNativeContext*)(iface->context);
   packet->packos.src=iface->addr;
+  if (context->waitWhenFull)
+    return PackosPacketSendWait(packet,context->yieldToRecipient,error);
   return PackosPacketSend(packet,context->yieldToRecipient,error);
 }
 
+static int call(IpIface iface, PackosPacket* packet, PackosError* error)
+{
+  IpIfaceNativeContext* context=(IpIfaceNativeContext*)(iface->context);
+  PackosPacket* reply;
+
+  /* Only one reply can be held for receive(). */
+  if (context->reply)
+    return send(iface,packet,error);
+
+  packet->packos.src=iface->addr;
+  reply=PackosPacketCall(packet,error);
+  if (!reply)
+    return -1;
+
+  context->reply=reply;
+  return 0;
+}
+
 static PackosPacket* receive(IpIface iface, PackosError* error)
 {
   IpIfaceNativeContext* context=(IpIfaceNativeContext*)(iface->context);
+  if (context->reply)
+    {
+      PackosPacket* res=context->reply;
+      context->reply=0;
+      *error=packosErrorNone;
+      return res;
+    }
+
   if (context->nextToYieldTo)
     {
       PackosPacket* res
@@ -54,6 +84,20 @@ static PackosPacket* receive(IpIface iface, PackosError* error)
     }
 }
 
+static int mcastJoin(IpIface iface, PackosAddress group, PackosError* error)
+{
+  PackosContext self=PackosGetCurrentContext(error);
+  if (!self) return -1;
+  return PackosPacketMcastJoin(self,group,error);
+}
+
+static int mcastLeave(IpIface iface, PackosAddress group, PackosError* error)
+{
+  PackosContext self=PackosGetCurrentContext(error);
+  if (!self) return -1;
+  return PackosPacketMcastLeave(self,group,error);
+}
+
 IpIface IpIfaceNativeNew(PackosError* error)
 {
   IpIfaceNativeContext* context;
@@ -93,12 +137,17 @@ IpIface IpIfaceNativeNew(PackosError* error)
     }
 
   context->yieldToRecipient=true;
+  context->waitWhenFull=false;
   context->nextToYieldTo=0;
+  context->reply=0;
   res->context=context;
 
   res->send=send;
   res->receive=receive;
+  res->call=call;
   res->close=0;
+  res->mcastJoin=mcastJoin;
+  res->mcastLeave=mcastLeave;
 
   return res;
 }
@@ -132,3 +181,18 @@ int IpIfaceNativeSetYieldToRecipient(IpIface iface,
   ((IpIfaceNativeContext*)(iface->context))->yieldToRecipient=yieldToRecipient;
   return 0;
 }
+
+int IpIfaceNativeSetWaitWhenFull(IpIface iface,
+                                 bool waitWhenFull,
+                                 PackosError* error)
+{
+  if (!error) return -2;
+  if (!iface)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  ((IpIfaceNativeContext*)(iface->context))->waitWhenFull=waitWhenFull;
+  return 0;
+}
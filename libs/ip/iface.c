@@ -16,6 +16,8 @@ int IpIfaceInit(IpIface iface,
   iface->queue=PackosPacketQueueNew(16,error);
   iface->next=iface->prev=0;
   iface->context=0;
+  iface->mcastJoin=iface->mcastLeave=0;
+  iface->call=0;
   iface->filters.first=iface->filters.last=0;
   iface->anonPortNext.udp=iface->anonPortNext.tcp=anonPortMin;
   iface->tcpContext=0;
@@ -5,6 +5,7 @@
 #include <util/string.h>
 #include <packos/arch.h>
 #include <packos/context.h>
+#include <packos/memory.h>
 
 int IpHeaderTypeOrder(IpHeaderType type, PackosError* error)
 {
@@ -38,126 +39,482 @@ static int sendICMP(IpIface iface,
   return -1;
 }
 
-int IpPacketFromNetworkOrder(PackosPacket* packet,
-                             PackosError* error)
+static int headerFromNetworkOrder(IpHeader* cur,
+                                  PackosError* error)
 {
-  IpHeaderIterator it;
-  IpHeader* cur;
-
-  if (!packet)
+  switch (cur->kind)
     {
-      *error=packosErrorInvalidArg;
+    case ipHeaderTypeHopByHop:
+    case ipHeaderTypeDestination:
+    case ipHeaderTypeRouting:
+      break;
+
+    case ipHeaderTypeFragment:
+      cur->u.fragment->fragmentOffsetAndM
+        =ntohs(cur->u.fragment->fragmentOffsetAndM);
+      cur->u.fragment->id
+        =ntohl(cur->u.fragment->id);
+      break;
+
+    case ipHeaderTypeUDP:
+      cur->u.udp->sourcePort=ntohs(cur->u.udp->sourcePort);
+      cur->u.udp->destPort=ntohs(cur->u.udp->destPort);
+      cur->u.udp->length=ntohs(cur->u.udp->length);
+      cur->u.udp->checksum=ntohs(cur->u.udp->checksum);
+      break;
+
+    case ipHeaderTypeICMP:
+      cur->u.icmp->checksum=ntohs(cur->u.icmp->checksum);
+      switch (cur->u.icmp->type)
+        {
+        case icmpTypeDestinationUnreachable:
+          cur->u.icmp->u.destinationUnreachable.unused=0;
+          break;
+
+        case icmpTypePacketTooBig:
+          cur->u.icmp->u.packetTooBig.mtu
+            =ntohl(cur->u.icmp->u.packetTooBig.mtu);
+          break;
+
+        case icmpTypeTimeExceeded:
+          cur->u.icmp->u.timeExceeded.unused=0;
+          break;
+
+        case icmpTypeParameterProblem:
+          cur->u.icmp->u.parameterProblem.pointer
+            =ntohl(cur->u.icmp->u.parameterProblem.pointer);
+          break;
+
+        case icmpTypeEchoRequest:
+          cur->u.icmp->u.echoRequest.identifier
+            =ntohs(cur->u.icmp->u.echoRequest.identifier);
+          cur->u.icmp->u.echoRequest.sequenceNumber
+            =ntohs(cur->u.icmp->u.echoRequest.sequenceNumber);
+          break;
+
+        case icmpTypeEchoReply:
+          cur->u.icmp->u.echoReply.identifier
+            =ntohs(cur->u.icmp->u.echoReply.identifier);
+          cur->u.icmp->u.echoReply.sequenceNumber
+            =ntohs(cur->u.icmp->u.echoReply.sequenceNumber);
+          break;
+
+        default:
+          *error=packosErrorNotImplemented;
+          return -1;
+        }
+      break;
+
+    case ipHeaderTypeTCP:
+      cur->u.tcp->sourcePort=ntohs(cur->u.tcp->sourcePort);
+      cur->u.tcp->destPort=ntohs(cur->u.tcp->destPort);
+      cur->u.tcp->sequenceNumber=ntohl(cur->u.tcp->sequenceNumber);
+      cur->u.tcp->ackNumber=ntohl(cur->u.tcp->ackNumber);
+      cur->u.tcp->dataOffsetAndFlags=ntohs(cur->u.tcp->dataOffsetAndFlags);
+      cur->u.tcp->window=ntohs(cur->u.tcp->window);
+      cur->u.tcp->checksum=ntohs(cur->u.tcp->checksum);
+      cur->u.tcp->urgent=ntohs(cur->u.tcp->urgent);
+      break;
+
+    default:
+      *error=packosErrorNotImplemented;
       return -1;
     }
 
-  packet->ipv6.versionAndTrafficClassAndFlowLabel
-    =ntohl(packet->ipv6.versionAndTrafficClassAndFlowLabel);
-  packet->ipv6.payloadLength
-    =ntohs(packet->ipv6.payloadLength);
+  return 0;
+}
 
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it)
+static int headerToNetworkOrder(IpHeader* cur,
+                                PackosError* error)
+{
+  switch (cur->kind)
     {
-      PackosError tmp;
-      UtilPrintfStream(errStream,&tmp,
-                       "IpPacketFromNetworkOrder(): IpHeaderIteratorNew(): %s\n",
-                       PackosErrorToString(*error)
-                       );
+    case ipHeaderTypeHopByHop:
+    case ipHeaderTypeDestination:
+    case ipHeaderTypeRouting:
+      break;
+
+    case ipHeaderTypeFragment:
+      cur->u.fragment->fragmentOffsetAndM
+        =htons(cur->u.fragment->fragmentOffsetAndM);
+      cur->u.fragment->id
+        =htonl(cur->u.fragment->id);
+      break;
+
+    case ipHeaderTypeUDP:
+      cur->u.udp->sourcePort=htons(cur->u.udp->sourcePort);
+      cur->u.udp->destPort=htons(cur->u.udp->destPort);
+      cur->u.udp->length=htons(cur->u.udp->length);
+      cur->u.udp->checksum=htons(cur->u.udp->checksum);
+      break;
+
+    case ipHeaderTypeICMP:
+      cur->u.icmp->checksum=htons(cur->u.icmp->checksum);
+      switch (cur->u.icmp->type)
+        {
+        case icmpTypeDestinationUnreachable:
+          cur->u.icmp->u.destinationUnreachable.unused=0;
+          break;
+
+        case icmpTypePacketTooBig:
+          cur->u.icmp->u.packetTooBig.mtu
+            =htonl(cur->u.icmp->u.packetTooBig.mtu);
+          break;
+
+        case icmpTypeTimeExceeded:
+          cur->u.icmp->u.timeExceeded.unused=0;
+          break;
+
+        case icmpTypeParameterProblem:
+          cur->u.icmp->u.parameterProblem.pointer
+            =htonl(cur->u.icmp->u.parameterProblem.pointer);
+          break;
+
+        case icmpTypeEchoRequest:
+          cur->u.icmp->u.echoRequest.identifier
+            =htons(cur->u.icmp->u.echoRequest.identifier);
+          cur->u.icmp->u.echoRequest.sequenceNumber
+            =htons(cur->u.icmp->u.echoRequest.sequenceNumber);
+          break;
+
+        case icmpTypeEchoReply:
+          cur->u.icmp->u.echoReply.identifier
+            =htons(cur->u.icmp->u.echoReply.identifier);
+          cur->u.icmp->u.echoReply.sequenceNumber
+            =htons(cur->u.icmp->u.echoReply.sequenceNumber);
+          break;
+
+        default:
+          *error=packosErrorNotImplemented;
+          return -1;
+        }
+      break;
+
+    case ipHeaderTypeTCP:
+      cur->u.tcp->sourcePort=htons(cur->u.tcp->sourcePort);
+      cur->u.tcp->destPort=htons(cur->u.tcp->destPort);
+      cur->u.tcp->sequenceNumber=htonl(cur->u.tcp->sequenceNumber);
+      cur->u.tcp->ackNumber=htonl(cur->u.tcp->ackNumber);
+      cur->u.tcp->dataOffsetAndFlags=htons(cur->u.tcp->dataOffsetAndFlags);
+      cur->u.tcp->window=htons(cur->u.tcp->window);
+      cur->u.tcp->checksum=htons(cur->u.tcp->checksum);
+      cur->u.tcp->urgent=htons(cur->u.tcp->urgent);
+      break;
+
+    default:
+      *error=packosErrorNotImplemented;
       return -1;
     }
 
-  while ((cur=IpHeaderIteratorNext(it,error))!=0)
+  return 0;
+}
+
+static IpPacketInfo* infoOf(PackosPacket* packet)
+{
+  return (IpPacketInfo*)(((byte*)packet)
+                         +PACKOS_PAGE_SIZE-PACKOS_PACKET_TAILROOM);
+}
+
+/* How the fields of a packet in either byte order are read and written. */
+static bool inNetworkOrder(PackosPacket* packet)
+{
+  return infoOf(packet)->networkOrder;
+}
+
+static uint16_t get16(PackosPacket* packet, uint16_t x)
+{
+  return inNetworkOrder(packet) ? ntohs(x) : x;
+}
+
+static uint32_t get32(PackosPacket* packet, uint32_t x)
+{
+  return inNetworkOrder(packet) ? ntohl(x) : x;
+}
+
+/* Walks the header chain once, filling in the packet's IpPacketInfo.
+ *  networkOrder says what order the headers are in; if convert is set
+ *  too, each is converted to host order on the way.  Stops at the
+ *  first header type we don't know, taking that as the protocol and
+ *  setting unknown.
+ */
+static IpPacketInfo* parseHeaders(PackosPacket* packet,
+                                  bool networkOrder,
+                                  bool convert,
+                                  PackosError* error)
+{
+  IpPacketInfo* info=infoOf(packet);
+  uint32_t offset=0;
+  byte kind=packet->ipv6.nextHeader;
+
+  info->valid=false;
+  info->firstKind=kind;
+  info->protocol=kind;
+  info->numHeaders=0;
+  info->unknown=false;
+
+  while (kind!=ipHeaderTypeNone)
     {
-      switch (cur->kind)
+      IpPacketHeaderSlot* slot;
+      int size;
+
+      switch (kind)
         {
         case ipHeaderTypeHopByHop:
         case ipHeaderTypeDestination:
         case ipHeaderTypeRouting:
+        case ipHeaderTypeFragment:
+        case ipHeaderTypeUDP:
+        case ipHeaderTypeTCP:
+        case ipHeaderTypeICMP:
           break;
 
+        default:
+          info->protocol=kind;
+          info->unknown=true;
+          kind=ipHeaderTypeNone;
+          continue;
+        }
+
+      if (info->numHeaders>=IP_PACKET_MAX_HEADERS)
+        {
+          *error=packosErrorNotImplemented;
+          return 0;
+        }
+
+      slot=info->headers+info->numHeaders;
+      slot->offset=offset;
+      slot->header.kind=kind;
+      slot->header.u.udp
+        =(IpHeaderUDP*)((packet->ipv6.dataAndHeaders)+offset);
+
+      if (networkOrder && convert
+          && (headerFromNetworkOrder(&(slot->header),error)<0))
+        return 0;
+
+      /* The only header whose length isn't a byte */
+      if (networkOrder && (!convert) && (kind==ipHeaderTypeTCP))
+        size=(ntohs(slot->header.u.tcp->dataOffsetAndFlags)>>12)*4;
+      else
+        {
+          size=IpHeaderGetSize(&(slot->header),error);
+          if (size<0) return 0;
+        }
+
+      offset+=size;
+      if (((packet->ipv6.dataAndHeaders)+offset)>((byte*)info))
+        {
+          *error=packosErrorInvalidArg;
+          return 0;
+        }
+
+      info->numHeaders++;
+      info->protocol=kind;
+
+      switch (kind)
+        {
+        case ipHeaderTypeHopByHop:
+          kind=slot->header.u.hopByHop->nextHeader;
+          break;
+        case ipHeaderTypeDestination:
+          kind=slot->header.u.dest->nextHeader;
+          break;
+        case ipHeaderTypeRouting:
+          kind=slot->header.u.routing0->nextHeader;
+          break;
         case ipHeaderTypeFragment:
-          cur->u.fragment->fragmentOffsetAndM
-            =ntohs(cur->u.fragment->fragmentOffsetAndM);
-          cur->u.fragment->id
-            =ntohl(cur->u.fragment->id);
+          kind=slot->header.u.fragment->nextHeader;
           break;
-
-        case ipHeaderTypeUDP:
-          cur->u.udp->sourcePort=ntohs(cur->u.udp->sourcePort);
-          cur->u.udp->destPort=ntohs(cur->u.udp->destPort);
-          cur->u.udp->length=ntohs(cur->u.udp->length);
-          cur->u.udp->checksum=ntohs(cur->u.udp->checksum);
+        default:
+          kind=ipHeaderTypeNone;
           break;
+        }
+    }
 
-        case ipHeaderTypeICMP:
-          cur->u.icmp->checksum=ntohs(cur->u.icmp->checksum);
-          switch (cur->u.icmp->type)
-            {
-            case icmpTypeDestinationUnreachable:
-              cur->u.icmp->u.destinationUnreachable.unused=0;
-              break;
-
-            case icmpTypePacketTooBig:
-              cur->u.icmp->u.packetTooBig.mtu
-                =ntohl(cur->u.icmp->u.packetTooBig.mtu);
-              break;
-
-            case icmpTypeTimeExceeded:
-              cur->u.icmp->u.timeExceeded.unused=0;
-              break;
-
-            case icmpTypeParameterProblem:
-              cur->u.icmp->u.parameterProblem.pointer
-                =ntohl(cur->u.icmp->u.parameterProblem.pointer);
-              break;
-
-            case icmpTypeEchoRequest:
-              cur->u.icmp->u.echoRequest.identifier
-                =ntohs(cur->u.icmp->u.echoRequest.identifier);
-              cur->u.icmp->u.echoRequest.sequenceNumber
-                =ntohs(cur->u.icmp->u.echoRequest.sequenceNumber);
-              break;
-
-            case icmpTypeEchoReply:
-              cur->u.icmp->u.echoReply.identifier
-                =ntohs(cur->u.icmp->u.echoReply.identifier);
-              cur->u.icmp->u.echoReply.sequenceNumber
-                =ntohs(cur->u.icmp->u.echoReply.sequenceNumber);
-              break;
-
-            default:
-              *error=packosErrorNotImplemented;
-              return -1;
-            }
-          break;
+  info->dataOffset=offset;
+  info->networkOrder=(networkOrder && !convert);
+  info->valid=true;
+  *error=packosErrorNone;
+  return info;
+}
 
-        case ipHeaderTypeTCP:
-          cur->u.tcp->sourcePort=ntohs(cur->u.tcp->sourcePort);
-          cur->u.tcp->destPort=ntohs(cur->u.tcp->destPort);
-          cur->u.tcp->sequenceNumber=ntohl(cur->u.tcp->sequenceNumber);
-          cur->u.tcp->ackNumber=ntohl(cur->u.tcp->ackNumber);
-          cur->u.tcp->dataOffsetAndFlags=ntohs(cur->u.tcp->dataOffsetAndFlags);
-          cur->u.tcp->window=ntohs(cur->u.tcp->window);
-          cur->u.tcp->checksum=ntohs(cur->u.tcp->checksum);
-          cur->u.tcp->urgent=ntohs(cur->u.tcp->urgent);
-          break;
+/* Whether the packet's IpPacketInfo still describes it.  The kernel
+ *  builds packets without going through IpHeaderAppend(), and pages
+ *  get reused, so it isn't enough that the chain starts the same way:
+ *  each header's next-header byte has to lead to the next slot, and
+ *  the headers have to fit in the payload.
+ */
+static bool infoIsCurrent(PackosPacket* packet,
+                          IpPacketInfo* info)
+{
+  unsigned int i;
+  byte kind=packet->ipv6.nextHeader;
+
+  if (!(info->valid && (info->firstKind==kind)))
+    return false;
+  if ((info->numHeaders>IP_PACKET_MAX_HEADERS)
+      || (info->dataOffset>get16(packet,packet->ipv6.payloadLength)))
+    return false;
 
+  for (i=0; i<info->numHeaders; i++)
+    {
+      IpPacketHeaderSlot* slot=info->headers+i;
+      if ((slot->header.kind!=kind)
+          || (slot->offset>=info->dataOffset))
+        return false;
+
+      switch (kind)
+        {
+        case ipHeaderTypeHopByHop:
+        case ipHeaderTypeDestination:
+        case ipHeaderTypeRouting:
+        case ipHeaderTypeFragment:
+          /* nextHeader is the first byte of each of these */
+          kind=packet->ipv6.dataAndHeaders[slot->offset];
+          break;
         default:
-          *error=packosErrorNotImplemented;
-          return -1;
+          kind=ipHeaderTypeNone;
+          break;
         }
     }
 
-  IpHeaderIteratorDelete(it,error);
+  if (info->unknown)
+    return (kind==info->protocol);
+  return (kind==ipHeaderTypeNone);
+}
+
+IpPacketInfo* IpPacketGetInfo(PackosPacket* packet,
+                              PackosError* error)
+{
+  IpPacketInfo* info;
+
+  if (!error) return 0;
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  info=infoOf(packet);
+  if (infoIsCurrent(packet,info))
+    {
+      *error=packosErrorNone;
+      return info;
+    }
+
+  return parseHeaders(packet,info->networkOrder,false,error);
+}
+
+IpHeader* IpPacketGetHeader(PackosPacket* packet,
+                            unsigned int i,
+                            PackosError* error)
+{
+  IpPacketInfo* info=IpPacketGetInfo(packet,error);
+  IpPacketHeaderSlot* slot;
+
+  if (!info) return 0;
+  if (i>=info->numHeaders)
+    {
+      *error=packosErrorDoesNotExist;
+      return 0;
+    }
+
+  /* The page may have been copied since it was parsed. */
+  slot=info->headers+i;
+  slot->header.u.udp
+    =(IpHeaderUDP*)((packet->ipv6.dataAndHeaders)+slot->offset);
+  return &(slot->header);
+}
+
+int IpPacketMarkNetworkOrder(PackosPacket* packet,
+                             PackosError* error)
+{
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!parseHeaders(packet,true,false,error))
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "IpPacketMarkNetworkOrder(): parseHeaders(): %s\n",
+                       PackosErrorToString(*error)
+                       );
+      return -1;
+    }
 
   return 0;
 }
 
+bool IpPacketIsNetworkOrder(PackosPacket* packet,
+                            PackosError* error)
+{
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return false;
+    }
+
+  *error=packosErrorNone;
+  return inNetworkOrder(packet);
+}
+
+int IpPacketFromNetworkOrder(PackosPacket* packet,
+                             PackosError* error)
+{
+  IpPacketInfo* info;
+
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  /* A packet we know nothing about is taken to be as it came in. */
+  info=infoOf(packet);
+  if (infoIsCurrent(packet,info))
+    {
+      unsigned int i;
+
+      if (!(info->networkOrder))
+        {
+          *error=packosErrorNone;
+          return 0;
+        }
+
+      for (i=0; i<info->numHeaders; i++)
+        {
+          IpHeader* cur=IpPacketGetHeader(packet,i,error);
+          if (!cur) return -1;
+          if (headerFromNetworkOrder(cur,error)<0) return -1;
+        }
+    }
+  else if (!parseHeaders(packet,true,true,error))
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "IpPacketFromNetworkOrder(): parseHeaders(): %s\n",
+                       PackosErrorToString(*error)
+                       );
+      return -1;
+    }
+
+  packet->ipv6.versionAndTrafficClassAndFlowLabel
+    =ntohl(packet->ipv6.versionAndTrafficClassAndFlowLabel);
+  packet->ipv6.payloadLength
+    =ntohs(packet->ipv6.payloadLength);
+
+  info->networkOrder=false;
+  *error=packosErrorNone;
+  return 0;
+}
+
 int IpPacketToNetworkOrder(PackosPacket* packet,
                            PackosError* error)
 {
-  IpHeaderIterator it;
-  IpHeader* cur;
+  IpPacketInfo* info;
+  unsigned int i;
 
   if (!packet)
     {
@@ -165,97 +522,105 @@ int IpPacketToNetworkOrder(PackosPacket* packet,
       return -1;
     }
 
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return -1;
+
+  if (info->networkOrder)
+    return 0;
+
+  for (i=0; i<info->numHeaders; i++)
+    {
+      IpHeader* cur=IpPacketGetHeader(packet,i,error);
+      if (!cur) return -1;
+      if (headerToNetworkOrder(cur,error)<0) return -1;
+    }
+
   packet->ipv6.versionAndTrafficClassAndFlowLabel
     =htonl(packet->ipv6.versionAndTrafficClassAndFlowLabel);
   packet->ipv6.payloadLength
     =htons(packet->ipv6.payloadLength);
 
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it) return -1;
+  info->networkOrder=true;
+  *error=packosErrorNone;
+  return 0;
+}
 
-  while ((cur=IpHeaderIteratorNext(it,error))!=0)
+uint16_t IpPacketGetPayloadLength(PackosPacket* packet,
+                                  PackosError* error)
+{
+  if (!packet)
     {
-      switch (cur->kind)
-        {
-        case ipHeaderTypeHopByHop:
-        case ipHeaderTypeDestination:
-        case ipHeaderTypeRouting:
-          break;
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
 
-        case ipHeaderTypeFragment:
-          cur->u.fragment->fragmentOffsetAndM
-            =htons(cur->u.fragment->fragmentOffsetAndM);
-          cur->u.fragment->id
-            =htonl(cur->u.fragment->id);
-          break;
+  *error=packosErrorNone;
+  return get16(packet,packet->ipv6.payloadLength);
+}
 
-        case ipHeaderTypeUDP:
-          cur->u.udp->sourcePort=htons(cur->u.udp->sourcePort);
-          cur->u.udp->destPort=htons(cur->u.udp->destPort);
-          cur->u.udp->length=htons(cur->u.udp->length);
-          cur->u.udp->checksum=htons(cur->u.udp->checksum);
-          break;
+int IpPacketSetPayloadLength(PackosPacket* packet,
+                             uint16_t payloadLength,
+                             PackosError* error)
+{
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
+  packet->ipv6.payloadLength
+    =(inNetworkOrder(packet) ? htons(payloadLength) : payloadLength);
+  *error=packosErrorNone;
+  return 0;
+}
 
-        case ipHeaderTypeICMP:
-          cur->u.icmp->checksum=htons(cur->u.icmp->checksum);
-          switch (cur->u.icmp->type)
-            {
-            case icmpTypeDestinationUnreachable:
-              cur->u.icmp->u.destinationUnreachable.unused=0;
-              break;
-
-            case icmpTypePacketTooBig:
-              cur->u.icmp->u.packetTooBig.mtu
-                =htonl(cur->u.icmp->u.packetTooBig.mtu);
-              break;
-
-            case icmpTypeTimeExceeded:
-              cur->u.icmp->u.timeExceeded.unused=0;
-              break;
-
-            case icmpTypeParameterProblem:
-              cur->u.icmp->u.parameterProblem.pointer
-                =htonl(cur->u.icmp->u.parameterProblem.pointer);
-              break;
-
-            case icmpTypeEchoRequest:
-              cur->u.icmp->u.echoRequest.identifier
-                =htons(cur->u.icmp->u.echoRequest.identifier);
-              cur->u.icmp->u.echoRequest.sequenceNumber
-                =htons(cur->u.icmp->u.echoRequest.sequenceNumber);
-              break;
-
-            case icmpTypeEchoReply:
-              cur->u.icmp->u.echoReply.identifier
-                =htons(cur->u.icmp->u.echoReply.identifier);
-              cur->u.icmp->u.echoReply.sequenceNumber
-                =htons(cur->u.icmp->u.echoReply.sequenceNumber);
-              break;
-
-            default:
-              *error=packosErrorNotImplemented;
-              return -1;
-            }
-          break;
+int IpPacketGetPorts(PackosPacket* packet,
+                     uint16_t* sourcePort,
+                     uint16_t* destPort,
+                     PackosError* error)
+{
+  IpPacketInfo* info;
+  IpHeader* last;
+  uint16_t src,dest;
 
-        case ipHeaderTypeTCP:
-          cur->u.tcp->sourcePort=htons(cur->u.tcp->sourcePort);
-          cur->u.tcp->destPort=htons(cur->u.tcp->destPort);
-          cur->u.tcp->sequenceNumber=htonl(cur->u.tcp->sequenceNumber);
-          cur->u.tcp->ackNumber=htonl(cur->u.tcp->ackNumber);
-          cur->u.tcp->dataOffsetAndFlags=htons(cur->u.tcp->dataOffsetAndFlags);
-          cur->u.tcp->window=htons(cur->u.tcp->window);
-          cur->u.tcp->checksum=htons(cur->u.tcp->checksum);
-          cur->u.tcp->urgent=htons(cur->u.tcp->urgent);
-          break;
+  if (!packet)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-        default:
-          *error=packosErrorNotImplemented;
-          return -1;
-        }
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return -1;
+
+  if (!(info->numHeaders))
+    {
+      *error=packosErrorWrongProtocol;
+      return -1;
     }
 
+  last=IpPacketGetHeader(packet,info->numHeaders-1,error);
+  if (!last) return -1;
+
+  switch (last->kind)
+    {
+    case ipHeaderTypeUDP:
+      src=last->u.udp->sourcePort;
+      dest=last->u.udp->destPort;
+      break;
+
+    case ipHeaderTypeTCP:
+      src=last->u.tcp->sourcePort;
+      dest=last->u.tcp->destPort;
+      break;
+
+    default:
+      *error=packosErrorWrongProtocol;
+      return -1;
+    }
+
+  if (sourcePort) *sourcePort=get16(packet,src);
+  if (destPort) *destPort=get16(packet,dest);
+  *error=packosErrorNone;
   return 0;
 }
 
@@ -281,8 +646,8 @@ IpReceiveOnUnfiltered(IpIface iface,
                       IpHeaderRouting0** routingHeader,
                       PackosError* error)
 {
-  IpHeaderIterator it;
-  IpHeader* cur;
+  IpPacketInfo* info;
+  unsigned int i;
   PackosPacket* packet;
   byte protocol;
 
@@ -292,19 +657,22 @@ IpReceiveOnUnfiltered(IpIface iface,
       return 0;
     }
 
+  /* Queued packets have been through here once already. */
   packet=IpIfaceDequeue(iface,protocolExpected,error);
   if (packet)
     {
-      if (IpPacketFromNetworkOrder(packet,error)<0)
+      int res=IpPacketProtocol(packet,error);
+      if (res<0)
         {
           PackosError tmp;
           PackosPacketFree(packet,&tmp);
           UtilPrintfStream(errStream,&tmp,
-                  "IpReceiveOnUnfiltered(): IpPacketFromNetworkOrder(): %s\n",
+                  "IpReceiveOnUnfiltered(): IpPacketProtocol(): %s\n",
                   PackosErrorToString(*error)
                   );
           return 0;
         }
+      *protocolP=res;
       return packet;
     }
 
@@ -336,13 +704,32 @@ IpReceiveOnUnfiltered(IpIface iface,
         return 0;
       }
 
-    if (IpPacketFromNetworkOrder(packet,error)<0)
+    /* Multicast deliveries share one page among all the members;
+     *  take a private copy before writing to it.
+     */
+    {
+      PackosPacket* unshared=PackosPacketUnshare(packet,error);
+      if (!unshared)
+        {
+          PackosError tmp;
+          PackosPacketFree(packet,&tmp);
+          UtilPrintfStream(errStream,&tmp,
+                           "IpReceiveOnUnfiltered(): "
+                           "PackosPacketUnshare(): %s\n",
+                           PackosErrorToString(*error)
+                           );
+          return 0;
+        }
+      packet=unshared;
+    }
+
+    if (IpPacketMarkNetworkOrder(packet,error)<0)
       {
         PackosError tmp;
         PackosPacketFree(packet,&tmp);
         UtilPrintfStream(errStream,&tmp,
                          "IpReceiveOnUnfiltered(): "
-                         "IpPacketFromNetworkOrder(): %s\n",
+                         "IpPacketMarkNetworkOrder(): %s\n",
                          PackosErrorToString(*error)
                          );
         return 0;
@@ -363,16 +750,24 @@ IpReceiveOnUnfiltered(IpIface iface,
     }
   }
 
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it)
+  info=IpPacketGetInfo(packet,error);
+  if (!info)
     {
       PackosError tmp;
       PackosPacketFree(packet,&tmp);
       return 0;
     }
 
-  while ((cur=IpHeaderIteratorNext(it,error))!=0)
+  for (i=0; i<info->numHeaders; i++)
     {
+      IpHeader* cur=IpPacketGetHeader(packet,i,error);
+      if (!cur)
+        {
+          PackosError tmp;
+          PackosPacketFree(packet,&tmp);
+          return 0;
+        }
+
       protocol=cur->kind;
       switch (cur->kind)
         {
@@ -425,7 +820,6 @@ IpReceiveOnUnfiltered(IpIface iface,
                       case 1: /* discard the packet */
                         {
                           PackosPacketFree(packet,error);
-                          IpHeaderIteratorDelete(it,error);
                           *error=packosErrorOptionNotSupported;
                           return 0;
                         }
@@ -443,7 +837,6 @@ IpReceiveOnUnfiltered(IpIface iface,
           else
             {
               PackosPacketFree(packet,error);
-              IpHeaderIteratorDelete(it,error);
               *error=packosErrorRoutingNotSupported;
               return 0;
             }
@@ -451,7 +844,6 @@ IpReceiveOnUnfiltered(IpIface iface,
 
         case ipHeaderTypeFragment:
           PackosPacketFree(packet,error);
-          IpHeaderIteratorDelete(it,error);
           *error=packosErrorFragmentsNotSupported;
           return 0;
           break;
@@ -463,13 +855,20 @@ IpReceiveOnUnfiltered(IpIface iface,
 
         default:
           PackosPacketFree(packet,error);
-          IpHeaderIteratorDelete(it,error);
           *error=packosErrorNotImplemented;
           return 0;
         }
     }
 
-  IpHeaderIteratorDelete(it,error);
+  /* parseHeaders() stops at a header type it doesn't know, so the loop
+   *  above never sees one.
+   */
+  if (info->unknown)
+    {
+      PackosPacketFree(packet,error);
+      *error=packosErrorNotImplemented;
+      return 0;
+    }
 
   *error=packosErrorNone;
   *protocolP=protocol;
@@ -521,10 +920,41 @@ PackosPacket* IpReceiveOn(IpIface iface,
       return 0;
     }
 
+  if (IpPacketFromNetworkOrder(res,error)<0)
+    {
+      PackosError tmp;
+      PackosPacketFree(res,&tmp);
+      UtilPrintfStream(errStream,&tmp,
+                       "IpReceiveOn(): IpPacketFromNetworkOrder(): %s\n",
+                       PackosErrorToString(*error));
+      return 0;
+    }
+
   return res;
 }
 
-int IpSend(PackosPacket* packet, PackosError* error)
+int IpCallOn(IpIface iface, PackosPacket* packet, PackosError* error)
+{
+  if (!(iface && packet && (iface->send)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!(iface->call))
+    return IpSendOn(iface,packet,error);
+
+  packet->ipv6.hopLimit--;
+
+  if (IpPacketToNetworkOrder(packet,error)<0) return -1;
+
+  return (iface->call)(iface,packet,error);
+}
+
+/* The interface to send packet on, setting its packos.dest to the next
+ *  hop.
+ */
+static IpIface route(PackosPacket* packet, PackosError* error)
 {
   IpIface iface=IpIfaceLookupSend(packet->ipv6.dest,
                                   error);
@@ -559,16 +989,32 @@ int IpSend(PackosPacket* packet, PackosError* error)
                           msg);
                 }
               *error=packosErrorNoRouteToHost;
-              return -1;
+              return 0;
             }
           else
             packet->packos.dest=addr;
         }
     }
 
+  return iface;
+}
+
+int IpSend(PackosPacket* packet, PackosError* error)
+{
+  IpIface iface=route(packet,error);
+  if (!iface) return -1;
+
   return IpSendOn(iface,packet,error);
 }
 
+int IpCall(PackosPacket* packet, PackosError* error)
+{
+  IpIface iface=route(packet,error);
+  if (!iface) return -1;
+
+  return IpCallOn(iface,packet,error);
+}
+
 PackosPacket* IpReceive(byte protocolExpected, /* 0 is wildcard */
                         IpHeaderRouting0** routingHeader,
                         IpIface* ifaceReceivedOn,
@@ -612,19 +1058,53 @@ PackosPacket* IpReceive(byte protocolExpected, /* 0 is wildcard */
       if ((!res) && ((*error)!=packosErrorQueueEmpty)) return 0;
     }
 
+  if (IpPacketFromNetworkOrder(res,error)<0)
+    {
+      PackosError tmp;
+      PackosPacketFree(res,&tmp);
+      UtilPrintfStream(errStream,&tmp,
+                       "IpReceive(): IpPacketFromNetworkOrder(): %s\n",
+                       PackosErrorToString(*error));
+      return 0;
+    }
+
   return res;
 }
 
 int IpMcastJoin(IpIface iface, PackosAddress group, PackosError* error)
 {
-  *error=packosErrorNotImplemented;
-  return -1;
+  if (!error) return -2;
+  if (!(iface && PackosAddrIsMcast(group)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!(iface->mcastJoin))
+    {
+      *error=packosErrorNotImplemented;
+      return -1;
+    }
+
+  return (iface->mcastJoin)(iface,group,error);
 }
 
 int IpMcastLeave(IpIface iface, PackosAddress group, PackosError* error)
 {
-  *error=packosErrorNotImplemented;
-  return -1;
+  if (!error) return -2;
+  if (!(iface && PackosAddrIsMcast(group)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!(iface->mcastLeave))
+    {
+      *error=packosErrorNotImplemented;
+      return -1;
+    }
+
+  return (iface->mcastLeave)(iface,group,error);
 }
 
 byte IpGetVersion(const PackosPacket* packet,
@@ -637,7 +1117,8 @@ byte IpGetVersion(const PackosPacket* packet,
     }
 
   *error=packosErrorNone;
-  return (packet->ipv6.versionAndTrafficClassAndFlowLabel)>>28;
+  return get32((PackosPacket*)packet,
+               packet->ipv6.versionAndTrafficClassAndFlowLabel)>>28;
 }
 
 byte IpGetTrafficClass(const PackosPacket* packet,
@@ -650,7 +1131,8 @@ byte IpGetTrafficClass(const PackosPacket* packet,
     }
 
   *error=packosErrorNone;
-  return ((packet->ipv6.versionAndTrafficClassAndFlowLabel)>>20)&255;
+  return (get32((PackosPacket*)packet,
+                packet->ipv6.versionAndTrafficClassAndFlowLabel)>>20)&255;
 }
 
 uint16_t IpGetFlowLabel(const PackosPacket* packet,
@@ -663,7 +1145,8 @@ uint16_t IpGetFlowLabel(const PackosPacket* packet,
     }
 
   *error=packosErrorNone;
-  return (packet->ipv6.versionAndTrafficClassAndFlowLabel)&65535;
+  return get32((PackosPacket*)packet,
+               packet->ipv6.versionAndTrafficClassAndFlowLabel)&65535;
 }
 
 int IpSetVersion(PackosPacket* packet,
@@ -677,10 +1160,12 @@ int IpSetVersion(PackosPacket* packet,
     }
 
   {
-    uint32_t vtfl=(packet->ipv6.versionAndTrafficClassAndFlowLabel);
+    uint32_t vtfl
+      =get32(packet,packet->ipv6.versionAndTrafficClassAndFlowLabel);
     vtfl&=~(15<<28);
     vtfl|=(version<<28);
-    packet->ipv6.versionAndTrafficClassAndFlowLabel=vtfl;
+    packet->ipv6.versionAndTrafficClassAndFlowLabel
+      =(inNetworkOrder(packet) ? htonl(vtfl) : vtfl);
   }
 
   *error=packosErrorNone;
@@ -698,10 +1183,12 @@ int IpSetTrafficClass(PackosPacket* packet,
     }
 
   {
-    uint32_t vtfl=(packet->ipv6.versionAndTrafficClassAndFlowLabel);
+    uint32_t vtfl
+      =get32(packet,packet->ipv6.versionAndTrafficClassAndFlowLabel);
     vtfl&=~(255<<20);
     vtfl|=((trafficClass&255)<<20);
-    packet->ipv6.versionAndTrafficClassAndFlowLabel=vtfl;
+    packet->ipv6.versionAndTrafficClassAndFlowLabel
+      =(inNetworkOrder(packet) ? htonl(vtfl) : vtfl);
   }
 
   *error=packosErrorNone;
@@ -719,10 +1206,12 @@ int IpSetFlowLabel(PackosPacket* packet,
     }
 
   {
-    uint32_t vtfl=(packet->ipv6.versionAndTrafficClassAndFlowLabel);
+    uint32_t vtfl
+      =get32(packet,packet->ipv6.versionAndTrafficClassAndFlowLabel);
     vtfl&=~65535;
     vtfl|=(flowLabel&65535);
-    packet->ipv6.versionAndTrafficClassAndFlowLabel=vtfl;
+    packet->ipv6.versionAndTrafficClassAndFlowLabel
+      =(inNetworkOrder(packet) ? htonl(vtfl) : vtfl);
   }
 
   *error=packosErrorNone;
@@ -818,7 +1307,8 @@ IpHeader* IpHeaderSeek(PackosPacket* packet,
                        IpHeaderType type,
                        PackosError* error)
 {
-  IpHeaderIterator it;
+  IpPacketInfo* info;
+  unsigned int i;
 
   if (!packet)
     {
@@ -826,19 +1316,12 @@ IpHeader* IpHeaderSeek(PackosPacket* packet,
       return 0;
     }
 
-  /* Memory leak: we never free the iterator...and we can't, easily,
-   *  because it contains the IpHeader we return.
-   */
-
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it) return 0;
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return 0;
 
-  while (IpHeaderIteratorHasNext(it,error))
-    {
-      IpHeader* cur=IpHeaderIteratorNext(it,error);
-      if (!cur) return 0;
-      if (cur->kind==type) return cur;
-    }
+  for (i=0; i<info->numHeaders; i++)
+    if (info->headers[i].header.kind==type)
+      return IpPacketGetHeader(packet,i,error);
 
   *error=packosErrorDoesNotExist;
   return 0;
@@ -847,8 +1330,7 @@ IpHeader* IpHeaderSeek(PackosPacket* packet,
 int IpPacketProtocol(PackosPacket* packet,
                      PackosError* error)
 {
-  IpHeaderIterator it;
-  int res;
+  IpPacketInfo* info;
 
   if (!packet)
     {
@@ -856,27 +1338,16 @@ int IpPacketProtocol(PackosPacket* packet,
       return -1;
     }
 
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it) return -1;
-
-  res=packet->ipv6.nextHeader;
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return -1;
 
-  while (IpHeaderIteratorHasNext(it,error))
-    {
-      IpHeader* cur=IpHeaderIteratorNext(it,error);
-      if (!cur) return -1;
-      res=cur->kind;
-    }
-
-  *error=packosErrorNone;
-  return res;
+  return info->protocol;
 }
 
 static IpHeader* getLastHeader(PackosPacket* packet,
                                PackosError* error)
 {
-  IpHeaderIterator it;
-  IpHeader* cur=0;
+  IpPacketInfo* info;
 
   if (!packet)
     {
@@ -884,30 +1355,13 @@ static IpHeader* getLastHeader(PackosPacket* packet,
       return 0;
     }
 
-  it=IpHeaderIteratorNew(packet,error);
-  if (!it) return 0;
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return 0;
 
-  while (IpHeaderIteratorHasNext(it,error))
-    {
-      cur=IpHeaderIteratorNext(it,error);
-      if (!cur)
-        {
-          PackosError tmp;
-          IpHeaderIteratorDelete(it,&tmp);
-          return 0;
-        }
-    }
-
-  {
-    PackosError tmp;
-    IpHeaderIteratorDelete(it,&tmp);
-  }
+  if (info->numHeaders)
+    return IpPacketGetHeader(packet,info->numHeaders-1,error);
 
-  if ((*error)!=packosErrorNone) return 0;
-
-  if (cur) return cur;
   *error=packosErrorDoesNotExist;
-
   return 0;
 }
 
@@ -915,6 +1369,8 @@ int IpHeaderAppend(PackosPacket* packet,
                    IpHeader* header,
                    PackosError* error)
 {
+  IpPacketInfo* info;
+  IpPacketHeaderSlot* slot;
   IpHeader* last;
   byte* newBase;
   int len;
@@ -928,6 +1384,24 @@ int IpHeaderAppend(PackosPacket* packet,
   len=IpHeaderGetSize(header,error);
   if (len<0) return -1;
 
+  /* The new header's in host order, so the rest had better be. */
+  if (inNetworkOrder(packet)
+      && (IpPacketFromNetworkOrder(packet,error)<0))
+    return -1;
+
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return -1;
+  if (info->numHeaders>=IP_PACKET_MAX_HEADERS)
+    {
+      *error=packosErrorNotImplemented;
+      return -1;
+    }
+  if (((packet->ipv6.dataAndHeaders)+(info->dataOffset)+len)>((byte*)info))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
   last=getLastHeader(packet,error);
   if ((!last) && ((*error)!=packosErrorDoesNotExist)) return -1;
 
@@ -1002,6 +1476,15 @@ int IpHeaderAppend(PackosPacket* packet,
   UtilMemcpy(newBase,header->u.udp,len);
 
   header->u.udp=(IpHeaderUDP*)newBase;
+
+  slot=info->headers+info->numHeaders;
+  slot->offset=newBase-(packet->ipv6.dataAndHeaders);
+  slot->header=*header;
+  info->numHeaders++;
+  info->firstKind=packet->ipv6.nextHeader;
+  info->protocol=header->kind;
+  info->unknown=false;
+  info->dataOffset=slot->offset+len;
   return 0;
 }
 
@@ -1011,7 +1494,8 @@ int IpPacketGetDataLen(PackosPacket* packet,
   byte* data=IpPacketData(packet,error);
   if (!data) return -1;
 
-  return packet->ipv6.payloadLength-(data-(packet->ipv6.dataAndHeaders));
+  return (get16(packet,packet->ipv6.payloadLength)
+          -(data-(packet->ipv6.dataAndHeaders)));
 }
 
 int IpPacketSetDataLen(PackosPacket* packet,
@@ -1021,28 +1505,23 @@ int IpPacketSetDataLen(PackosPacket* packet,
   byte* data=IpPacketData(packet,error);
   if (!data) return -1;
 
-  packet->ipv6.payloadLength=datalen+(data-(packet->ipv6.dataAndHeaders));
-  return 0;
+  return IpPacketSetPayloadLength(packet,
+                                  datalen+(data-(packet->ipv6.dataAndHeaders)),
+                                  error);
 }
 
 byte* IpPacketData(PackosPacket* packet,
                    PackosError* error)
 {
-  IpHeader* last;
+  IpPacketInfo* info;
   if (!packet)
     {
       *error=packosErrorInvalidArg;
       return 0;
     }
 
-  last=getLastHeader(packet,error);
-  if (!last)
-    {
-      if ((*error)!=packosErrorDoesNotExist)
-        return 0;
+  info=IpPacketGetInfo(packet,error);
+  if (!info) return 0;
 
-      return packet->ipv6.dataAndHeaders;
-    }
-  else
-    return IpHeaderGetNextPos(last,error);
+  return (packet->ipv6.dataAndHeaders)+(info->dataOffset);
 }
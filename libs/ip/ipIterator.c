@@ -1,11 +1,10 @@
 #include <ip.h>
 #include <util/alloc.h>
 
+/* Steps through the headers IpPacketGetInfo() found. */
 struct IpHeaderIterator {
   PackosPacket* packet;
-  uint32_t curOffset;
-  byte curType;
-  IpHeader curHeader;
+  unsigned int index;
 };
 
 IpHeaderIterator IpHeaderIteratorNew(PackosPacket* packet,
@@ -52,7 +51,7 @@ int IpHeaderIteratorDelete(IpHeaderIterator it,
 IpHeader* IpHeaderIteratorNext(IpHeaderIterator iterator,
                                PackosError* error)
 {
-  void* h;
+  IpHeader* res;
 
   if (!iterator)
     {
@@ -60,96 +59,26 @@ IpHeader* IpHeaderIteratorNext(IpHeaderIterator iterator,
       return 0;
     }
 
-  if (iterator->curType==ipHeaderTypeNone)
-    {
-      *error=packosErrorDoesNotExist;
-      return 0;
-    }
-
-  h=((iterator->packet->ipv6.dataAndHeaders)+(iterator->curOffset));
-
-  switch (iterator->curHeader.kind=iterator->curType)
-    {
-    case ipHeaderTypeHopByHop:
-      iterator->curHeader.u.hopByHop=(IpHeaderHopByHopOptions*)h;
-      iterator->curType=iterator->curHeader.u.hopByHop->nextHeader;
-      iterator->curOffset+=8*(iterator->curHeader.u.hopByHop->len+1);
-      break;
-
-    case ipHeaderTypeDestination:
-      iterator->curHeader.u.dest=(IpHeaderDestOptions*)h;
-      iterator->curType=iterator->curHeader.u.dest->nextHeader;
-      iterator->curOffset+=8*(iterator->curHeader.u.dest->len+1);
-      break;
-
-    case ipHeaderTypeRouting:
-      iterator->curHeader.u.routing0=(IpHeaderRouting0*)h;
-      iterator->curType=iterator->curHeader.u.routing0->nextHeader;
-      iterator->curOffset+=8*(iterator->curHeader.u.routing0->len+1);
-      break;
-
-    case ipHeaderTypeFragment:
-      iterator->curHeader.u.fragment=(IpHeaderFragment*)h;
-      iterator->curType=iterator->curHeader.u.fragment->nextHeader;
-      iterator->curOffset+=sizeof(IpHeaderFragment);
-      break;
-
-    case ipHeaderTypeUDP:
-      iterator->curHeader.u.udp=(IpHeaderUDP*)h;
-      iterator->curType=ipHeaderTypeNone;
-      iterator->curOffset+=sizeof(IpHeaderUDP);
-      break;
-
-    case ipHeaderTypeTCP:
-      iterator->curHeader.u.tcp=(IpHeaderTCP*)h;
-      iterator->curType=ipHeaderTypeNone;
-      iterator->curOffset
-        +=((iterator->curHeader.u.tcp->dataOffsetAndFlags)>>12)*4;
-      break;
-
-    case ipHeaderTypeICMP:
-      iterator->curHeader.u.icmp=(IpHeaderICMP*)h;
-      iterator->curType=ipHeaderTypeNone;
-      iterator->curOffset+=sizeof(IpHeaderICMP);
-      break;
-
-    default:
-      iterator->curType=ipHeaderTypeNone;
-      *error=packosErrorNotImplemented;
-      return 0;
-    }
-
-  return &(iterator->curHeader);
+  res=IpPacketGetHeader(iterator->packet,iterator->index,error);
+  if (res) iterator->index++;
+  return res;
 }
 
 bool IpHeaderIteratorHasNext(IpHeaderIterator iterator,
                              PackosError* error)
 {
+  IpPacketInfo* info;
+
   if (!iterator)
     {
       *error=packosErrorInvalidArg;
       return false;
     }
 
-  *error=packosErrorNone;
-  switch (iterator->curType)
-    {
-    case ipHeaderTypeHopByHop:
-    case ipHeaderTypeDestination:
-    case ipHeaderTypeRouting:
-    case ipHeaderTypeFragment:
-    case ipHeaderTypeUDP:
-    case ipHeaderTypeICMP:
-    case ipHeaderTypeTCP:
-      return true;
-
-    case ipHeaderTypeNone:
-      return false;
+  info=IpPacketGetInfo(iterator->packet,error);
+  if (!info) return false;
 
-    default:
-      *error=packosErrorNotImplemented;
-      return false;
-    }
+  return (iterator->index<info->numHeaders);
 }
 
 int IpHeaderIteratorRewind(IpHeaderIterator iterator,
@@ -161,8 +90,6 @@ int IpHeaderIteratorRewind(IpHeaderIterator iterator,
       return false;
     }
 
-  iterator->curOffset=0;
-  iterator->curType=iterator->packet->ipv6.nextHeader;
-  iterator->curHeader.u.udp=0;
+  iterator->index=0;
   return 0;
 }
@@ -3,9 +3,29 @@
 #include <ip.h>
 #include <packet-queue.h>
 
+static PackosPacketQueueClass classOf(int protocol)
+{
+  switch (protocol)
+    {
+    case ipHeaderTypeUDP:
+      return packosPacketQueueClassUDP;
+
+    case ipHeaderTypeTCP:
+      return packosPacketQueueClassTCP;
+
+    case ipHeaderTypeICMP:
+      return packosPacketQueueClassICMP;
+
+    default:
+      return packosPacketQueueClassOther;
+    }
+}
+
 PackosPacketQueue PackosPacketQueueNew(int capacity,
                                        PackosError* error)
 {
+  PackosPacketQueueEntry* entries;
+  int i;
   PackosPacketQueue res
     =(PackosPacketQueue)(malloc(sizeof(struct PackosPacketQueue)));
   if (!res)
@@ -14,16 +34,26 @@ PackosPacketQueue PackosPacketQueueNew(int capacity,
       return 0;
     }
 
-  res->packets=(PackosPacket**)(malloc(capacity*sizeof(PackosPacket*)));
-  if (!(res->packets))
+  /* Any one ring may have to hold the whole queue. */
+  entries=(PackosPacketQueueEntry*)
+    (malloc(packosPacketQueueNumClasses*capacity
+            *sizeof(PackosPacketQueueEntry)));
+  if (!entries)
     {
       free(res);
       *error=packosErrorOutOfMemory;
       return 0;
     }
 
+  for (i=0; i<packosPacketQueueNumClasses; i++)
+    {
+      res->rings[i].entries=entries+(i*capacity);
+      res->rings[i].start=res->rings[i].count=0;
+    }
+
   res->capacity=capacity;
-  res->start=res->count=0;
+  res->count=0;
+  res->nextSeq=0;
   return res;
 }
 
@@ -37,16 +67,21 @@ int PackosPacketQueueDelete(PackosPacketQueue queue,
     }
 
   {
-    int i;
+    int i,j;
     int N=queue->capacity;
-    for (i=0; i<queue->count; i++)
+    for (i=0; i<packosPacketQueueNumClasses; i++)
       {
-        PackosPacket* packet=queue->packets[(queue->start+i)%N];
-        if (packet)
-          PackosPacketFree(packet,error);
+        PackosPacketQueueRing* ring=queue->rings+i;
+        for (j=0; j<ring->count; j++)
+          {
+            PackosPacket* packet=ring->entries[(ring->start+j)%N].packet;
+            if (packet)
+              PackosPacketFree(packet,error);
+          }
       }
   }
 
+  free(queue->rings[0].entries);
   free(queue);
   return 0;
 }
@@ -55,6 +90,10 @@ int PackosPacketQueueEnqueue(PackosPacketQueue queue,
                              PackosPacket* packet,
                              PackosError* error)
 {
+  PackosPacketQueueRing* ring;
+  PackosPacketQueueEntry* entry;
+  int protocol;
+
   if (!(queue && packet))
     {
       *error=packosErrorInvalidArg;
@@ -67,14 +106,56 @@ int PackosPacketQueueEnqueue(PackosPacketQueue queue,
       return -1;
     }
 
+  /* A packet we can't parse can still go out through a dequeue that
+   *  takes any protocol.
+   */
   {
-    int i=((queue->start)+(queue->count))%(queue->capacity);
-    queue->packets[i]=packet;
+    PackosError tmp;
+    protocol=IpPacketProtocol(packet,&tmp);
+    if (protocol<0)
+      protocol=ipHeaderTypeError;
   }
+
+  ring=queue->rings+classOf(protocol);
+  entry=ring->entries+(((ring->start)+(ring->count))%(queue->capacity));
+  entry->packet=packet;
+  entry->seq=queue->nextSeq++;
+  entry->protocol=protocol;
+
+  ring->count++;
   queue->count++;
   return 0;
 }
 
+static PackosPacket* takeAt(PackosPacketQueue queue,
+                            PackosPacketQueueRing* ring,
+                            int i)
+{
+  int N=queue->capacity;
+  PackosPacket* res=ring->entries[(ring->start+i)%N].packet;
+
+  if (i)
+    {
+      /* Only the "other" ring is ever taken from the middle, and only
+       *  when a caller asks for an unusual protocol.
+       */
+      while (i<ring->count-1)
+        {
+          ring->entries[(ring->start+i)%N]=ring->entries[(ring->start+i+1)%N];
+          i++;
+        }
+    }
+  else
+    {
+      ring->start++;
+      ring->start%=N;
+    }
+
+  ring->count--;
+  queue->count--;
+  return res;
+}
+
 PackosPacket* PackosPacketQueueDequeue(PackosPacketQueue queue,
                                        byte protocolExpected,
                                        PackosError* error)
@@ -93,38 +174,49 @@ PackosPacket* PackosPacketQueueDequeue(PackosPacketQueue queue,
 
   if (protocolExpected)
     {
-      PackosPacket* res=0;
+      PackosPacketQueueClass class=classOf(protocolExpected);
+      PackosPacketQueueRing* ring=queue->rings+class;
       int i;
-      for (i=0; i<queue->count; i++)
+
+      if (class!=packosPacketQueueClassOther)
         {
-          PackosPacket* cur=queue->packets[(queue->start+i)%(queue->capacity)];
-          int protocol=IpPacketProtocol(cur,error);
-          if (protocol==protocolExpected)
+          if (ring->count)
             {
-              res=cur;
-              break;
+              *error=packosErrorNone;
+              return takeAt(queue,ring,0);
             }
         }
+      else
+        for (i=0; i<ring->count; i++)
+          {
+            int j=(ring->start+i)%(queue->capacity);
+            if (ring->entries[j].protocol==protocolExpected)
+              {
+                *error=packosErrorNone;
+                return takeAt(queue,ring,i);
+              }
+          }
 
-      while (i<queue->count)
-        {
-          queue->packets[(queue->start+i)%(queue->capacity)]
-            =queue->packets[(queue->start+i+1)%(queue->capacity)];
-          i++;
-        }
-
-      if (res) queue->count--;
-
-      return res;
+      *error=packosErrorQueueEmpty;
+      return 0;
     }
   else
     {
-      PackosPacket* res=queue->packets[queue->start];
-      queue->start++;
-      queue->start%=(queue->capacity);
-      queue->count--;
+      PackosPacketQueueRing* oldest=0;
+      int i;
+
+      for (i=0; i<packosPacketQueueNumClasses; i++)
+        {
+          PackosPacketQueueRing* ring=queue->rings+i;
+          if (!(ring->count)) continue;
+          if ((!oldest)
+              || (((int32_t)(ring->entries[ring->start].seq
+                             -oldest->entries[oldest->start].seq))<0))
+            oldest=ring;
+        }
 
-      return res;
+      *error=packosErrorNone;
+      return takeAt(queue,oldest,0);
     }
 }
 
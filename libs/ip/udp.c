@@ -18,14 +18,24 @@ struct UdpSocket {
 
   PackosPacketQueue queue;
 
+  /* In its bucket of socketsByPort, once bound. */
   UdpSocket next;
   UdpSocket prev;
 };
 
-static struct {
-  UdpSocket first;
-  UdpSocket last;
-} sockets={0,0};
+/* Bound sockets, hashed by owner and local port, so that demultiplexing
+ *  a datagram doesn't mean walking every socket of every context.
+ */
+#define UDP_SOCKET_HASH_SIZE 64
+static UdpSocket socketsByPort[UDP_SOCKET_HASH_SIZE];
+
+static unsigned int hashPort(PackosContext owner,
+                             uint16_t port)
+{
+  uint32_t h=((uint32_t)owner)^port;
+  h*=2654435761U;
+  return (h>>24)%UDP_SOCKET_HASH_SIZE;
+}
 
 UdpSocket UdpSocketNew(PackosError* error)
 {
@@ -53,14 +63,7 @@ UdpSocket UdpSocketNew(PackosError* error)
   res->iface=0;
   res->addr=PackosAddrGetZero();
   res->port=0;
-
-  if ((res->prev=sockets.last)!=0)
-    res->prev->next=res;
-  else
-    sockets.first=res;
-  res->next=0;
-
-  sockets.last=res;
+  res->next=res->prev=0;
   return res;
 }
 
@@ -75,15 +78,16 @@ int UdpSocketClose(UdpSocket socket,
 
   if (PackosPacketQueueDelete(socket->queue,error)<0) return -1;
 
-  if (socket->next)
-    socket->next->prev=socket->prev;
-  else
-    sockets.last=socket->prev;
+  if (socket->port)
+    {
+      if (socket->next)
+        socket->next->prev=socket->prev;
 
-  if (socket->prev)
-    socket->prev->next=socket->next;
-  else
-    sockets.first=socket->next;
+      if (socket->prev)
+        socket->prev->next=socket->next;
+      else
+        socketsByPort[hashPort(socket->owner,socket->port)]=socket->next;
+    }
 
   free(socket);
   return 0;
@@ -105,7 +109,7 @@ static UdpSocket seek(PackosAddress addr,
   self=PackosKernelContextCurrent(error);
   if (!self) return 0;
 
-  for (cur=sockets.first; cur; cur=cur->next)
+  for (cur=socketsByPort[hashPort(self,port)]; cur; cur=cur->next)
     {
       if (cur->owner!=self) continue;
       if (cur->port!=port) continue;
@@ -207,6 +211,15 @@ int UdpSocketBind(UdpSocket socket,
 
   socket->addr=addr;
   socket->port=port;
+
+  {
+    UdpSocket* bucket=socketsByPort+hashPort(socket->owner,port);
+    socket->prev=0;
+    socket->next=*bucket;
+    if (socket->next)
+      socket->next->prev=socket;
+    *bucket=socket;
+  }
   return 0;
 }
 
@@ -330,34 +343,35 @@ IpHeaderUDP* UdpPacketSeekHeader(PackosPacket* packet,
   
 }
 
-int UdpSocketSend(UdpSocket socket,
-                  PackosPacket* packet,
-                  PackosError* error)
+/* Fills in the source port and checksum, returning the UDP header. */
+static IpHeader* prepare(UdpSocket socket,
+                         PackosPacket* packet,
+                         PackosError* error)
 {
   IpHeader* udp;
   if (!(socket && packet))
     {
       *error=packosErrorInvalidArg;
-      return -1;
+      return 0;
     }
 
   if (!(socket->port))
     {
       *error=packosErrorSocketNotBound;
-      return -1;
+      return 0;
     }
 
   udp=IpHeaderSeek(packet,ipHeaderTypeUDP,error);
   if (!udp)
     {
       if ((*error)==packosErrorDoesNotExist) *error=packosErrorWrongProtocol;
-      return -1;
+      return 0;
     }
 
   if (!(udp->u.udp->destPort))
     {
       *error=packosErrorNoDestPort;
-      return -1;
+      return 0;
     }
 
   udp->u.udp->sourcePort=socket->port;
@@ -368,13 +382,23 @@ int UdpSocketSend(UdpSocket socket,
       {
         PackosError tmp;
         UtilPrintfStream(errStream,&tmp,
-                         "UdpSocketSend(): UdpChecksum(): %s\n",
+                         "udp::prepare(): UdpChecksum(): %s\n",
                          PackosErrorToString(*error));
-        return -1;
+        return 0;
       }
     udp->u.udp->checksum=checksum;
   }
 
+  return udp;
+}
+
+int UdpSocketSend(UdpSocket socket,
+                  PackosPacket* packet,
+                  PackosError* error)
+{
+  IpHeader* udp=prepare(socket,packet,error);
+  if (!udp) return -1;
+
   if (PackosAddrEq(packet->ipv6.src,packet->ipv6.dest))
     {
       UdpSocket otherSocket
@@ -402,6 +426,36 @@ int UdpSocketSend(UdpSocket socket,
     return IpSend(packet,error);
 }
 
+PackosPacket* UdpSocketCall(UdpSocket socket,
+                            PackosPacket* request,
+                            PackosError* error)
+{
+  int res=-1;
+
+  if (prepare(socket,request,error))
+    {
+      if (PackosAddrEq(request->ipv6.src,request->ipv6.dest))
+        res=UdpSocketSend(socket,request,error);
+      else if (socket->iface)
+        res=IpCallOn(socket->iface,request,error);
+      else
+        res=IpCall(request,error);
+    }
+
+  /* A server that finished has the request in its queue. */
+  if (res<0)
+    {
+      if ((*error)!=packosErrorContextFinished)
+        {
+          PackosError tmp;
+          PackosPacketFree(request,&tmp);
+        }
+      return 0;
+    }
+
+  return UdpSocketReceive(socket,0,false,error);
+}
+
 PackosPacket* UdpSocketReceive(UdpSocket socket,
                                IpHeaderRouting0** routingHeader,
                                bool stopWhenReceiveOtherPacket,
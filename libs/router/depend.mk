@@ -9,4 +9,8 @@ router.o: ../../include/ip.h ../../include/icmp-types.h
 router.o: ../../include/iface-native.h ../../include/iface.h
 router.o: ../../include/tcp.h ../../include/ip-filter.h
 router.o: ../../include/packet-queue.h ../../include/iface-shm.h
-router.o: ../../include/udp.h ../../include/icmp.h
+router.o: ../../include/udp.h ../../include/icmp.h ../../include/route-table.h
+route-table.o: ../../include/util/alloc.h ../../include/packos/types.h
+route-table.o: ../../include/packos/errors.h ../../include/packos/arch.h
+route-table.o: ../../include/route-table.h ../../include/ip.h
+route-table.o: ../../include/packos/packet.h ../../include/icmp-types.h
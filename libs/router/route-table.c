@@ -0,0 +1,322 @@
+#include <util/alloc.h>
+#include <packos/arch.h>
+#include <route-table.h>
+
+#define ADDR_BITS 128
+
+typedef struct RouteTableNode {
+  PackosAddress prefix; /* bits past len are clear */
+  unsigned int len;
+  bool hasRoute;
+  IpIface iface;
+  struct RouteTableNode* children[2];
+} RouteTableNode;
+
+struct RouteTable {
+  RouteTableNode* root;
+  uint32_t numRoutes;
+};
+
+static inline unsigned int bitAt(const PackosAddress* addr,
+                                 unsigned int i)
+{
+  return (addr->bytes[i>>3]>>(7-(i&7)))&1;
+}
+
+/* How many leading bits a and b share, up to max. */
+static unsigned int commonLen(const PackosAddress* a,
+                              const PackosAddress* b,
+                              unsigned int max)
+{
+  unsigned int i;
+
+  for (i=0; (i<4) && (i*32<max); i++)
+    {
+      uint32_t diff=ntohl(a->quads[i]^b->quads[i]);
+      if (diff)
+        {
+          unsigned int res=i*32+__builtin_clz(diff);
+          return (res<max) ? res : max;
+        }
+    }
+
+  return max;
+}
+
+static PackosAddress maskAddr(PackosAddress addr,
+                              unsigned int len)
+{
+  unsigned int i;
+
+  for (i=0; i<4; i++)
+    {
+      if (len>=32)
+        len-=32;
+      else if (len==0)
+        addr.quads[i]=0;
+      else
+        {
+          addr.quads[i]&=htonl(~((1U<<(32-len))-1));
+          len=0;
+        }
+    }
+
+  return addr;
+}
+
+static RouteTableNode* nodeNew(const PackosAddress* prefix,
+                               unsigned int len,
+                               PackosError* error)
+{
+  RouteTableNode* res=(RouteTableNode*)(malloc(sizeof(RouteTableNode)));
+  if (!res)
+    {
+      *error=packosErrorOutOfMemory;
+      return 0;
+    }
+
+  res->prefix=maskAddr(*prefix,len);
+  res->len=len;
+  res->hasRoute=false;
+  res->iface=0;
+  res->children[0]=res->children[1]=0;
+  return res;
+}
+
+static void nodeFree(RouteTableNode* node)
+{
+  if (!node) return;
+  nodeFree(node->children[0]);
+  nodeFree(node->children[1]);
+  free(node);
+}
+
+RouteTable RouteTableNew(PackosError* error)
+{
+  RouteTable res;
+
+  if (!error) return 0;
+
+  res=(RouteTable)(malloc(sizeof(struct RouteTable)));
+  if (!res)
+    {
+      *error=packosErrorOutOfMemory;
+      return 0;
+    }
+
+  res->root=0;
+  res->numRoutes=0;
+  return res;
+}
+
+int RouteTableDelete(RouteTable table,
+                     PackosError* error)
+{
+  if (!error) return -2;
+  if (!table)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  nodeFree(table->root);
+  free(table);
+  return 0;
+}
+
+int RouteTableAdd(RouteTable table,
+                  PackosAddressMask prefix,
+                  IpIface iface,
+                  PackosError* error)
+{
+  RouteTableNode** slot;
+  PackosAddress key;
+  unsigned int len;
+
+  if (!error) return -2;
+  if ((!table) || (!iface) || (prefix.len>ADDR_BITS))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  len=prefix.len;
+  key=maskAddr(prefix.addr,len);
+
+  slot=&(table->root);
+  while (1)
+    {
+      RouteTableNode* node=*slot;
+      RouteTableNode* added;
+      unsigned int common;
+
+      if (!node)
+        {
+          added=nodeNew(&key,len,error);
+          if (!added) return -1;
+          *slot=added;
+        }
+      else
+        {
+          common=commonLen(&(node->prefix),&key,
+                           (node->len<len) ? node->len : len);
+
+          if (common==node->len)
+            {
+              if (node->len<len)
+                {
+                  slot=node->children+bitAt(&key,node->len);
+                  continue;
+                }
+
+              added=node;
+              if (added->hasRoute)
+                {
+                  added->iface=iface;
+                  return 0;
+                }
+            }
+          else if (common==len)
+            {
+              /* The new prefix goes above this node. */
+              added=nodeNew(&key,len,error);
+              if (!added) return -1;
+              added->children[bitAt(&(node->prefix),len)]=node;
+              *slot=added;
+            }
+          else
+            {
+              /* They part before either ends: fork where they do. */
+              RouteTableNode* fork=nodeNew(&key,common,error);
+              if (!fork) return -1;
+
+              added=nodeNew(&key,len,error);
+              if (!added)
+                {
+                  free(fork);
+                  return -1;
+                }
+
+              fork->children[bitAt(&key,common)]=added;
+              fork->children[bitAt(&(node->prefix),common)]=node;
+              *slot=fork;
+            }
+        }
+
+      added->hasRoute=true;
+      added->iface=iface;
+      table->numRoutes++;
+      return 0;
+    }
+}
+
+int RouteTableRemove(RouteTable table,
+                     PackosAddressMask prefix,
+                     PackosError* error)
+{
+  RouteTableNode** slot;
+  RouteTableNode** parentSlot=0;
+  RouteTableNode* node;
+  PackosAddress key;
+  unsigned int len;
+
+  if (!error) return -2;
+  if ((!table) || (prefix.len>ADDR_BITS))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  len=prefix.len;
+  key=maskAddr(prefix.addr,len);
+
+  slot=&(table->root);
+  while ((node=*slot)!=0)
+    {
+      if ((node->len>len)
+          || (commonLen(&(node->prefix),&key,node->len)<node->len))
+        node=0;
+      else if (node->len<len)
+        {
+          parentSlot=slot;
+          slot=node->children+bitAt(&key,node->len);
+          continue;
+        }
+      break;
+    }
+
+  if ((!node) || (!(node->hasRoute)))
+    {
+      *error=packosErrorDoesNotExist;
+      return -1;
+    }
+
+  node->hasRoute=false;
+  node->iface=0;
+  table->numRoutes--;
+
+  /* Nodes without routes are only kept to fork the trie. */
+  if (node->children[0] && node->children[1])
+    return 0;
+
+  *slot=node->children[0] ? node->children[0] : node->children[1];
+  free(node);
+
+  if (parentSlot && !(*slot))
+    {
+      RouteTableNode* parent=*parentSlot;
+      if (!(parent->hasRoute))
+        {
+          *parentSlot=parent->children[0]
+            ? parent->children[0]
+            : parent->children[1];
+          free(parent);
+        }
+    }
+
+  return 0;
+}
+
+IpIface RouteTableLookup(RouteTable table,
+                         PackosAddress addr,
+                         PackosError* error)
+{
+  RouteTableNode* node;
+  IpIface res=0;
+
+  if (!error) return 0;
+  if (!table)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  node=table->root;
+  while (node)
+    {
+      if (commonLen(&(node->prefix),&addr,node->len)<node->len)
+        break;
+      if (node->hasRoute)
+        res=node->iface;
+      if (node->len>=ADDR_BITS)
+        break;
+      node=node->children[bitAt(&addr,node->len)];
+    }
+
+  if (!res)
+    *error=packosErrorNoRouteToHost;
+  return res;
+}
+
+uint32_t RouteTableNumRoutes(RouteTable table,
+                             PackosError* error)
+{
+  if (!error) return 0;
+  if (!table)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  return table->numRoutes;
+}
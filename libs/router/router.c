@@ -8,26 +8,22 @@
 #include <ip-filter.h>
 #include <icmp.h>
 
-#define MAXROUTES 16
+#include <route-table.h>
 
-typedef struct {
-  PackosAddressMask mask;
-  IpIface iface;
-} RoutingTableEntry;
+/* Define ROUTER_TRACE to log each packet's route as it's looked up. */
 
 typedef struct {
-  int numRoutes;
-  RoutingTableEntry routes[MAXROUTES];
+  RouteTable routes;
   IpIface native,nonNative;
 } Context;
 
-static RoutingTableEntry* seekEntry(Context* context,
-                                    PackosPacket* packet,
-                                    PackosError* error)
+static IpIface seekRoute(Context* context,
+                         PackosPacket* packet,
+                         PackosError* error)
 {
-  int i,N=context->numRoutes;
-  if (N>MAXROUTES) N=MAXROUTES;
+  IpIface res=RouteTableLookup(context->routes,packet->ipv6.dest,error);
 
+#ifdef ROUTER_TRACE
   {
     char destAddrBuff[80];
     const char* destAddrStr=destAddrBuff;
@@ -39,41 +35,14 @@ static RoutingTableEntry* seekEntry(Context* context,
         <0)
       destAddrStr=PackosErrorToString(tmp);
 
-    UtilPrintfStream(errStream,error,"seekEntry(%s)\n",destAddrStr);
+    UtilPrintfStream(errStream,&tmp,"seekRoute(%s): %s\n",destAddrStr,
+                     (res==context->native) ? "native"
+                     : (res==context->nonNative) ? "shm"
+                     : res ? "other" : "none");
   }
+#endif
 
-  for (i=0; i<N; i++)
-    {
-      RoutingTableEntry* cur=context->routes+i;
-
-      {
-        char maskAddrBuff[80],destAddrBuff[80];
-        const char* maskAddrStr=maskAddrBuff;
-        const char* destAddrStr=destAddrBuff;
-        PackosError tmp;
-
-        if (PackosAddrToString(cur->mask.addr,
-                               maskAddrBuff,sizeof(maskAddrBuff),
-                               &tmp)
-            <0)
-          maskAddrStr=PackosErrorToString(tmp);
-
-        if (PackosAddrToString(packet->ipv6.dest,
-                               destAddrBuff,sizeof(destAddrBuff),
-                               &tmp)
-            <0)
-          destAddrStr=PackosErrorToString(tmp);
-
-        UtilPrintfStream(errStream,error,"Is %s in %s/%d?\n",
-                destAddrStr,maskAddrStr,cur->mask.len);
-      }
-
-      if (PackosAddrMatch(cur->mask,packet->ipv6.dest))
-        return cur;
-    }
-
-  *error=packosErrorNoRouteToHost;
-  return 0;
+  return res;
 }
 
 static IpFilterAction filterMethod(IpIface iface,
@@ -82,24 +51,22 @@ static IpFilterAction filterMethod(IpIface iface,
                                    PackosError* error)
 {
   Context* context=(Context*)context_;
-  RoutingTableEntry* entry;
-
-  UtilPrintfStream(errStream,error,"filterMethod\n");
+  IpIface routeIface;
 
-  entry=seekEntry(context,packet,error);
-  if (!entry)
+  routeIface=seekRoute(context,packet,error);
+  if (!routeIface)
     {
-      UtilPrintfStream(errStream,error,"filterMethod(): seekEntry(): %s\n",
+      UtilPrintfStream(errStream,error,"filterMethod(): seekRoute(): %s\n",
               PackosErrorToString(*error));
       return ipFilterActionError;
     }
 
-  if (entry->iface==iface)
+  if (routeIface==iface)
     return ipFilterActionPass;
 
   packet->packos.dest=packet->ipv6.dest;
 
-  if (IpSendOn(entry->iface,packet,error)<0)
+  if (IpSendOn(routeIface,packet,error)<0)
     {
       UtilPrintfStream(errStream,error,"filterMethod(): IpSendOn(): %s\n",
 	      PackosErrorToString(*error));
@@ -200,28 +167,53 @@ void routerProcess(void)
       return;
     }
 
-  context.native=native.iface;
-  context.routes[context.numRoutes].mask=PackosSysAddressMask(&error);
-  context.routes[context.numRoutes++].iface=native.iface;
-  if (error!=packosErrorNone)
+  context.routes=RouteTableNew(&error);
+  if (!context.routes)
     {
-      UtilPrintfStream(errStream,&error,"PackosSysAddressMask(): %s\n",PackosErrorToString(error));
+      UtilPrintfStream(errStream,&error,"RouteTableNew(): %s\n",PackosErrorToString(error));
       return;
     }
 
-  context.nonNative=shm.iface;
-  context.routes[context.numRoutes].mask=mask;
-  context.routes[context.numRoutes++].iface=shm.iface;
+  context.native=native.iface;
+  {
+    PackosAddressMask nativeMask=PackosSysAddressMask(&error);
+    if (error!=packosErrorNone)
+      {
+        UtilPrintfStream(errStream,&error,"PackosSysAddressMask(): %s\n",PackosErrorToString(error));
+        return;
+      }
 
-  context.routes[context.numRoutes].mask.addr
-    =PackosAddrFromString("::",&error);
-  if (error!=packosErrorNone)
+    if (RouteTableAdd(context.routes,nativeMask,native.iface,&error)<0)
+      {
+        UtilPrintfStream(errStream,&error,"RouteTableAdd(native): %s\n",PackosErrorToString(error));
+        return;
+      }
+  }
+
+  context.nonNative=shm.iface;
+  if (RouteTableAdd(context.routes,mask,shm.iface,&error)<0)
     {
-      UtilPrintfStream(errStream,&error,"PackosAddrFromString(\"::\"): %s\n",PackosErrorToString(error));
+      UtilPrintfStream(errStream,&error,"RouteTableAdd(shm): %s\n",PackosErrorToString(error));
       return;
     }
-  context.routes[context.numRoutes].mask.len=0;
-  context.routes[context.numRoutes++].iface=shm.iface;
+
+  {
+    PackosAddressMask defaultRoute;
+
+    defaultRoute.addr=PackosAddrFromString("::",&error);
+    if (error!=packosErrorNone)
+      {
+        UtilPrintfStream(errStream,&error,"PackosAddrFromString(\"::\"): %s\n",PackosErrorToString(error));
+        return;
+      }
+    defaultRoute.len=0;
+
+    if (RouteTableAdd(context.routes,defaultRoute,shm.iface,&error)<0)
+      {
+        UtilPrintfStream(errStream,&error,"RouteTableAdd(default): %s\n",PackosErrorToString(error));
+        return;
+      }
+  }
 
   native.filter=IpFilterInstall(native.iface,filterMethod,&context,&error);
   if (!native.filter)
@@ -258,11 +250,15 @@ void routerProcess(void)
       PackosError error;
       PackosPacket* packet;
 
+#ifdef ROUTER_TRACE
       UtilPrintfStream(errStream,&error,"Router about to receive\n");
+#endif
       packet=UdpSocketReceive(irqSendSock,0,true,&error);
       if (packet)
 	{
+#ifdef ROUTER_TRACE
 	  UtilPrintfStream(errStream,&error,"Router received packet on irqSendSock\n");
+#endif
 	  if (IpIfaceShmOnSendInterrupt(&error)<0)
 	    {
 	      UtilPrintfStream(errStream,&error,"IpIfaceShmOnSendInterrupt(): %s\n",
@@ -279,11 +275,15 @@ void routerProcess(void)
 	      return;
 	    }
 
+#ifdef ROUTER_TRACE
 	  UtilPrintfStream(errStream,&error,"Router received packet, not on irqSendSock\n");
+#endif
 
 	  if (UdpSocketReceivePending(irqReceiveSock,&error))
 	    {
+#ifdef ROUTER_TRACE
 	      UtilPrintfStream(errStream,&error,"Router: packet pending on irqReceiveSock\n");
+#endif
 	      packet=UdpSocketReceive(irqReceiveSock,0,true,&error);
 	      if (!packet)
 		{
@@ -292,7 +292,9 @@ void routerProcess(void)
 		  return;
 		}
 
+#ifdef ROUTER_TRACE
 	      UtilPrintfStream(errStream,&error,"Router received packet on irqReceiveSock\n");
+#endif
               PackosPacketFree(packet,&error);
 
 	      if (IpIfaceShmOnReceiveInterrupt(&error)<0)
@@ -305,8 +307,10 @@ void routerProcess(void)
 	      packet=IpReceiveOn(shm.iface,0,0,&error);
 	      if (packet)
 		{
+#ifdef ROUTER_TRACE
 		  UtilPrintfStream(errStream,&error,
 			  "Router received packet via shm, not forwarded\n");
+#endif
                   PackosPacketFree(packet,&error);
 		}
 	      else
@@ -328,7 +332,9 @@ void routerProcess(void)
 		  return;
 		}
 
+#ifdef ROUTER_TRACE
 	      UtilPrintfStream(errStream,&error,"Router seems to have received some other packet\n");
+#endif
 	    }
 	}
 
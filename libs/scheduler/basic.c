@@ -4,6 +4,7 @@
 #include <packos/packet.h>
 #include <packos/sys/contextP.h>
 #include <packos/interrupts.h>
+#include <packos/clock.h>
 #include <contextQueue.h>
 #include <packos/arch.h>
 
@@ -56,11 +57,190 @@ static int incrIfNonDaemon(PackosContext context,
   return 0;
 }
 
+/* One queue per priority, and how many blocked contexts each
+ *  priority has; a blocked context is counted at the priority it
+ *  blocked with, in blockedAt.
+ */
+typedef struct {
+  PackosContextQueue runnable[SCHEDULER_BASIC_NUM_PRIORITIES];
+  unsigned int numBlocked[SCHEDULER_BASIC_NUM_PRIORITIES];
+} RunQueues;
+
+static unsigned int priorityOf(SchedulerBasicContextMetadata* metadata)
+{
+  if (metadata->priority>=SCHEDULER_BASIC_NUM_PRIORITIES)
+    return SCHEDULER_BASIC_NUM_PRIORITIES-1;
+  return metadata->priority;
+}
+
+static int appendRunnable(RunQueues* queues,
+                          PackosContext context,
+                          SchedulerBasicContextMetadata* metadata,
+                          PackosError* error)
+{
+  unsigned int priority=priorityOf(metadata);
+
+  /* The kernel hands the CPU back when a context wakes one that
+   *  outranks it.
+   */
+  if (PackosKernelContextSetPriority(context,priority,error)<0)
+    return -1;
+
+  metadata->state=schedulerBasicStateRunnable;
+  return PackosContextQueueAppend(queues->runnable[priority],context,error);
+}
+
+/* The head of the highest-priority nonempty queue, taken off it; or
+ *  0 if nothing is runnable.
+ */
+static PackosContext takeRunnable(RunQueues* queues)
+{
+  PackosError error;
+  int priority;
+
+  for (priority=SCHEDULER_BASIC_NUM_PRIORITIES-1; priority>=0; priority--)
+    {
+      PackosContext res;
+      if (PackosContextQueueEmpty(queues->runnable[priority],&error))
+        continue;
+
+      res=PackosContextQueueHead(queues->runnable[priority],&error);
+      PackosContextQueueRemove(queues->runnable[priority],res,&error);
+      return res;
+    }
+
+  return 0;
+}
+
+/* Puts context in a runnable queue, or leaves it out: blocked
+ *  contexts cost nothing until the kernel reports them woken, and
+ *  parked ones until the control server activates them.
+ */
+static int place(PackosContext context,
+                 void* arg,
+                 PackosError* error)
+{
+  RunQueues* queues=(RunQueues*)arg;
+  SchedulerBasicContextMetadata* metadata
+    =PackosContextGetMetadata(context,error);
+  if (!metadata)
+    {
+      if ((*error)==packosErrorNone)
+        *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!(metadata->isRunning))
+    {
+      metadata->state=schedulerBasicStateParked;
+      return 0;
+    }
+
+  if (PackosContextBlocking(context,error))
+    {
+      metadata->state=schedulerBasicStateBlocked;
+      metadata->blockedAt=priorityOf(metadata);
+      queues->numBlocked[metadata->blockedAt]++;
+      return 0;
+    }
+
+  return appendRunnable(queues,context,metadata,error);
+}
+
+static int unpark(PackosContext context,
+                  void* arg,
+                  PackosError* error)
+{
+  SchedulerBasicContextMetadata* metadata
+    =PackosContextGetMetadata(context,error);
+  if (metadata
+      && (metadata->state==schedulerBasicStateParked)
+      && (metadata->isRunning)
+      )
+    return place(context,arg,error);
+  return 0;
+}
+
+static void takeWoken(RunQueues* queues)
+{
+  PackosError error;
+  PackosContext woken;
+
+  while ((woken=PackosKernelContextTakeWoken(&error))!=0)
+    {
+      SchedulerBasicContextMetadata* metadata
+        =PackosContextGetMetadata(woken,&error);
+      if (!(metadata && (metadata->state==schedulerBasicStateBlocked)))
+        continue;
+      queues->numBlocked[metadata->blockedAt]--;
+      if (PackosContextFinished(woken,&error))
+        continue;
+
+      if (appendRunnable(queues,woken,metadata,&error)<0)
+        UtilPrintfStream(errStream,&error,
+                         "scheduler: PackosContextQueueAppend(): %s\n",
+                         PackosErrorToString(error));
+    }
+}
+
+/* How long cur may run.  A context that wakes one outranking it
+ *  yields at once, from its send; but a wakeup the running context
+ *  didn't send, such as an interrupt's, waits for the scheduler.  So
+ *  while something that outranks cur is blocked, cur gets a short
+ *  slice, and the woken context waits at most that long.
+ */
+static uint64_t sliceFor(RunQueues* queues,
+                         PackosContext cur)
+{
+  PackosError error;
+  unsigned int priority;
+  SchedulerBasicContextMetadata* metadata
+    =PackosContextGetMetadata(cur,&error);
+
+  if (!metadata)
+    return SCHEDULER_BASIC_SLICE_USEC;
+
+  for (priority=priorityOf(metadata)+1;
+       priority<SCHEDULER_BASIC_NUM_PRIORITIES;
+       priority++)
+    if (queues->numBlocked[priority])
+      return SCHEDULER_BASIC_PREEMPT_USEC;
+
+  return SCHEDULER_BASIC_SLICE_USEC;
+}
+
+/* The clock is tickless, so ask for the next timer to come due, and
+ *  for the end of the slice, if there is one; the idle context's has
+ *  none, and can run until something happens.
+ */
+static void setAlarm(TimerServer timerServer,
+                     uint64_t slice)
+{
+  PackosError error;
+  uint64_t alarm;
+
+  if (!(TimerServerNextExpiry(timerServer,&alarm,&error)))
+    alarm=0;
+
+  if (slice)
+    {
+      uint64_t sliceEnds=PackosClockNow(&error)+slice;
+      if ((!alarm) || (sliceEnds<alarm))
+        alarm=sliceEnds;
+    }
+
+  if (PackosClockSetAlarm(alarm,&error)<0)
+    UtilPrintfStream(errStream,&error,"scheduler: PackosClockSetAlarm(): %s\n",
+                     PackosErrorToString(error));
+}
+
 void SchedulerBasic(void)
 {
   SchedulerBasicContextMetadata idleMetadata;
   PackosError error;
   PackosContextQueue contexts;
+  RunQueues queues;
+  PackosContext idle;
   int numNonDaemons=0;
   UdpSocket tickSocket;
   PackosInterruptId clockId;
@@ -68,6 +248,7 @@ void SchedulerBasic(void)
   PackosAddress myAddr;
   TimerServer timerServer;
   SchedulerControlServer controlServer;
+  uint64_t nextPoll=0;
 
   const uint16_t clockPort=7000;
 
@@ -78,6 +259,16 @@ void SchedulerBasic(void)
     return;
 
   contexts=PackosContextQueueNew(&error);
+  {
+    int i;
+    for (i=0; i<SCHEDULER_BASIC_NUM_PRIORITIES; i++)
+      {
+        queues.runnable[i]=PackosContextQueueNew(&error);
+        if (!(queues.runnable[i]))
+          return;
+        queues.numBlocked[i]=0;
+      }
+  }
 
   clockId
     =PackosInterruptAliasLookup(PACKOS_INTERRUPT_ALIAS_CLOCK,&error);
@@ -149,8 +340,17 @@ void SchedulerBasic(void)
       return;
     }
 
+  if (PackosContextQueueForEach(contexts,place,&queues,&error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "PackosContextQueueForEach(place): %s\n",
+                       PackosErrorToString(error));
+      return;
+    }
+
   {
-    PackosContext idle=PackosContextNew(SchedulerIdle,"idle",&error);
+    idle=PackosContextNew(SchedulerIdle,"idle",&error);
     if (!idle)
       {
         UtilPrintfStream(errStream,&error,"PackosContextNew(idle): %s\n",
@@ -161,6 +361,8 @@ void SchedulerBasic(void)
     idleMetadata.isDaemon=true;
     idleMetadata.isRunning=true;
     idleMetadata.dependsOn=0;
+    idleMetadata.priority=0;
+    idleMetadata.state=schedulerBasicStateRunnable;
 
     if (PackosContextSetMetadata(idle,&idleMetadata,&error)<0)
       {
@@ -203,34 +405,26 @@ void SchedulerBasic(void)
                    "There are %d non-daemon processes\n",
                    numNonDaemons);
 
-  while ((PackosContextQueueLen(contexts,&error)>1)
-         && (numNonDaemons>0)
-         )
+  /* The idle context is not queued; it gets the CPU only when nothing
+   *  else is runnable.  A slot ends within SCHEDULER_BASIC_SLICE_USEC,
+   *  or SCHEDULER_BASIC_PREEMPT_USEC while a blocked context outranks
+   *  the one running.  A context woken by a send from the one running
+   *  doesn't wait: the sender yields back here at once.  Others wait at
+   *  most the short slice, and interrupt handlers not at all, since the
+   *  kernel switches straight to them.  The idle slot lasts until a
+   *  timer comes due or a packet arrives.
+   */
+  while (numNonDaemons>0)
     {
       PackosPacket* packet;
-      PackosContext cur=PackosContextQueueHead(contexts,&error);
-      SchedulerBasicContextMetadata* curMetadata
-        =(SchedulerBasicContextMetadata*)
-        (PackosContextGetMetadata(cur,&error));
-
-      while ((!(curMetadata->isRunning))
-             || (PackosContextBlocking(cur,&error))
-             )
-        {
-          PackosContext next;
-          PackosContextQueueRemove(contexts,cur,&error);
-          PackosContextQueueAppend(contexts,cur,&error);
-          next=PackosContextQueueHead(contexts,&error);
-          if (next==cur)
-            {
-              UtilPrintfStream(errStream,&error,"scheduler: all contexts are blocking\n");
-              return;
-            }
-          cur=next;
-          curMetadata
-            =(SchedulerBasicContextMetadata*)
-            (PackosContextGetMetadata(cur,&error));
-        }
+      PackosContext cur;
+      bool poll=false;
+
+      takeWoken(&queues);
+
+      cur=takeRunnable(&queues);
+      if (!cur)
+        cur=idle;
 
       if (PackosContextFinished(cur,&error))
         {
@@ -245,12 +439,19 @@ void SchedulerBasic(void)
             if (metadata && !(metadata->isDaemon))
               numNonDaemons--;
           }
+          if (cur==idle)
+            {
+              UtilPrintfStream(errStream,&error,"scheduler: idle exited\n");
+              return;
+            }
           continue;
         }
 
       /*UtilPrintfStream(errStream,&error,"scheduler: give %p/%s a slot\n",
         cur,PackosContextGetName(cur,&error));*/
 
+      setAlarm(timerServer,(cur==idle) ? 0 : sliceFor(&queues,cur));
+
       IpIfaceNativeSetNextYieldTo(iface,cur,&error);
       packet=UdpSocketReceive(tickSocket,0,true,&error);
       if (!packet)
@@ -258,6 +459,7 @@ void SchedulerBasic(void)
           switch (error)
             {
             case packosErrorStoppedForOtherSocket:
+              poll=true;
               break;
 
             case packosErrorContextFinished:
@@ -325,35 +527,47 @@ void SchedulerBasic(void)
           else
             {
               /*UtilPrintfStream(errStream,&error,"Got a tick\n");*/
-              if (TimerServerTick(timerServer,&error)<0)
-                UtilPrintfStream(errStream,&error,"TimerServerTick(): %s\n",
+              uint64_t now=PackosClockNow(&error);
+              if (TimerServerAdvance(timerServer,now,&error)<0)
+                UtilPrintfStream(errStream,&error,"TimerServerAdvance(): %s\n",
                         PackosErrorToString(error));
-              {
-                static int i=0;
-                i++;
-                i%=10;
-                if (i==0)
-                  {
-                    TcpPoll(&error);
-#ifdef CONTROL
-                    if (SchedulerControlServerPoll(controlServer,&error)<0)
-                      {
-                        UtilPrintfStream(errStream,&error,
-                                         "SchedulerControlServerPoll(): %s\n",
-                                         PackosErrorToString(error));
-                        return;
-                      }
-#endif
-                  }
-              }
+              if (now>=nextPoll)
+                poll=true;
             }
 
           PackosPacketFree(packet,&error);
         }
 
-      PackosContextQueueRemove(contexts,cur,&error);
+      if (TimerServerPoll(timerServer,&error)<0)
+        UtilPrintfStream(errStream,&error,"TimerServerPoll(): %s\n",
+                         PackosErrorToString(error));
+
+      if (poll)
+        {
+          TcpPoll(&error);
+#ifdef CONTROL
+          if (SchedulerControlServerPoll(controlServer,&error)<0)
+            {
+              UtilPrintfStream(errStream,&error,
+                               "SchedulerControlServerPoll(): %s\n",
+                               PackosErrorToString(error));
+              return;
+            }
+          if (PackosContextQueueForEach(contexts,unpark,&queues,
+                                        &error)
+              <0)
+            UtilPrintfStream(errStream,&error,
+                             "PackosContextQueueForEach(unpark): %s\n",
+                             PackosErrorToString(error));
+#endif
+          nextPoll=PackosClockNow(&error)+SCHEDULER_BASIC_POLL_USEC;
+        }
+
+      if (cur==idle)
+        continue;
+
       if (!PackosContextFinished(cur,&error))
-        PackosContextQueueAppend(contexts,cur,&error);
+        place(cur,&queues,&error);
       else
         {
           const char* name=PackosContextGetName(cur,&error);
@@ -367,6 +581,7 @@ void SchedulerBasic(void)
             if (metadata && !(metadata->isDaemon))
               numNonDaemons--;
           }
+          PackosContextQueueRemove(contexts,cur,&error);
         }
     }
 }
@@ -2,35 +2,76 @@
 #include <util/stream.h>
 
 #include <contextQueue.h>
+#include <packos/sys/contextP.h>
 
-typedef struct PackosContextQueueNode* PackosContextQueueNode;
-
-struct PackosContextQueueNode {
-  PackosContext context;
-  PackosContextQueueNode next;
-  PackosContextQueueNode prev;
-};
-
+/* The links live in the contexts themselves (see
+ *  PackosContextQueueLink), so queueing and dequeueing never touch the
+ *  allocator, and a context can be removed without searching for it.
+ */
 struct PackosContextQueue {
-  PackosContextQueueNode first;
-  PackosContextQueueNode last;
+  PackosContext first;
+  PackosContext last;
+  int len;
 };
 
+/* context's link for queue, or 0 if it isn't in queue. */
+static PackosContextQueueLink* linkOf(PackosContext context,
+                                      PackosContextQueue queue)
+{
+  int i;
+  for (i=0; i<PACKOS_CONTEXT_QUEUE_MAX_LINKS; i++)
+    if (context->os.queueLinks[i].queue==queue)
+      return context->os.queueLinks+i;
+  return 0;
+}
+
 #if 0
 static void PackosContextQueueDump(PackosContextQueue queue, int max)
 {
   PackosError error;
-  PackosContextQueueNode cur;
+  PackosContext cur;
   UtilPrintfStream(errStream,&error,
-                   "PackosContextQueueDump(%p): first: %p last: %p\n",
-                   queue,queue->first,queue->last);
+                   "PackosContextQueueDump(%p): first: %p last: %p len: %d\n",
+                   queue,queue->first,queue->last,queue->len);
 
-  for (cur=queue->first; cur && (max>0); cur=cur->next, max--)
-    UtilPrintfStream(errStream,&error," %p",cur->context);
+  for (cur=queue->first; cur && (max>0); cur=linkOf(cur,queue)->next, max--)
+    UtilPrintfStream(errStream,&error," %p",cur);
   UtilPrintfStream(errStream,&error,"\n");
 }
 #endif
 
+static PackosContextQueueLink* newLink(PackosContextQueue queue,
+                                       PackosContext context,
+                                       PackosError* error)
+{
+  PackosContextQueueLink* link;
+
+  if (!(queue && context))
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  if (linkOf(context,queue))
+    {
+      *error=packosErrorResourceInUse;
+      return 0;
+    }
+
+  link=linkOf(context,0);
+  if (!link)
+    {
+      UtilPrintfStream(errStream,error,
+                       "contextQueue:newLink(): context in too many queues\n");
+      *error=packosErrorResourceInUse;
+      return 0;
+    }
+
+  link->queue=queue;
+  link->next=link->prev=0;
+  return link;
+}
+
 PackosContextQueue PackosContextQueueNew(PackosError* error)
 {
   PackosContextQueue queue
@@ -43,63 +84,43 @@ PackosContextQueue PackosContextQueueNew(PackosError* error)
     }
 
   queue->first=queue->last=0;
+  queue->len=0;
   return queue;
 }
 
 void PackosContextQueueDelete(PackosContextQueue queue,
                               PackosError* error)
 {
-  PackosContextQueueNode cur;
-  PackosContextQueueNode next;
+  PackosContext cur;
+  PackosContext next;
 
   if (!queue) return;
 
   for (cur=queue->first; cur; cur=next)
     {
-      next=cur->next;
-      free(cur);
-    }
-}
-
-static PackosContextQueueNode mkNode(PackosContextQueue queue,
-                                     PackosContext context,
-                                     PackosError* error)
-{
-  PackosContextQueueNode node;
-
-  if (!(queue && context))
-    {
-      *error=packosErrorInvalidArg;
-      return 0;
-    }
-
-  node=(PackosContextQueueNode)(malloc(sizeof(struct PackosContextQueueNode)));
-  if (!node)
-    {
-      UtilPrintfStream(errStream,error,"malloc(PackosContextQueueNode)\n");
-      *error=packosErrorOutOfMemory;
-      return 0;
+      PackosContextQueueLink* link=linkOf(cur,queue);
+      next=link->next;
+      link->queue=0;
     }
 
-  node->prev=node->next=0;
-  node->context=context;
-  return node;
+  free(queue);
 }
 
 int PackosContextQueueInsert(PackosContextQueue queue,
                              PackosContext context,
                              PackosError* error)
 {
-  PackosContextQueueNode node=mkNode(queue,context,error);
-  if (!node) return -1;
+  PackosContextQueueLink* link=newLink(queue,context,error);
+  if (!link) return -1;
 
-  node->prev=0;
-  node->next=queue->first;
-  if (node->next)
-    node->next->prev=node;
+  link->prev=0;
+  link->next=queue->first;
+  if (link->next)
+    linkOf(link->next,queue)->prev=context;
   else
-    queue->last=node;
-  queue->first=node;
+    queue->last=context;
+  queue->first=context;
+  queue->len++;
 
   return 0;
 }
@@ -108,52 +129,52 @@ int PackosContextQueueAppend(PackosContextQueue queue,
                              PackosContext context,
                              PackosError* error)
 {
-  PackosContextQueueNode node=mkNode(queue,context,error);
-  if (!node) return -1;
+  PackosContextQueueLink* link=newLink(queue,context,error);
+  if (!link) return -1;
 
-  node->next=0;
-  node->prev=queue->last;
-  if (node->prev)
-    node->prev->next=node;
+  link->next=0;
+  link->prev=queue->last;
+  if (link->prev)
+    linkOf(link->prev,queue)->next=context;
   else
-    queue->first=node;
-  queue->last=node;
+    queue->first=context;
+  queue->last=context;
+  queue->len++;
 
   return 0;
 }
 
-static PackosContextQueueNode
-PackosContextQueueSeek(PackosContextQueue queue,
-                       PackosContext context,
-                       PackosError* error)
-{
-  PackosContextQueueNode cur;
-  for (cur=queue->first; cur; cur=cur->next)
-    if (cur->context==context)
-      return cur;
-
-  *error=packosErrorDoesNotExist;
-  return 0;
-}
-
 int PackosContextQueueRemove(PackosContextQueue queue,
                              PackosContext context,
                              PackosError* error)
 {
-  PackosContextQueueNode node=PackosContextQueueSeek(queue,context,error);
-  if (!node) return -1;
+  PackosContextQueueLink* link;
+
+  if (!(queue && context))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-  if (node->next)
-    node->next->prev=node->prev;
+  link=linkOf(context,queue);
+  if (!link)
+    {
+      *error=packosErrorDoesNotExist;
+      return -1;
+    }
+
+  if (link->next)
+    linkOf(link->next,queue)->prev=link->prev;
   else
-    queue->last=node->prev;
+    queue->last=link->prev;
 
-  if (node->prev)
-    node->prev->next=node->next;
+  if (link->prev)
+    linkOf(link->prev,queue)->next=link->next;
   else
-    queue->first=node->next;
+    queue->first=link->next;
 
-  free(node);
+  link->queue=0;
+  queue->len--;
   return 0;
 }
 
@@ -172,24 +193,27 @@ PackosContext PackosContextQueueHead(PackosContextQueue queue,
       return 0;
     }
 
-  return queue->first->context;
+  return queue->first;
 }
 
+/* op may remove the context it is given. */
 int PackosContextQueueForEach(PackosContextQueue queue,
                               PackosContextOp op,
                               void* arg,
                               PackosError* error)
 {
-  PackosContextQueueNode cur;
+  PackosContext cur;
+  PackosContext next;
   if (!(queue && op))
     {
       *error=packosErrorInvalidArg;
       return -1;
     }
 
-  for (cur=queue->first; cur; cur=cur->next)
+  for (cur=queue->first; cur; cur=next)
     {
-      if (op(cur->context,arg,error)<0)
+      next=linkOf(cur,queue)->next;
+      if (op(cur,arg,error)<0)
         return -1;
     }
 
@@ -201,16 +225,16 @@ PackosContext PackosContextQueueFind(PackosContextQueue queue,
                                      void* arg,
                                      PackosError* error)
 {
-  PackosContextQueueNode cur;
+  PackosContext cur;
   if (!(queue && filter))
     {
       *error=packosErrorInvalidArg;
       return 0;
     }
 
-  for (cur=queue->first; cur; cur=cur->next) {
-    if ((cur->context) && (filter(cur->context,arg,error))) {
-      return cur->context;
+  for (cur=queue->first; cur; cur=linkOf(cur,queue)->next) {
+    if (filter(cur,arg,error)) {
+      return cur;
     }
 
     if ((*error)!=packosErrorNone)
@@ -230,9 +254,6 @@ bool PackosContextQueueEmpty(PackosContextQueue queue,
 int PackosContextQueueLen(PackosContextQueue queue,
                           PackosError* error)
 {
-  PackosContextQueueNode cur;
-  int res=0;
-
   if (!error) return -2;
   if (!queue)
     {
@@ -240,8 +261,19 @@ int PackosContextQueueLen(PackosContextQueue queue,
       return -1;
     }
 
-  for (cur=queue->first; cur; cur=cur->next)
-    res++;
+  return queue->len;
+}
+
+bool PackosContextQueueContains(PackosContextQueue queue,
+                                PackosContext context,
+                                PackosError* error)
+{
+  if (!(queue && context))
+    {
+      *error=packosErrorInvalidArg;
+      return false;
+    }
 
-  return res;
+  *error=packosErrorNone;
+  return (linkOf(context,queue)!=0);
 }
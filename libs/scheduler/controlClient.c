@@ -137,7 +137,7 @@ static int requestReply(SchedulerControl control,
   request->version=htons(SCHEDULER_CONTROL_PROTOCOL_VERSION);
   request->cmd=htons(request->cmd);
   request->requestId=htons(control->nextId++);
-  request->reserved=0;
+  request->arg=htons(request->arg);
 
   if (TcpSocketSend(control->socket,request,sizeof(ControlRequest),error)<0)
     {
@@ -205,6 +205,7 @@ int SchedulerControlReportInited(SchedulerControl control,
   ControlReply reply;
 
   request.cmd=controlRequestCmdReportInited;
+  request.arg=0;
 
   if (requestReply(control,&request,&reply,error)<0)
     {
@@ -228,3 +229,37 @@ int SchedulerControlReportInited(SchedulerControl control,
 
   return 0;
 }
+
+int SchedulerControlSetPriority(SchedulerControl control,
+                                uint8_t priority,
+                                PackosError* error)
+{
+  ControlRequest request;
+  ControlReply reply;
+
+  if (!error) return -2;
+
+  request.cmd=controlRequestCmdSetPriority;
+  request.arg=priority;
+
+  if (requestReply(control,&request,&reply,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "SchedulerControlSetPriority(): requestReply(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  *error=(PackosError)(reply.errorAsInt);
+  if ((*error)!=packosErrorNone)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "SchedulerControlSetPriority(): error from server(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  return 0;
+}
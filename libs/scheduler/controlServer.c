@@ -168,6 +168,30 @@ static int activateDependents(PackosContext context,
   return 0;
 }
 
+static int sendReply(SchedulerControlClient client,
+                     ControlRequest* request,
+                     PackosError replyError,
+                     PackosError* error)
+{
+  ControlReply reply;
+  reply.version=request->version;
+  reply.cmd=request->cmd;
+  reply.requestId=request->requestId;
+  reply.errorAsInt=htonl(replyError);
+  reply.reserved=0;
+  if (TcpSocketSend(client->socket,&reply,sizeof(reply),error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "controlServer:sendReply(): TcpSocketSend(): %s\n",
+                       PackosErrorToString(*error)
+                       );
+      return -1;
+    }
+
+  return 0;
+}
+
 static int handleRequest(SchedulerControlServer server,
                          SchedulerControlClient client,
                          ControlRequest* request,
@@ -184,23 +208,8 @@ static int handleRequest(SchedulerControlServer server,
     {
     case controlRequestCmdReportInited:
       client->metadata->isInited=true;
-      {
-        ControlReply reply;
-        reply.version=request->version;
-        reply.cmd=htons(controlRequestCmdReportInited);
-        reply.requestId=request->requestId;
-        reply.errorAsInt=htonl(packosErrorNone);
-        reply.reserved=0;
-        if (TcpSocketSend(client->socket,&reply,sizeof(reply),error)<0)
-          {
-            PackosError tmp;
-            UtilPrintfStream(errStream,&tmp,
-                             "controlServer:handleRequest(): TcpSocketSend(): %s\n",
-                             PackosErrorToString(*error)
-                             );
-            return -1;
-          }
-      }
+      if (sendReply(client,request,packosErrorNone,error)<0)
+        return -1;
       UtilPrintfStream(errStream,error,
                        "controlServer:handleRequest(): %s activated\n",
                        PackosContextGetName(client->context,error)
@@ -211,6 +220,18 @@ static int handleRequest(SchedulerControlServer server,
                                 error);
       break;
 
+    case controlRequestCmdSetPriority:
+      {
+        uint16_t priority=ntohs(request->arg);
+        if (priority>=SCHEDULER_BASIC_NUM_PRIORITIES)
+          return sendReply(client,request,packosErrorInvalidArg,error);
+
+        client->metadata->priority=priority;
+        if (sendReply(client,request,packosErrorNone,error)<0)
+          return -1;
+      }
+      break;
+
     case controlRequestCmdInvalid:
     default:
       UtilPrintfStream(errStream,error,
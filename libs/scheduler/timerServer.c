@@ -1,4 +1,5 @@
 #include <packos/arch.h>
+#include <packos/clock.h>
 
 #include <util/stream.h>
 #include <util/alloc.h>
@@ -7,11 +8,36 @@
 #include <timer-protocol.h>
 #include "timerServer.h"
 
+/* Timers live in a hierarchical timing wheel: level 0 has one slot
+ *  per microsecond, and each level above has slots TIMER_WHEEL_SLOTS
+ *  times as wide, whose timers are cascaded down a level as their slot
+ *  comes up.  Arming and cancelling are O(1).  Each level keeps a
+ *  bitmap of its nonempty slots, so that advancing the wheel skips
+ *  straight to the next slot with anything in it, and the scheduler
+ *  can be told when that is.  Timers are also hashed by (client
+ *  address, port, id), so that a client can cancel or rearm one.
+ *
+ * Timers further off than TIMER_WHEEL_MAX_USEC (about 18 minutes) wait
+ *  in the top level's last slot, and are put back when it cascades.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1<<TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_MAX_USEC \
+  ((uint64_t)1<<(TIMER_WHEEL_BITS*TIMER_WHEEL_LEVELS))
+
+#define TIMER_HASH_SIZE 256
+
+/* Tick replies being built, one per destination socket. */
+#define TIMER_TICK_BATCHES 8
+
 struct TimerServer {
-  struct {
-    TimerClient first;
-    TimerClient last;
-  } clients;
+  TimerClient wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  TimerClient byKey[TIMER_HASH_SIZE];
+
+  /* The next microsecond to process; everything before it has fired. */
+  uint64_t now;
 
   UdpSocket sock;
   PackosAddress myAddr;
@@ -20,6 +46,9 @@ struct TimerServer {
 struct TimerClient {
   TimerClient next;
   TimerClient prev;
+  TimerClient* slot;
+
+  TimerClient nextByKey;
 
   struct {
     PackosAddress addr;
@@ -28,113 +57,132 @@ struct TimerClient {
 
   uint32_t id;
   uint16_t requestId;
-  bool repeat;
-
-  struct {
-    uint32_t sec,usec;
-  } initial;
 
-  uint32_t deltaTicks;
+  uint64_t expires;
+  uint64_t period; /* 0 for a one-shot timer */
 };
 
-static uint32_t timeToTicks(uint32_t sec,
-                            uint32_t usec)
+static uint64_t timeToUsec(uint32_t sec,
+                           uint32_t usec)
 {
-  return sec*10+((usec+49999)/100000);
+  return ((uint64_t)sec)*1000000+usec;
 }
 
-static int insertClient(TimerServer server,
-                        TimerClient client,
-                        PackosError* error)
+static unsigned int lowestBit(uint64_t bits)
 {
-  TimerClient after;
+  uint32_t lo=(uint32_t)bits;
+  if (lo)
+    return __builtin_ctz(lo);
+  return 32+__builtin_ctz((uint32_t)(bits>>32));
+}
 
-  if (!error) return -2;
-  if (!(server && client))
-    {
-      *error=packosErrorInvalidArg;
-      return -1;
-    }
+/* The bits of a level's bitmap, starting with the one for slot first. */
+static uint64_t rotateFrom(uint64_t bits,
+                           unsigned int first)
+{
+  if (!first)
+    return bits;
+  return (bits>>first)|(bits<<(TIMER_WHEEL_SLOTS-first));
+}
 
-  for (after=server->clients.first;
-       after && (after->deltaTicks<=client->deltaTicks);
-       after=after->next
+static unsigned int hashKey(PackosAddress addr,
+                            uint16_t port,
+                            uint32_t id)
+{
+  uint32_t h=addr.quads[0]^addr.quads[1]^addr.quads[2]^addr.quads[3];
+  h^=(((uint32_t)port)<<16)^id;
+  h*=2654435761U;
+  return (h>>24)%TIMER_HASH_SIZE;
+}
+
+static TimerClient* seekKey(TimerServer server,
+                            PackosAddress addr,
+                            uint16_t port,
+                            uint32_t id)
+{
+  TimerClient* link;
+  for (link=server->byKey+hashKey(addr,port,id);
+       *link;
+       link=&((*link)->nextByKey)
        )
-    client->deltaTicks-=after->deltaTicks;
+    if (((*link)->id==id)
+        && ((*link)->remote.port==port)
+        && PackosAddrEq((*link)->remote.addr,addr)
+        )
+      break;
 
-  if (after)
-    after=after->prev;
-  else
-    after=server->clients.last;
+  return link;
+}
 
-  if (after)
-    {
-      client->next=after->next;
-      if (client->next)
-        after->next->prev=client;
-      else
-        server->clients.last=client;
+static void insertClient(TimerServer server,
+                         TimerClient client)
+{
+  uint64_t at=client->expires;
+  uint64_t delta;
+  unsigned int level,index;
+
+  if (at<server->now)
+    at=server->now;
+  else if (at-server->now>=TIMER_WHEEL_MAX_USEC)
+    at=server->now+TIMER_WHEEL_MAX_USEC-1;
+  delta=at-server->now;
+
+  for (level=0;
+       (level<TIMER_WHEEL_LEVELS-1)
+         && (delta>=((uint64_t)1<<(TIMER_WHEEL_BITS*(level+1))));
+       level++
+       )
+    ;
 
-      client->prev=after;
-      after->next=client;
-    }
-  else
-    {
-      client->next=server->clients.first;
-      if (client->next)
-        client->next->prev=client;
-      else
-        server->clients.last=client;
-      server->clients.first=client;
-    }
+  index=(at>>(TIMER_WHEEL_BITS*level))&(TIMER_WHEEL_SLOTS-1);
+  client->slot=&(server->wheel[level][index]);
+  server->occupied[level]|=((uint64_t)1)<<index;
 
-  return 0;
+  client->prev=0;
+  client->next=*(client->slot);
+  if (client->next)
+    client->next->prev=client;
+  *(client->slot)=client;
 }
 
-static int removeClient(TimerServer server,
-                        TimerClient client,
-                        PackosError* error)
+static void removeClient(TimerServer server,
+                         TimerClient client)
 {
-  if (!error) return -2;
-  if (!(server && client))
-    {
-      *error=packosErrorInvalidArg;
-      return -1;
-    }
-
   if (client->prev)
     client->prev->next=client->next;
   else
-    server->clients.first=client->next;
+    {
+      *(client->slot)=client->next;
+      if (!(client->next))
+        {
+          unsigned int flat=client->slot-server->wheel[0];
+          server->occupied[flat>>TIMER_WHEEL_BITS]
+            &=~(((uint64_t)1)<<(flat&(TIMER_WHEEL_SLOTS-1)));
+        }
+    }
 
   if (client->next)
     client->next->prev=client->prev;
-  else
-    server->clients.last=client->prev;
 
-  return 0;
-}
-
-static int moveClient(TimerServer server,
-                      TimerClient client,
-                      PackosError* error)
-{
-  if (removeClient(server,client,error)<0) return -1;
-  if (insertClient(server,client,error)<0) return -1;
-  return 0;
+  client->next=client->prev=0;
+  client->slot=0;
 }
 
+/* Arms a timer to fire at expires, then every period after if that's
+ *  nonzero; or rearms it, if the client already has one with this id
+ *  on this port.
+ */
 static TimerClient newClient(TimerServer server,
                              PackosAddress addr,
                              uint16_t port,
-                             uint32_t sec,
-                             uint32_t usec,
+                             uint64_t expires,
+                             uint64_t period,
                              uint32_t id, /* included in the tick packets */
-                             bool repeat,
+                             uint16_t requestId,
                              PackosError* error)
 {
   TimerClient res;
-  uint32_t numTicks;
+  TimerClient* link;
 
   if (!error) return 0;
   if (!server)
@@ -143,13 +191,6 @@ static TimerClient newClient(TimerServer server,
       return 0;
     }
 
-  numTicks=timeToTicks(sec,usec);
-  if (!numTicks)
-    {
-      *error=packosErrorInvalidArg;
-      return 0;
-    }
-
 #if 0
   {
     PackosError tmp;
@@ -157,47 +198,87 @@ static TimerClient newClient(TimerServer server,
     const char* msg=buff;
     if (PackosAddrToString(addr,buff,sizeof(buff),&tmp)<0)
       msg=PackosErrorToString(tmp);
-    UtilPrintfStream(errStream,error,"newClient(%s:%hu,%u,%u,%u)\n",
-            msg,port,sec,usec,id);
+    UtilPrintfStream(errStream,error,"newClient(%s:%hu,%u)\n",
+            msg,port,id);
   }
 #endif
 
-  res=(TimerClient)(malloc(sizeof(struct TimerClient)));
-  if (!res)
+  link=seekKey(server,addr,port,id);
+  res=*link;
+  if (res)
+    removeClient(server,res);
+  else
     {
-      *error=packosErrorOutOfMemory;
-      return 0;
-    }
+      res=(TimerClient)(malloc(sizeof(struct TimerClient)));
+      if (!res)
+        {
+          *error=packosErrorOutOfMemory;
+          return 0;
+        }
 
-  res->remote.addr=addr;
-  res->remote.port=port;
-  res->id=id;
-  res->repeat=repeat;
-  res->initial.sec=sec;
-  res->initial.usec=usec;
-  res->deltaTicks=numTicks;
+      res->remote.addr=addr;
+      res->remote.port=port;
+      res->id=id;
+      res->nextByKey=0;
+      *link=res;
+    }
 
-  res->next=res->prev=0;
-  insertClient(server,res,error);
+  res->requestId=requestId;
+  res->expires=expires;
+  res->period=period;
+  insertClient(server,res);
   return res;
 }
 
-static int freeClient(TimerServer server,
-                      TimerClient client,
-                      PackosError* error)
+static void freeClient(TimerServer server,
+                       TimerClient client)
 {
-  if (!error) return -2;
-  if (!(server && client))
+  TimerClient* link=seekKey(server,client->remote.addr,client->remote.port,
+                            client->id);
+  if (*link==client)
+    *link=client->nextByKey;
+
+  if (client->slot)
+    removeClient(server,client);
+  free(client);
+}
+
+static int cancelClient(TimerServer server,
+                        PackosAddress addr,
+                        uint16_t port,
+                        uint32_t id,
+                        PackosError* error)
+{
+  TimerClient client=*(seekKey(server,addr,port,id));
+  if (!client)
     {
-      *error=packosErrorInvalidArg;
+      *error=packosErrorDoesNotExist;
       return -1;
     }
 
-  if (removeClient(server,client,error)<0) return -1;
-  free(client);
+  freeClient(server,client);
   return 0;
 }
 
+/* Drops every timer of a socket that has gone away. */
+static void cancelAllFor(TimerServer server,
+                         PackosAddress addr,
+                         uint16_t port)
+{
+  unsigned int i;
+  for (i=0; i<TIMER_HASH_SIZE; i++)
+    {
+      TimerClient cur=server->byKey[i];
+      while (cur)
+        {
+          TimerClient next=cur->nextByKey;
+          if ((cur->remote.port==port) && PackosAddrEq(cur->remote.addr,addr))
+            freeClient(server,cur);
+          cur=next;
+        }
+    }
+}
+
 TimerServer TimerServerInit(PackosError* error)
 {
   TimerServer res;
@@ -248,7 +329,27 @@ TimerServer TimerServerInit(PackosError* error)
                    "Bound timer socket to %d\n",
                    UdpSocketGetLocalPort(res->sock,error));
 
-  res->clients.first=res->clients.last=0;
+  {
+    unsigned int level,i;
+    for (level=0; level<TIMER_WHEEL_LEVELS; level++)
+      for (i=0; i<TIMER_WHEEL_SLOTS; i++)
+        res->wheel[level][i]=0;
+    for (level=0; level<TIMER_WHEEL_LEVELS; level++)
+      res->occupied[level]=0;
+    for (i=0; i<TIMER_HASH_SIZE; i++)
+      res->byKey[i]=0;
+  }
+
+  res->now=PackosClockNow(error);
+  if ((*error)!=packosErrorNone)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"TimerServerInit(): PackosClockNow(): %s\n",
+                       PackosErrorToString(*error));
+      UdpSocketClose(res->sock,&tmp);
+      free(res);
+      return 0;
+    }
   return res;
 }
 
@@ -262,15 +363,12 @@ int TimerServerClose(TimerServer server,
       return -1;
     }
 
-  while (server->clients.first)
-    {
-      if (freeClient(server,server->clients.first,error)<0)
-        {
-          UtilPrintfStream(errStream,error,"TimerServerClose(): freeClient(): %s\n",
-                  PackosErrorToString(*error));
-          return -1;
-        }
-    }
+  {
+    unsigned int i;
+    for (i=0; i<TIMER_HASH_SIZE; i++)
+      while (server->byKey[i])
+        freeClient(server,server->byKey[i]);
+  }
 
   if (UdpSocketClose(server->sock,error)<0)
     {
@@ -319,10 +417,130 @@ static void sendError(TimerServer server,
     }
 }
 
+static TimerClient openClient(TimerServer server,
+                              PackosAddress addr,
+                              uint16_t port,
+                              TimerRequest* request,
+                              PackosError* error)
+{
+  uint64_t delay=timeToUsec(request->args.open.sec,request->args.open.usec);
+  uint64_t now;
+
+  if (!delay)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  now=PackosClockNow(error);
+  if ((*error)!=packosErrorNone)
+    return 0;
+
+  return newClient(server,addr,port,
+                   now+delay,
+                   request->args.open.repeat ? delay : 0,
+                   request->id,
+                   request->requestId,
+                   error);
+}
+
+/* Carries out every entry of a batch, and acknowledges them all in one
+ *  reply.
+ */
+static int processBatch(TimerServer server,
+                        PackosAddress addr,
+                        uint16_t port,
+                        TimerRequest* request,
+                        uint16_t datalen,
+                        PackosError* error)
+{
+  uint32_t numEntries=request->args.batch.numEntries;
+  uint16_t tickPort=(request->args.batch.tickPort
+                     ? request->args.batch.tickPort
+                     : port);
+  TimerBatchEntry* entries=TimerRequestBatchEntries(request);
+  PackosPacket* packet;
+  IpHeaderUDP* udpHeader;
+  TimerReply* reply;
+  uint32_t* errors;
+  unsigned int i;
+
+  if ((numEntries>TIMER_BATCH_MAX_ENTRIES)
+      || (datalen<sizeof(TimerRequest)+numEntries*sizeof(TimerBatchEntry))
+      )
+    {
+      sendError(server,addr,port,request,packosErrorProtocolError);
+      *error=packosErrorProtocolError;
+      return -1;
+    }
+
+  packet=UdpPacketNew(server->sock,
+                      sizeof(TimerReply)+numEntries*sizeof(uint32_t),
+                      &udpHeader,
+                      error);
+  if (!packet)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"processBatch(): UdpPacketNew(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  packet->packos.dest=packet->ipv6.dest=addr;
+  packet->ipv6.src=server->myAddr;
+  udpHeader->destPort=port;
+  reply=(TimerReply*)(((byte*)udpHeader)+sizeof(IpHeaderUDP));
+  reply->id=request->id;
+  reply->requestId=request->requestId;
+  reply->cmd=timerRequestCmdBatch;
+  reply->u.batch.numEntries=numEntries;
+  errors=TimerReplyBatchErrors(reply);
+
+  for (i=0; i<numEntries; i++)
+    {
+      PackosError entryError=packosErrorNone;
+
+      switch ((TimerBatchOp)(entries[i].op))
+        {
+        case timerBatchOpArm:
+          newClient(server,addr,tickPort,
+                    entries[i].deadline,
+                    entries[i].period,
+                    entries[i].id,
+                    request->requestId,
+                    &entryError);
+          break;
+
+        case timerBatchOpCancel:
+          cancelClient(server,addr,tickPort,entries[i].id,&entryError);
+          break;
+
+        case timerBatchOpInvalid:
+        default:
+          entryError=packosErrorBadProtocolCmd;
+          break;
+        }
+
+      errors[i]=(uint32_t)entryError;
+    }
+
+  if (UdpSocketSend(server->sock,packet,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"processBatch(): UdpSocketSend(): %s\n",
+                       PackosErrorToString(*error));
+      PackosPacketFree(packet,&tmp);
+      return -1;
+    }
+
+  return 0;
+}
+
 static int processRequest(TimerServer server,
                           PackosAddress addr,
                           uint16_t port,
                           TimerRequest* request,
+                          uint16_t datalen,
                           PackosError* error)
 {
   if (!error) return -2;
@@ -332,6 +550,12 @@ static int processRequest(TimerServer server,
       return -1;
     }
 
+  if (datalen<sizeof(TimerRequest))
+    {
+      *error=packosErrorProtocolError;
+      return -1;
+    }
+
   if (request->version!=TIMER_PROTOCOL_VERSION)
     {
       sendError(server,addr,port,request,packosErrorWrongProtocolVersion);
@@ -342,15 +566,10 @@ static int processRequest(TimerServer server,
     {
     case timerRequestCmdOpen:
       {
-        TimerClient client=newClient(server,addr,port,
-                                     request->args.open.sec,
-                                     request->args.open.usec,
-                                     request->id,
-                                     request->args.open.repeat,
-                                     error);
+        TimerClient client=openClient(server,addr,port,request,error);
         if (!client)
           {
-            UtilPrintfStream(errStream,error,"processRequest(): newClient(): %s\n",
+            UtilPrintfStream(errStream,error,"processRequest(): openClient(): %s\n",
                     PackosErrorToString(*error));
             sendError(server,addr,port,request,*error);
             return -1;
@@ -360,7 +579,15 @@ static int processRequest(TimerServer server,
       break;
 
     case timerRequestCmdClose:
-      break;
+      if (cancelClient(server,addr,port,request->id,error)<0)
+        {
+          sendError(server,addr,port,request,*error);
+          return -1;
+        }
+      return 0;
+
+    case timerRequestCmdBatch:
+      return processBatch(server,addr,port,request,datalen,error);
 
     case timerRequestCmdInvalid:
     case timerRequestCmdTick:
@@ -372,131 +599,256 @@ static int processRequest(TimerServer server,
   return 0;
 }
 
-static int sendOneTick(TimerServer server,
-                       TimerClient client,
-                       PackosError* error)
-{
+typedef struct {
+  PackosPacket* packet;
   IpHeaderUDP* udpHeader;
   TimerReply* reply;
-  PackosPacket* packet;
+  PackosAddress addr;
+  uint16_t port;
+} TickBatch;
+
+/* The replies for one tick.  Sockets found to be gone are only noted
+ *  here; their timers are dropped once the tick's list is done with.
+ */
+typedef struct {
+  TickBatch batches[TIMER_TICK_BATCHES];
+  unsigned int numBatches;
+  struct {
+    PackosAddress addr;
+    uint16_t port;
+  } gone[TIMER_TICK_BATCHES];
+  unsigned int numGone;
+} TickRound;
 
-  if (false) {
-    char buff[80];
-    const char* msg=buff;
-    PackosError tmp;
-    if (PackosAddrToString(client->remote.addr,buff,sizeof(buff),&tmp)<0)
-      msg=PackosErrorToString(tmp);
-    UtilPrintfStream(errStream,error,"sendOneTick(%s)\n",msg);
-  }
+static void sendTickBatch(TimerServer server,
+                          TickRound* round,
+                          TickBatch* batch)
+{
+  PackosError error;
+  uint16_t datalen=sizeof(TimerReply)
+    +batch->reply->u.tick.numIds*sizeof(uint32_t);
 
-  packet=UdpPacketNew(server->sock,sizeof(TimerReply),&udpHeader,error);
-  if (!packet)
+  batch->udpHeader->length=datalen+sizeof(IpHeaderUDP);
+  if (IpPacketSetDataLen(batch->packet,datalen,&error)<0)
     {
-      UtilPrintfStream(errStream,error,"sendOneTick(): UdpPacketNew(): %s\n",
-              PackosErrorToString(*error));
-      return -1;
+      UtilPrintfStream(errStream,&error,
+                       "sendTickBatch(): IpPacketSetDataLen(): %s\n",
+                       PackosErrorToString(error));
+      PackosPacketFree(batch->packet,&error);
+      batch->packet=0;
+      return;
     }
 
-  packet->packos.dest=packet->ipv6.dest=client->remote.addr;
-  packet->ipv6.src=server->myAddr;
-  udpHeader->destPort=client->remote.port;
-  reply=(TimerReply*)(((byte*)udpHeader)+sizeof(IpHeaderUDP));
-  reply->id=client->id;
-  reply->requestId=client->requestId;
-  reply->cmd=timerRequestCmdTick;
-
-  if (UdpSocketSend(server->sock,packet,error)<0)
+  if (UdpSocketSend(server->sock,batch->packet,&error)<0)
     {
       PackosError tmp;
-      PackosPacketFree(packet,&tmp);
-      UtilPrintfStream(errStream,&tmp,"sendOneTick(): 2UdpSocketSend(): %s\n",
-                       PackosErrorToString(*error));
-      PackosPacketFree(packet,&tmp);
+      UtilPrintfStream(errStream,&tmp,"sendTickBatch(): UdpSocketSend(): %s\n",
+                       PackosErrorToString(error));
+      PackosPacketFree(batch->packet,&tmp);
 
-      if ((*error)==packosErrorAddressUnreachable)
+      if ((error==packosErrorAddressUnreachable)
+          && (round->numGone<TIMER_TICK_BATCHES)
+          )
         {
-          PackosError tmp;
-          if (freeClient(server,client,&tmp)<0)
-            {
-              PackosError tmp2;
-              UtilPrintfStream(errStream,&tmp2,
-                               "sendOneTick(): freeClient(): %s\n",
-                               PackosErrorToString(tmp));
-            }
+          round->gone[round->numGone].addr=batch->addr;
+          round->gone[round->numGone].port=batch->port;
+          round->numGone++;
         }
+    }
 
-      return -1;
+  batch->packet=0;
+}
+
+/* Adds client's id to the reply going to its socket, starting one
+ *  (and sending the oldest, if need be) if there isn't one yet.
+ */
+static int addTick(TimerServer server,
+                   TickRound* round,
+                   TimerClient client,
+                   PackosError* error)
+{
+  TickBatch* batch=0;
+  unsigned int i;
+
+  for (i=0; i<round->numBatches; i++)
+    if ((round->batches[i].port==client->remote.port)
+        && PackosAddrEq(round->batches[i].addr,client->remote.addr)
+        )
+      {
+        batch=round->batches+i;
+        break;
+      }
+
+  if (batch
+      && (batch->packet)
+      && (batch->reply->u.tick.numIds>=TIMER_REPLY_MAX_TICK_IDS)
+      )
+    sendTickBatch(server,round,batch);
+
+  if (!batch)
+    {
+      if (round->numBatches>=TIMER_TICK_BATCHES)
+        {
+          if (round->batches[0].packet)
+            sendTickBatch(server,round,round->batches);
+          for (i=1; i<round->numBatches; i++)
+            round->batches[i-1]=round->batches[i];
+          round->numBatches--;
+        }
+
+      batch=round->batches+(round->numBatches++);
+      batch->packet=0;
+      batch->addr=client->remote.addr;
+      batch->port=client->remote.port;
     }
 
+  if (!(batch->packet))
+    {
+      batch->packet
+        =UdpPacketNew(server->sock,
+                      sizeof(TimerReply)
+                      +TIMER_REPLY_MAX_TICK_IDS*sizeof(uint32_t),
+                      &(batch->udpHeader),
+                      error);
+      if (!(batch->packet))
+        {
+          UtilPrintfStream(errStream,error,"addTick(): UdpPacketNew(): %s\n",
+                           PackosErrorToString(*error));
+          return -1;
+        }
+
+      batch->packet->packos.dest=batch->packet->ipv6.dest=client->remote.addr;
+      batch->packet->ipv6.src=server->myAddr;
+      batch->udpHeader->destPort=client->remote.port;
+      batch->reply=(TimerReply*)(((byte*)(batch->udpHeader))
+                                 +sizeof(IpHeaderUDP));
+      batch->reply->id=client->id;
+      batch->reply->requestId=client->requestId;
+      batch->reply->cmd=timerRequestCmdTick;
+      batch->reply->u.tick.numIds=0;
+    }
+
+  TimerReplyTickIds(batch->reply)[batch->reply->u.tick.numIds++]=client->id;
   return 0;
 }
 
-static int sendTicks(TimerServer server,
-                     PackosError* error)
+/* Moves the timers in one slot of level down a level. */
+static void cascade(TimerServer server,
+                    unsigned int level,
+                    unsigned int index)
 {
-  if (!error) return -2;
-  if (!server)
+  TimerClient cur=server->wheel[level][index];
+  server->wheel[level][index]=0;
+  server->occupied[level]&=~(((uint64_t)1)<<index);
+
+  while (cur)
     {
-      *error=packosErrorInvalidArg;
-      return -1;
+      TimerClient next=cur->next;
+      insertClient(server,cur);
+      cur=next;
     }
+}
+
+/* The first microsecond, from server->now on, at which a nonempty slot
+ *  fires or cascades; nothing happens before it.  Returns false if the
+ *  wheel is empty.
+ */
+static bool nextEvent(TimerServer server,
+                      uint64_t* when)
+{
+  unsigned int level;
+  bool res=false;
 
-  while ((server->clients.first)
-         && ((server->clients.first->deltaTicks)==0)
-         )
+  for (level=0; level<TIMER_WHEEL_LEVELS; level++)
     {
-      if (sendOneTick(server,server->clients.first,error)<0)
+      unsigned int shift=TIMER_WHEEL_BITS*level;
+      uint64_t width=((uint64_t)1)<<shift;
+      uint64_t base,cur;
+      unsigned int index;
+
+      if (!(server->occupied[level]))
+        continue;
+
+      /* The first boundary of this level's slots at or after now. */
+      base=(server->now+width-1)&~(width-1);
+      index=(base>>shift)&(TIMER_WHEEL_SLOTS-1);
+      cur=base
+        +(((uint64_t)lowestBit(rotateFrom(server->occupied[level],index)))
+          <<shift);
+
+      if ((!res) || (cur<*when))
         {
-          PackosError tmp;
+          *when=cur;
+          res=true;
+        }
+    }
 
-          char buff[80];
-          const char* addrStr;
-          if (PackosAddrToString(server->clients.first->remote.addr,
-                                 buff,sizeof(buff),error)<0)
-            addrStr=PackosErrorToString(*error);
-          else
-            addrStr=buff;
+  return res;
+}
 
-          UtilPrintfStream(errStream,&tmp,
-                           "sendTicks(): sendOneTick(%s): %s\n",
-                           addrStr,
-                           PackosErrorToString(*error));
+/* Fires whatever is due at server->now, after the cascades due then. */
+static int expireNow(TimerServer server,
+                     PackosError* error)
+{
+  TickRound round;
+  unsigned int index,i;
+  TimerClient cur;
+  int res=0;
 
-          freeClient(server,server->clients.first,&tmp);
-          return -1;
-        }
+  round.numBatches=round.numGone=0;
 
-      if (server->clients.first->repeat)
+  index=server->now&(TIMER_WHEEL_SLOTS-1);
+  if (!index)
+    {
+      unsigned int level;
+      for (level=1; level<TIMER_WHEEL_LEVELS; level++)
         {
-          server->clients.first->deltaTicks
-            =timeToTicks(server->clients.first->initial.sec,
-                         server->clients.first->initial.usec);
-
-          if (moveClient(server,server->clients.first,error)<0)
-            {
-              UtilPrintfStream(errStream,error,"sendTicks(): moveClient(): %s\n",
-                      PackosErrorToString(*error));
-              return -1;
-            }
+          unsigned int levelIndex
+            =(server->now>>(TIMER_WHEEL_BITS*level))&(TIMER_WHEEL_SLOTS-1);
+          cascade(server,level,levelIndex);
+          if (levelIndex)
+            break;
         }
-      else
+    }
+
+  cur=server->wheel[0][index];
+  server->wheel[0][index]=0;
+  server->occupied[0]&=~(((uint64_t)1)<<index);
+  while (cur)
+    {
+      TimerClient next=cur->next;
+      cur->slot=0;
+
+      if (addTick(server,&round,cur,error)<0)
+        res=-1;
+
+      if (cur->period)
         {
-          if (freeClient(server,server->clients.first,error)<0)
-            {
-              UtilPrintfStream(errStream,error,"sendTicks(): freeClient(): %s\n",
-                      PackosErrorToString(*error));
-              return -1;
-            }
+          cur->expires=server->now+cur->period;
+          insertClient(server,cur);
         }
+      else
+        freeClient(server,cur);
+
+      cur=next;
     }
 
-  return 0;
+  for (i=0; i<round.numBatches; i++)
+    if (round.batches[i].packet)
+      sendTickBatch(server,&round,round.batches+i);
+
+  for (i=0; i<round.numGone; i++)
+    cancelAllFor(server,round.gone[i].addr,round.gone[i].port);
+
+  return res;
 }
 
-int TimerServerTick(TimerServer server,
-                    PackosError* error)
+int TimerServerAdvance(TimerServer server,
+                       uint64_t now,
+                       PackosError* error)
 {
-  PackosPacket* packet;
+  int res=0;
+
   if (!error) return -2;
   if (!server)
     {
@@ -504,70 +856,131 @@ int TimerServerTick(TimerServer server,
       return -1;
     }
 
-  if (server->clients.first)
+  while (server->now<=now)
     {
-      if (server->clients.first->deltaTicks)
-        server->clients.first->deltaTicks--;
+      uint64_t when;
+      if ((!(nextEvent(server,&when))) || (when>now))
+        {
+          server->now=now+1;
+          break;
+        }
 
-      if (server->clients.first->deltaTicks==0)
+      server->now=when;
+      if (expireNow(server,error)<0)
         {
-          if (sendTicks(server,error)<0)
-            {
-              /*UtilPrintfStream(errStream,error,"TimerServerTick(): sendTicks(): %s\n",
-                PackosErrorToString(*error));*/
-              server->clients.first->deltaTicks++;
-            }
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "TimerServerAdvance(): expireNow(): %s\n",
+                           PackosErrorToString(*error));
+          res=-1;
         }
+      server->now++;
     }
 
-  if (!(UdpSocketReceivePending(server->sock,error)))
+  return res;
+}
+
+bool TimerServerNextExpiry(TimerServer server,
+                           uint64_t* when,
+                           PackosError* error)
+{
+  if (!error) return false;
+  if (!(server && when))
     {
-      if ((*error)==packosErrorNone)
-        return 0;
-      UtilPrintfStream(errStream,error,
-              "TimerServerTick(): UdpSocketReceivePending(): %s\n",
-              PackosErrorToString(*error));
-      return -1;
+      *error=packosErrorInvalidArg;
+      return false;
     }
 
-  packet=UdpSocketReceive(server->sock,0,true,error);
-  if (!packet)
+  *error=packosErrorNone;
+  return nextEvent(server,when);
+}
+
+int TimerServerPoll(TimerServer server,
+                    PackosError* error)
+{
+  if (!error) return -2;
+  if (!server)
     {
-      if ((*error)==packosErrorStoppedForOtherSocket)
-        (*error)=packosErrorNone;
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-      if ((*error)==packosErrorNone)
-        return  0;
+  /* Catch the wheel up first, so that new timers are placed relative
+   *  to the present rather than to the last time anything fired.
+   */
+  if (UdpSocketReceivePending(server->sock,error))
+    {
+      PackosError tmp;
+      uint64_t now=PackosClockNow(&tmp);
+      if (tmp==packosErrorNone)
+        TimerServerAdvance(server,now,&tmp);
     }
 
-  {
-    IpHeaderUDP* udp;
-    TimerRequest* request=(TimerRequest*)(IpPacketData(packet,error));
-    if (!request)
-      {
-        UtilPrintfStream(errStream,error,"TimerServerTick(): IpPacketData(): %s\n",
-                PackosErrorToString(*error));
-        return -1;
-      }
+  while (UdpSocketReceivePending(server->sock,error))
+    {
+      PackosPacket* packet;
+      IpHeaderUDP* udp;
+      TimerRequest* request;
+      PackosError tmp;
+      int datalen;
 
-    udp=UdpPacketSeekHeader(packet,error);
-    if (!udp)
-      {
-        UtilPrintfStream(errStream,error,
-                "TimerServerTick(): UdpPacketSeekHeader(): %s\n",
-                PackosErrorToString(*error));
-        return -1;
-      }
+      packet=UdpSocketReceive(server->sock,0,true,error);
+      if (!packet)
+        {
+          if ((*error)==packosErrorStoppedForOtherSocket)
+            (*error)=packosErrorNone;
+
+          if ((*error)==packosErrorNone)
+            return 0;
+          UtilPrintfStream(errStream,&tmp,
+                           "TimerServerPoll(): UdpSocketReceive(): %s\n",
+                           PackosErrorToString(*error));
+          return -1;
+        }
+
+      request=(TimerRequest*)(IpPacketData(packet,error));
+      if (!request)
+        {
+          UtilPrintfStream(errStream,&tmp,"TimerServerPoll(): IpPacketData(): %s\n",
+                           PackosErrorToString(*error));
+          PackosPacketFree(packet,&tmp);
+          return -1;
+        }
+
+      udp=UdpPacketSeekHeader(packet,error);
+      if (!udp)
+        {
+          UtilPrintfStream(errStream,&tmp,
+                           "TimerServerPoll(): UdpPacketSeekHeader(): %s\n",
+                           PackosErrorToString(*error));
+          PackosPacketFree(packet,&tmp);
+          return -1;
+        }
+
+      /* A failed request has already been answered with an error. */
+      datalen=IpPacketGetDataLen(packet,error);
+      if (datalen<0)
+        {
+          UtilPrintfStream(errStream,&tmp,
+                           "TimerServerPoll(): IpPacketGetDataLen(): %s\n",
+                           PackosErrorToString(*error));
+          PackosPacketFree(packet,&tmp);
+          return -1;
+        }
 
+      processRequest(server,packet->ipv6.src,udp->sourcePort,request,
+                     datalen,error);
+      PackosPacketFree(packet,&tmp);
+    }
+
+  if ((*error)!=packosErrorNone)
     {
       PackosError tmp;
-      int res=processRequest(server,
-                             packet->ipv6.src,
-                             udp->sourcePort,
-                             request,
-                             error);
-      PackosPacketFree(packet,&tmp);
-      return res;
+      UtilPrintfStream(errStream,&tmp,
+                       "TimerServerPoll(): UdpSocketReceivePending(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
     }
-  }
+
+  return 0;
 }
@@ -7,7 +7,21 @@ typedef struct TimerServer* TimerServer;
 TimerServer TimerServerInit(PackosError* error);
 int TimerServerClose(TimerServer server,
                      PackosError* error);
-int TimerServerTick(TimerServer server,
+
+/* Fires every timer due at or before now, in microseconds on the
+ *  kernel clock.
+ */
+int TimerServerAdvance(TimerServer server,
+                       uint64_t now,
+                       PackosError* error);
+
+/* When TimerServerAdvance() next has work to do; false if never. */
+bool TimerServerNextExpiry(TimerServer server,
+                           uint64_t* when,
+                           PackosError* error);
+
+/* Serves every request waiting on the timer socket. */
+int TimerServerPoll(TimerServer server,
                     PackosError* error);
 
 #endif /*_LIBS_SCHEDULER_TIMER_SRVR_H_*/
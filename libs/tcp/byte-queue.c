@@ -0,0 +1,234 @@
+#include <util/alloc.h>
+#include <util/string.h>
+#include <packos/checksums.h>
+
+#include "byte-queue.h"
+
+void ByteQueueInit(ByteQueue* queue,
+                   uint32_t limit)
+{
+  queue->head=queue->tail=0;
+  queue->start=queue->end=queue->len=queue->reserved=0;
+  queue->limit=limit;
+  queue->latestSequenceNumber=queue->latestAckNumber=0;
+}
+
+byte* ByteQueueReserve(ByteQueue* queue,
+                       uint32_t* nbytes,
+                       PackosError* error)
+{
+  uint32_t room;
+
+  if (!error) return 0;
+  if (!(queue && nbytes))
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  if (queue->len>=queue->limit)
+    {
+      *error=packosErrorQueueFull;
+      return 0;
+    }
+
+  if ((!(queue->tail)) || (queue->end==TCP_CHUNK_SIZE))
+    {
+      ByteQueueChunk* chunk
+        =(ByteQueueChunk*)(malloc(sizeof(ByteQueueChunk)));
+      if (!chunk)
+        {
+          *error=packosErrorOutOfMemory;
+          return 0;
+        }
+
+      chunk->next=0;
+      if (queue->tail)
+        queue->tail->next=chunk;
+      else
+        {
+          queue->head=chunk;
+          queue->start=0;
+        }
+      queue->tail=chunk;
+      queue->end=0;
+    }
+
+  room=TCP_CHUNK_SIZE-queue->end;
+  if (room>(queue->limit-queue->len))
+    room=queue->limit-queue->len;
+
+  *nbytes=queue->reserved=room;
+  return queue->tail->data+queue->end;
+}
+
+int ByteQueueCommit(ByteQueue* queue,
+                    uint32_t nbytes,
+                    PackosError* error)
+{
+  if (!error) return -2;
+  if ((!queue) || (nbytes>queue->reserved))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  queue->len+=nbytes;
+  queue->end+=nbytes;
+  queue->reserved=0;
+  return 0;
+}
+
+int ByteQueueEnqueue(ByteQueue* queue,
+                     const void* data,
+                     uint32_t nbytes,
+                     PackosError* error)
+{
+  const byte* base=(const byte*)data;
+  uint32_t done=0;
+
+  if (!error) return -2;
+  if (!(queue && data))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  while (done<nbytes)
+    {
+      uint32_t room;
+      byte* dest=ByteQueueReserve(queue,&room,error);
+      if (!dest)
+        {
+          /* Take what fits; the rest can come again. */
+          if (done) break;
+          return -1;
+        }
+
+      if (room>(nbytes-done))
+        room=nbytes-done;
+      UtilMemcpy(dest,base+done,room);
+      ByteQueueCommit(queue,room,error);
+      done+=room;
+    }
+
+  return done;
+}
+
+int ByteQueueRead(ByteQueue* queue,
+                  uint32_t offset,
+                  void* data,
+                  uint32_t nbytes,
+                  uint16_t* sum,
+                  PackosError* error)
+{
+  byte* base=(byte*)data;
+  ByteQueueChunk* chunk;
+  uint32_t actual,done=0,pos;
+
+  if (!error) return -2;
+  if (!(queue && data))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!nbytes) return 0;
+
+  if (queue->len<=offset)
+    {
+      *error=packosErrorQueueEmpty;
+      return -1;
+    }
+
+  actual=nbytes;
+  if (actual>(queue->len-offset))
+    actual=queue->len-offset;
+
+  chunk=queue->head;
+  pos=queue->start+offset;
+  while (pos>=TCP_CHUNK_SIZE)
+    {
+      chunk=chunk->next;
+      pos-=TCP_CHUNK_SIZE;
+    }
+
+  if (sum)
+    *sum=0;
+
+  while (done<actual)
+    {
+      uint32_t n=TCP_CHUNK_SIZE-pos;
+      if (n>(actual-done))
+        n=actual-done;
+
+      if (sum)
+        {
+          uint16_t partial=PackosChecksumCopy(base+done,chunk->data+pos,n);
+          if (done&1)
+            partial=PackosChecksumSwap(partial);
+          *sum=PackosChecksumAdd(*sum,partial);
+        }
+      else
+        UtilMemcpy(base+done,chunk->data+pos,n);
+
+      done+=n;
+      chunk=chunk->next;
+      pos=0;
+    }
+
+  return actual;
+}
+
+int ByteQueueDequeue(ByteQueue* queue,
+                     void* data,
+                     uint32_t nbytes,
+                     PackosError* error)
+{
+  int actual=ByteQueueRead(queue,0,data,nbytes,0,error);
+  if ((actual>0) && (ByteQueueDrop(queue,actual,error)<0))
+    return -1;
+
+  return actual;
+}
+
+int ByteQueueDrop(ByteQueue* queue,
+                  uint32_t nbytes,
+                  PackosError* error)
+{
+  if (!error) return -2;
+  if (!queue)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (nbytes>queue->len)
+    nbytes=queue->len;
+
+  queue->start+=nbytes;
+  queue->len-=nbytes;
+
+  while (queue->head
+         && ((queue->start>=TCP_CHUNK_SIZE)
+             || ((queue->len==0) && !(queue->reserved))
+             )
+         )
+    {
+      ByteQueueChunk* next=queue->head->next;
+      free(queue->head);
+      queue->head=next;
+      if (queue->start>=TCP_CHUNK_SIZE)
+        queue->start-=TCP_CHUNK_SIZE;
+      else
+        queue->start=0;
+    }
+
+  if (!(queue->head))
+    {
+      queue->tail=0;
+      queue->start=queue->end=0;
+    }
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _LIBS_TCP_BYTE_QUEUE_H_
+#define _LIBS_TCP_BYTE_QUEUE_H_
+
+#include <packos/types.h>
+#include <packos/errors.h>
+
+/* Socket buffers are chains of chunks from the arena, allocated as
+ *  data arrives and freed as soon as it's consumed; an idle socket
+ *  holds none.  Each buffer grows up to its limit.
+ */
+#define TCP_CHUNK_SIZE 2048
+
+typedef struct ByteQueueChunk {
+  struct ByteQueueChunk* next;
+  byte data[TCP_CHUNK_SIZE];
+} ByteQueueChunk;
+
+/* start is the offset of the first byte in head, end that of the byte
+ *  after the last in tail.  reserved is how much ByteQueueReserve()
+ *  last offered, from end on.
+ */
+typedef struct {
+  ByteQueueChunk *head,*tail;
+  uint32_t start,end,len,limit,reserved;
+  uint32_t latestSequenceNumber,latestAckNumber;
+} ByteQueue;
+
+void ByteQueueInit(ByteQueue* queue,
+                   uint32_t limit);
+
+/* The free space at the end of the queue, up to the end of its last
+ *  chunk and within its limit; adds a chunk if there's none.  Nothing
+ *  counts as queued until it's committed.
+ */
+byte* ByteQueueReserve(ByteQueue* queue,
+                       uint32_t* nbytes,
+                       PackosError* error);
+
+/* Queues nbytes written at the last ByteQueueReserve(). */
+int ByteQueueCommit(ByteQueue* queue,
+                    uint32_t nbytes,
+                    PackosError* error);
+
+/* Queues as much of data as fits; returns how much that was. */
+int ByteQueueEnqueue(ByteQueue* queue,
+                     const void* data,
+                     uint32_t nbytes,
+                     PackosError* error);
+
+/* Copies out up to nbytes, starting offset bytes into the queue,
+ *  without dequeueing them.  If sum is non-null, fills it in with the
+ *  partial checksum of the bytes read.
+ */
+int ByteQueueRead(ByteQueue* queue,
+                  uint32_t offset,
+                  void* data,
+                  uint32_t nbytes,
+                  uint16_t* sum,
+                  PackosError* error);
+
+int ByteQueueDequeue(ByteQueue* queue,
+                     void* data,
+                     uint32_t nbytes,
+                     PackosError* error);
+
+/* Frees each chunk as it empties, so a drained queue holds nothing;
+ *  except the one with space reserved in it.
+ */
+int ByteQueueDrop(ByteQueue* queue,
+                  uint32_t nbytes,
+                  PackosError* error);
+
+#endif /*_LIBS_TCP_BYTE_QUEUE_H_*/
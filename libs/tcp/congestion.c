@@ -0,0 +1,329 @@
+#include "congestion.h"
+
+#define TCP_RTO_INITIAL_USEC 1000000
+#define TCP_RTO_MIN_USEC 200000
+#define TCP_RTO_MAX_USEC 60000000
+/* Each socket's retransmission timer has a timer-server deadline of
+ *  its own, which goes off within about a scheduling slice.
+ */
+#define TCP_CLOCK_GRANULARITY_USEC 10000
+
+/* CUBIC's constants, in 1024ths: beta=0.7, C=0.4.  Its times are in
+ *  1024ths of a second, which keeps the cube in 64 bits without any
+ *  64-bit division.
+ */
+#define CUBIC_BETA 717
+#define CUBIC_C 410
+#define CUBIC_CUBE_FACTOR ((((uint64_t)1)<<40)/CUBIC_C)
+#define CUBIC_MAX_OFFSET (1<<16)
+#define CUBIC_MAX_SEGMENTS (1<<20)
+#define CUBIC_USEC_PER_TICK 977
+
+static bool seqGe(uint32_t a, uint32_t b)
+{
+  return (a-b)<0x80000000U;
+}
+
+static uint32_t maxU32(uint32_t a, uint32_t b)
+{
+  return (a>b) ? a : b;
+}
+
+static uint32_t minU32(uint32_t a, uint32_t b)
+{
+  return (a<b) ? a : b;
+}
+
+void TcpCongestionInit(TcpCongestion* cc,
+                       const TcpCongestionAlgorithm* algorithm,
+                       uint32_t mss)
+{
+  cc->algorithm=algorithm;
+  TcpCongestionSetMss(cc,mss);
+  cc->ssthresh=0x7fffffff;
+  cc->avoidAcked=0;
+  cc->highestSent=0;
+
+  cc->dupAcks=0;
+  cc->inRecovery=false;
+  cc->recover=0;
+
+  cc->rtt.timing=false;
+  cc->rtt.seq=0;
+  cc->rtt.sentAt=0;
+  cc->rtt.srtt=cc->rtt.rttvar=0;
+  cc->rtt.rto=TCP_RTO_INITIAL_USEC;
+
+  cc->cubic.wMax=0;
+  cc->cubic.origin=cc->cubic.k=0;
+  cc->cubic.epochStart=0;
+  cc->cubic.wEst=0;
+  cc->cubic.estAcked=0;
+}
+
+void TcpCongestionSetMss(TcpCongestion* cc,
+                         uint32_t mss)
+{
+  cc->mss=mss;
+
+  /* RFC 6928's initial window. */
+  cc->cwnd=minU32(10*mss,maxU32(2*mss,14600));
+}
+
+void TcpCongestionOnAck(TcpCongestion* cc,
+                        uint32_t acked,
+                        uint64_t now)
+{
+  if (cc->cwnd<cc->ssthresh)
+    cc->cwnd+=minU32(acked,cc->mss);
+  else
+    cc->algorithm->avoid(cc,acked,now);
+
+  if (cc->cwnd>0x40000000)
+    cc->cwnd=0x40000000;
+}
+
+void TcpCongestionOnLoss(TcpCongestion* cc,
+                         uint32_t inFlight,
+                         uint32_t highestSent,
+                         uint64_t now)
+{
+  cc->ssthresh=cc->algorithm->ssthresh(cc,inFlight,now);
+  cc->cwnd=cc->ssthresh+3*(cc->mss);
+  cc->avoidAcked=0;
+  cc->inRecovery=true;
+  cc->recover=highestSent;
+  cc->rtt.timing=false;
+}
+
+void TcpCongestionOnDupAck(TcpCongestion* cc)
+{
+  cc->cwnd+=cc->mss;
+}
+
+bool TcpCongestionOnRecoveryAck(TcpCongestion* cc,
+                                uint32_t ackNumber,
+                                uint32_t acked,
+                                uint32_t inFlight)
+{
+  if (seqGe(ackNumber,cc->recover))
+    {
+      cc->cwnd=minU32(cc->ssthresh,maxU32(inFlight,cc->mss)+cc->mss);
+      cc->inRecovery=false;
+      cc->dupAcks=0;
+      return false;
+    }
+
+  /* A partial ACK: deflate by what it acked, but let one new segment
+   *  out for the one that'll be resent.
+   */
+  if (acked>=cc->cwnd)
+    cc->cwnd=cc->mss;
+  else
+    cc->cwnd-=acked;
+  if (acked>=cc->mss)
+    cc->cwnd+=cc->mss;
+  return true;
+}
+
+void TcpCongestionOnTimeout(TcpCongestion* cc,
+                            uint32_t inFlight,
+                            uint64_t now)
+{
+  cc->ssthresh=cc->algorithm->ssthresh(cc,inFlight,now);
+  cc->cwnd=cc->mss;
+  cc->avoidAcked=0;
+  cc->inRecovery=false;
+  cc->dupAcks=0;
+  cc->rtt.timing=false;
+
+  cc->rtt.rto*=2;
+  if (cc->rtt.rto>TCP_RTO_MAX_USEC)
+    cc->rtt.rto=TCP_RTO_MAX_USEC;
+}
+
+void TcpCongestionRttSample(TcpCongestion* cc,
+                            uint32_t rtt)
+{
+  uint32_t rto;
+
+  if (!rtt) rtt=1;
+
+  if (!(cc->rtt.srtt))
+    {
+      cc->rtt.srtt=rtt;
+      cc->rtt.rttvar=rtt/2;
+    }
+  else
+    {
+      uint32_t diff=(cc->rtt.srtt>rtt) ? cc->rtt.srtt-rtt : rtt-cc->rtt.srtt;
+      cc->rtt.rttvar=cc->rtt.rttvar-(cc->rtt.rttvar>>2)+(diff>>2);
+      cc->rtt.srtt=cc->rtt.srtt-(cc->rtt.srtt>>3)+(rtt>>3);
+    }
+
+  rto=cc->rtt.srtt+maxU32(TCP_CLOCK_GRANULARITY_USEC,4*(cc->rtt.rttvar));
+  if (rto<TCP_RTO_MIN_USEC)
+    rto=TCP_RTO_MIN_USEC;
+  if (rto>TCP_RTO_MAX_USEC)
+    rto=TCP_RTO_MAX_USEC;
+  cc->rtt.rto=rto;
+}
+
+/* NewReno (RFC 5681, 6582): halve on loss; one mss per window acked. */
+
+static uint32_t newRenoSsthresh(TcpCongestion* cc,
+                                uint32_t inFlight,
+                                uint64_t now)
+{
+  return maxU32(inFlight/2,2*(cc->mss));
+}
+
+static void newRenoAvoid(TcpCongestion* cc,
+                         uint32_t acked,
+                         uint64_t now)
+{
+  cc->avoidAcked+=acked;
+  if (cc->avoidAcked>=cc->cwnd)
+    {
+      cc->avoidAcked-=cc->cwnd;
+      cc->cwnd+=cc->mss;
+    }
+}
+
+const TcpCongestionAlgorithm tcpCongestionNewReno={
+  newRenoSsthresh,
+  newRenoAvoid
+};
+
+/* CUBIC (RFC 8312): after a loss, cwnd follows
+ *  W(t)=C*(t-K)^3+Wmax, flattening out around the window where the
+ *  loss happened; but never grows slower than Reno would.
+ */
+
+static uint32_t cubeRoot(uint64_t x)
+{
+  uint32_t lo=0,hi=(1<<21)-1;
+
+  while (lo<hi)
+    {
+      uint32_t mid=(lo+hi+1)/2;
+      if (((uint64_t)mid)*mid*mid<=x)
+        lo=mid;
+      else
+        hi=mid-1;
+    }
+
+  return lo;
+}
+
+static uint32_t cubicSsthresh(TcpCongestion* cc,
+                              uint32_t inFlight,
+                              uint64_t now)
+{
+  uint32_t segs=cc->cwnd/cc->mss;
+
+  cc->cubic.epochStart=0;
+
+  /* Fast convergence: a second loss below the last Wmax means there's
+   *  less to go round; give some up.
+   */
+  if (segs<cc->cubic.wMax)
+    cc->cubic.wMax=(segs*(1024+CUBIC_BETA))/2048;
+  else
+    cc->cubic.wMax=segs;
+
+  return maxU32((cc->cwnd>>10)*CUBIC_BETA
+                +(((cc->cwnd&1023)*CUBIC_BETA)>>10),
+                2*(cc->mss));
+}
+
+static void cubicAvoid(TcpCongestion* cc,
+                       uint32_t acked,
+                       uint64_t now)
+{
+  uint32_t segs=cc->cwnd/cc->mss;
+  uint32_t t,offset,target,cnt;
+  uint64_t elapsed,delta;
+
+  if (!segs) segs=1;
+
+  if (!(cc->cubic.epochStart))
+    {
+      cc->cubic.epochStart=now ? now : 1;
+      cc->cubic.wEst=cc->cwnd;
+      cc->cubic.estAcked=0;
+
+      if (cc->cubic.wMax>segs)
+        {
+          uint32_t gap=minU32(cc->cubic.wMax-segs,CUBIC_MAX_SEGMENTS);
+          cc->cubic.k=cubeRoot(((uint64_t)gap)*CUBIC_CUBE_FACTOR);
+          cc->cubic.origin=cc->cubic.wMax;
+        }
+      else
+        {
+          cc->cubic.k=0;
+          cc->cubic.origin=segs;
+        }
+    }
+
+  elapsed=now-cc->cubic.epochStart+cc->rtt.srtt;
+  if (elapsed>0xffffffffU)
+    elapsed=0xffffffffU;
+  t=((uint32_t)elapsed)/CUBIC_USEC_PER_TICK;
+
+  offset=(t<cc->cubic.k) ? cc->cubic.k-t : t-cc->cubic.k;
+  if (offset>CUBIC_MAX_OFFSET)
+    offset=CUBIC_MAX_OFFSET;
+  delta=(CUBIC_C*(((uint64_t)offset)*offset*offset))>>40;
+  if (delta>CUBIC_MAX_SEGMENTS)
+    delta=CUBIC_MAX_SEGMENTS;
+
+  if (t<cc->cubic.k)
+    target=(delta<cc->cubic.origin) ? cc->cubic.origin-(uint32_t)delta : 0;
+  else
+    target=minU32(cc->cubic.origin+(uint32_t)delta,CUBIC_MAX_SEGMENTS);
+
+  /* How many windows' worth of ACKs per extra segment. */
+  if (target>segs)
+    cnt=segs/(target-segs);
+  else
+    cnt=100*segs;
+  if (!(cc->cubic.wMax) && (cnt>20))
+    cnt=20;
+
+  /* Reno's window grows by 3(1-beta)/(1+beta), about 0.53, segments a
+   *  round trip; if it would be ahead, catch up with it.
+   */
+  {
+    uint32_t perSegment=cc->cwnd+((cc->cwnd>>3)*7);
+    cc->cubic.estAcked+=acked;
+    while (cc->cubic.estAcked>=perSegment)
+      {
+        cc->cubic.estAcked-=perSegment;
+        cc->cubic.wEst+=cc->mss;
+      }
+
+    if (cc->cubic.wEst>cc->cwnd)
+      {
+        uint32_t estSegs=cc->cubic.wEst/cc->mss;
+        if (estSegs>segs)
+          cnt=minU32(cnt,segs/(estSegs-segs));
+      }
+  }
+
+  if (!cnt) cnt=1;
+  if (cnt>(0x7fffffffU/cc->mss))
+    cnt=0x7fffffffU/cc->mss;
+
+  cc->avoidAcked+=acked;
+  if (cc->avoidAcked>=cnt*(cc->mss))
+    {
+      cc->avoidAcked-=cnt*(cc->mss);
+      cc->cwnd+=cc->mss;
+    }
+}
+
+const TcpCongestionAlgorithm tcpCongestionCubic={
+  cubicSsthresh,
+  cubicAvoid
+};
@@ -0,0 +1,99 @@
+#ifndef _LIBS_TCP_CONGESTION_H_
+#define _LIBS_TCP_CONGESTION_H_
+
+#include <tcp.h>
+
+/* Per-connection congestion state, and the retransmission timeout
+ *  (RFC 6298) that goes with it.  Windows are in bytes, times in
+ *  microseconds on PackosClockNow()'s clock.
+ */
+typedef struct TcpCongestion TcpCongestion;
+
+/* What an algorithm decides for itself: where ssthresh goes on a loss,
+ *  and how cwnd grows in congestion avoidance.  Slow start, fast
+ *  recovery and timeouts are common to all of them.
+ */
+typedef uint32_t (*TcpCongestionSsthreshMethod)
+     (TcpCongestion* cc, uint32_t inFlight, uint64_t now);
+typedef void (*TcpCongestionAvoidMethod)
+     (TcpCongestion* cc, uint32_t acked, uint64_t now);
+
+typedef struct {
+  TcpCongestionSsthreshMethod ssthresh;
+  TcpCongestionAvoidMethod avoid;
+} TcpCongestionAlgorithm;
+
+struct TcpCongestion {
+  const TcpCongestionAlgorithm* algorithm;
+  uint32_t mss,cwnd,ssthresh;
+  uint32_t avoidAcked; /* bytes acked toward the next mss of cwnd */
+  uint32_t highestSent; /* after the last byte ever sent */
+
+  /* Fast recovery, per NewReno (RFC 6582). */
+  uint32_t dupAcks;
+  bool inRecovery;
+  uint32_t recover; /* the highest sequence number sent when it began */
+
+  /* One segment at a time is timed; never a retransmitted one. */
+  struct {
+    bool timing;
+    uint32_t seq; /* timed until an ACK covers this */
+    uint64_t sentAt;
+    uint32_t srtt,rttvar,rto;
+  } rtt;
+
+  struct {
+    uint32_t wMax;          /* in segments */
+    uint32_t origin,k;      /* in segments; in 1024ths of a second */
+    uint64_t epochStart;    /* 0 until congestion avoidance starts */
+    uint32_t wEst;          /* what Reno would have by now, in bytes */
+    uint32_t estAcked;
+  } cubic;
+};
+
+extern const TcpCongestionAlgorithm tcpCongestionNewReno;
+extern const TcpCongestionAlgorithm tcpCongestionCubic;
+
+void TcpCongestionInit(TcpCongestion* cc,
+                       const TcpCongestionAlgorithm* algorithm,
+                       uint32_t mss);
+
+/* The MSS was settled by the handshake; restarts the initial window
+ *  from it.  Call before any data is sent.
+ */
+void TcpCongestionSetMss(TcpCongestion* cc,
+                         uint32_t mss);
+
+/* New data was acked, outside fast recovery. */
+void TcpCongestionOnAck(TcpCongestion* cc,
+                        uint32_t acked,
+                        uint64_t now);
+
+/* The third duplicate ACK: enters fast recovery.  highestSent is the
+ *  sequence number after the last byte sent.
+ */
+void TcpCongestionOnLoss(TcpCongestion* cc,
+                         uint32_t inFlight,
+                         uint32_t highestSent,
+                         uint64_t now);
+
+/* Another duplicate ACK during fast recovery. */
+void TcpCongestionOnDupAck(TcpCongestion* cc);
+
+/* An ACK during fast recovery that doesn't cover recover; returns
+ *  false, and leaves recovery, if it does.
+ */
+bool TcpCongestionOnRecoveryAck(TcpCongestion* cc,
+                                uint32_t ackNumber,
+                                uint32_t acked,
+                                uint32_t inFlight);
+
+/* The retransmission timer ran out. */
+void TcpCongestionOnTimeout(TcpCongestion* cc,
+                            uint32_t inFlight,
+                            uint64_t now);
+
+void TcpCongestionRttSample(TcpCongestion* cc,
+                            uint32_t rtt);
+
+#endif /*_LIBS_TCP_CONGESTION_H_*/
@@ -9,6 +9,7 @@ tcp.o: ../../include/udp.h ../../include/icmp.h ../../include/ip-filter.h
 tcp.o: ../../include/iface.h ../../include/packet-queue.h
 tcp.o: ../../include/timer.h ../../include/packos/context.h
 tcp.o: ../../include/packos/checksums.h ../../include/packos/arch.h
+tcp.o: ../../include/packos/clock.h byte-queue.h congestion.h sack.h
 test.o: /usr/include/assert.h /usr/include/features.h
 test.o: /usr/include/stdc-predef.h ../../include/util/stream.h
 test.o: ../../include/packos/errors.h ../../include/packos/types.h
@@ -23,3 +24,11 @@ test.o: ../../include/packet-queue.h ../../include/router.h
 test.o: ../../include/schedulers/basic.h ../../include/schedulers/common.h
 test.o: ../../include/contextQueue.h ../../include/file.h
 test.o: ../../include/file-system-dumbfs.h ../../include/file-system.h
+byte-queue.o: ../../include/util/alloc.h ../../include/packos/types.h
+byte-queue.o: ../../include/packos/errors.h ../../include/util/string.h
+byte-queue.o: ../../include/packos/checksums.h ../../include/packos/packet.h
+byte-queue.o: ../../include/ip.h ../../include/icmp-types.h byte-queue.h
+congestion.o: congestion.h ../../include/tcp.h ../../include/ip.h
+congestion.o: ../../include/packos/packet.h ../../include/packos/types.h
+congestion.o: ../../include/packos/errors.h ../../include/icmp-types.h
+sack.o: sack.h ../../include/packos/types.h
@@ -0,0 +1,116 @@
+#include "sack.h"
+
+/* Sequence numbers are compared as offsets from una, which everything
+ *  on the board is after.
+ */
+
+void TcpScoreboardClear(TcpScoreboard* board,
+                        uint32_t una)
+{
+  board->numRanges=0;
+  board->retransmitNext=una;
+}
+
+void TcpScoreboardAdd(TcpScoreboard* board,
+                      uint32_t una,
+                      uint32_t left,
+                      uint32_t right)
+{
+  TcpSackRange merged[TCP_SACK_MAX_RANGES+1];
+  uint32_t i,n=0;
+  uint32_t l=left-una,r=right-una;
+  bool placed=false;
+
+  if ((l==0) || (l>=r) || (r>=0x80000000U))
+    return;
+
+  for (i=0; i<board->numRanges; i++)
+    {
+      uint32_t curL=board->ranges[i].left-una;
+      uint32_t curR=board->ranges[i].right-una;
+
+      if (curR<l)
+        merged[n++]=board->ranges[i];
+      else if (curL>r)
+        {
+          if (!placed)
+            {
+              merged[n].left=una+l;
+              merged[n++].right=una+r;
+              placed=true;
+            }
+          merged[n++]=board->ranges[i];
+        }
+      else
+        {
+          if (curL<l) l=curL;
+          if (curR>r) r=curR;
+        }
+    }
+
+  if (!placed)
+    {
+      merged[n].left=una+l;
+      merged[n++].right=una+r;
+    }
+
+  if (n>TCP_SACK_MAX_RANGES)
+    n=TCP_SACK_MAX_RANGES;
+
+  for (i=0; i<n; i++)
+    board->ranges[i]=merged[i];
+  board->numRanges=n;
+}
+
+void TcpScoreboardTrim(TcpScoreboard* board,
+                       uint32_t una)
+{
+  uint32_t i,n=0;
+
+  for (i=0; i<board->numRanges; i++)
+    {
+      TcpSackRange cur=board->ranges[i];
+      uint32_t curR=cur.right-una;
+
+      if ((curR==0) || (curR>=0x80000000U))
+        continue;
+      if ((cur.left-una)>=0x80000000U)
+        cur.left=una;
+      board->ranges[n++]=cur;
+    }
+
+  board->numRanges=n;
+  if ((board->retransmitNext-una)>=0x80000000U)
+    board->retransmitNext=una;
+}
+
+bool TcpScoreboardNextHole(TcpScoreboard* board,
+                           uint32_t una,
+                           uint32_t* start,
+                           uint32_t* len)
+{
+  uint32_t i,from=board->retransmitNext-una;
+
+  if (from>=0x80000000U)
+    from=0;
+
+  for (i=0; i<board->numRanges; i++)
+    {
+      uint32_t curL=board->ranges[i].left-una;
+      uint32_t curR=board->ranges[i].right-una;
+
+      if (curR<=from)
+        continue;
+      if (curL<=from)
+        {
+          from=curR;
+          continue;
+        }
+
+      *start=una+from;
+      *len=curL-from;
+      return true;
+    }
+
+  return false;
+}
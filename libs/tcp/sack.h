@@ -0,0 +1,44 @@
+#ifndef _LIBS_TCP_SACK_H_
+#define _LIBS_TCP_SACK_H_
+
+#include <packos/types.h>
+
+/* What the peer has told us, through SACK options (RFC 2018), that it
+ *  holds beyond the cumulative ACK: disjoint ranges of sequence numbers,
+ *  [left,right), in order.  If there are more than fit, the furthest
+ *  ones are forgotten; they'll be reported again.
+ */
+#define TCP_SACK_MAX_RANGES 8
+
+typedef struct {
+  uint32_t left,right;
+} TcpSackRange;
+
+typedef struct {
+  TcpSackRange ranges[TCP_SACK_MAX_RANGES];
+  uint32_t numRanges;
+  uint32_t retransmitNext; /* holes before this have been resent */
+} TcpScoreboard;
+
+void TcpScoreboardClear(TcpScoreboard* board,
+                        uint32_t una);
+
+/* una is the cumulative ACK; the range must be after it. */
+void TcpScoreboardAdd(TcpScoreboard* board,
+                      uint32_t una,
+                      uint32_t left,
+                      uint32_t right);
+
+/* Forgets everything before una, once the ACK has caught up. */
+void TcpScoreboardTrim(TcpScoreboard* board,
+                       uint32_t una);
+
+/* The next hole, from una or retransmitNext, whichever's later, that
+ *  has SACKed data after it; false if there's none.
+ */
+bool TcpScoreboardNextHole(TcpScoreboard* board,
+                           uint32_t una,
+                           uint32_t* start,
+                           uint32_t* len);
+
+#endif /*_LIBS_TCP_SACK_H_*/
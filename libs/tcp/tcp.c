@@ -8,28 +8,85 @@
 #include <ip-filter.h>
 #include <iface.h>
 #include <timer.h>
+#include <timer-protocol.h>
 #include <packos/context.h>
 #include <packos/checksums.h>
 #include <packos/arch.h>
+#include <packos/clock.h>
+
+#include "byte-queue.h"
+#include "congestion.h"
+#include "sack.h"
 
 /*#define TCP_DEBUG*/
 
+#define TCP_PORT_HASH_SIZE 64
+#define TCP_CONNECTION_HASH_SIZE 256
+#define TCP_TICK_USEC 100000
+
+/* Every bound socket is on the first..last list, for the timer, and in
+ *  byPort, for binding.  Incoming segments are matched against
+ *  connections, keyed by (remote address, remote port, local port),
+ *  and then against listeners, keyed by local port; a socket is in at
+ *  most one of those two.
+ */
 struct TcpIfaceContext {
-  Timer timer;
+  TimerBatch timers;
   UdpSocket timerSocket;
 
   TcpSocket first;
   TcpSocket last;
 
+  TcpSocket byPort[TCP_PORT_HASH_SIZE];
+  TcpSocket connections[TCP_CONNECTION_HASH_SIZE];
+  TcpSocket listeners[TCP_PORT_HASH_SIZE];
+
   IpFilter filter;
 };
 
-#define QUEUE_SIZE 16384
+typedef enum {
+  tcpTableByPort=0,
+  tcpTableByKey, /* connections or listeners */
+  tcpNumTables
+} TcpTable;
+
+typedef struct {
+  TcpSocket next,prev;
+  TcpSocket* bucket; /* 0 if not in the table */
+} TcpTableLink;
+
+/* How far each socket buffer (a ByteQueue) grows. */
+#define TCP_BUFFER_DEFAULT_LIMIT 65536
+#define TCP_BUFFER_MAX_LIMIT (1<<20)
+
+/* The most data we put in one segment: an MTU, less the IPv6 and TCP
+ *  headers.
+ */
+#define TCP_SEGMENT_SIZE (PACKOS_MTU-40-sizeof(IpHeaderTCP))
+
+/* Options (RFC 7323, 2018), and how long they are as we lay them out. */
+#define TCP_OPTION_END 0
+#define TCP_OPTION_NOP 1
+#define TCP_OPTION_MSS 2
+#define TCP_OPTION_WINDOW_SCALE 3
+#define TCP_OPTION_SACK_PERMITTED 4
+#define TCP_OPTION_SACK 5
+#define TCP_OPTION_TIMESTAMP 8
+
+#define TCP_OPTIONS_MAX 40
+#define TCP_TIMESTAMP_OPTION_LEN 12
+#define TCP_MAX_WINDOW_SHIFT 14
+/* RFC 8200's minimum MTU, less the headers; for peers that send no MSS. */
+#define TCP_DEFAULT_MSS 1220
 
 typedef struct {
-  byte data[QUEUE_SIZE];
-  uint32_t start,len,latestSequenceNumber,latestAckNumber;
-} ByteQueue;
+  bool hasMss,hasWindowScale,sackPermitted,hasTimestamp;
+  uint16_t mss;
+  byte windowScale;
+  uint32_t tsVal,tsEcr;
+  uint32_t numSacks;
+  TcpSackRange sacks[4];
+} TcpOptions;
 
 struct TcpSocket {
   TcpSocketState state;
@@ -41,8 +98,26 @@ struct TcpSocket {
   PackosAddress remoteAddr;
   uint16_t remotePort;
 
+  /* out holds everything from the oldest unacknowledged byte on; its
+   *  latestSequenceNumber is that byte's.  The first inFlight bytes
+   *  have been sent.
+   */
   ByteQueue in,out;
-  uint32_t remoteWindow;
+  uint32_t inFlight;
+  uint32_t remoteWindow; /* already scaled */
+  TcpCongestion congestion;
+  TcpScoreboard scoreboard;
+
+  /* Until the peer's SYN arrives (negotiated), the flags say what
+   *  we'll offer; then, what was agreed.
+   */
+  struct {
+    bool negotiated;
+    bool windowScale,sackPermitted,timestamps;
+    byte sendShift,receiveShift;
+    uint16_t mss; /* the peer's */
+    uint32_t tsRecent;
+  } options;
 
   TcpSocket waitingToAccept;
   TcpSocket acceptedFrom;
@@ -50,8 +125,16 @@ struct TcpSocket {
   TcpSocket next;
   TcpSocket prev;
 
+  TcpTableLink links[tcpNumTables];
+
+  /* ticksLeft counts down to the next flush of short segments and
+   *  ACKs; retransmitAt is the retransmission deadline, 0 if nothing's
+   *  in flight.  armedAt is the deadline of the socket's own timer at
+   *  the timer server, 0 if none; it's never later than retransmitAt.
+   */
   struct {
     int ticksLeft,initTicks;
+    uint64_t retransmitAt,armedAt;
   } timing;
 };
 
@@ -60,31 +143,23 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
                                       PackosPacket* packet,
                                       PackosError* error);
 
-static int ByteQueueEnqueue(ByteQueue* queue,
-                            const void* data,
-                            uint32_t nbytes,
-                            PackosError* error);
-static int ByteQueueDequeue(ByteQueue* queue,
-                            void* data,
-                            uint32_t nbytes,
-                            PackosError* error);
-static int ByteQueueRead(ByteQueue* queue,
-                         void* data,
-                         uint32_t nbytes,
-                         PackosError* error);
-static int ByteQueueDrop(ByteQueue* queue,
-                         uint32_t nbytes,
-                         PackosError* error);
-
 static int checkPackets(IpIface iface,
                         PackosError* error);
 static PackosPacket* newPacket(TcpSocket socket,
                                uint32_t datalen,
+                               bool syn,
                                uint32_t* actualDatalen,
                                IpHeaderTCP** tcpHeader,
                                PackosError* error);
 static int fire(TcpSocket socket,
                 PackosError* error);
+static int transmit(TcpSocket socket,
+                    bool partial,
+                    PackosError* error);
+static int flush(TcpSocket socket,
+                 PackosError* error);
+static void setRetransmitAt(TcpSocket socket,
+                            uint64_t when);
 
 static bool modLt(uint32_t a, uint32_t b);
 #if 0
@@ -155,36 +230,63 @@ static int TcpInitIface(IpIface iface,
                        );
 #endif
 
-      iface->tcpContext->timer=TimerNew(iface->tcpContext->timerSocket,
-                                        0,100000,
-                                        (uint32_t)iface,
-                                        true,
-                                        error);
-      if (!iface->tcpContext->timer)
+      iface->tcpContext->timers=TimerBatchNew(iface->tcpContext->timerSocket,
+                                              error);
+      if (!iface->tcpContext->timers)
         {
           PackosError tmp;
-          UtilPrintfStream(errStream,error,"TcpInitIface(): TimerNew(): %s\n",
+          UtilPrintfStream(errStream,error,"TcpInitIface(): TimerBatchNew(): %s\n",
                            PackosErrorToString(*error));
           UdpSocketClose(iface->tcpContext->timerSocket,&tmp);
           free(iface->tcpContext);
           return -1;
         }
+
+      {
+        PackosError tmp;
+        uint64_t now=PackosClockNow(&tmp);
+
+        if ((TimerBatchArm(iface->tcpContext->timers,(uint32_t)iface,
+                           now+TCP_TICK_USEC,TCP_TICK_USEC,
+                           error)<0)
+            || (TimerBatchSend(iface->tcpContext->timers,error)<0))
+          {
+            UtilPrintfStream(errStream,&tmp,"TcpInitIface(): arming the tick: %s\n",
+                             PackosErrorToString(*error));
+            TimerBatchClose(iface->tcpContext->timers,&tmp);
+            UdpSocketClose(iface->tcpContext->timerSocket,&tmp);
+            free(iface->tcpContext);
+            return -1;
+          }
+      }
     }
   else
     {
       iface->tcpContext->timerSocket=0;
-      iface->tcpContext->timer=0;
+      iface->tcpContext->timers=0;
     }
 
   iface->tcpContext->first=iface->tcpContext->last=0;
+  {
+    int i;
+    for (i=0; i<TCP_PORT_HASH_SIZE; i++)
+      iface->tcpContext->byPort[i]=iface->tcpContext->listeners[i]=0;
+    for (i=0; i<TCP_CONNECTION_HASH_SIZE; i++)
+      iface->tcpContext->connections[i]=0;
+  }
   iface->tcpContext->filter=IpFilterInstall(iface,TcpFilterMethod,0,error);
   if (!(iface->tcpContext->filter))
     {
       PackosError tmp;
       UtilPrintfStream(errStream,error,"TcpInitIface(): IpFilterInstall(): %s\n",
               PackosErrorToString(*error));
-      TimerClose(iface->tcpContext->timer,&tmp);
-      UdpSocketClose(iface->tcpContext->timerSocket,&tmp);
+      if (iface->tcpContext->timers)
+        {
+          TimerBatchCancel(iface->tcpContext->timers,(uint32_t)iface,&tmp);
+          TimerBatchSend(iface->tcpContext->timers,&tmp);
+          TimerBatchClose(iface->tcpContext->timers,&tmp);
+          UdpSocketClose(iface->tcpContext->timerSocket,&tmp);
+        }
       free(iface->tcpContext);
       return -1;
     }
@@ -209,23 +311,106 @@ TcpSocket TcpSocketNew(PackosError* error)
   res->localPort=0;
   res->remoteAddr=PackosAddrGetZero();
   res->remotePort=0;
+  res->inFlight=0;
   res->remoteWindow=0;
   res->waitingToAccept=0;
   res->acceptedFrom=0;
 
-  res->in.start=res->in.len=0;
-  res->in.latestSequenceNumber=res->in.latestAckNumber=0;
-  res->out.start=res->out.len=0;
-  res->out.latestSequenceNumber=res->out.latestAckNumber=0;
+  ByteQueueInit(&(res->in),TCP_BUFFER_DEFAULT_LIMIT);
+  ByteQueueInit(&(res->out),TCP_BUFFER_DEFAULT_LIMIT);
 
   res->next=res->prev=0;
+  {
+    int i;
+    for (i=0; i<tcpNumTables; i++)
+      {
+        res->links[i].next=res->links[i].prev=0;
+        res->links[i].bucket=0;
+      }
+  }
   res->state=tcpSocketStateClosed;
   res->errorThatClosed=packosErrorNone;
   res->timing.initTicks=3;
   res->timing.ticksLeft=res->timing.initTicks;
+  res->timing.retransmitAt=res->timing.armedAt=0;
+  TcpCongestionInit(&(res->congestion),&tcpCongestionCubic,TCP_SEGMENT_SIZE);
+  TcpScoreboardClear(&(res->scoreboard),0);
+
+  res->options.negotiated=false;
+  res->options.windowScale=true;
+  res->options.sackPermitted=true;
+  res->options.timestamps=true;
+  res->options.sendShift=res->options.receiveShift=0;
+  res->options.mss=TCP_SEGMENT_SIZE;
+  res->options.tsRecent=0;
   return res;
 }
 
+static unsigned int hashPort(uint16_t port)
+{
+  uint32_t h=port*2654435761U;
+  return (h>>24)%TCP_PORT_HASH_SIZE;
+}
+
+static unsigned int hashConnection(PackosAddress remoteAddr,
+                                   uint16_t remotePort,
+                                   uint16_t localPort)
+{
+  uint32_t h=remoteAddr.quads[0]^remoteAddr.quads[1]
+    ^remoteAddr.quads[2]^remoteAddr.quads[3];
+  h^=(((uint32_t)remotePort)<<16)|localPort;
+  h*=2654435761U;
+  return (h>>24)%TCP_CONNECTION_HASH_SIZE;
+}
+
+static void tableInsert(TcpSocket* bucket,
+                        TcpSocket socket,
+                        TcpTable table)
+{
+  TcpTableLink* link=socket->links+table;
+  link->bucket=bucket;
+  link->prev=0;
+  link->next=*bucket;
+  if (link->next)
+    link->next->links[table].prev=socket;
+  *bucket=socket;
+}
+
+static void tableRemove(TcpSocket socket,
+                        TcpTable table)
+{
+  TcpTableLink* link=socket->links+table;
+  if (!(link->bucket))
+    return;
+
+  if (link->prev)
+    link->prev->links[table].next=link->next;
+  else
+    *(link->bucket)=link->next;
+
+  if (link->next)
+    link->next->links[table].prev=link->prev;
+
+  link->next=link->prev=0;
+  link->bucket=0;
+}
+
+/* Files a bound socket under its remote end, once it has one. */
+static void addConnection(TcpSocket socket)
+{
+  TcpIfaceContext context;
+  if (!(socket->iface))
+    return;
+
+  context=socket->iface->tcpContext;
+  tableRemove(socket,tcpTableByKey);
+  tableInsert(context->connections
+              +hashConnection(socket->remoteAddr,socket->remotePort,
+                              socket->localPort),
+              socket,
+              tcpTableByKey);
+}
+
 static int TcpSocketDelete(TcpSocket socket,
                            PackosError* error)
 {
@@ -253,8 +438,20 @@ static int TcpSocketDelete(TcpSocket socket,
       else
         socket->iface->tcpContext->first=socket->next;
       socket->next=socket->prev=0;
+
+      tableRemove(socket,tcpTableByPort);
+      tableRemove(socket,tcpTableByKey);
     }
 
+  setRetransmitAt(socket,0);
+
+  {
+    PackosError tmp;
+    socket->out.reserved=0;
+    ByteQueueDrop(&(socket->in),socket->in.len,&tmp);
+    ByteQueueDrop(&(socket->out),socket->out.len,&tmp);
+  }
+
   free(socket);
   return 0;
 }
@@ -289,11 +486,11 @@ int TcpSocketClose(TcpSocket socket,
       socket->state=tcpSocketStateFinWait1;
     case tcpSocketStateFinWait1:
     case tcpSocketStateFinWait2:
-      return fire(socket,error);
+      return flush(socket,error);
 
     case tcpSocketStateCloseWait:
-      if (fire(socket,error)<0)
-        UtilPrintfStream(errStream,error,"TcpSocketClose(): fire(): %s\n",
+      if (flush(socket,error)<0)
+        UtilPrintfStream(errStream,error,"TcpSocketClose(): flush(): %s\n",
                 PackosErrorToString(*error));
       socket->state=tcpSocketStateLastAck;
       return 0;
@@ -323,10 +520,57 @@ TcpSocketState TcpSocketGetState(TcpSocket socket,
   return socket->state;
 }
 
-static TcpSocket seek(IpIface iface,
-		      uint16_t localPort,
-                      int remotePort,
-		      PackosError* error)
+int TcpSocketSetCongestionControl(TcpSocket socket,
+                                  TcpCongestionControl algorithm,
+                                  PackosError* error)
+{
+  if (!error) return -2;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  switch (algorithm)
+    {
+    case tcpCongestionControlNewReno:
+      socket->congestion.algorithm=&tcpCongestionNewReno;
+      return 0;
+
+    case tcpCongestionControlCubic:
+      socket->congestion.algorithm=&tcpCongestionCubic;
+      return 0;
+    }
+
+  *error=packosErrorInvalidArg;
+  return -1;
+}
+
+int TcpSocketSetBufferLimits(TcpSocket socket,
+                             uint32_t sendLimit,
+                             uint32_t receiveLimit,
+                             PackosError* error)
+{
+  if (!error) return -2;
+  if ((!socket)
+      || (!sendLimit) || (sendLimit>TCP_BUFFER_MAX_LIMIT)
+      || (!receiveLimit) || (receiveLimit>TCP_BUFFER_MAX_LIMIT)
+      )
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  /* Shrinking below what's buffered just stops it growing. */
+  socket->out.limit=sendLimit;
+  socket->in.limit=receiveLimit;
+  return 0;
+}
+
+/* Any socket bound to localPort. */
+static TcpSocket seekPort(IpIface iface,
+                          uint16_t localPort,
+                          PackosError* error)
 {
   TcpSocket cur;
 
@@ -336,21 +580,63 @@ static TcpSocket seek(IpIface iface,
       return 0;
     }
 
-  for (cur=iface->tcpContext->first; cur; cur=cur->next)
-    {
-      if ((cur->localPort==localPort)
-          && (   (remotePort==-1)
-                 || (cur->remotePort==remotePort)
-                 || (cur->state==tcpSocketStateListen)
-                 )
-          )
-        return cur;
-    }
+  for (cur=iface->tcpContext->byPort[hashPort(localPort)];
+       cur;
+       cur=cur->links[tcpTableByPort].next)
+    if (cur->localPort==localPort)
+      return cur;
 
   *error=packosErrorDoesNotExist;
   return 0;
 }
 
+static TcpSocket seekListener(IpIface iface,
+                              uint16_t localPort,
+                              PackosError* error)
+{
+  TcpSocket cur;
+
+  for (cur=iface->tcpContext->listeners[hashPort(localPort)];
+       cur;
+       cur=cur->links[tcpTableByKey].next)
+    if (cur->localPort==localPort)
+      return cur;
+
+  *error=packosErrorDoesNotExist;
+  return 0;
+}
+
+/* The connection a segment from remoteAddr:remotePort to localPort
+ *  belongs to, or else the listener on localPort.
+ */
+static TcpSocket seek(IpIface iface,
+                      PackosAddress remoteAddr,
+                      uint16_t remotePort,
+                      uint16_t localPort,
+                      PackosError* error)
+{
+  TcpSocket cur;
+
+  if (!localPort)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  for (cur=iface->tcpContext->connections[hashConnection(remoteAddr,
+                                                          remotePort,
+                                                          localPort)];
+       cur;
+       cur=cur->links[tcpTableByKey].next)
+    if ((cur->localPort==localPort)
+        && (cur->remotePort==remotePort)
+        && PackosAddrEq(cur->remoteAddr,remoteAddr)
+        )
+      return cur;
+
+  return seekListener(iface,localPort,error);
+}
+
 static uint16_t seekAnonTcpPort(IpIface iface,
                                 PackosError* error)
 {
@@ -358,13 +644,13 @@ static uint16_t seekAnonTcpPort(IpIface iface,
   for (port=iface->anonPortNext.tcp; port<=anonPortMax; port++)
     {
       PackosError tmp;
-      if (!seek(iface,port,-1,&tmp)) return port;
+      if (!seekPort(iface,port,&tmp)) return port;
     }
 
   for (port=anonPortMax; port<iface->anonPortNext.tcp; port++)
     {
       PackosError tmp;
-      if (!seek(iface,port,-1,&tmp)) return port;
+      if (!seekPort(iface,port,&tmp)) return port;
     }
 
   *error=packosErrorAllAnonPortsBound;
@@ -439,11 +725,12 @@ int TcpSocketBind(TcpSocket socket,
     }
   else
     {
-      TcpSocket other=seek(iface,port,-1,error);
+      TcpSocket other=seekPort(iface,port,error);
       if (other)
         {
-          if (!((other->state==tcpSocketStateListen)
-                && (socket->acceptedFrom==other)
+          PackosError tmp;
+          if (!((socket->acceptedFrom)
+                && (socket->acceptedFrom==seekListener(iface,port,&tmp))
                 )
               )
             {
@@ -465,6 +752,7 @@ int TcpSocketBind(TcpSocket socket,
 
   iface->tcpContext->first=socket;
 
+  tableInsert(iface->tcpContext->byPort+hashPort(port),socket,tcpTableByPort);
   return 0;
 }
 
@@ -485,6 +773,11 @@ int TcpSocketListen(TcpSocket socket,
     }
 
   socket->state=tcpSocketStateListen;
+  if (socket->iface)
+    tableInsert(socket->iface->tcpContext->listeners
+                +hashPort(socket->localPort),
+                socket,
+                tcpTableByKey);
   return 0;
 }
 
@@ -580,6 +873,52 @@ const char* TcpSocketStateToString(TcpSocketState state,
     }
 }
 
+static bool canSend(TcpSocket socket,
+                    const char* caller,
+                    PackosError* error)
+{
+  if ((socket->state!=tcpSocketStateEstablished)
+      && (socket->state!=tcpSocketStateCloseWait)
+      )
+    {
+      UtilPrintfStream(errStream,error,"%s(): state is %s instead of %s or %s\n",
+              caller,
+              TcpSocketStateToString(socket->state,error),
+              TcpSocketStateToString(tcpSocketStateEstablished,error),
+              TcpSocketStateToString(tcpSocketStateCloseWait,error)
+              );
+      *error=packosErrorConnectionClosed;
+      return false;
+    }
+
+  return true;
+}
+
+/* Data's been added to the outgoing queue: send what the windows allow,
+ *  and a short segment too if nothing is in flight (Nagle).
+ */
+static void sent(TcpSocket socket,
+                 const char* caller,
+                 int actual,
+                 PackosError* error)
+{
+  if (transmit(socket,!(socket->inFlight),error)<0)
+    {
+      UtilPrintfStream(errStream,error,"%s(): transmit(): %s\n",
+              caller,
+              PackosErrorToString(*error));
+      *error=packosErrorNone;
+    }
+
+#ifdef TCP_DEBUG
+  UtilPrintfStream(errStream,error,
+                   "<%s>: %s(): sent %d bytes\n",
+                   PackosContextGetOwnName(error),
+                   caller,
+                   actual);
+#endif
+}
+
 int TcpSocketSend(TcpSocket socket,
                   const void* buff,
                   uint32_t nbytes,
@@ -598,18 +937,8 @@ int TcpSocketSend(TcpSocket socket,
       return -1;
     }
 
-  if ((socket->state!=tcpSocketStateEstablished)
-      && (socket->state!=tcpSocketStateCloseWait)
-      )
-    {
-      UtilPrintfStream(errStream,error,"TcpSocketSend(): state is %s instead of %s or %s\n",
-              TcpSocketStateToString(socket->state,error),
-              TcpSocketStateToString(tcpSocketStateEstablished,error),
-              TcpSocketStateToString(tcpSocketStateCloseWait,error)
-              );
-      *error=packosErrorConnectionClosed;
-      return -1;
-    }
+  if (!canSend(socket,"TcpSocketSend",error))
+    return -1;
 
   if (!nbytes) return 0;
 
@@ -621,29 +950,104 @@ int TcpSocketSend(TcpSocket socket,
       return -1;
     }
 
-  if ((socket->out.len)>=(PACKOS_MTU-40))
+  sent(socket,"TcpSocketSend",actual,error);
+  return actual;
+}
+
+void* TcpSocketSendBuffer(TcpSocket socket,
+                          uint32_t* nbytes,
+                          PackosError* error)
+{
+  byte* res;
+
+  if (!error) return 0;
+  if (!(socket
+        && (socket->iface)
+        && nbytes
+        )
+      )
     {
-      if (fire(socket,error)<0)
-        {
-          UtilPrintfStream(errStream,error,"TcpSocketSend(): fire(): %s\n",
-                  PackosErrorToString(*error));
-          *error=packosErrorNone;
-        }
+      *error=packosErrorInvalidArg;
+      return 0;
     }
 
-#ifdef TCP_DEBUG
-  UtilPrintfStream(errStream,error,
-                   "<%s>: TcpSocketSend(): sent %d bytes\n",
-                   PackosContextGetOwnName(error),
-                   actual);
-#endif
+  if (!canSend(socket,"TcpSocketSendBuffer",error))
+    return 0;
 
-  return actual;
+  res=ByteQueueReserve(&(socket->out),nbytes,error);
+  if (!res)
+    {
+      PackosError tmp;
+      if ((*error)!=packosErrorQueueFull)
+        UtilPrintfStream(errStream,&tmp,
+                         "TcpSocketSendBuffer(): ByteQueueReserve(): %s\n",
+                         PackosErrorToString(*error));
+      return 0;
+    }
+
+  return res;
 }
 
-static int fire(TcpSocket socket,
-                PackosError* error)
+int TcpSocketSendCommit(TcpSocket socket,
+                        uint32_t nbytes,
+                        PackosError* error)
 {
+  if (!error) return -2;
+  if (!(socket && (socket->iface)))
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!canSend(socket,"TcpSocketSendCommit",error))
+    return -1;
+
+  if (!nbytes)
+    {
+      socket->out.reserved=0;
+      return 0;
+    }
+
+  if (ByteQueueCommit(&(socket->out),nbytes,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "TcpSocketSendCommit(): ByteQueueCommit(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  sent(socket,"TcpSocketSendCommit",nbytes,error);
+  return nbytes;
+}
+
+/* The most data a segment to this peer can carry, after its MSS and
+ *  the options agreed on; before the handshake, just our own limit.
+ */
+static uint32_t segmentSize(TcpSocket socket)
+{
+  uint32_t res=socket->options.mss;
+  if (res>TCP_SEGMENT_SIZE)
+    res=TCP_SEGMENT_SIZE;
+  if (socket->options.negotiated && socket->options.timestamps)
+    res-=TCP_TIMESTAMP_OPTION_LEN;
+  return res;
+}
+
+/* Sends nbytes (or as many as fit in a packet) from offset bytes into
+ *  the outgoing queue, acknowledging everything received so far.
+ *  Returns the number of bytes sent.
+ */
+static int sendSegment(TcpSocket socket,
+                       uint32_t offset,
+                       uint32_t nbytes,
+                       PackosError* error)
+{
+  int actual;
+  uint16_t dataSum=0;
+  IpHeaderTCP* tcp;
+  PackosPacket* packet;
+
   if (!error) return -2;
   if (!socket)
     {
@@ -651,148 +1055,379 @@ static int fire(TcpSocket socket,
       return -1;
     }
 
+  packet=newPacket(socket,nbytes,false,&nbytes,&tcp,error);
+  if (!packet)
+    {
+      UtilPrintfStream(errStream,error,"tcp::sendSegment(): newPacket(): %s\n",
+              PackosErrorToString(*error));
+      return -1;
+    }
+
+  if (nbytes>0)
+    {
+      actual=ByteQueueRead(&(socket->out),
+                           offset,
+                           ((char*)(tcp))
+                           +((tcp->dataOffsetAndFlags)>>12)*4,
+                           nbytes,
+                           &dataSum,
+                           error);
+
+      if (actual<0)
+        {
+          PackosError tmp;
+          PackosPacketFree(packet,&tmp);
+
+          UtilPrintfStream(errStream,error,"tcp::sendSegment(): ByteQueueRead(): %s\n",
+                  PackosErrorToString(*error));
+          return -1;
+        }
+    }
+  else
+    actual=0;
+
+  if ((actual>0) && ((offset+actual)==socket->out.len))
+    tcp->dataOffsetAndFlags|=tcpFlagPush;
+
+  tcp->sequenceNumber=socket->out.latestSequenceNumber+offset;
+
+  tcp->dataOffsetAndFlags|=tcpFlagAck;
+  tcp->ackNumber=socket->in.latestSequenceNumber;
+  socket->in.latestAckNumber=tcp->ackNumber;
+
+  switch (socket->state)
+    {
+    case tcpSocketStateInvalid:
+    case tcpSocketStateListen:
+    case tcpSocketStateClosed:
+      break;
+
+    case tcpSocketStateSynSent:
+    case tcpSocketStateSynReceived:
+    case tcpSocketStateEstablished:
+    case tcpSocketStateClosing:
+    case tcpSocketStateCloseWait:
+    case tcpSocketStateLastAck:
+    case tcpSocketStateTimeWait:
+      break;
+
+    case tcpSocketStateFinWait1:
+    case tcpSocketStateFinWait2:
+      /* Only the last segment can carry the FIN. */
+      if ((offset+actual)==socket->out.len)
+        tcp->dataOffsetAndFlags|=tcpFlagFin;
+      break;
+    }
+
+  {
+    IpHeader h;
+    h.kind=ipHeaderTypeTCP;
+    h.u.tcp=tcp;
+    int checksum=TcpChecksumWithData(packet,&h,dataSum,error);
+    if (checksum<0)
+      {
+        PackosError tmp;
+        PackosPacketFree(packet,&tmp);
+        UtilPrintfStream(errStream,error,"tcp<%s>::sendSegment(): TcpChecksumWithData():%s\n",
+                PackosContextGetOwnName(error),
+                PackosErrorToString(*error));
+        return -1;
+      }
+
+    tcp->checksum=checksum;
+  }
+
 #ifdef TCP_DEBUG
   UtilPrintfStream(errStream,error,
-          "tcp<%s>::fire(): {in={lsn=%u, lan=%u, len=%u}, out={lsn=%u, lan=%u, len=%u}, %s}\n",
+          "tcp<%s>::sendSegment(): {%hu => %hu, seq %u, ack %u, ch %hu, len %hu}\n",
           PackosContextGetOwnName(error),
-          socket->in.latestSequenceNumber,socket->in.latestAckNumber,
-          socket->in.len,
-          socket->out.latestSequenceNumber,socket->out.latestAckNumber,
-          socket->out.len,
-          TcpSocketStateToString(socket->state,error)
+          tcp->sourcePort,tcp->destPort,tcp->sequenceNumber,tcp->ackNumber,
+          tcp->checksum,
+          nbytes
           );
 #endif
 
-  if (socket->state==tcpSocketStateTimeWait)
+  if (IpSend(packet,error)<0)
     {
-      TcpSocketDelete(socket,error);
-      return 1;
+      PackosError tmp;
+      PackosPacketFree(packet,&tmp);
+      UtilPrintfStream(errStream,error,"tcp<%s>::sendSegment(): IpSend(): %s\n",
+                       PackosContextGetOwnName(&tmp),
+                       PackosErrorToString(*error));
+      return -1;
     }
 
-  if ((socket->out.len==0)
-      && ((socket->in.latestSequenceNumber)==(socket->in.latestAckNumber))
-      )
-    return 0;
+  return actual;
+}
 
-  {
-    uint32_t actual,nbytes=socket->out.len;
-    IpHeaderTCP* tcp;
-    PackosPacket* packet;
+/* Sends as much unsent data as the peer's window and the congestion
+ *  window allow, one segment after another, without waiting for
+ *  acknowledgements.  Unless partial
+ *  is set, stops short of a segment smaller than segmentSize(), so
+ *  that small writes can collect into one.  Returns the number of
+ *  segments sent.
+ */
+static int transmit(TcpSocket socket,
+                    bool partial,
+                    PackosError* error)
+{
+  int sent=0;
+  uint32_t window,size;
 
-    if (nbytes>socket->remoteWindow)
-      nbytes=socket->remoteWindow;
+  if (!error) return -2;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-    packet=newPacket(socket,nbytes,&nbytes,&tcp,error);
-    if (!packet)
-      {
-        UtilPrintfStream(errStream,error,"tcp::fire(): newPacket(): %s\n",
-                PackosErrorToString(*error));
-        return -1;
-      }
+  window=socket->remoteWindow;
+  if (window>socket->congestion.cwnd)
+    window=socket->congestion.cwnd;
+  size=segmentSize(socket);
+
+  while ((socket->inFlight<socket->out.len)
+         && (socket->inFlight<window)
+         )
+    {
+      int actual;
+      uint32_t nbytes=socket->out.len-socket->inFlight;
+
+      if (nbytes>(window-socket->inFlight))
+        nbytes=window-socket->inFlight;
+      if (nbytes>size)
+        nbytes=size;
+      if ((nbytes<size) && !partial)
+        break;
+
+      actual=sendSegment(socket,socket->inFlight,nbytes,error);
+      if (actual<0)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,"tcp::transmit(): sendSegment(): %s\n",
+                           PackosErrorToString(*error));
+          return -1;
+        }
+      if (!actual)
+        break;
 
-    if (nbytes>0)
       {
-        actual=ByteQueueRead(&(socket->out),
-                             ((char*)(tcp))
-                             +((tcp->dataOffsetAndFlags)>>12)*4,
-                             nbytes,
-                             error);
+        PackosError tmp;
+        uint64_t now=PackosClockNow(&tmp);
 
-        if (actual<0)
-          {
-            PackosError tmp;
-            PackosPacketFree(packet,&tmp);
+        /* The retransmission timer runs from the oldest segment in
+         *  flight.
+         */
+        if (!(socket->inFlight))
+          setRetransmitAt(socket,now+socket->congestion.rtt.rto);
 
-            UtilPrintfStream(errStream,error,"tcp::fire(): ByteQueueRead(): %s\n",
-                    PackosErrorToString(*error));
-            return -1;
+        /* Segments sent again after a timeout aren't timed (Karn). */
+        if (!modLt(socket->out.latestSequenceNumber+socket->inFlight,
+                   socket->congestion.highestSent))
+          {
+            socket->congestion.highestSent
+              =socket->out.latestSequenceNumber+socket->inFlight+actual;
+            if (!(socket->congestion.rtt.timing))
+              {
+                socket->congestion.rtt.timing=true;
+                socket->congestion.rtt.seq=socket->congestion.highestSent;
+                socket->congestion.rtt.sentAt=now;
+              }
           }
       }
-    else
-      actual=0;
 
-    if (actual>0)
-      tcp->dataOffsetAndFlags|=tcpFlagPush;
+      socket->inFlight+=actual;
+      sent++;
+    }
 
-    tcp->sequenceNumber=socket->out.latestSequenceNumber;
+  return sent;
+}
 
-    tcp->dataOffsetAndFlags|=tcpFlagAck;
-    tcp->ackNumber=socket->in.latestSequenceNumber;
-    socket->in.latestAckNumber=tcp->ackNumber;
+/* Sends whatever's waiting: unsent data the window allows, even in a
+ *  short segment; else a probe, if the window's shut; else an ACK, if
+ *  one is owed.
+ */
+static int flush(TcpSocket socket,
+                 PackosError* error)
+{
+  int sent;
 
-    switch (socket->state)
-      {
-      case tcpSocketStateInvalid:
-      case tcpSocketStateListen:
-      case tcpSocketStateClosed:
-        break;
+  if (!error) return -2;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-      case tcpSocketStateSynSent:
-      case tcpSocketStateSynReceived:
-      case tcpSocketStateEstablished:
-      case tcpSocketStateClosing:
-      case tcpSocketStateCloseWait:
-      case tcpSocketStateLastAck:
-      case tcpSocketStateTimeWait:
-        break;
+  if ((socket->out.len==0)
+      && ((socket->in.latestSequenceNumber)==(socket->in.latestAckNumber))
+      )
+    return 0;
 
-      case tcpSocketStateFinWait1:
-      case tcpSocketStateFinWait2:
-        tcp->dataOffsetAndFlags|=tcpFlagFin;
-        break;
-      }
+  sent=transmit(socket,true,error);
+  if (sent<0)
+    return -1;
+  if (sent>0)
+    return 0;
 
+  if ((socket->inFlight==0) && (socket->out.len>0))
     {
-      IpHeader h;
-      h.kind=ipHeaderTypeTCP;
-      h.u.tcp=tcp;
-      int checksum=TcpChecksum(packet,&h,error);
-      if (checksum<0)
+      PackosError tmp;
+      int actual=sendSegment(socket,0,1,error);
+      if (actual<0)
+        return -1;
+      socket->inFlight=actual;
+      setRetransmitAt(socket,PackosClockNow(&tmp)+socket->congestion.rtt.rto);
+      return 0;
+    }
+
+  /* Nothing new could go out; acknowledge only if there's something
+   *  we haven't acknowledged yet, or the peer sees duplicate ACKs.
+   */
+  if ((socket->in.latestSequenceNumber)==(socket->in.latestAckNumber))
+    return 0;
+
+  if (sendSegment(socket,socket->inFlight,0,error)<0)
+    return -1;
+  return 0;
+}
+
+/* Sets the retransmission deadline, and queues the matching change to
+ *  the socket's timer, keyed by the socket, in its iface's batch;
+ *  checkPackets() sends the batch.  A deadline that moves later leaves
+ *  the timer as it is: when that goes off early, it's armed again.
+ */
+static void setRetransmitAt(TcpSocket socket,
+                            uint64_t when)
+{
+  TimerBatch timers;
+  PackosError error;
+
+  socket->timing.retransmitAt=when;
+  if (!(socket->iface && (timers=socket->iface->tcpContext->timers)))
+    return;
+
+  if (when
+      && ((!(socket->timing.armedAt)) || (when<socket->timing.armedAt))
+      )
+    {
+      if (TimerBatchArm(timers,(uint32_t)socket,when,0,&error)<0)
         {
           PackosError tmp;
-          PackosPacketFree(packet,&tmp);
-          UtilPrintfStream(errStream,error,"tcp<%s>::fire(): TcpChecksum():%s\n",
-                  PackosContextGetOwnName(error),
-                  PackosErrorToString(*error));
-          return -1;
+          UtilPrintfStream(errStream,&tmp,
+                           "tcp::setRetransmitAt(): TimerBatchArm(): %s\n",
+                           PackosErrorToString(error));
+          return;
         }
+      socket->timing.armedAt=when;
+    }
+  else if ((!when) && socket->timing.armedAt)
+    {
+      if (TimerBatchCancel(timers,(uint32_t)socket,&error)<0)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "tcp::setRetransmitAt(): TimerBatchCancel(): %s\n",
+                           PackosErrorToString(error));
+          return;
+        }
+      socket->timing.armedAt=0;
+    }
+}
+
+/* Called when the retransmission timer runs out: whatever's in flight
+ *  is taken to be lost.  We go back to the oldest unacknowledged byte
+ *  and send one segment from there, and the rest is sent again as
+ *  acknowledgements come in.
+ */
+static int retransmit(TcpSocket socket,
+                      uint64_t now,
+                      PackosError* error)
+{
+  int actual;
+  uint32_t nbytes;
 
-      tcp->checksum=checksum;
+  if (!error) return -2;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
     }
 
-#ifdef TCP_DEBUG
-    UtilPrintfStream(errStream,error,
-            "tcp<%s>::fire(): {%hu => %hu, seq %u, ack %u, ch %hu, len %hu}\n",
-            PackosContextGetOwnName(error),
-            tcp->sourcePort,tcp->destPort,tcp->sequenceNumber,tcp->ackNumber,
-            tcp->checksum,
-            nbytes
-            );
-#endif
+  setRetransmitAt(socket,0);
+  if (!(socket->inFlight))
+    return 0;
+
+  TcpCongestionOnTimeout(&(socket->congestion),socket->inFlight,now);
+  TcpScoreboardClear(&(socket->scoreboard),socket->out.latestSequenceNumber);
+
+  nbytes=socket->inFlight;
+  if (nbytes>segmentSize(socket))
+    nbytes=segmentSize(socket);
+
+  actual=sendSegment(socket,0,nbytes,error);
+  if (actual<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"tcp::retransmit(): sendSegment(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  socket->inFlight=actual;
+  setRetransmitAt(socket,now+socket->congestion.rtt.rto);
+  return 0;
+}
+
+/* Called when the socket's tick count runs out. */
+static int fire(TcpSocket socket,
+                PackosError* error)
+{
+  if (!error) return -2;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
 
-    if (IpSend(packet,error)<0)
-      {
-        PackosError tmp;
-        PackosPacketFree(packet,&tmp);
-        UtilPrintfStream(errStream,error,"tcp<%s>::fire(): IpSend(): %s\n",
-                         PackosContextGetOwnName(&tmp),
-                         PackosErrorToString(*error));
-        return -1;
-      }
 #ifdef TCP_DEBUG
-    else
-      UtilPrintfStream(errStream,error,"tcp<%s>::fire(): IpSend(): success\n",
-                       PackosContextGetOwnName(error));
+  UtilPrintfStream(errStream,error,
+          "tcp<%s>::fire(): {in={lsn=%u, lan=%u, len=%u}, out={lsn=%u, lan=%u, len=%u}, %s}\n",
+          PackosContextGetOwnName(error),
+          socket->in.latestSequenceNumber,socket->in.latestAckNumber,
+          socket->in.len,
+          socket->out.latestSequenceNumber,socket->out.latestAckNumber,
+          socket->out.len,
+          TcpSocketStateToString(socket->state,error)
+          );
 #endif
-  }
+
+  if (socket->state==tcpSocketStateTimeWait)
+    {
+      TcpSocketDelete(socket,error);
+      return 1;
+    }
+
+  if (flush(socket,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"tcp::fire(): flush(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
 
   return 0;
 }
 
+/* Called on the iface's periodic tick.  Sockets with timers of their
+ *  own are retransmitted from retransmitTimerFired(); without a timer
+ *  server, in the scheduler, the deadlines are checked here.
+ */
 static int tick(IpIface iface,
                 PackosError* error)
 {
   TcpSocket cur;
+  uint64_t now;
 
   const char* name=PackosContextGetOwnName(error);
   if (!name)
@@ -808,6 +1443,8 @@ static int tick(IpIface iface,
       return -1;
     }
 
+  now=PackosClockNow(error);
+
   cur=iface->tcpContext->first;
   while (cur)
     {
@@ -819,6 +1456,20 @@ static int tick(IpIface iface,
           UtilPrintfStream(errStream,error,"tcp<%s>::tick(): %p, %p\n",name,cur,next);
 #endif
 
+          if ((!(iface->tcpContext->timers))
+              && cur->timing.retransmitAt
+              && (cur->timing.retransmitAt<=now)
+              )
+            {
+              PackosError tmp;
+              if (retransmit(cur,now,&tmp)<0)
+                {
+                  UtilPrintfStream(errStream,error,"tcp::tick(): retransmit(): %s\n",
+                          PackosErrorToString(tmp));
+                  *error=tmp;
+                }
+            }
+
           cur->timing.ticksLeft--;
           if (cur->timing.ticksLeft<=0)
             {
@@ -843,16 +1494,71 @@ static int tick(IpIface iface,
             }
         }
 
-      cur=next;
+      cur=next;
+    }
+
+#ifdef TCP_DEBUG
+  UtilPrintfStream(errStream,error,"tcp<%s>::tick(): done\n",name);
+#endif
+
+  if ((*error)!=packosErrorNone)
+    return -1;
+
+  return 0;
+}
+
+/* A socket's retransmission timer went off.  The socket may have gone
+ *  since; if its deadline has moved later, the timer's armed again.
+ */
+static int retransmitTimerFired(IpIface iface,
+                                uint32_t id,
+                                PackosError* error)
+{
+  TcpSocket cur;
+  uint64_t now;
+
+  for (cur=iface->tcpContext->first; cur; cur=cur->next)
+    if (((uint32_t)cur)==id)
+      break;
+  if (!cur)
+    return 0;
+
+  cur->timing.armedAt=0;
+  now=PackosClockNow(error);
+  if (cur->timing.retransmitAt && (cur->timing.retransmitAt<=now))
+    {
+      if (retransmit(cur,now,error)<0)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "tcp::retransmitTimerFired(): retransmit(): %s\n",
+                           PackosErrorToString(*error));
+          return -1;
+        }
     }
+  else
+    setRetransmitAt(cur,cur->timing.retransmitAt);
 
-#ifdef TCP_DEBUG
-  UtilPrintfStream(errStream,error,"tcp<%s>::tick(): done\n",name);
-#endif
+  return 0;
+}
 
-  if ((*error)!=packosErrorNone)
-    return -1;
+/* Sends the queued timer changes. */
+static int sendTimers(IpIface iface,
+                      PackosError* error)
+{
+  /* A cancel can cross the tick of a timer that had just gone off. */
+  if ((TimerBatchSend(iface->tcpContext->timers,error)<0)
+      && ((*error)!=packosErrorDoesNotExist)
+      )
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "tcp::sendTimers(): TimerBatchSend(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
 
+  *error=packosErrorNone;
   return 0;
 }
 
@@ -879,6 +1585,9 @@ static int checkPackets(IpIface iface,
       return 0;
     }
 
+  if (sendTimers(iface,error)<0)
+    return -1;
+
   {
     int res=0;
     PackosPacket* packet=UdpSocketReceive(iface->tcpContext->timerSocket,
@@ -886,14 +1595,41 @@ static int checkPackets(IpIface iface,
     if (packet)
       {
         PackosError tmp;
+        bool ticked=false;
+        TimerReply* reply=(TimerReply*)(IpPacketData(packet,&tmp));
+
+        if (reply && (reply->cmd==timerRequestCmdTick))
+          {
+            uint32_t i;
+            for (i=0;
+                 (i<reply->u.tick.numIds) && (i<TIMER_REPLY_MAX_TICK_IDS);
+                 i++)
+              {
+                uint32_t id=TimerReplyTickIds(reply)[i];
+                if (id==(uint32_t)iface)
+                  ticked=true;
+                else if (retransmitTimerFired(iface,id,&tmp)<0)
+                  {
+                    *error=tmp;
+                    res=-1;
+                  }
+              }
+          }
         PackosPacketFree(packet,&tmp);
 
-        if (tick(iface,error)<0)
+        if (ticked && (tick(iface,&tmp)<0))
           {
-            UtilPrintfStream(errStream,&tmp,
+            UtilPrintfStream(errStream,error,
                              "tcp::checkPackets(): tick(): %s\n",
-                             PackosErrorToString(*error));
-            return -1;
+                             PackosErrorToString(tmp));
+            *error=tmp;
+            res=-1;
+          }
+
+        if (sendTimers(iface,&tmp)<0)
+          {
+            *error=tmp;
+            res=-1;
           }
       }
     else
@@ -1024,141 +1760,230 @@ bool TcpSocketReceivePending(TcpSocket socket,
   return (socket->in.len)>0;
 }
 
-static int ByteQueueEnqueue(ByteQueue* queue,
-                            const void* data,
-                            uint32_t nbytes,
-                            PackosError* error)
+static uint32_t tsClock(void)
 {
-  int actual;
-
-  if (!error) return -2;
-  if (!(queue && data))
-    {
-      *error=packosErrorInvalidArg;
-      return -1;
-    }
+  PackosError tmp;
+  /* About a millisecond a tick; RFC 7323 allows anything to a second. */
+  return (uint32_t)(PackosClockNow(&tmp)>>10);
+}
 
-  if (!nbytes) return 0;
+/* Enough to advertise the whole of the largest receive buffer the
+ *  socket could be given, since the shift can't change later.
+ */
+static byte ourWindowShift(void)
+{
+  byte res=0;
+  while ((res<TCP_MAX_WINDOW_SHIFT) && ((TCP_BUFFER_MAX_LIMIT>>res)>0xffff))
+    res++;
+  return res;
+}
 
-  if (queue->len==QUEUE_SIZE)
-    {
-      *error=packosErrorQueueFull;
-      return -1;
-    }
+static void putOption16(byte* pos, uint16_t value)
+{
+  pos[0]=value>>8;
+  pos[1]=value&0xff;
+}
 
-  actual=nbytes;
-  if (actual>(QUEUE_SIZE-(queue->len)))
-    actual=QUEUE_SIZE-(queue->len);
+static void putOption32(byte* pos, uint32_t value)
+{
+  putOption16(pos,value>>16);
+  putOption16(pos+2,value&0xffff);
+}
 
-  {
-    char* base=(char*)data;
-    if ((QUEUE_SIZE-(queue->start+queue->len))<actual)
-      {
-        int first=QUEUE_SIZE-(queue->start+queue->len);
-        int second=actual-first;
-        UtilMemcpy(queue->data+queue->start+queue->len,base,first);
-        UtilMemcpy(queue->data,base+first,second);
-      }
-    else
-      UtilMemcpy(queue->data+queue->start+queue->len,base,actual);
-  }
+static uint16_t getOption16(const byte* pos)
+{
+  return (((uint16_t)(pos[0]))<<8)|pos[1];
+}
 
-  queue->len+=actual;
-  return actual;
+static uint32_t getOption32(const byte* pos)
+{
+  return (((uint32_t)(getOption16(pos)))<<16)|getOption16(pos+2);
 }
 
-static int ByteQueueRead(ByteQueue* queue,
-                         void* data,
-                         uint32_t nbytes,
-                         PackosError* error)
+/* Lays out the options for a segment, padded to a multiple of 4 bytes;
+ *  returns their length.  A SYN offers whatever the socket still
+ *  allows; anything else carries a timestamp, if they were agreed.
+ */
+static uint32_t buildOptions(TcpSocket socket,
+                             bool syn,
+                             byte* buff)
 {
-  int actual;
+  uint32_t len=0;
 
-  if (!error) return -2;
-  if (!(queue && data))
+  if (syn)
     {
-      *error=packosErrorInvalidArg;
-      return -1;
-    }
+      buff[len++]=TCP_OPTION_MSS;
+      buff[len++]=4;
+      putOption16(buff+len,TCP_SEGMENT_SIZE);
+      len+=2;
 
-  if (!nbytes) return 0;
+      if (socket->options.sackPermitted && !(socket->options.timestamps))
+        {
+          buff[len++]=TCP_OPTION_NOP;
+          buff[len++]=TCP_OPTION_NOP;
+        }
+      if (socket->options.sackPermitted)
+        {
+          buff[len++]=TCP_OPTION_SACK_PERMITTED;
+          buff[len++]=2;
+        }
+    }
 
-  if (queue->len==0)
+  if (socket->options.timestamps)
     {
-      *error=packosErrorQueueEmpty;
-      return -1;
+      if (!(syn && socket->options.sackPermitted))
+        {
+          buff[len++]=TCP_OPTION_NOP;
+          buff[len++]=TCP_OPTION_NOP;
+        }
+      buff[len++]=TCP_OPTION_TIMESTAMP;
+      buff[len++]=10;
+      putOption32(buff+len,tsClock());
+      putOption32(buff+len+4,socket->options.tsRecent);
+      len+=8;
     }
 
-  actual=nbytes;
-  if (actual>(queue->len))
-    actual=queue->len;
-
-  if ((queue->start+actual)>QUEUE_SIZE)
+  if (syn && socket->options.windowScale)
     {
-      char* base=(char*)data;
-      int first=queue->start+actual-QUEUE_SIZE;
-      int second=actual-first;
-      UtilMemcpy(base,queue->data+queue->start,first);
-      UtilMemcpy(base+first,queue->data,second);
-      queue->start=second;
+      buff[len++]=TCP_OPTION_NOP;
+      buff[len++]=TCP_OPTION_WINDOW_SCALE;
+      buff[len++]=3;
+      buff[len++]=ourWindowShift();
     }
-  else
-    UtilMemcpy(data,queue->data+queue->start,actual);
 
-  return actual;
+  return len;
 }
 
-static int ByteQueueDequeue(ByteQueue* queue,
-                            void* data,
-                            uint32_t nbytes,
-                            PackosError* error)
+static void parseOptions(const IpHeaderTCP* tcp,
+                         TcpOptions* options)
 {
-  int actual=ByteQueueRead(queue,data,nbytes,error);
-  if (actual>0)
+  const byte* base=(const byte*)tcp;
+  uint32_t size=((tcp->dataOffsetAndFlags)>>12)*4;
+  uint32_t offset=sizeof(IpHeaderTCP);
+
+  options->hasMss=options->hasWindowScale=false;
+  options->sackPermitted=options->hasTimestamp=false;
+  options->numSacks=0;
+
+  while (offset<size)
     {
-      queue->start+=actual;
-      queue->len-=actual;
-      if (queue->len==0)
-        queue->start=0;
-    }
+      byte kind=base[offset],len;
 
-  return actual;
+      if (kind==TCP_OPTION_END)
+        break;
+      if (kind==TCP_OPTION_NOP)
+        {
+          offset++;
+          continue;
+        }
+
+      if ((offset+1)>=size)
+        break;
+      len=base[offset+1];
+      if ((len<2) || ((offset+len)>size))
+        break;
+
+      switch (kind)
+        {
+        case TCP_OPTION_MSS:
+          if (len==4)
+            {
+              options->hasMss=true;
+              options->mss=getOption16(base+offset+2);
+            }
+          break;
+
+        case TCP_OPTION_WINDOW_SCALE:
+          if (len==3)
+            {
+              options->hasWindowScale=true;
+              options->windowScale=base[offset+2];
+            }
+          break;
+
+        case TCP_OPTION_SACK_PERMITTED:
+          if (len==2)
+            options->sackPermitted=true;
+          break;
+
+        case TCP_OPTION_SACK:
+          {
+            uint32_t i,n=(len-2)/8;
+            if (n>4) n=4;
+            for (i=0; i<n; i++)
+              {
+                options->sacks[i].left=getOption32(base+offset+2+8*i);
+                options->sacks[i].right=getOption32(base+offset+6+8*i);
+              }
+            options->numSacks=n;
+          }
+          break;
+
+        case TCP_OPTION_TIMESTAMP:
+          if (len==10)
+            {
+              options->hasTimestamp=true;
+              options->tsVal=getOption32(base+offset+2);
+              options->tsEcr=getOption32(base+offset+6);
+            }
+          break;
+
+        default:
+          break;
+        }
+
+      offset+=len;
+    }
 }
 
-static int ByteQueueDrop(ByteQueue* queue,
-                         uint32_t nbytes,
-                         PackosError* error)
+/* Settles the options from the peer's SYN: each is on only if both
+ *  sides asked for it.
+ */
+static void applySynOptions(TcpSocket socket,
+                            const TcpOptions* options)
 {
-  if (!error) return -2;
-  if (!queue)
+  socket->options.mss=options->hasMss ? options->mss : TCP_DEFAULT_MSS;
+
+  if (socket->options.windowScale && options->hasWindowScale)
     {
-      *error=packosErrorInvalidArg;
-      return -1;
+      socket->options.sendShift
+        =(options->windowScale>TCP_MAX_WINDOW_SHIFT)
+        ? TCP_MAX_WINDOW_SHIFT
+        : options->windowScale;
+      socket->options.receiveShift=ourWindowShift();
     }
-
-  if (!nbytes) return 0;
-
-  if (nbytes>=queue->len)
+  else
     {
-      queue->len=0;
-      queue->start=0;
-      return 0;
+      socket->options.windowScale=false;
+      socket->options.sendShift=socket->options.receiveShift=0;
     }
 
-  queue->start+=nbytes;
-  queue->start%=QUEUE_SIZE;
-  queue->len-=nbytes;
-  return 0;
+  socket->options.sackPermitted
+    =socket->options.sackPermitted && options->sackPermitted;
+
+  socket->options.timestamps
+    =socket->options.timestamps && options->hasTimestamp;
+  if (socket->options.timestamps)
+    socket->options.tsRecent=options->tsVal;
+
+  socket->options.negotiated=true;
+  TcpCongestionSetMss(&(socket->congestion),segmentSize(socket));
 }
 
 static PackosPacket* newPacket(TcpSocket socket,
                                uint32_t datalen,
+                               bool syn,
                                uint32_t* actualDatalen,
                                IpHeaderTCP** tcpHeader,
                                PackosError* error)
 {
   PackosPacket* packet;
   uint32_t actualSize;
+  struct {
+    IpHeaderTCP tcp;
+    byte options[TCP_OPTIONS_MAX];
+  } header;
+  uint32_t optionsLen;
 
   if (!error) return 0;
   if (!socket)
@@ -1186,9 +2011,12 @@ static PackosPacket* newPacket(TcpSocket socket,
   packet->ipv6.src=socket->iface->addr;
   packet->ipv6.dest=socket->remoteAddr;
 
+  optionsLen=buildOptions(socket,syn,header.options);
+
   {
     uint32_t headerSize
-      =sizeof(packet->packos)+sizeof(packet->ipv6)+sizeof(IpHeaderTCP);
+      =sizeof(packet->packos)+sizeof(packet->ipv6)+sizeof(IpHeaderTCP)
+      +optionsLen;
     if (actualSize<(headerSize+datalen))
       datalen=actualSize-headerSize;
   }
@@ -1198,18 +2026,27 @@ static PackosPacket* newPacket(TcpSocket socket,
 
   {
     IpHeader h;
-    IpHeaderTCP tcp;
+    IpHeaderTCP* tcp=&(header.tcp);
+    uint32_t window=(socket->in.len<socket->in.limit)
+      ? socket->in.limit-socket->in.len
+      : 0;
+
+    /* The window in a SYN is never scaled. */
+    if (!syn)
+      window>>=socket->options.receiveShift;
+    if (window>0xffff)
+      window=0xffff;
 
     h.kind=ipHeaderTypeTCP;
-    h.u.tcp=&tcp;
-    tcp.sourcePort=socket->localPort;
-    tcp.destPort=socket->remotePort;
-    tcp.sequenceNumber=0;
-    tcp.ackNumber=socket->in.latestSequenceNumber;
-    tcp.dataOffsetAndFlags=(sizeof(tcp)/4)<<12;
-    tcp.window=QUEUE_SIZE-socket->in.len;
-    tcp.urgent=0;
-    tcp.checksum=0; /* Will have to compute when sent */
+    h.u.tcp=tcp;
+    tcp->sourcePort=socket->localPort;
+    tcp->destPort=socket->remotePort;
+    tcp->sequenceNumber=0;
+    tcp->ackNumber=socket->in.latestSequenceNumber;
+    tcp->dataOffsetAndFlags=((sizeof(IpHeaderTCP)+optionsLen)/4)<<12;
+    tcp->window=window;
+    tcp->urgent=0;
+    tcp->checksum=0; /* Will have to compute when sent */
 
     if (IpHeaderAppend(packet,&h,error)<0)
       {
@@ -1254,7 +2091,6 @@ static int sendSimple(TcpSocket socket,
 {
   IpHeaderTCP* tcp;
   PackosPacket* packet;
-  uint32_t datalen=0,actualDatalen;
 
   if (!error) return -2;
   if (!socket)
@@ -1263,9 +2099,6 @@ static int sendSimple(TcpSocket socket,
       return -1;
     }
 
-  if (flags & tcpFlagSyn)
-    datalen=4;
-
   switch (socket->state)
     {
     case tcpSocketStateInvalid:
@@ -1286,7 +2119,7 @@ static int sendSimple(TcpSocket socket,
       break;
     }
 
-  packet=newPacket(socket,datalen,&actualDatalen,&tcp,error);
+  packet=newPacket(socket,0,(flags & tcpFlagSyn)!=0,0,&tcp,error);
   if (!packet)
     {
       PackosError tmp;
@@ -1296,36 +2129,7 @@ static int sendSimple(TcpSocket socket,
       return -1;
     }
 
-  if (actualDatalen<datalen)
-    {
-      PackosError tmp;
-      UtilPrintfStream(errStream,&tmp,
-              "sendSimple(): packet too small for MSS (%d instead of %d)\n",
-              actualDatalen,datalen);
-      *error=packosErrorUnknownError;
-      return -1;
-    }
-
-  if (flags & tcpFlagSyn)
-    {
-      {
-        typedef struct {
-          byte kind,length;
-          uint16_t mss;
-        } MSS;
-        MSS* mss=(MSS*)(((char*)tcp)+sizeof(IpHeaderTCP));
-        mss->kind=2;
-        mss->length=4;
-        mss->mss=htons(PACKOS_MTU-sizeof(packet->ipv6));
-      }
-
-      tcp->dataOffsetAndFlags
-        =((tcp->dataOffsetAndFlags & 0xfff)
-          | (((tcp->dataOffsetAndFlags>>12)+1)<<12)
-          );
-    }
-
-  tcp->sequenceNumber=socket->out.latestSequenceNumber;
+  tcp->sequenceNumber=socket->out.latestSequenceNumber+socket->inFlight;
 
   tcp->dataOffsetAndFlags|=flags;
 
@@ -1388,6 +2192,7 @@ static int sendInitial(TcpSocket socket,
   seq=generateInitialSeq();
   socket->out.latestSequenceNumber=seq;
   socket->out.latestAckNumber=seq-1;
+  socket->congestion.highestSent=seq;
 
   return sendSimple(socket,flags,error);
 }
@@ -1408,11 +2213,58 @@ static int sendInitialSyn(TcpSocket socket,
   return 0;
 }
 
+/* Resends, during fast recovery, the next hole that hasn't been: the
+ *  first one the peer's SACKs show, or else (NewReno's guess) the
+ *  oldest unacknowledged segment, if that hasn't been resent yet.
+ */
+static int resendNext(TcpSocket socket,
+                      PackosError* error)
+{
+  TcpScoreboard* board=&(socket->scoreboard);
+  uint32_t una=socket->out.latestSequenceNumber;
+  uint32_t start,nbytes;
+  int actual;
+
+  if (!TcpScoreboardNextHole(board,una,&start,&nbytes))
+    {
+      if (modLt(una,board->retransmitNext))
+        return 0;
+      start=una;
+      nbytes=socket->inFlight;
+    }
+
+  if (nbytes>segmentSize(socket))
+    nbytes=segmentSize(socket);
+  if (!nbytes)
+    return 0;
+
+  actual=sendSegment(socket,start-una,nbytes,error);
+  if (actual<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "resendNext(): sendSegment(): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  board->retransmitNext=start+actual;
+  return 0;
+}
+
+/* mayBeDuplicate is whether the segment could count as a duplicate
+ *  ACK: it carries no data, SYN or FIN, and leaves the window as it
+ *  was.
+ */
 static int recordAck(TcpSocket socket,
                      uint32_t ackNumber,
+                     bool mayBeDuplicate,
+                     const TcpOptions* options,
                      PackosError* error)
 {
+  TcpCongestion* cc;
   uint32_t delta;
+  uint64_t now;
 
   if (!error) return -2;
   if (!socket)
@@ -1421,26 +2273,120 @@ static int recordAck(TcpSocket socket,
       return -1;
     }
 
+  cc=&(socket->congestion);
+
   delta=ackNumber-(socket->out.latestAckNumber);
   if (delta>=0x80000000) return 0;
 
-  if (ByteQueueDrop(&(socket->out),delta,error)<0)
+  now=PackosClockNow(error);
+
+  if (delta)
+    {
+      if (ByteQueueDrop(&(socket->out),delta,error)<0)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "recordAck(): ByteQueueDrop(): %s\n",
+                           PackosErrorToString(*error));
+          return -1;
+        }
+#ifdef TCP_DEBUG
+      else
+        UtilPrintfStream(errStream,error,
+                         "<%s>: recordAck(%u): dropped %u bytes\n",
+                         PackosContextGetOwnName(error),
+                         ackNumber,delta);
+#endif
+
+      if (delta>=socket->inFlight)
+        socket->inFlight=0;
+      else
+        socket->inFlight-=delta;
+
+      socket->out.latestSequenceNumber=socket->out.latestAckNumber=ackNumber;
+      TcpScoreboardTrim(&(socket->scoreboard),ackNumber);
+
+      /* With timestamps, every ACK of new data is a sample, even of a
+       *  segment that was resent; without, only the timed one is.
+       */
+      if (socket->options.timestamps
+          && options->hasTimestamp
+          && options->tsEcr)
+        {
+          cc->rtt.timing=false;
+          TcpCongestionRttSample(cc,(tsClock()-options->tsEcr)<<10);
+        }
+      else if (cc->rtt.timing && modGe(ackNumber,cc->rtt.seq))
+        {
+          cc->rtt.timing=false;
+          TcpCongestionRttSample(cc,(uint32_t)(now-cc->rtt.sentAt));
+        }
+    }
+
+  if (socket->options.sackPermitted)
+    {
+      uint32_t i;
+      for (i=0; i<options->numSacks; i++)
+        {
+          const TcpSackRange* range=options->sacks+i;
+          if (!modLt(cc->highestSent,range->right))
+            TcpScoreboardAdd(&(socket->scoreboard),ackNumber,
+                             range->left,range->right);
+        }
+    }
+
+  if (!delta)
+    {
+      if (mayBeDuplicate && socket->inFlight)
+        {
+          cc->dupAcks++;
+          if (cc->inRecovery)
+            {
+              TcpCongestionOnDupAck(cc);
+              if (resendNext(socket,error)<0)
+                return -1;
+            }
+          else if (cc->dupAcks==3)
+            {
+              /* Fast retransmit. */
+              TcpCongestionOnLoss(cc,socket->inFlight,cc->highestSent,now);
+              socket->scoreboard.retransmitNext=ackNumber;
+              if (resendNext(socket,error)<0)
+                return -1;
+            }
+        }
+    }
+  else
+    {
+      if (cc->inRecovery)
+        {
+          if (TcpCongestionOnRecoveryAck(cc,ackNumber,delta,socket->inFlight))
+            {
+              if (resendNext(socket,error)<0)
+                return -1;
+            }
+        }
+      else
+        {
+          cc->dupAcks=0;
+          TcpCongestionOnAck(cc,delta,now);
+        }
+
+      setRetransmitAt(socket,socket->inFlight ? now+cc->rtt.rto : 0);
+    }
+
+  /* Each ACK may open the window for more; a short segment can go
+   *  once nothing else is in flight.
+   */
+  if (transmit(socket,!(socket->inFlight),error)<0)
     {
       PackosError tmp;
       UtilPrintfStream(errStream,&tmp,
-                       "recordAck(): ByteQueueDrop(): %s\n",
+                       "recordAck(): transmit(): %s\n",
                        PackosErrorToString(*error));
       return -1;
     }
-#ifdef TCP_DEBUG
-  else
-    UtilPrintfStream(errStream,error,
-                     "<%s>: recordAck(%u): dropped %u bytes\n",
-                     PackosContextGetOwnName(error),
-                     ackNumber,delta);
-#endif
 
-  socket->out.latestSequenceNumber=socket->out.latestAckNumber=ackNumber;
   return 0;
 }
 
@@ -1452,6 +2398,8 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
   TcpSocket socket;
   IpHeader* h;
   IpHeaderTCP* tcp;
+  TcpOptions options;
+  bool mayBeDuplicate;
 
 #ifdef TCP_DEBUG
   UtilPrintfStream(errStream,error,"%s: TcpFilterMethod()\n",
@@ -1473,9 +2421,18 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
   if (!(h && h->u.tcp))
     return ipFilterActionPass;
 
+  if (IpPacketFromNetworkOrder(packet,error)<0)
+    {
+      UtilPrintfStream(errStream,error,
+                       "TcpFilterMethod(): IpPacketFromNetworkOrder(): %s\n",
+                       PackosErrorToString(*error));
+      return ipFilterActionError;
+    }
+
   tcp=h->u.tcp;
+  parseOptions(tcp,&options);
 
-  socket=seek(iface,tcp->destPort,tcp->sourcePort,error);
+  socket=seek(iface,packet->ipv6.src,tcp->sourcePort,tcp->destPort,error);
   if (socket)
     {
       if ((socket->state!=tcpSocketStateListen)
@@ -1622,7 +2579,45 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
         }
     }
 
-  socket->remoteWindow=tcp->window;
+  {
+    PackosError tmp;
+    uint32_t window=tcp->window;
+
+    /* The window in a SYN is never scaled. */
+    if (!(tcp->dataOffsetAndFlags & tcpFlagSyn))
+      window<<=socket->options.sendShift;
+
+    mayBeDuplicate=((window==socket->remoteWindow)
+                    && !(tcp->dataOffsetAndFlags & (tcpFlagSyn | tcpFlagFin))
+                    && (IpPacketGetDataLen(packet,&tmp)==0)
+                    );
+    socket->remoteWindow=window;
+  }
+
+  /* PAWS (RFC 7323): a timestamp older than the last one taken marks
+   *  an old duplicate; it gets an ACK, and nothing else.
+   */
+  if (socket->options.timestamps
+      && options.hasTimestamp
+      && !(tcp->dataOffsetAndFlags & tcpFlagSyn)
+      && ((socket->state==tcpSocketStateEstablished)
+          || (socket->state==tcpSocketStateCloseWait)
+          )
+      )
+    {
+      if (modLt(options.tsVal,socket->options.tsRecent))
+        {
+          if (sendAck(socket,error)<0)
+            UtilPrintfStream(errStream,error,"TcpFilterMethod(): sendAck(): %s\n",
+                    PackosErrorToString(*error));
+          PackosPacketFree(packet,error);
+          *error=packosErrorNone;
+          return ipFilterActionReplied;
+        }
+
+      if (!modLt(socket->in.latestAckNumber,tcp->sequenceNumber))
+        socket->options.tsRecent=options.tsVal;
+    }
 
   switch (socket->state)
     {
@@ -1670,6 +2665,9 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
 
                   incoming->remoteAddr=packet->ipv6.src;
                   incoming->remotePort=tcp->sourcePort;
+                  incoming->remoteWindow=tcp->window;
+                  applySynOptions(incoming,&options);
+                  addConnection(incoming);
                   incoming->state=tcpSocketStateSynReceived;
                   incoming->in.latestSequenceNumber=tcp->sequenceNumber+1;
                   incoming->in.latestAckNumber=tcp->sequenceNumber;
@@ -1699,6 +2697,7 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
         {
           socket->in.latestSequenceNumber=tcp->sequenceNumber;
           socket->in.latestAckNumber=tcp->sequenceNumber-1;
+          applySynOptions(socket,&options);
 
           if (tcp->dataOffsetAndFlags & tcpFlagAck)
             {
@@ -1757,7 +2756,8 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
 
       if ((tcp->dataOffsetAndFlags) & tcpFlagAck)
         {
-          if (recordAck(socket,tcp->ackNumber,error)<0)
+          if (recordAck(socket,tcp->ackNumber,mayBeDuplicate,&options,
+                        error)<0)
             UtilPrintfStream(errStream,error,"TcpFilterMethod(): recordAck(): %s\n",
                     PackosErrorToString(*error));
         }
@@ -1899,7 +2899,8 @@ static IpFilterAction TcpFilterMethod(IpIface iface,
     case tcpSocketStateLastAck:
       if (tcp->dataOffsetAndFlags & tcpFlagAck)
         {
-          if (recordAck(socket,tcp->ackNumber,error)<0)
+          if (recordAck(socket,tcp->ackNumber,mayBeDuplicate,&options,
+                        error)<0)
             UtilPrintfStream(errStream,error,
                              "TcpFilterMethod(): recordAck(): %s\n",
                              PackosErrorToString(*error));
@@ -1962,6 +2963,7 @@ int TcpSocketConnect(TcpSocket socket,
 
   socket->remoteAddr=addr;
   socket->remotePort=port;
+  addConnection(socket);
 
   if (sendInitialSyn(socket,error)<0)
     {
@@ -1,5 +1,6 @@
 #include <util/alloc.h>
 #include <util/stream.h>
+#include <util/string.h>
 
 #include <timer.h>
 #include <timer-protocol.h>
@@ -10,47 +11,46 @@ struct Timer {
   bool repeat;
 };
 
-Timer TimerNew(UdpSocket socket,
-               uint32_t sec,
-               uint32_t usec,
-               uint32_t id, /* included in the tick packets */
-               bool repeat,
-               PackosError* error)
+/* Batches go out from a socket of their own, so that the one reply to
+ *  each is all that ever arrives on it; the ticks go to socket.
+ */
+struct TimerBatch {
+  UdpSocket socket;
+  UdpSocket requestSocket;
+  uint16_t requestId;
+  uint32_t numEntries;
+  TimerBatchEntry entries[TIMER_BATCH_MAX_ENTRIES];
+};
+
+/* A request to the timer server, with extra bytes after it for the
+ *  caller to fill in.
+ */
+static PackosPacket* requestNew(UdpSocket socket,
+                                TimerRequestCmd cmd,
+                                uint32_t id,
+                                uint16_t extra,
+                                TimerRequest** request,
+                                PackosError* error)
 {
   PackosPacket* packet;
   IpHeaderUDP* udpHeader;
-  TimerRequest* request;
-  Timer timer;
   PackosAddress myAddr;
 
-  if (!error) return 0;
-  if (!socket)
-    {
-      *error=packosErrorInvalidArg;
-      return 0;
-    }
-
   myAddr=PackosMyAddress(error);
   if ((*error)!=packosErrorNone)
     {
-      UtilPrintfStream(errStream,error,"TimerNew(): PackosMyAddress(): %s\n",
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"requestNew(): PackosMyAddress(): %s\n",
               PackosErrorToString(*error));
       return 0;
     }
 
-  timer=(Timer)(malloc(sizeof(struct Timer)));
-  if (!timer)
-    {
-      *error=packosErrorOutOfMemory;
-      return 0;
-    }
-
-  packet=UdpPacketNew(socket,sizeof(TimerRequest),&udpHeader,error);
+  packet=UdpPacketNew(socket,sizeof(TimerRequest)+extra,&udpHeader,error);
   if (!packet)
     {
-      UtilPrintfStream(errStream,error,"TimerNew(): UdpPacketNew(): %s\n",
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"requestNew(): UdpPacketNew(): %s\n",
               PackosErrorToString(*error));
-      free(timer);
       return 0;
     }
 
@@ -59,44 +59,80 @@ Timer TimerNew(UdpSocket socket,
     {
       PackosError tmp;
       PackosPacketFree(packet,&tmp);
-      free(timer);
-
-      UtilPrintfStream(errStream,error,"TimerNew(): PackosSchedulerAddress(): %s\n",
+      UtilPrintfStream(errStream,&tmp,"requestNew(): PackosSchedulerAddress(): %s\n",
               PackosErrorToString(*error));
       return 0;
     }
 
-  {
-    PackosError tmp;
-    char buff[80];
-    const char* msg=buff;
-    if (PackosAddrToString(packet->ipv6.dest,buff,sizeof(buff),&tmp)<0)
-      msg=PackosErrorToString(tmp);
-  }
-
   packet->packos.dest=packet->ipv6.dest;
   packet->ipv6.src=myAddr;
 
   udpHeader->destPort=TIMER_FIXED_UDP_PORT;
 
-  request=(TimerRequest*)(((byte*)udpHeader)+sizeof(IpHeaderUDP));
-  request->id=id;
-  request->version=TIMER_PROTOCOL_VERSION;
-  request->cmd=timerRequestCmdOpen;
-  request->requestId=1;
-  request->reserved=0;
-  request->args.open.sec=sec;
-  request->args.open.usec=usec;
-  request->args.open.repeat=repeat;
+  *request=(TimerRequest*)(((byte*)udpHeader)+sizeof(IpHeaderUDP));
+  (*request)->id=id;
+  (*request)->version=TIMER_PROTOCOL_VERSION;
+  (*request)->cmd=cmd;
+  (*request)->requestId=1;
+  (*request)->reserved=0;
+  return packet;
+}
 
+static int requestSend(UdpSocket socket,
+                       PackosPacket* packet,
+                       PackosError* error)
+{
   if (UdpSocketSend(socket,packet,error)<0)
     {
       PackosError tmp;
       PackosPacketFree(packet,&tmp);
+      UtilPrintfStream(errStream,&tmp,"requestSend(): UdpSocketSend(): %s\n",
+              PackosErrorToString(*error));
+      return -1;
+    }
+
+  return 0;
+}
+
+Timer TimerNew(UdpSocket socket,
+               uint32_t sec,
+               uint32_t usec,
+               uint32_t id, /* included in the tick packets */
+               bool repeat,
+               PackosError* error)
+{
+  PackosPacket* packet;
+  TimerRequest* request;
+  Timer timer;
+
+  if (!error) return 0;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  timer=(Timer)(malloc(sizeof(struct Timer)));
+  if (!timer)
+    {
+      *error=packosErrorOutOfMemory;
+      return 0;
+    }
+
+  packet=requestNew(socket,timerRequestCmdOpen,id,0,&request,error);
+  if (!packet)
+    {
       free(timer);
+      return 0;
+    }
 
-      UtilPrintfStream(errStream,error,"TimerNew(): UdpSocketSend(): %s\n",
-              PackosErrorToString(*error));
+  request->args.open.sec=sec;
+  request->args.open.usec=usec;
+  request->args.open.repeat=repeat;
+
+  if (requestSend(socket,packet,error)<0)
+    {
+      free(timer);
       return 0;
     }
 
@@ -110,6 +146,221 @@ Timer TimerNew(UdpSocket socket,
 int TimerClose(Timer timer,
                PackosError* error)
 {
-  *error=packosErrorNotImplemented;
-  return -1;
+  PackosPacket* packet;
+  TimerRequest* request;
+
+  if (!error) return -2;
+  if (!timer)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  packet=requestNew(timer->socket,timerRequestCmdClose,timer->id,0,
+                    &request,error);
+  if (!packet)
+    return -1;
+
+  if (requestSend(timer->socket,packet,error)<0)
+    return -1;
+
+  free(timer);
+  return 0;
+}
+
+TimerBatch TimerBatchNew(UdpSocket socket,
+                         PackosError* error)
+{
+  TimerBatch res;
+
+  if (!error) return 0;
+  if (!socket)
+    {
+      *error=packosErrorInvalidArg;
+      return 0;
+    }
+
+  res=(TimerBatch)(malloc(sizeof(struct TimerBatch)));
+  if (!res)
+    {
+      *error=packosErrorOutOfMemory;
+      return 0;
+    }
+
+  res->requestSocket=UdpSocketNew(error);
+  if (!(res->requestSocket))
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"TimerBatchNew(): UdpSocketNew(): %s\n",
+              PackosErrorToString(*error));
+      free(res);
+      return 0;
+    }
+
+  if (UdpSocketBind(res->requestSocket,PackosAddrGetZero(),0,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"TimerBatchNew(): UdpSocketBind(): %s\n",
+              PackosErrorToString(*error));
+      UdpSocketClose(res->requestSocket,&tmp);
+      free(res);
+      return 0;
+    }
+
+  res->socket=socket;
+  res->requestId=1;
+  res->numEntries=0;
+  return res;
+}
+
+int TimerBatchClose(TimerBatch batch,
+                    PackosError* error)
+{
+  if (!error) return -2;
+  if (!batch)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (UdpSocketClose(batch->requestSocket,error)<0)
+    return -1;
+
+  free(batch);
+  return 0;
+}
+
+static int addEntry(TimerBatch batch,
+                    TimerBatchOp op,
+                    uint32_t id,
+                    uint64_t deadline,
+                    uint32_t period,
+                    PackosError* error)
+{
+  TimerBatchEntry* entry;
+
+  if (!error) return -2;
+  if (!batch)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (batch->numEntries>=TIMER_BATCH_MAX_ENTRIES)
+    if (TimerBatchSend(batch,error)<0)
+      return -1;
+
+  entry=batch->entries+(batch->numEntries++);
+  entry->id=id;
+  entry->op=op;
+  entry->reserved=0;
+  entry->deadline=deadline;
+  entry->period=period;
+  return 0;
+}
+
+int TimerBatchArm(TimerBatch batch,
+                  uint32_t id,
+                  uint64_t deadline,
+                  uint32_t period,
+                  PackosError* error)
+{
+  return addEntry(batch,timerBatchOpArm,id,deadline,period,error);
+}
+
+int TimerBatchCancel(TimerBatch batch,
+                     uint32_t id,
+                     PackosError* error)
+{
+  return addEntry(batch,timerBatchOpCancel,id,0,0,error);
+}
+
+int TimerBatchSend(TimerBatch batch,
+                   PackosError* error)
+{
+  PackosPacket* packet;
+  PackosPacket* replyPacket;
+  TimerRequest* request;
+  TimerReply* reply;
+  uint16_t len,requestId;
+  uint32_t i;
+  int tickPort,res=0;
+
+  if (!error) return -2;
+  if (!batch)
+    {
+      *error=packosErrorInvalidArg;
+      return -1;
+    }
+
+  if (!(batch->numEntries))
+    {
+      *error=packosErrorNone;
+      return 0;
+    }
+
+  len=batch->numEntries*sizeof(TimerBatchEntry);
+  packet=requestNew(batch->requestSocket,timerRequestCmdBatch,0,len,
+                    &request,error);
+  if (!packet)
+    return -1;
+
+  request->requestId=requestId=batch->requestId;
+  request->args.batch.numEntries=batch->numEntries;
+  tickPort=UdpSocketGetLocalPort(batch->socket,error);
+  if (tickPort<0)
+    {
+      PackosError tmp;
+      PackosPacketFree(packet,&tmp);
+      return -1;
+    }
+  request->args.batch.tickPort=tickPort;
+  UtilMemcpy(TimerRequestBatchEntries(request),batch->entries,len);
+
+  batch->numEntries=0;
+  batch->requestId++;
+  if (!(batch->requestId))
+    batch->requestId=1;
+
+  /* The timer server runs in the scheduler, so the reply comes straight
+   *  back.
+   */
+  replyPacket=UdpSocketCall(batch->requestSocket,packet,error);
+  if (!replyPacket)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,"TimerBatchSend(): UdpSocketCall(): %s\n",
+              PackosErrorToString(*error));
+      return -1;
+    }
+
+  reply=(TimerReply*)(IpPacketData(replyPacket,error));
+  if (!reply)
+    {
+      PackosError tmp;
+      PackosPacketFree(replyPacket,&tmp);
+      return -1;
+    }
+
+  if ((reply->cmd!=timerRequestCmdBatch) || (reply->requestId!=requestId))
+    {
+      PackosError tmp;
+      PackosPacketFree(replyPacket,&tmp);
+      *error=packosErrorProtocolError;
+      return -1;
+    }
+
+  *error=packosErrorNone;
+  for (i=0; (i<reply->u.batch.numEntries) && (res==0); i++)
+    if (TimerReplyBatchErrors(reply)[i]!=packosErrorNone)
+      {
+        *error=(PackosError)(TimerReplyBatchErrors(reply)[i]);
+        res=-1;
+      }
+
+  {
+    PackosError tmp;
+    PackosPacketFree(replyPacket,&tmp);
+  }
+  return res;
 }
@@ -0,0 +1,232 @@
+#include <util/stream.h>
+#include <packos/checksums.h>
+#include <byte-queue.h>
+
+#include "checks.h"
+
+typedef enum {
+  bqOpInit,     /* the limit is a */
+  bqOpReserve,  /* expect is the room offered, or -1 for packosErrorQueueFull */
+  bqOpCommit,   /* a of what was reserved */
+  bqOpEnqueue,  /* a bytes; expect is how many fit, or -1 */
+  bqOpRead,     /* a bytes from offset b; expect as for ByteQueueRead() */
+  bqOpSum,      /* the same, checksummed */
+  bqOpDequeue,  /* a bytes; expect is how many came */
+  bqOpDrop,     /* a bytes */
+  bqOpLen,      /* expect is the length */
+  bqOpChunks    /* expect is how many chunks it holds */
+} BqOp;
+
+/* Each byte is a function of its place in everything ever queued, so
+ *  that whatever comes out can be checked.
+ */
+#define BQ_PATTERN(pos) ((byte)(((pos)*7)+((pos)>>8)+3))
+
+static const struct {
+  BqOp op;
+  uint32_t a,b;
+  int expect;
+} byteQueueSteps[]={
+  {bqOpInit,5000,0,0},
+  {bqOpChunks,0,0,0},
+
+  /* Space comes a chunk at a time, and only what's committed counts. */
+  {bqOpReserve,0,0,TCP_CHUNK_SIZE},
+  {bqOpCommit,100,0,0},
+  {bqOpLen,0,0,100},
+  {bqOpChunks,0,0,1},
+  {bqOpReserve,0,0,TCP_CHUNK_SIZE-100},
+  {bqOpCommit,0,0,0},
+  {bqOpLen,0,0,100},
+
+  /* Enqueueing fills the last chunk before adding more, up to the
+   *  limit; what doesn't fit is left.
+   */
+  {bqOpEnqueue,3000,0,3000},
+  {bqOpLen,0,0,3100},
+  {bqOpChunks,0,0,2},
+  {bqOpEnqueue,5000,0,1900},
+  {bqOpLen,0,0,5000},
+  {bqOpChunks,0,0,3},
+  {bqOpEnqueue,10,0,-1},
+  {bqOpReserve,0,0,-1},
+
+  /* Reads cross chunks, and stop at the end. */
+  {bqOpRead,200,2000,200},
+  {bqOpRead,3000,1000,3000},
+  {bqOpRead,500,4900,100},
+  {bqOpRead,1,5000,-1},
+  {bqOpSum,301,2001,301},
+  {bqOpSum,4095,1,4095},
+  {bqOpLen,0,0,5000},
+
+  /* Chunks go as soon as they're consumed. */
+  {bqOpDrop,2100,0,0},
+  {bqOpLen,0,0,2900},
+  {bqOpChunks,0,0,2},
+  {bqOpRead,100,0,100},
+  {bqOpDequeue,1000,0,1000},
+  {bqOpLen,0,0,1900},
+  {bqOpChunks,0,0,2},
+  {bqOpDequeue,5000,0,1900},
+  {bqOpLen,0,0,0},
+  {bqOpChunks,0,0,0},
+  {bqOpDequeue,10,0,-1},
+
+  /* An empty queue keeps its chunk while space is reserved in it. */
+  {bqOpReserve,0,0,TCP_CHUNK_SIZE},
+  {bqOpDrop,0,0,0},
+  {bqOpChunks,0,0,1},
+  {bqOpCommit,0,0,0},
+  {bqOpDrop,0,0,0},
+  {bqOpChunks,0,0,0},
+
+  /* A limit under a chunk caps what's offered. */
+  {bqOpInit,100,0,0},
+  {bqOpReserve,0,0,100},
+  {bqOpCommit,60,0,0},
+  {bqOpReserve,0,0,40},
+  {bqOpCommit,40,0,0},
+  {bqOpReserve,0,0,-1},
+  {bqOpDequeue,100,0,100},
+  {bqOpChunks,0,0,0}
+};
+
+static uint32_t numChunks(const ByteQueue* queue)
+{
+  const ByteQueueChunk* chunk;
+  uint32_t res=0;
+
+  for (chunk=queue->head; chunk; chunk=chunk->next)
+    res++;
+
+  return res;
+}
+
+static bool matchesPattern(const byte* data, uint32_t from, uint32_t nbytes)
+{
+  uint32_t i;
+
+  for (i=0; i<nbytes; i++)
+    if (data[i]!=BQ_PATTERN(from+i))
+      return false;
+
+  return true;
+}
+
+bool CheckByteQueue(void)
+{
+  static byte buff[3*TCP_CHUNK_SIZE],flat[3*TCP_CHUNK_SIZE];
+  PackosError error=packosErrorNone;
+  ByteQueue queue;
+  byte* reserved=0;
+  uint32_t written=0,consumed=0;
+  unsigned int i;
+
+  ByteQueueInit(&queue,0);
+
+  for (i=0; i<sizeof(byteQueueSteps)/sizeof(byteQueueSteps[0]); i++)
+    {
+      uint32_t a=byteQueueSteps[i].a,b=byteQueueSteps[i].b,j;
+      int expect=byteQueueSteps[i].expect;
+      int actual=0;
+      bool passed=true;
+
+      switch (byteQueueSteps[i].op)
+        {
+        case bqOpInit:
+          ByteQueueInit(&queue,a);
+          written=consumed=0;
+          break;
+
+        case bqOpReserve:
+          {
+            uint32_t room=0;
+            reserved=ByteQueueReserve(&queue,&room,&error);
+            if (reserved)
+              {
+                for (j=0; j<room; j++)
+                  reserved[j]=BQ_PATTERN(written+j);
+                passed=(room==(uint32_t)expect);
+              }
+            else
+              passed=((expect<0) && (error==packosErrorQueueFull));
+          }
+          break;
+
+        case bqOpCommit:
+          passed=(ByteQueueCommit(&queue,a,&error)==0);
+          written+=a;
+          break;
+
+        case bqOpEnqueue:
+          for (j=0; j<a; j++)
+            buff[j]=BQ_PATTERN(written+j);
+          actual=ByteQueueEnqueue(&queue,buff,a,&error);
+          if (actual>0)
+            written+=actual;
+          passed=((actual==expect)
+                  && ((expect>=0) || (error==packosErrorQueueFull)));
+          break;
+
+        case bqOpRead:
+          actual=ByteQueueRead(&queue,b,buff,a,0,&error);
+          passed=((actual==expect)
+                  && ((expect>=0) || (error==packosErrorQueueEmpty))
+                  && ((actual<0) || matchesPattern(buff,consumed+b,actual)));
+          break;
+
+        case bqOpSum:
+          {
+            uint16_t sum,flatSum;
+
+            for (j=0; j<a; j++)
+              flat[j]=BQ_PATTERN(consumed+b+j);
+            flatSum=PackosChecksumCopy(buff,flat,a);
+
+            actual=ByteQueueRead(&queue,b,buff,a,&sum,&error);
+            passed=((actual==expect) && (sum==flatSum));
+          }
+          break;
+
+        case bqOpDequeue:
+          actual=ByteQueueDequeue(&queue,buff,a,&error);
+          if (actual>0)
+            {
+              passed=matchesPattern(buff,consumed,actual);
+              consumed+=actual;
+            }
+          passed=(passed && (actual==expect)
+                  && ((expect>=0) || (error==packosErrorQueueEmpty)));
+          break;
+
+        case bqOpDrop:
+          passed=(ByteQueueDrop(&queue,a,&error)==0);
+          consumed+=a;
+          break;
+
+        case bqOpLen:
+          passed=(queue.len==(uint32_t)expect);
+          break;
+
+        case bqOpChunks:
+          passed=(numChunks(&queue)==(uint32_t)expect);
+          break;
+        }
+
+      if (!passed)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "byte queue: FAILED: step %u: got %d, len %u,"
+                           " %u chunks: %s\n",
+                           i,actual,queue.len,numChunks(&queue),
+                           PackosErrorToString(error));
+          ByteQueueDrop(&queue,queue.len,&tmp);
+          return false;
+        }
+    }
+
+  UtilPrintfStream(errStream,&error,"byte queue: ok\n");
+  return true;
+}
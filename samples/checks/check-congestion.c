@@ -0,0 +1,270 @@
+#include <util/stream.h>
+#include <congestion.h>
+
+#include "checks.h"
+
+typedef enum {
+  ccOpInit,        /* a is 0 for NewReno, 1 for CUBIC; b is the mss */
+  ccOpAck,         /* b ACKs of a bytes each */
+  ccOpRounds,      /* a round trips of b usec, each acking all of cwnd */
+  ccOpLoss,        /* a in flight, b sent so far */
+  ccOpDupAck,
+  ccOpPartialAck,  /* ACK a acks b bytes with c in flight; stays in recovery */
+  ccOpFullAck,     /* the same, but it ends recovery */
+  ccOpTimeout,     /* a in flight */
+  ccOpRtt,         /* b samples of a usec each */
+  ccOpExpect,      /* field a is b */
+  ccOpExpectAtLeast,
+  ccOpExpectAtMost
+} CcOp;
+
+typedef enum {
+  ccCwnd,
+  ccSsthresh,
+  ccInRecovery,
+  ccSrtt,
+  ccRttvar,
+  ccRto,
+  ccWMax
+} CcField;
+
+static const char* const ccFieldNames[]={
+  "cwnd","ssthresh","inRecovery","srtt","rttvar","rto","wMax"
+};
+
+static const struct {
+  CcOp op;
+  uint32_t a,b,c;
+} congestionSteps[]={
+  /* NewReno.  The initial window is ten segments; slow start adds at
+   *  most one mss per ACK.
+   */
+  {ccOpInit,0,1000,0},
+  {ccOpExpect,ccCwnd,10000,0},
+  {ccOpExpect,ccRto,1000000,0},
+  {ccOpAck,500,1,0},
+  {ccOpAck,3000,1,0},
+  {ccOpExpect,ccCwnd,11500,0},
+
+  /* Halve what's in flight; cwnd inflates by three for the duplicate
+   *  ACKs so far, and one more for each after.
+   */
+  {ccOpLoss,11500,50000,0},
+  {ccOpExpect,ccSsthresh,5750,0},
+  {ccOpExpect,ccCwnd,8750,0},
+  {ccOpExpect,ccInRecovery,1,0},
+  {ccOpDupAck,0,0,0},
+  {ccOpExpect,ccCwnd,9750,0},
+
+  /* Partial ACKs deflate by what they ack, giving an mss back for the
+   *  resent segment only when at least an mss was acked.
+   */
+  {ccOpPartialAck,40000,3000,6000},
+  {ccOpExpect,ccCwnd,7750,0},
+  {ccOpPartialAck,40500,500,5500},
+  {ccOpExpect,ccCwnd,7250,0},
+
+  /* A full ACK leaves cwnd at ssthresh, or less if little is in flight. */
+  {ccOpFullAck,50000,9500,4000},
+  {ccOpExpect,ccCwnd,5000,0},
+  {ccOpExpect,ccInRecovery,0,0},
+
+  /* Below ssthresh it's still slow start; above, one mss per window. */
+  {ccOpAck,1000,1,0},
+  {ccOpExpect,ccCwnd,6000,0},
+  {ccOpAck,3000,1,0},
+  {ccOpExpect,ccCwnd,6000,0},
+  {ccOpAck,3000,1,0},
+  {ccOpExpect,ccCwnd,7000,0},
+
+  /* Timeouts drop to one segment and back off, up to a minute. */
+  {ccOpTimeout,7000,0,0},
+  {ccOpExpect,ccSsthresh,3500,0},
+  {ccOpExpect,ccCwnd,1000,0},
+  {ccOpExpect,ccRto,2000000,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpExpect,ccSsthresh,2000,0},
+  {ccOpExpect,ccRto,4000000,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpExpect,ccRto,32000000,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpExpect,ccRto,60000000,0},
+  {ccOpTimeout,1000,0,0},
+  {ccOpExpect,ccRto,60000000,0},
+
+  /* RFC 6298: the first sample sets srtt, and half of it rttvar. */
+  {ccOpInit,0,1000,0},
+  {ccOpRtt,100000,1,0},
+  {ccOpExpect,ccSrtt,100000,0},
+  {ccOpExpect,ccRttvar,50000,0},
+  {ccOpExpect,ccRto,300000,0},
+  {ccOpRtt,100000,1,0},
+  {ccOpExpect,ccSrtt,100000,0},
+  {ccOpExpect,ccRttvar,37500,0},
+  {ccOpExpect,ccRto,250000,0},
+
+  /* A steady RTT wears rttvar away, down to the 200ms floor... */
+  {ccOpRtt,100000,100,0},
+  {ccOpExpect,ccSrtt,100000,0},
+  {ccOpExpectAtMost,ccRttvar,3,0},
+  {ccOpExpect,ccRto,200000,0},
+
+  /* ...and srtt follows a new one, with the clock's granularity on top. */
+  {ccOpRtt,400000,200,0},
+  {ccOpExpect,ccSrtt,400000,0},
+  {ccOpExpectAtMost,ccRttvar,3,0},
+  {ccOpExpect,ccRto,410000,0},
+
+  /* A huge first sample hits the one-minute ceiling. */
+  {ccOpInit,0,1000,0},
+  {ccOpRtt,30000000,1,0},
+  {ccOpExpect,ccRto,60000000,0},
+
+  /* CUBIC backs off to 0.7 of cwnd, and remembers where it was. */
+  {ccOpInit,1,1000,0},
+  {ccOpLoss,10000,50000,0},
+  {ccOpExpect,ccSsthresh,7001,0},
+  {ccOpExpect,ccCwnd,10001,0},
+  {ccOpExpect,ccWMax,10,0},
+  {ccOpFullAck,50000,10000,9000},
+  {ccOpExpect,ccCwnd,7001,0},
+
+  /* A loss below that gives some more up (fast convergence). */
+  {ccOpLoss,7001,60000,0},
+  {ccOpExpect,ccSsthresh,4902,0},
+  {ccOpExpect,ccWMax,5,0},
+
+  /* From a hundred segments: back to 70, then climbing to level out
+   *  near the old window after about K=cbrt(30/0.4)=4.2s, and only
+   *  then probing past it.
+   */
+  {ccOpInit,1,1000,0},
+  {ccOpAck,1000,90,0},
+  {ccOpExpect,ccCwnd,100000,0},
+  {ccOpLoss,100000,200000,0},
+  {ccOpExpect,ccWMax,100,0},
+  {ccOpExpect,ccSsthresh,70019,0},
+  {ccOpFullAck,200000,100000,80000},
+  {ccOpExpect,ccCwnd,70019,0},
+  {ccOpRounds,10,100000,0},
+  {ccOpExpectAtLeast,ccCwnd,80000,0},
+  {ccOpExpectAtMost,ccCwnd,95000,0},
+  {ccOpRounds,32,100000,0},
+  {ccOpExpectAtLeast,ccCwnd,97000,0},
+  {ccOpExpectAtMost,ccCwnd,101000,0},
+  {ccOpRounds,40,100000,0},
+  {ccOpExpectAtLeast,ccCwnd,110000,0}
+};
+
+static uint32_t fieldOf(const TcpCongestion* cc, CcField field)
+{
+  switch (field)
+    {
+    case ccCwnd: return cc->cwnd;
+    case ccSsthresh: return cc->ssthresh;
+    case ccInRecovery: return cc->inRecovery ? 1 : 0;
+    case ccSrtt: return cc->rtt.srtt;
+    case ccRttvar: return cc->rtt.rttvar;
+    case ccRto: return cc->rtt.rto;
+    case ccWMax: return cc->cubic.wMax;
+    }
+
+  return 0;
+}
+
+bool CheckCongestion(void)
+{
+  PackosError error;
+  TcpCongestion cc;
+  uint64_t now=1000000;
+  unsigned int i;
+
+  TcpCongestionInit(&cc,&tcpCongestionNewReno,1000);
+
+  for (i=0; i<sizeof(congestionSteps)/sizeof(congestionSteps[0]); i++)
+    {
+      uint32_t a=congestionSteps[i].a,b=congestionSteps[i].b;
+      uint32_t c=congestionSteps[i].c;
+      uint32_t j,k;
+      bool passed=true;
+
+      switch (congestionSteps[i].op)
+        {
+        case ccOpInit:
+          TcpCongestionInit(&cc,
+                            a ? &tcpCongestionCubic : &tcpCongestionNewReno,
+                            b);
+          break;
+
+        case ccOpAck:
+          for (j=0; j<b; j++)
+            TcpCongestionOnAck(&cc,a,now);
+          break;
+
+        case ccOpRounds:
+          for (j=0; j<a; j++)
+            {
+              uint32_t segs=cc.cwnd/cc.mss;
+              for (k=0; k<segs; k++)
+                TcpCongestionOnAck(&cc,cc.mss,now);
+              now+=b;
+            }
+          break;
+
+        case ccOpLoss:
+          TcpCongestionOnLoss(&cc,a,b,now);
+          break;
+
+        case ccOpDupAck:
+          TcpCongestionOnDupAck(&cc);
+          break;
+
+        case ccOpPartialAck:
+          passed=TcpCongestionOnRecoveryAck(&cc,a,b,c);
+          break;
+
+        case ccOpFullAck:
+          passed=!TcpCongestionOnRecoveryAck(&cc,a,b,c);
+          break;
+
+        case ccOpTimeout:
+          TcpCongestionOnTimeout(&cc,a,now);
+          break;
+
+        case ccOpRtt:
+          for (j=0; j<b; j++)
+            TcpCongestionRttSample(&cc,a);
+          break;
+
+        case ccOpExpect:
+          passed=(fieldOf(&cc,(CcField)a)==b);
+          break;
+
+        case ccOpExpectAtLeast:
+          passed=(fieldOf(&cc,(CcField)a)>=b);
+          break;
+
+        case ccOpExpectAtMost:
+          passed=(fieldOf(&cc,(CcField)a)<=b);
+          break;
+        }
+
+      if (!passed)
+        {
+          if (congestionSteps[i].op>=ccOpExpect)
+            UtilPrintfStream(errStream,&error,
+                             "congestion: FAILED: step %u: %s is %u, not %u\n",
+                             i,ccFieldNames[a],fieldOf(&cc,(CcField)a),b);
+          else
+            UtilPrintfStream(errStream,&error,
+                             "congestion: FAILED: step %u: inRecovery is %u\n",
+                             i,cc.inRecovery ? 1U : 0U);
+          return false;
+        }
+    }
+
+  UtilPrintfStream(errStream,&error,"congestion: ok\n");
+  return true;
+}
@@ -0,0 +1,158 @@
+#include <util/stream.h>
+#include <packos/arch.h>
+#include <route-table.h>
+
+#include "checks.h"
+
+/* Stand-ins for interfaces; RouteTable never looks inside them. */
+static byte fakeIfaces[6];
+#define FAKE_IFACE(i) (((i)<0) ? ((IpIface)0) : ((IpIface)(fakeIfaces+(i))))
+
+typedef enum {
+  routeOpAdd,    /* expect is the fake iface */
+  routeOpRemove, /* expect is 0, or -1 for packosErrorDoesNotExist */
+  routeOpLookup, /* expect is the fake iface, or -1 for no route */
+  routeOpCount   /* expect is the number of routes */
+} RouteOp;
+
+/* Addresses are w0:w1::w7. */
+static const struct {
+  RouteOp op;
+  uint16_t w0,w1,w7;
+  unsigned int len;
+  int expect;
+} routeSteps[]={
+  {routeOpLookup,0x2001,0x0db8,1,128,-1},
+
+  /* A default route, a /16, two /32s under it, and a host route under
+   *  one of those; the /32 comes with host bits set, which don't count.
+   */
+  {routeOpAdd,0,0,0,0,0},
+  {routeOpAdd,0x2001,0,0,16,1},
+  {routeOpAdd,0x2001,0x0db8,0xffff,32,2},
+  {routeOpAdd,0x2001,0x0db9,0,32,3},
+  {routeOpAdd,0x2001,0x0db8,1,128,4},
+  {routeOpCount,0,0,0,0,5},
+
+  /* The longest covering prefix wins. */
+  {routeOpLookup,0x2001,0x0db8,1,128,4},
+  {routeOpLookup,0x2001,0x0db8,2,128,2},
+  {routeOpLookup,0x2001,0x0db9,1,128,3},
+  {routeOpLookup,0x2001,0x0dbf,1,128,1},
+  {routeOpLookup,0x3000,0,1,128,0},
+
+  /* Adding a prefix that's already there replaces its route. */
+  {routeOpAdd,0x2001,0x0db8,0,32,5},
+  {routeOpCount,0,0,0,0,5},
+  {routeOpLookup,0x2001,0x0db8,2,128,5},
+
+  /* Once a prefix is removed, its addresses fall to the next one out,
+   *  and the longer prefixes under it stay.
+   */
+  {routeOpRemove,0x2001,0x0db8,0,32,0},
+  {routeOpLookup,0x2001,0x0db8,2,128,1},
+  {routeOpLookup,0x2001,0x0db8,1,128,4},
+  {routeOpRemove,0x2001,0x0db8,0,32,-1},
+
+  {routeOpRemove,0x2001,0x0db8,1,128,0},
+  {routeOpLookup,0x2001,0x0db8,1,128,1},
+
+  {routeOpRemove,0,0,0,0,0},
+  {routeOpLookup,0x3000,0,1,128,-1},
+  {routeOpLookup,0x2001,0x0db9,1,128,3},
+
+  {routeOpRemove,0x2001,0,0,16,0},
+  {routeOpRemove,0x2001,0x0db9,0,32,0},
+  {routeOpCount,0,0,0,0,0},
+  {routeOpLookup,0x2001,0x0db9,1,128,-1}
+};
+
+static PackosAddressMask prefixOf(uint16_t w0, uint16_t w1, uint16_t w7,
+                                  unsigned int len)
+{
+  PackosAddressMask res;
+  int i;
+
+  for (i=0; i<8; i++)
+    res.addr.words[i]=0;
+  res.addr.words[0]=htons(w0);
+  res.addr.words[1]=htons(w1);
+  res.addr.words[7]=htons(w7);
+  res.len=len;
+  return res;
+}
+
+bool CheckRouteTable(void)
+{
+  PackosError error;
+  unsigned int i;
+  RouteTable table=RouteTableNew(&error);
+  if (!table)
+    {
+      UtilPrintfStream(errStream,&error,
+                       "route table: FAILED: RouteTableNew(): %s\n",
+                       PackosErrorToString(error));
+      return false;
+    }
+
+  for (i=0; i<sizeof(routeSteps)/sizeof(routeSteps[0]); i++)
+    {
+      PackosAddressMask prefix=prefixOf(routeSteps[i].w0,routeSteps[i].w1,
+                                        routeSteps[i].w7,routeSteps[i].len);
+      int expect=routeSteps[i].expect;
+      bool passed=false;
+
+      switch (routeSteps[i].op)
+        {
+        case routeOpAdd:
+          passed=(RouteTableAdd(table,prefix,FAKE_IFACE(expect),&error)==0);
+          break;
+
+        case routeOpRemove:
+          if (expect<0)
+            passed=((RouteTableRemove(table,prefix,&error)<0)
+                    && (error==packosErrorDoesNotExist));
+          else
+            passed=(RouteTableRemove(table,prefix,&error)==0);
+          break;
+
+        case routeOpLookup:
+          {
+            IpIface iface=RouteTableLookup(table,prefix.addr,&error);
+            passed=((iface==FAKE_IFACE(expect))
+                    && ((expect>=0) || (error==packosErrorNoRouteToHost)));
+          }
+          break;
+
+        case routeOpCount:
+          passed=(RouteTableNumRoutes(table,&error)==(uint32_t)expect);
+          break;
+        }
+
+      if (!passed)
+        {
+          PackosError tmp;
+          UtilPrintfStream(errStream,&tmp,
+                           "route table: FAILED: step %u (%x:%x::%x/%u): %s\n",
+                           i,
+                           (unsigned int)(routeSteps[i].w0),
+                           (unsigned int)(routeSteps[i].w1),
+                           (unsigned int)(routeSteps[i].w7),
+                           routeSteps[i].len,
+                           PackosErrorToString(error));
+          RouteTableDelete(table,&tmp);
+          return false;
+        }
+    }
+
+  if (RouteTableDelete(table,&error)<0)
+    {
+      UtilPrintfStream(errStream,&error,
+                       "route table: FAILED: RouteTableDelete(): %s\n",
+                       PackosErrorToString(error));
+      return false;
+    }
+
+  UtilPrintfStream(errStream,&error,"route table: ok\n");
+  return true;
+}
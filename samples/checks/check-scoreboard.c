@@ -0,0 +1,184 @@
+#include <util/stream.h>
+#include <sack.h>
+
+#include "checks.h"
+
+/* Sequence numbers in the steps are offsets from this, so that the
+ *  later ones wrap round.
+ */
+#define SB_BASE 0xfffffc00U
+
+typedef enum {
+  sbOpClear,   /* una is a */
+  sbOpAdd,     /* [b,c) is SACKed, with una at a */
+  sbOpTrim,    /* una moved up to a */
+  sbOpResent,  /* retransmitNext is a */
+  sbOpCount,   /* there are a ranges */
+  sbOpRange,   /* range a is [b,c) */
+  sbOpHole,    /* with una at a, the next hole is c bytes from b */
+  sbOpNoHole   /* with una at a, there's no hole */
+} SbOp;
+
+static const struct {
+  SbOp op;
+  uint32_t a,b,c;
+} scoreboardSteps[]={
+  {sbOpClear,0,0,0},
+  {sbOpNoHole,0,0,0},
+
+  /* Nothing at or behind una, and nothing empty. */
+  {sbOpAdd,0,0,500},
+  {sbOpAdd,0,300,300},
+  {sbOpAdd,0,0xfffffff0U,100},
+  {sbOpCount,0,0,0},
+
+  /* Adjacent and overlapping ranges merge; contained ones change nothing. */
+  {sbOpAdd,0,200,300},
+  {sbOpAdd,0,400,500},
+  {sbOpCount,2,0,0},
+  {sbOpAdd,0,300,400},
+  {sbOpCount,1,0,0},
+  {sbOpRange,0,200,500},
+  {sbOpAdd,0,450,600},
+  {sbOpAdd,0,250,350},
+  {sbOpAdd,0,150,200},
+  {sbOpCount,1,0,0},
+  {sbOpRange,0,150,600},
+  {sbOpAdd,0,700,800},
+  {sbOpCount,2,0,0},
+  {sbOpRange,1,700,800},
+
+  /* Holes come from una, or from what's been resent, whichever's later. */
+  {sbOpHole,0,0,150},
+  {sbOpResent,150,0,0},
+  {sbOpHole,0,600,100},
+  {sbOpResent,800,0,0},
+  {sbOpNoHole,0,0,0},
+
+  /* Trimming drops what una has passed, and clips what it's inside. */
+  {sbOpTrim,650,0,0},
+  {sbOpCount,1,0,0},
+  {sbOpRange,0,700,800},
+  {sbOpTrim,750,0,0},
+  {sbOpRange,0,750,800},
+  {sbOpNoHole,750,0,0},
+
+  /* With una past retransmitNext, holes start from una again. */
+  {sbOpTrim,800,0,0},
+  {sbOpCount,0,0,0},
+  {sbOpTrim,900,0,0},
+  {sbOpAdd,900,1000,1100},
+  {sbOpHole,900,900,100},
+
+  /* Nine ranges, across the wrap: the furthest doesn't fit. */
+  {sbOpClear,0,0,0},
+  {sbOpAdd,0,100,200},
+  {sbOpAdd,0,300,400},
+  {sbOpAdd,0,500,600},
+  {sbOpAdd,0,700,800},
+  {sbOpAdd,0,900,1000},
+  {sbOpAdd,0,1100,1200},
+  {sbOpAdd,0,1300,1400},
+  {sbOpAdd,0,1500,1600},
+  {sbOpAdd,0,1700,1800},
+  {sbOpCount,8,0,0},
+  {sbOpRange,7,1500,1600},
+
+  /* A nearer one pushes the furthest out. */
+  {sbOpAdd,0,20,50},
+  {sbOpCount,8,0,0},
+  {sbOpRange,0,20,50},
+  {sbOpRange,7,1300,1400},
+
+  /* One range over six of them leaves three. */
+  {sbOpAdd,0,150,1250},
+  {sbOpCount,3,0,0},
+  {sbOpRange,0,20,50},
+  {sbOpRange,1,100,1250},
+  {sbOpRange,2,1300,1400},
+
+  {sbOpHole,0,0,20},
+  {sbOpResent,50,0,0},
+  {sbOpHole,0,50,50},
+  {sbOpResent,1250,0,0},
+  {sbOpHole,0,1250,50},
+  {sbOpResent,1400,0,0},
+  {sbOpNoHole,0,0,0},
+
+  {sbOpTrim,1300,0,0},
+  {sbOpCount,1,0,0},
+  {sbOpRange,0,1300,1400},
+  {sbOpTrim,1400,0,0},
+  {sbOpCount,0,0,0}
+};
+
+bool CheckScoreboard(void)
+{
+  PackosError error;
+  TcpScoreboard board;
+  unsigned int i;
+
+  TcpScoreboardClear(&board,SB_BASE);
+
+  for (i=0; i<sizeof(scoreboardSteps)/sizeof(scoreboardSteps[0]); i++)
+    {
+      uint32_t a=scoreboardSteps[i].a,b=scoreboardSteps[i].b;
+      uint32_t c=scoreboardSteps[i].c;
+      uint32_t start,len;
+      bool passed=true;
+
+      switch (scoreboardSteps[i].op)
+        {
+        case sbOpClear:
+          TcpScoreboardClear(&board,SB_BASE+a);
+          break;
+
+        case sbOpAdd:
+          TcpScoreboardAdd(&board,SB_BASE+a,SB_BASE+b,SB_BASE+c);
+          break;
+
+        case sbOpTrim:
+          TcpScoreboardTrim(&board,SB_BASE+a);
+          break;
+
+        case sbOpResent:
+          board.retransmitNext=SB_BASE+a;
+          break;
+
+        case sbOpCount:
+          passed=(board.numRanges==a);
+          break;
+
+        case sbOpRange:
+          passed=((a<board.numRanges)
+                  && (board.ranges[a].left==SB_BASE+b)
+                  && (board.ranges[a].right==SB_BASE+c));
+          break;
+
+        case sbOpHole:
+          passed=(TcpScoreboardNextHole(&board,SB_BASE+a,&start,&len)
+                  && (start==SB_BASE+b) && (len==c));
+          break;
+
+        case sbOpNoHole:
+          passed=!TcpScoreboardNextHole(&board,SB_BASE+a,&start,&len);
+          break;
+        }
+
+      if (!passed)
+        {
+          UtilPrintfStream(errStream,&error,
+                           "scoreboard: FAILED: step %u: %u ranges",
+                           i,board.numRanges);
+          for (a=0; a<board.numRanges; a++)
+            UtilPrintfStream(errStream,&error," [%u,%u)",
+                             board.ranges[a].left-SB_BASE,
+                             board.ranges[a].right-SB_BASE);
+          UtilPrintfStream(errStream,&error,"\n");
+          return false;
+        }
+    }
+
+  UtilPrintfStream(errStream,&error,"scoreboard: ok\n");
+  return true;
+}
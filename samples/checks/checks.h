@@ -0,0 +1,14 @@
+#ifndef _CHECKS_H_
+#define _CHECKS_H_
+
+#include <packos/types.h>
+
+/* Each prints "<name>: ok" or "<name>: FAILED: ..." and returns
+ *  whether it passed.
+ */
+bool CheckRouteTable(void);
+bool CheckCongestion(void);
+bool CheckScoreboard(void);
+bool CheckByteQueue(void);
+
+#endif /*_CHECKS_H_*/
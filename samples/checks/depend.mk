@@ -0,0 +1 @@
+# DO NOT DELETE
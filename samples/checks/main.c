@@ -0,0 +1,66 @@
+#include <util/stream.h>
+#include <util/alloc.h>
+
+#include <packos/sys/contextP.h>
+#include <packos/packet.h>
+
+#include <schedulers/basic.h>
+
+#include "checks.h"
+
+static SchedulerBasicContextMetadata checksMetadata;
+
+/* Runs the library checks that need no network, one after another. */
+static void checksProcess(void)
+{
+  PackosError error;
+  int numFailed=0;
+
+  if (UtilArenaInit(&error)<0)
+    return;
+
+  if (!CheckRouteTable()) numFailed++;
+  if (!CheckCongestion()) numFailed++;
+  if (!CheckScoreboard()) numFailed++;
+  if (!CheckByteQueue()) numFailed++;
+
+  UtilPrintfStream(errStream,&error,"checks: %d failed\n",numFailed);
+}
+
+int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
+                                     PackosError* error)
+{
+  PackosContext checks=PackosContextNew(checksProcess,"checks",error);
+  if (!checks)
+    {
+      UtilPrintfStream(errStream,error,"PackosContextNew(checks): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  checksMetadata.isDaemon=false;
+  checksMetadata.isRunning=true;
+  checksMetadata.isInited=true;
+  checksMetadata.dependsOn=0;
+  checksMetadata.priority=0;
+
+  if (PackosContextSetMetadata(checks,&checksMetadata,error)<0)
+    {
+      PackosError tmp;
+      UtilPrintfStream(errStream,&tmp,
+                       "PackosContextSetMetadata(checks): %s\n",
+                       PackosErrorToString(*error));
+      return -1;
+    }
+
+  PackosContextQueueAppend(contexts,checks,error);
+  return 0;
+}
+
+void testMain(void)
+{
+  PackosError error;
+
+  PackosKernelLoop(PackosContextNew(SchedulerBasic,"scheduler",&error),&error);
+  UtilPrintfStream(errStream,&error,"Loop terminated\n");
+}
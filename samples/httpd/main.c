@@ -137,6 +137,31 @@ static const char* httpStatusString(HttpStatus status)
     }
 }
 
+/* Copies nbytes straight into httpClient's outgoing queue. */
+static int sendBytes(TcpSocket httpClient,
+                     const char* data,
+                     uint32_t nbytes,
+                     PackosError* error)
+{
+  uint32_t done=0;
+
+  while (done<nbytes)
+    {
+      uint32_t room;
+      char* dest=(char*)(TcpSocketSendBuffer(httpClient,&room,error));
+      if (!dest) return -1;
+
+      if (room>(nbytes-done))
+        room=nbytes-done;
+      UtilMemcpy(dest,data+done,room);
+      if (TcpSocketSendCommit(httpClient,room,error)<0)
+        return -1;
+      done+=room;
+    }
+
+  return done;
+}
+
 static int readLine(TcpSocket httpClient,
                     char* buff,
                     int buffsize,
@@ -304,6 +329,14 @@ static void httpProcess(void)
         return;
       }
 
+    if (IpIfaceNativeSetWaitWhenFull(iface,true,&error)<0)
+      {
+        UtilPrintfStream(errStream,&error,
+                "httpProcess(): IpIfaceNativeSetWaitWhenFull: %s\n",
+                PackosErrorToString(error));
+        return;
+      }
+
     if (IpIfaceRegister(iface,&error)<0)
       {
         UtilPrintfStream(errStream,&error,
@@ -479,9 +512,9 @@ static void httpProcess(void)
         
         UtilPrintfStream(s,&error,"HTTP/1.0 %d %s\n",reply.status,
                          httpStatusString(reply.status));
-        if (TcpSocketSend(httpClient,statusLine,UtilStrlen(statusLine),&error)<0)
+        if (sendBytes(httpClient,statusLine,UtilStrlen(statusLine),&error)<0)
           {
-            UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSend(statusLine): %s\n",
+            UtilPrintfStream(errStream,&error,"httpProcess(): sendBytes(statusLine): %s\n",
                     PackosErrorToString(error));
             TcpSocketClose(httpClient,&error);
             continue;
@@ -501,9 +534,9 @@ static void httpProcess(void)
             }
 
           UtilPrintfStream(s,&error,"Content-type: %s\n",reply.contentType);
-          if (TcpSocketSend(httpClient,buff,UtilStrlen(buff),&error)<0)
+          if (sendBytes(httpClient,buff,UtilStrlen(buff),&error)<0)
             {
-              UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSend(buff): %s\n",
+              UtilPrintfStream(errStream,&error,"httpProcess(): sendBytes(buff): %s\n",
                       PackosErrorToString(error));
               TcpSocketClose(httpClient,&error);
               continue;
@@ -512,9 +545,9 @@ static void httpProcess(void)
 
       {
         const char* fixedHeaders="Connection: close\nServer: sample-httpd/0.1 (PackOS)\n\n";
-        if (TcpSocketSend(httpClient,fixedHeaders,UtilStrlen(fixedHeaders),&error)<0)
+        if (sendBytes(httpClient,fixedHeaders,UtilStrlen(fixedHeaders),&error)<0)
           {
-            UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSend(fixedHeaders): %s\n",
+            UtilPrintfStream(errStream,&error,"httpProcess(): sendBytes(fixedHeaders): %s\n",
                     PackosErrorToString(error));
             TcpSocketClose(httpClient,&error);
             continue;
@@ -524,11 +557,26 @@ static void httpProcess(void)
 #ifdef USE_FILES
       while (reply.f)
         {
-          char buff[512];
-          int actual=FileRead(reply.f,buff,sizeof(buff),&error);
+          /* Read the file straight into the socket's outgoing queue. */
+          uint32_t room;
+          int actual;
+          char* buff=(char*)(TcpSocketSendBuffer(httpClient,&room,&error));
+          if (!buff)
+            {
+              PackosError tmp;
+              UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSendBuffer(): %s\n",
+                      PackosErrorToString(error));
+              TcpSocketClose(httpClient,&error);
+              FileClose(reply.f,&tmp);
+              reply.f=0;
+              continue;
+            }
+
+          actual=FileRead(reply.f,buff,room,&error);
           if (actual<0)
             {
               PackosError tmp;
+              TcpSocketSendCommit(httpClient,0,&tmp);
               FileClose(reply.f,&tmp);
               reply.f=0;
 
@@ -538,10 +586,10 @@ static void httpProcess(void)
             }
           UtilPrintfStream(errStream,&error,"httpProcess(): FileRead(): read %d bytes:\n",actual);
 
-          if (TcpSocketSend(httpClient,buff,actual,&error)<0)
+          if (TcpSocketSendCommit(httpClient,actual,&error)<0)
             {
               PackosError tmp;
-              UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSend(buff): %s\n",
+              UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSendCommit(): %s\n",
                       PackosErrorToString(error));
               TcpSocketClose(httpClient,&error);
               FileClose(reply.f,&tmp);
@@ -550,26 +598,11 @@ static void httpProcess(void)
             }
         }
 #else
-      if (reply.text)
-        {
-          int offset=0,nbytes=UtilStrlen(reply.text);
-          while (nbytes>0)
-            {
-              int actual=TcpSocketSend(httpClient,
-                                       reply.text+offset,nbytes,
-                                       &error);
-              if (actual<0)
-                {
-                  UtilPrintfStream(errStream,&error,"httpProcess(): TcpSocketSend(buff): %s\n",
-                          PackosErrorToString(error));
-                  TcpSocketClose(httpClient,&error);
-                  nbytes=0;
-                  continue;
-                }
-              offset+=actual;
-              nbytes-=actual;
-            }
-        }
+      if (reply.text
+          && (sendBytes(httpClient,reply.text,UtilStrlen(reply.text),&error)<0)
+          )
+        UtilPrintfStream(errStream,&error,"httpProcess(): sendBytes(text): %s\n",
+                PackosErrorToString(error));
 #endif
       TcpSocketClose(httpClient,&error);
   }
@@ -584,7 +617,8 @@ PackosAddress routerAddr;
 int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
                                      PackosError* error)
 {
-  PackosContext router=PackosContextNew(routerProcess,"router",error);
+  PackosContext router
+    =PackosContextNewWithQueueLen(routerProcess,"router",64,error);
   if (!router)
     {
       UtilPrintfStream(errStream,error,"PackosContextNew: %s\n",PackosErrorToString(*error));
@@ -601,7 +635,8 @@ int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
       return -1;
     }
 
-  PackosContext httpServer=PackosContextNew(httpProcess,"httpServer",error);
+  PackosContext httpServer
+    =PackosContextNewWithQueueLen(httpProcess,"httpServer",64,error);
   if (!httpServer)
     {
       UtilPrintfStream(errStream,error,"PackosContextNew(httpServer): %s\n",
@@ -66,6 +66,7 @@ int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
   rtl8139Metadata.isRunning=false;
   rtl8139Metadata.isInited=true;
   rtl8139Metadata.dependsOn=pciDriver;
+  rtl8139Metadata.priority=SCHEDULER_BASIC_NUM_PRIORITIES-1;
 
   if (PackosContextSetMetadata(rtl8139,&rtl8139Metadata,error)<0)
     {
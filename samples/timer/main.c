@@ -3,7 +3,9 @@
 
 #include <packos/sys/contextP.h>
 #include <packos/packet.h>
+#include <packos/clock.h>
 #include <timer.h>
+#include <timer-protocol.h>
 #include <iface-native.h>
 
 #include <schedulers/basic.h>
@@ -295,6 +297,135 @@ static void mooseProcess(void)
     }
 }
 
+/* Arms three one-shot timers and cancels the middle one, all in one
+ *  batch, and checks that every entry succeeds and that only the other
+ *  two go off, in order.
+ */
+static void batchProcess(void)
+{
+  PackosError error;
+  UdpSocket socket;
+  TimerBatch batch;
+  uint64_t now;
+  bool sawFirst=false,sawCancelled=false,done=false;
+  const char* failure=0;
+
+  if (UtilArenaInit(&error)<0)
+    return;
+
+  {
+    IpIface iface=IpIfaceNativeNew(&error);
+    if (!iface)
+      {
+        UtilPrintfStream(errStream,&error,
+                "batchProcess(): IpIfaceNativeNew: %s\n",
+                PackosErrorToString(error));
+        return;
+      }
+
+    if (IpIfaceRegister(iface,&error)<0)
+      {
+        UtilPrintfStream(errStream,&error,
+                "batchProcess(): IpIfaceRegister: %s\n",
+                PackosErrorToString(error));
+        return;
+      }
+  }
+
+  socket=UdpSocketNew(&error);
+  if (!socket)
+    {
+      UtilPrintfStream(errStream,&error,"batchProcess(): UdpSocketNew(): %s\n",
+              PackosErrorToString(error));
+      return;
+    }
+
+  if (UdpSocketBind(socket,PackosAddrGetZero(),5001,&error)<0)
+    {
+      UtilPrintfStream(errStream,&error,"batchProcess(): UdpSocketBind(): %s\n",
+              PackosErrorToString(error));
+      UdpSocketClose(socket,&error);
+      return;
+    }
+
+  batch=TimerBatchNew(socket,&error);
+  if (!batch)
+    {
+      UtilPrintfStream(errStream,&error,"batchProcess(): TimerBatchNew(): %s\n",
+              PackosErrorToString(error));
+      UdpSocketClose(socket,&error);
+      return;
+    }
+
+  now=PackosClockNow(&error);
+  if ((TimerBatchArm(batch,10,now+200000,0,&error)<0)
+      || (TimerBatchArm(batch,11,now+400000,0,&error)<0)
+      || (TimerBatchArm(batch,12,now+600000,0,&error)<0)
+      || (TimerBatchCancel(batch,11,&error)<0)
+      || (TimerBatchSend(batch,&error)<0))
+    {
+      UtilPrintfStream(errStream,&error,"batchProcess(): batch: %s\n",
+              PackosErrorToString(error));
+      TimerBatchClose(batch,&error);
+      UdpSocketClose(socket,&error);
+      return;
+    }
+
+  while ((!failure) && (!done))
+    {
+      TimerReply* reply;
+      PackosPacket* packet=UdpSocketReceive(socket,0,true,&error);
+      if (!packet)
+        {
+          switch (error)
+            {
+            case packosErrorNone:
+            case packosErrorPacketFilteredOut:
+            case packosErrorStoppedForOtherSocket:
+              continue;
+
+            default:
+              UtilPrintfStream(errStream,&error,
+                      "batchProcess(): UdpSocketReceive(): %s\n",
+                      PackosErrorToString(error));
+              failure="receive failed";
+              continue;
+            }
+        }
+
+      reply=(TimerReply*)(IpPacketData(packet,&error));
+      if (!reply)
+        failure="no reply data";
+      else if (reply->cmd==timerRequestCmdTick)
+        {
+          uint32_t i;
+          for (i=0; i<reply->u.tick.numIds; i++)
+            switch (TimerReplyTickIds(reply)[i])
+              {
+              case 10: sawFirst=true; break;
+              case 11: sawCancelled=true; break;
+              case 12:
+                if (!sawFirst)
+                  failure="first timer never went off";
+                else if (sawCancelled)
+                  failure="cancelled timer went off";
+                done=true;
+                break;
+              }
+        }
+
+      PackosPacketFree(packet,&error);
+    }
+
+  if (failure)
+    UtilPrintfStream(errStream,&error,"timer batch: FAILED: %s\n",failure);
+  else
+    UtilPrintfStream(errStream,&error,"timer batch: ok\n");
+
+  TimerBatchClose(batch,&error);
+  UdpSocketClose(socket,&error);
+}
+
 int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
                                      PackosError* error)
 {
@@ -308,6 +439,18 @@ int SchedulerCallbackCreateProcesses(PackosContextQueue contexts,
 
   PackosContextQueueAppend(contexts,moose,error);
 
+  {
+    PackosContext batch=PackosContextNew(batchProcess,"batch",error);
+    if (!batch)
+      {
+        UtilPrintfStream(errStream,error,"PackosContextNew(batch): %s\n",
+                PackosErrorToString(*error));
+        return -1;
+      }
+
+    PackosContextQueueAppend(contexts,batch,error);
+  }
+
   return 0;
 }
 